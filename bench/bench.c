@@ -0,0 +1,191 @@
+#include "bench.h"
+
+#include "naxConfig.h"
+
+#include <unistd.h>
+#include <getopt.h>
+
+/*
+ *  naxbench [-f filter] [-r repeat] [-t milliseconds] [-l]
+ *  each case is calibrated until one sample take [-t] milliseconds(200 by default), then [-r] samples(5 by default)
+ *  are taken with the same iterations. one JSON object per line are printed, the name order and the fields are stable,
+ *  so the outputs of two versions can be compared line by line.
+ */
+
+#define BENCH_MAXIMUM_REPEAT    (64)
+
+static const struct bench_case *__bench_tables[] = {
+    bench_core_cases,
+    bench_digest_cases,
+    bench_logger_cases,
+    bench_tcpal_cases,
+};
+
+static uint64_t bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_compare_double(const void *left, const void *right)
+{
+    double l, r;
+
+    l = *(const double *)left;
+    r = *(const double *)right;
+    return (l > r) ? 1 : ((l < r) ? -1 : 0);
+}
+
+/* one sample, the nanoseconds per operation and the bytes per second */
+static void bench_sample(const struct bench_case *bc, void *context, int64_t iterations, int64_t *done, double *nsop, double *bps)
+{
+    uint64_t begin, elapsed;
+    int64_t bytes;
+
+    bytes = 0;
+    begin = bench_now();
+    *done = bc->proc(context, iterations, &bytes);
+    elapsed = bench_now() - begin;
+
+    *nsop = (*done > 0) ? (double)elapsed / (double)*done : 0;
+    *bps = (elapsed > 0) ? (double)bytes * 1000000000 / (double)elapsed : 0;
+}
+
+static nsp_status_t bench_run(const struct bench_case *bc, int repeat, int milliseconds)
+{
+    void *context;
+    int64_t iterations, done;
+    uint64_t begin, elapsed;
+    double nsop[BENCH_MAXIMUM_REPEAT], bps[BENCH_MAXIMUM_REPEAT];
+    double median_nsop, median_bps;
+    int64_t bytes;
+    int i;
+    nsp_status_t status;
+
+    context = NULL;
+    if (bc->setup) {
+        status = bc->setup(&context);
+        if (!NSP_SUCCESS(status)) {
+            printf("{\"name\":\"%s\",\"error\":%ld}\n", bc->name, status);
+            return status;
+        }
+    }
+
+    /* calibrate, this also warm up the cache and the allocator */
+    iterations = 1;
+    while (1) {
+        bytes = 0;
+        begin = bench_now();
+        done = bc->proc(context, iterations, &bytes);
+        elapsed = bench_now() - begin;
+        if (elapsed >= (uint64_t)milliseconds * 1000000) {
+            break;
+        }
+        /* aim a little above the target, grow no more than 100 times a step */
+        if (elapsed < (uint64_t)milliseconds * 10000) {
+            iterations = done * 100;
+        } else {
+            iterations = (int64_t)((double)done * milliseconds * 1000000 * 1.2 / elapsed) + 1;
+        }
+    }
+
+    for (i = 0; i < repeat; i++) {
+        bench_sample(bc, context, iterations, &done, &nsop[i], &bps[i]);
+    }
+
+    if (bc->teardown) {
+        bc->teardown(context);
+    }
+
+    /* median for report, minimum for the best case */
+    qsort(nsop, repeat, sizeof(nsop[0]), &bench_compare_double);
+    qsort(bps, repeat, sizeof(bps[0]), &bench_compare_double);
+    median_nsop = (repeat & 1) ? nsop[repeat / 2] : (nsop[repeat / 2 - 1] + nsop[repeat / 2]) / 2;
+    median_bps = (repeat & 1) ? bps[repeat / 2] : (bps[repeat / 2 - 1] + bps[repeat / 2]) / 2;
+
+    printf("{\"name\":\"%s\",\"iterations\":%lld,\"repeat\":%d,\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,\"ns_per_op_max\":%.2f,"
+        "\"ops_per_second\":%.0f,\"mb_per_second\":%.2f}\n",
+        bc->name, (long long)done, repeat, median_nsop, nsop[0], nsop[repeat - 1],
+        (median_nsop > 0) ? 1000000000 / median_nsop : 0, median_bps / (1 << 20));
+    fflush(stdout);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_display_usage()
+{
+    static const char *usage_context =
+            "usage naxbench - micro benchmarks of libnax\n"
+            "SYNOPSIS\n"
+            "\t[-h]\tdisplay usage context and exit\n"
+            "\t[-l]\tlist the names of cases and exit\n"
+            "\t[-f filter]\trun the cases which name contain [filter] only\n"
+            "\t[-r repeat]\tsamples of each case, the median are reported, 5 by default\n"
+            "\t[-t milliseconds]\tthe minimum duration of one sample, 200 by default\n"
+            ;
+
+    printf("%s", usage_context);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter;
+    int repeat;
+    int milliseconds;
+    int list;
+    int opt;
+    size_t i;
+    const struct bench_case *bc;
+
+    filter = NULL;
+    repeat = 5;
+    milliseconds = 200;
+    list = 0;
+
+    while (-1 != (opt = getopt(argc, argv, "hlf:r:t:"))) {
+        switch (opt) {
+            case 'l':
+                list = 1;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case 't':
+                milliseconds = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                bench_display_usage();
+                return 0;
+        }
+    }
+
+    if (repeat <= 0 || repeat > BENCH_MAXIMUM_REPEAT || milliseconds <= 0) {
+        bench_display_usage();
+        return 1;
+    }
+
+    if (!list) {
+        printf("{\"name\":\"naxbench\",\"version\":\"%d.%d.%d\",\"repeat\":%d,\"milliseconds\":%d}\n",
+            nax_VERSION_MAJOR, nax_VERSION_MINOR, nax_VERSION_PATCH, repeat, milliseconds);
+    }
+
+    for (i = 0; i < sizeof(__bench_tables) / sizeof(__bench_tables[0]); i++) {
+        for (bc = __bench_tables[i]; bc->name; bc++) {
+            if (filter && !strstr(bc->name, filter)) {
+                continue;
+            }
+            if (list) {
+                printf("%s\n", bc->name);
+                continue;
+            }
+            bench_run(bc, repeat, milliseconds);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#if !defined BENCH_H_20231109
+#define BENCH_H_20231109
+
+#include "compiler.h"
+
+/*
+ *  micro benchmarks of libnax primitives.
+ *  a case execute @iterations operations in @proc and return the amount of operations actually done,
+ *  which may be rounded up to the natural unit of the case(a whole synthetic stream for example).
+ *  bytes processed are added to @bytes, leave it untouched when the throughput in bytes is meaningless.
+ */
+struct bench_case {
+    const char *name;
+    nsp_status_t (*setup)(void **context);
+    int64_t (*proc)(void *context, int64_t iterations, int64_t *bytes);
+    void (*teardown)(void *context);
+};
+
+/* case tables, terminate by a entry with NULL @name */
+extern const struct bench_case bench_core_cases[];
+extern const struct bench_case bench_digest_cases[];
+extern const struct bench_case bench_logger_cases[];
+extern const struct bench_case bench_tcpal_cases[];
+
+/* pseudo random sequence with fixed seed, so the inputs are same in every run */
+static inline uint32_t bench_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "bench.h"
+
+#include "object.h"
+#include "avltree.h"
+#include "cfifo.h"
+#include "zmalloc.h"
+#include "threading.h"
+
+/*---------------------------------------------object---------------------------------------------*/
+
+#define BENCH_OBJECT_THREADS    (4)
+
+struct bench_object_worker {
+    lwp_t lwp;
+    objhld_t hld;
+    int64_t iterations;
+};
+
+static nsp_status_t bench_object_setup(void **context)
+{
+    objhld_t *hld;
+
+    hld = (objhld_t *)zmalloc(sizeof(*hld));
+    if (!hld) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    *hld = objallo2(64);
+    if (INVALID_OBJHLD == *hld) {
+        zfree(hld);
+        return NSP_STATUS_FATAL;
+    }
+
+    *context = hld;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_object_teardown(void *context)
+{
+    objclos(*(objhld_t *)context);
+    zfree(context);
+}
+
+static void *bench_object_refr_proc(void *p)
+{
+    struct bench_object_worker *worker;
+    int64_t i;
+
+    worker = (struct bench_object_worker *)p;
+    for (i = 0; i < worker->iterations; i++) {
+        if (objrefr(worker->hld)) {
+            objdefr(worker->hld);
+        }
+    }
+    return NULL;
+}
+
+static int64_t bench_object_refr(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_object_worker worker;
+
+    worker.hld = *(objhld_t *)context;
+    worker.iterations = iterations;
+    bench_object_refr_proc(&worker);
+    return iterations;
+}
+
+/* the same handle referenced by all threads, the iterations are shared by them */
+static int64_t bench_object_refr_contention(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_object_worker workers[BENCH_OBJECT_THREADS];
+    int i;
+
+    for (i = 0; i < BENCH_OBJECT_THREADS; i++) {
+        workers[i].hld = *(objhld_t *)context;
+        workers[i].iterations = (iterations + BENCH_OBJECT_THREADS - 1) / BENCH_OBJECT_THREADS;
+        lwp_create(&workers[i].lwp, 0, &bench_object_refr_proc, &workers[i]);
+    }
+
+    for (i = 0; i < BENCH_OBJECT_THREADS; i++) {
+        lwp_join(&workers[i].lwp, NULL);
+    }
+
+    return workers[0].iterations * BENCH_OBJECT_THREADS;
+}
+
+static int64_t bench_object_allo(void *context, int64_t iterations, int64_t *bytes)
+{
+    int64_t i;
+    objhld_t hld;
+
+    for (i = 0; i < iterations; i++) {
+        hld = objallo2(64);
+        objclos(hld);
+    }
+    return iterations;
+}
+
+/*---------------------------------------------avltree---------------------------------------------*/
+
+#define BENCH_AVL_NODES     (65536)
+
+struct bench_avl_node {
+    struct avltree_node_t leaf;
+    uint32_t key;
+};
+
+struct bench_avl {
+    struct avltree_node_t *root;
+    struct bench_avl_node *nodes;
+    int inserted;
+};
+
+static int bench_avl_compare(const void *left, const void *right)
+{
+    return avl_type_compare(struct bench_avl_node, leaf, key, left, right);
+}
+
+static nsp_status_t bench_avl_setup(void **context)
+{
+    struct bench_avl *avl;
+    uint32_t seed;
+    int i;
+
+    avl = (struct bench_avl *)zmalloc(sizeof(*avl));
+    if (!avl) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    avl->nodes = (struct bench_avl_node *)zmalloc(sizeof(struct bench_avl_node) * BENCH_AVL_NODES);
+    if (!avl->nodes) {
+        zfree(avl);
+        return posix__makeerror(ENOMEM);
+    }
+
+    /* distinct keys in random order */
+    seed = BENCH_AVL_NODES;
+    for (i = 0; i < BENCH_AVL_NODES; i++) {
+        avl->nodes[i].key = ((bench_random(&seed) << 16) | (uint32_t)i);
+    }
+
+    avl->root = NULL;
+    for (i = 0; i < BENCH_AVL_NODES; i++) {
+        avl->root = avlinsert(avl->root, &avl->nodes[i].leaf, &bench_avl_compare);
+    }
+    avl->inserted = BENCH_AVL_NODES;
+
+    *context = avl;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_avl_teardown(void *context)
+{
+    struct bench_avl *avl;
+
+    avl = (struct bench_avl *)context;
+    zfree(avl->nodes);
+    zfree(avl);
+}
+
+/* the tree is rebuilt from empty after all nodes are in, so the depth range in [0, log2(BENCH_AVL_NODES)] */
+static int64_t bench_avl_insert(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_avl *avl;
+    int64_t i;
+
+    avl = (struct bench_avl *)context;
+    for (i = 0; i < iterations; i++) {
+        if (avl->inserted >= BENCH_AVL_NODES) {
+            avl->root = NULL;
+            avl->inserted = 0;
+        }
+        avl->root = avlinsert(avl->root, &avl->nodes[avl->inserted].leaf, &bench_avl_compare);
+        avl->inserted++;
+    }
+    return iterations;
+}
+
+static int64_t bench_avl_search(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_avl *avl;
+    struct bench_avl_node target;
+    int64_t i;
+    uint32_t seed;
+
+    avl = (struct bench_avl *)context;
+
+    seed = 0;
+    for (i = 0; i < iterations; i++) {
+        target.key = avl->nodes[(bench_random(&seed) ^ (bench_random(&seed) << 15)) & (BENCH_AVL_NODES - 1)].key;
+        if (!avlsearch(avl->root, &target.leaf, &bench_avl_compare)) {
+            abort();
+        }
+    }
+    return iterations;
+}
+
+/*---------------------------------------------ckfifo---------------------------------------------*/
+
+#define BENCH_CKFIFO_SIZE   (4096)
+
+struct bench_ckfifo {
+    struct ckfifo *ring;
+    unsigned char buffer[BENCH_CKFIFO_SIZE];
+    unsigned char data[BENCH_CKFIFO_SIZE];
+};
+
+static nsp_status_t bench_ckfifo_setup(void **context)
+{
+    struct bench_ckfifo *fifo;
+
+    fifo = (struct bench_ckfifo *)zmalloc(sizeof(*fifo));
+    if (!fifo) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    fifo->ring = ckfifo_init(fifo->buffer, sizeof(fifo->buffer));
+    if (!fifo->ring) {
+        zfree(fifo);
+        return NSP_STATUS_FATAL;
+    }
+    memset(fifo->data, 0x5A, sizeof(fifo->data));
+
+    *context = fifo;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_ckfifo_teardown(void *context)
+{
+    ckfifo_uninit(((struct bench_ckfifo *)context)->ring);
+    zfree(context);
+}
+
+/* one put and one get of @size bytes each iteration, the offsets walk through the whole ring */
+static int64_t bench_ckfifo_putget(void *context, int64_t iterations, int64_t *bytes, uint32_t size)
+{
+    struct bench_ckfifo *fifo;
+    int64_t i;
+
+    fifo = (struct bench_ckfifo *)context;
+    for (i = 0; i < iterations; i++) {
+        if (ckfifo_put(fifo->ring, fifo->data, size) != size || ckfifo_get(fifo->ring, fifo->data, size) != size) {
+            abort();
+        }
+    }
+
+    *bytes += iterations * size;
+    return iterations;
+}
+
+static int64_t bench_ckfifo_putget16(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_ckfifo_putget(context, iterations, bytes, 16);
+}
+
+static int64_t bench_ckfifo_putget1000(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_ckfifo_putget(context, iterations, bytes, 1000);
+}
+
+/*---------------------------------------------zmalloc---------------------------------------------*/
+
+#define BENCH_ZMALLOC_BATCH     (256)
+
+/* allocate a batch and free it in the same order, so the allocator see more than one block in use */
+static int64_t bench_zmalloc(void *context, int64_t iterations, int64_t *bytes, size_t size)
+{
+    void *blocks[BENCH_ZMALLOC_BATCH];
+    int64_t i;
+    int j;
+
+    for (i = 0; i < iterations; i += BENCH_ZMALLOC_BATCH) {
+        for (j = 0; j < BENCH_ZMALLOC_BATCH; j++) {
+            blocks[j] = zmalloc(size);
+        }
+        for (j = 0; j < BENCH_ZMALLOC_BATCH; j++) {
+            zfree(blocks[j]);
+        }
+    }
+    return i;
+}
+
+static int64_t bench_zmalloc64(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_zmalloc(context, iterations, bytes, 64);
+}
+
+static int64_t bench_zmalloc4096(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_zmalloc(context, iterations, bytes, 4096);
+}
+
+const struct bench_case bench_core_cases[] = {
+    { "object/refr-defr", &bench_object_setup, &bench_object_refr, &bench_object_teardown },
+    { "object/refr-defr/4threads", &bench_object_setup, &bench_object_refr_contention, &bench_object_teardown },
+    { "object/allo-clos", NULL, &bench_object_allo, NULL },
+    { "avltree/insert/65536", &bench_avl_setup, &bench_avl_insert, &bench_avl_teardown },
+    { "avltree/search/65536", &bench_avl_setup, &bench_avl_search, &bench_avl_teardown },
+    { "ckfifo/put-get/16", &bench_ckfifo_setup, &bench_ckfifo_putget16, &bench_ckfifo_teardown },
+    { "ckfifo/put-get/1000", &bench_ckfifo_setup, &bench_ckfifo_putget1000, &bench_ckfifo_teardown },
+    { "zmalloc/zfree/64", NULL, &bench_zmalloc64, NULL },
+    { "zmalloc/zfree/4096", NULL, &bench_zmalloc4096, NULL },
+    { NULL, NULL, NULL, NULL },
+};
@@ -0,0 +1,171 @@
+#include "bench.h"
+
+#include "hash.h"
+#include "zmalloc.h"
+
+/* input, output(base64 text expand 4/3) and the key of siphash */
+struct bench_digest {
+    unsigned char input[4096];
+    char output[8192];
+    int encoded;
+    uint8_t key[16];
+};
+
+static nsp_status_t bench_digest_setup(void **context)
+{
+    struct bench_digest *digest;
+    uint32_t seed;
+    size_t i;
+
+    digest = (struct bench_digest *)zmalloc(sizeof(*digest));
+    if (!digest) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    seed = sizeof(digest->input);
+    for (i = 0; i < sizeof(digest->input); i++) {
+        digest->input[i] = (unsigned char)bench_random(&seed);
+    }
+    for (i = 0; i < sizeof(digest->key); i++) {
+        digest->key[i] = (uint8_t)i;
+    }
+
+    /* the decode case consume this */
+    base64_encode((const char *)digest->input, sizeof(digest->input), digest->output);
+    digest->encoded = (int)strlen(digest->output);
+
+    *context = digest;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_digest_teardown(void *context)
+{
+    zfree(context);
+}
+
+static int64_t bench_crc32(void *context, int64_t iterations, int64_t *bytes, uint32_t size)
+{
+    struct bench_digest *digest;
+    volatile uint32_t crc;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    crc = 0;
+    for (i = 0; i < iterations; i++) {
+        crc = crc32(crc, digest->input, size);
+    }
+
+    *bytes += iterations * size;
+    return iterations;
+}
+
+static int64_t bench_crc32_64(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_crc32(context, iterations, bytes, 64);
+}
+
+static int64_t bench_crc32_4096(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_crc32(context, iterations, bytes, 4096);
+}
+
+static int64_t bench_md5(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_digest *digest;
+    /* the md5 context is opaque, this storage large enough to hold it */
+    uint64_t md5ctx[32];
+    abuff_md5_result_t result;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    for (i = 0; i < iterations; i++) {
+        md5_init((md5ctx_pt)md5ctx);
+        md5_update((md5ctx_pt)md5ctx, digest->input, sizeof(digest->input));
+        md5_final((md5ctx_pt)md5ctx, &result);
+    }
+
+    *bytes += iterations * sizeof(digest->input);
+    return iterations;
+}
+
+static int64_t bench_sha256(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_digest *digest;
+    abuff_sha256_result_t result;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    for (i = 0; i < iterations; i++) {
+        sha256(digest->input, sizeof(digest->input), &result);
+    }
+
+    *bytes += iterations * sizeof(digest->input);
+    return iterations;
+}
+
+static int64_t bench_base64_encode(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_digest *digest;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    for (i = 0; i < iterations; i++) {
+        base64_encode((const char *)digest->input, sizeof(digest->input), digest->output);
+    }
+
+    *bytes += iterations * sizeof(digest->input);
+    return iterations;
+}
+
+/* bytes count in the decoded size, so it compare with the encode case */
+static int64_t bench_base64_decode(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_digest *digest;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    for (i = 0; i < iterations; i++) {
+        base64_decode(digest->output, digest->encoded, (char *)digest->input);
+    }
+
+    *bytes += iterations * sizeof(digest->input);
+    return iterations;
+}
+
+static int64_t bench_siphash(void *context, int64_t iterations, int64_t *bytes, size_t size)
+{
+    struct bench_digest *digest;
+    volatile uint64_t hash;
+    int64_t i;
+
+    digest = (struct bench_digest *)context;
+    for (i = 0; i < iterations; i++) {
+        hash = siphash(digest->input, size, digest->key);
+    }
+    (void)hash;
+
+    *bytes += iterations * size;
+    return iterations;
+}
+
+static int64_t bench_siphash16(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_siphash(context, iterations, bytes, 16);
+}
+
+static int64_t bench_siphash4096(void *context, int64_t iterations, int64_t *bytes)
+{
+    return bench_siphash(context, iterations, bytes, 4096);
+}
+
+const struct bench_case bench_digest_cases[] = {
+    { "crc32/64", &bench_digest_setup, &bench_crc32_64, &bench_digest_teardown },
+    { "crc32/4096", &bench_digest_setup, &bench_crc32_4096, &bench_digest_teardown },
+    { "md5/4096", &bench_digest_setup, &bench_md5, &bench_digest_teardown },
+    { "sha256/4096", &bench_digest_setup, &bench_sha256, &bench_digest_teardown },
+    { "base64/encode/4096", &bench_digest_setup, &bench_base64_encode, &bench_digest_teardown },
+    { "base64/decode/4096", &bench_digest_setup, &bench_base64_decode, &bench_digest_teardown },
+    { "siphash/16", &bench_digest_setup, &bench_siphash16, &bench_digest_teardown },
+    { "siphash/4096", &bench_digest_setup, &bench_siphash4096, &bench_digest_teardown },
+    { NULL, NULL, NULL, NULL },
+};
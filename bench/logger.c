@@ -0,0 +1,59 @@
+#include "bench.h"
+
+#include "logger.h"
+
+#include <unistd.h>
+#include <ftw.h>
+
+/* log_save discard the records beyond the pending limit of the asynchronous writer, flush on the calling thread
+ *  after each batch, so every record are formatted and written to file */
+#define BENCH_LOGGER_BATCH      (64)
+
+static char __bench_logger_dir[] = "/tmp/naxbench.XXXXXX";
+
+static nsp_status_t bench_logger_setup(void **context)
+{
+    static int initialized = 0;
+
+    /* the root directory of logger can only be set once */
+    if (!initialized) {
+        if (!mkdtemp(__bench_logger_dir)) {
+            return posix__makeerror(errno);
+        }
+        log_init2(__bench_logger_dir);
+        initialized = 1;
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static int bench_logger_remove(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    remove(path);
+    return 0;
+}
+
+static void bench_logger_teardown(void *context)
+{
+    log_flush();
+    nftw(__bench_logger_dir, &bench_logger_remove, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int64_t bench_logger_save(void *context, int64_t iterations, int64_t *bytes)
+{
+    int64_t i;
+    int j;
+
+    for (i = 0; i < iterations; i += BENCH_LOGGER_BATCH) {
+        for (j = 0; j < BENCH_LOGGER_BATCH; j++) {
+            log_save("naxbench", kLogLevel_Info, kLogTarget_Filesystem, "link:%lld received %d bytes from %s:%u",
+                i + j, 1024, "192.168.0.100", 10256);
+        }
+        log_flush();
+    }
+    return i;
+}
+
+const struct bench_case bench_logger_cases[] = {
+    { "log/save-flush", &bench_logger_setup, &bench_logger_save, &bench_logger_teardown },
+    { NULL, NULL, NULL, NULL },
+};
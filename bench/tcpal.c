@@ -0,0 +1,209 @@
+#include "bench.h"
+
+#include "ncb.h"
+#include "tcp.h"
+#include "bufpool.h"
+#include "zmalloc.h"
+
+/* parse of TCP stream on a detached ncb, a synthetic stream are fed in pieces of TCP_BUFFER_SIZE like @_tcp_rx do,
+ *  so the packets across pieces go through the parse cache and the large ones through the large-block.
+ *  every packet has a 4 bytes little-endian length head which count only the user data */
+
+#define BENCH_TCPAL_STREAM_SIZE     (1 << 20)
+#define BENCH_TCPAL_HEAD_SIZE       (4)
+
+enum bench_tcpal_mode {
+    kBenchTcpal_Template = 0,
+    kBenchTcpal_Frame,
+    kBenchTcpal_Delimiter,
+};
+
+struct bench_tcpal {
+    ncb_t *ncb;
+    unsigned char *stream;
+    int size;
+    int packets;
+};
+
+static int64_t __bench_tcpal_delivered = 0;
+static uint64_t __bench_tcpal_checksum = 0;
+
+static void STDCALL bench_tcpal_callback(const struct nis_event *event, const void *data)
+{
+    const tcp_data_t *tcp_data;
+
+    if (EVT_RECEIVEDATA == event->Event) {
+        tcp_data = (const tcp_data_t *)data;
+        __bench_tcpal_checksum += tcp_data->e.Packet.Data[0];
+        __bench_tcpal_delivered++;
+    }
+}
+
+static nsp_status_t STDCALL bench_tcpal_parser(void *data, int cb, int *user_data_size)
+{
+    uint32_t length;
+
+    memcpy(&length, data, sizeof(length));
+    *user_data_size = (int)le32toh(length);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* stream of @length bytes packets, the whole packets fit in BENCH_TCPAL_STREAM_SIZE, one at least */
+static nsp_status_t bench_tcpal_setup(void **context, enum bench_tcpal_mode mode, int length)
+{
+    struct bench_tcpal *tcpal;
+    ncb_t *ncb;
+    unsigned char *packet;
+    uint32_t head;
+    int packet_length;
+    int i;
+
+    tcpal = (struct bench_tcpal *)zmalloc(sizeof(*tcpal));
+    if (!tcpal) {
+        return posix__makeerror(ENOMEM);
+    }
+    memset(tcpal, 0, sizeof(*tcpal));
+
+    packet_length = (kBenchTcpal_Delimiter == mode) ? length : length + BENCH_TCPAL_HEAD_SIZE;
+    tcpal->packets = (BENCH_TCPAL_STREAM_SIZE / packet_length > 0) ? BENCH_TCPAL_STREAM_SIZE / packet_length : 1;
+    tcpal->size = tcpal->packets * packet_length;
+    tcpal->stream = (unsigned char *)zmalloc(tcpal->size);
+    tcpal->ncb = ncb = (ncb_t *)zmalloc(sizeof(ncb_t));
+    if (!tcpal->stream || !ncb) {
+        zfree(tcpal->stream);
+        zfree(ncb);
+        zfree(tcpal);
+        return posix__makeerror(ENOMEM);
+    }
+
+    for (i = 0; i < tcpal->packets; i++) {
+        packet = tcpal->stream + i * packet_length;
+        memset(packet, 'a' + (i % 26), packet_length);
+        if (kBenchTcpal_Delimiter == mode) {
+            packet[length - 2] = '\r';
+            packet[length - 1] = '\n';
+        } else {
+            head = htole32((uint32_t)length);
+            memcpy(packet, &head, sizeof(head));
+        }
+    }
+
+    memset(ncb, 0, sizeof(*ncb));
+    ncb->hld = 1;
+    ncb->protocol = IPPROTO_TCP;
+    ncb->nis_callback = &bench_tcpal_callback;
+    ncb->u.tcp.rx_parse_buffer = (unsigned char *)bufpool_alloc(TCP_BUFFER_SIZE);
+    if (!ncb->u.tcp.rx_parse_buffer) {
+        zfree(tcpal->stream);
+        zfree(ncb);
+        zfree(tcpal);
+        return posix__makeerror(ENOMEM);
+    }
+
+    switch (mode) {
+        case kBenchTcpal_Template:
+            ncb->u.tcp.template.cb_ = BENCH_TCPAL_HEAD_SIZE;
+            ncb->u.tcp.template.parser_ = &bench_tcpal_parser;
+            break;
+        case kBenchTcpal_Frame:
+            ncb->u.tcp.template.cb_ = BENCH_TCPAL_HEAD_SIZE;
+            ncb->u.tcp.frame.cb_ = BENCH_TCPAL_HEAD_SIZE;
+            ncb->u.tcp.frame.offset = 0;
+            ncb->u.tcp.frame.flags = 0;
+            ncb->u.tcp.frame.width = 4;
+            break;
+        case kBenchTcpal_Delimiter:
+            memcpy(ncb->u.tcp.delimiter, "\r\n", 2);
+            ncb->u.tcp.delimiter_cb = 2;
+            break;
+        default:
+            break;
+    }
+
+    *context = tcpal;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void bench_tcpal_teardown(void *context)
+{
+    struct bench_tcpal *tcpal;
+
+    tcpal = (struct bench_tcpal *)context;
+    if (tcpal->ncb->u.tcp.lbdata) {
+        bufpool_free(tcpal->ncb->u.tcp.lbdata);
+    }
+    bufpool_free(tcpal->ncb->u.tcp.rx_parse_buffer);
+    zfree(tcpal->ncb);
+    zfree(tcpal->stream);
+    zfree(tcpal);
+}
+
+/* feed whole streams until @iterations packets are delivered */
+static int64_t bench_tcpal_parse(void *context, int64_t iterations, int64_t *bytes)
+{
+    struct bench_tcpal *tcpal;
+    int offset;
+    int piece;
+    int cpcb;
+    int overplus;
+
+    tcpal = (struct bench_tcpal *)context;
+    __bench_tcpal_delivered = 0;
+
+    while (__bench_tcpal_delivered < iterations) {
+        for (offset = 0; offset < tcpal->size; offset += piece) {
+            piece = (tcpal->size - offset < TCP_BUFFER_SIZE) ? tcpal->size - offset : TCP_BUFFER_SIZE;
+            cpcb = piece;
+            do {
+                overplus = tcp_parse_pkt(tcpal->ncb, tcpal->stream + offset + (piece - cpcb), cpcb);
+                if (overplus < 0) {
+                    abort();
+                }
+                cpcb = overplus;
+            } while (overplus > 0);
+        }
+        *bytes += tcpal->size;
+    }
+
+    return __bench_tcpal_delivered;
+}
+
+static nsp_status_t bench_tcpal_setup_tst64(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Template, 64);
+}
+
+static nsp_status_t bench_tcpal_setup_frame64(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Frame, 64);
+}
+
+static nsp_status_t bench_tcpal_setup_tst1024(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Template, 1024);
+}
+
+static nsp_status_t bench_tcpal_setup_frame1024(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Frame, 1024);
+}
+
+static nsp_status_t bench_tcpal_setup_tst200000(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Template, 200000);
+}
+
+static nsp_status_t bench_tcpal_setup_delim64(void **context)
+{
+    return bench_tcpal_setup(context, kBenchTcpal_Delimiter, 64);
+}
+
+const struct bench_case bench_tcpal_cases[] = {
+    { "tcp_parse_pkt/tst/64", &bench_tcpal_setup_tst64, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { "tcp_parse_pkt/frame/64", &bench_tcpal_setup_frame64, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { "tcp_parse_pkt/tst/1024", &bench_tcpal_setup_tst1024, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { "tcp_parse_pkt/frame/1024", &bench_tcpal_setup_frame1024, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { "tcp_parse_pkt/tst/200000", &bench_tcpal_setup_tst200000, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { "tcp_parse_pkt/delim/64", &bench_tcpal_setup_delim64, &bench_tcpal_parse, &bench_tcpal_teardown },
+    { NULL, NULL, NULL, NULL },
+};
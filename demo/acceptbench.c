@@ -0,0 +1,126 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>   /* getrusage(2) */
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+/* accept benchmark, [count] threads connect to the listener on loopback and close the connection immediately, as fast as they can,
+ *  connections/s accepted by the server and CPU time of each connection(user + sys of the whole process) are reported.
+ *  clients are plain sockets and close with RST, so the ephemeral ports never stay in TIME_WAIT.
+ */
+
+#define ACCEPTBENCH_ROUND_SECONDS   (3)
+
+static uint64_t __acceptbench_accepted = 0;
+static uint64_t __acceptbench_failed = 0;
+static int __acceptbench_stop = 0;
+static uint16_t __acceptbench_port = 0;
+
+static void STDCALL acceptbench_server_callback(const struct nis_event *event, const void *data)
+{
+    if (EVT_TCP_ACCEPTED == event->Event) {
+        atom_addone(&__acceptbench_accepted);
+    }
+}
+
+static void *acceptbench_client_proc(void *p)
+{
+    struct sockaddr_in addr;
+    struct linger lgr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(__acceptbench_port);
+    lgr.l_onoff = 1;
+    lgr.l_linger = 0;
+
+    while (!__atomic_load_n(&__acceptbench_stop, __ATOMIC_ACQUIRE)) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            atom_addone(&__acceptbench_failed);
+            lwp_delay(1000);
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lgr, sizeof(lgr));
+        if (0 != connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+            atom_addone(&__acceptbench_failed);
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static uint64_t acceptbench_cputime()
+{
+    struct rusage usage;
+
+    if (0 != getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+nsp_status_t start_acceptbench(const struct argument *parameter, lwp_event_t *exit)
+{
+    HTCPLINK server;
+    lwp_t *clients;
+    uint64_t begin, elapse, cpu, accepted;
+    nsp_status_t status;
+    int i;
+
+    server = tcp_create(&acceptbench_server_callback, "127.0.0.1", parameter->port);
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    if (!NSP_SUCCESS(tcp_listen(server, 0))) {
+        tcp_destroy(server);
+        return NSP_STATUS_FATAL;
+    }
+
+    clients = (lwp_t *)malloc(parameter->acceptbench * sizeof(lwp_t));
+    if (!clients) {
+        tcp_destroy(server);
+        return posix__makeerror(ENOMEM);
+    }
+
+    __acceptbench_port = parameter->port;
+    __atomic_store_n(&__acceptbench_stop, 0, __ATOMIC_RELEASE);
+    atom_set64(&__acceptbench_accepted, 0);
+    atom_set64(&__acceptbench_failed, 0);
+    begin = clock_monotonic();
+    cpu = acceptbench_cputime();
+    for (i = 0; i < parameter->acceptbench; i++) {
+        lwp_create(&clients[i], 0, &acceptbench_client_proc, NULL);
+    }
+
+    status = lwp_event_wait(exit, ACCEPTBENCH_ROUND_SECONDS * 1000);
+    accepted = atom_get64(&__acceptbench_accepted);
+    cpu = acceptbench_cputime() - cpu;
+    elapse = clock_monotonic() - begin;
+    __atomic_store_n(&__acceptbench_stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < parameter->acceptbench; i++) {
+        lwp_join(&clients[i], NULL);
+    }
+    free(clients);
+    tcp_destroy(server);
+
+    if (posix__makeerror(ETIMEDOUT) != status) {
+        return NSP_STATUS_FATAL;
+    }
+
+    printf("clients\tconnections/s\tcpu(us)/connection\tfailed\n");
+    printf("%d\t%.0f\t\t%.2f\t\t\t%llu\n", parameter->acceptbench, (double)accepted * 10000000 / elapse,
+        (accepted > 0) ? (double)cpu / accepted : 0.0, (unsigned long long)atom_get64(&__acceptbench_failed));
+    return NSP_STATUS_SUCCESSFUL;
+}
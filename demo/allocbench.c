@@ -0,0 +1,186 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <sys/resource.h>   /* getrusage(2) */
+#include <sys/wait.h>       /* waitpid(2) */
+#include <unistd.h>         /* fork(2) */
+
+/* allocation-heavy echo benchmark, every packet arrived at server are echoed back and every echo arrived at client are sent again,
+ *  so each message cost a Tx node allocation on both side and it usually freed by another thread.
+ *  the round run twice in child processes, once with NAX_SLAB=0(every node from zmalloc) and once with the slab cache,
+ *  messages/s and CPU time of each message(user + sys of the whole process) are reported.
+ */
+
+#define ALLOCBENCH_ROUND_SECONDS    (3)
+#define ALLOCBENCH_LINKS            (16)
+#define ALLOCBENCH_WINDOW           (32)
+#define ALLOCBENCH_MAXIMUM_LENGTH   (0x10000)
+
+static uint64_t __allocbench_rx = 0;
+static int __allocbench_stop = 0;
+
+static void STDCALL allocbench_server_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA == event->Event) {
+        tcp_write(event->Ln.Tcp.Link, tcpdata->e.Packet.Data, tcpdata->e.Packet.Size, NULL);
+    }
+}
+
+static void STDCALL allocbench_client_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    atom_addone(&__allocbench_rx);
+    if (!__atomic_load_n(&__allocbench_stop, __ATOMIC_ACQUIRE)) {
+        tcp_write(event->Ln.Tcp.Link, tcpdata->e.Packet.Data, tcpdata->e.Packet.Size, NULL);
+    }
+}
+
+static uint64_t allocbench_cputime()
+{
+    struct rusage usage;
+
+    if (0 != getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static nsp_status_t allocbench_run_round(const struct argument *parameter, const char *mode, lwp_event_t *exit)
+{
+    HTCPLINK server, clients[ALLOCBENCH_LINKS];
+    char target[128];
+    unsigned char *packet;
+    uint64_t begin, elapse, cpu, rx;
+    nsp_status_t status;
+    int i, j;
+
+    crt_sprintf(target, sizeof(target), "IPC:/tmp/nax-allocbench-%d.sock", ifos_getpid());
+    server = tcp_create2(&allocbench_server_callback, target, 0, gettst());
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    for (i = 0; i < ALLOCBENCH_LINKS; i++) {
+        clients[i] = INVALID_HTCPLINK;
+    }
+    packet = NULL;
+    status = NSP_STATUS_FATAL;
+    do {
+        /* accepted links inherit the tst of listener */
+        nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+        if (!NSP_SUCCESS(tcp_listen(server, 100))) {
+            break;
+        }
+
+        for (i = 0; i < ALLOCBENCH_LINKS; i++) {
+            clients[i] = tcp_create2(&allocbench_client_callback, "IPC:", 0, gettst());
+            if (INVALID_HTCPLINK == clients[i] || !NSP_SUCCESS(tcp_connect(clients[i], target, 0))) {
+                break;
+            }
+            /* links share the Rx threads, a blocking link stall the others on the same thread */
+            nis_cntl(clients[i], NI_SETATTR, nis_cntl(clients[i], NI_GETATTR) | LINKATTR_NONBLOCK);
+        }
+        if (i < ALLOCBENCH_LINKS) {
+            break;
+        }
+
+        packet = (unsigned char *)ztrymalloc(parameter->length);
+        if (!packet) {
+            break;
+        }
+        memset(packet, 'A', parameter->length);
+
+        __atomic_store_n(&__allocbench_stop, 0, __ATOMIC_RELEASE);
+        atom_set64(&__allocbench_rx, 0);
+        begin = clock_monotonic();
+        cpu = allocbench_cputime();
+        for (i = 0; i < ALLOCBENCH_LINKS; i++) {
+            for (j = 0; j < ALLOCBENCH_WINDOW; j++) {
+                tcp_write(clients[i], packet, parameter->length, NULL);
+            }
+        }
+        status = lwp_event_wait(exit, ALLOCBENCH_ROUND_SECONDS * 1000);
+        rx = atom_get64(&__allocbench_rx);
+        cpu = allocbench_cputime() - cpu;
+        elapse = clock_monotonic() - begin;
+        __atomic_store_n(&__allocbench_stop, 1, __ATOMIC_RELEASE);
+        if (posix__makeerror(ETIMEDOUT) != status) {
+            status = NSP_STATUS_FATAL;
+            break;
+        }
+
+        printf("%s\t%.0f\t\t%.2f\n", mode, (double)rx * 10000000 / elapse, (rx > 0) ? (double)cpu / rx : 0.0);
+        status = NSP_STATUS_SUCCESSFUL;
+    } while (0);
+
+    for (i = 0; i < ALLOCBENCH_LINKS; i++) {
+        if (INVALID_HTCPLINK != clients[i]) {
+            tcp_destroy(clients[i]);
+        }
+    }
+    tcp_destroy(server);
+    if (packet) {
+        zfree(packet);
+    }
+    return status;
+}
+
+/* the slab switch is read once when the first object allocated, so each mode run in a fresh process */
+static nsp_status_t allocbench_fork_round(const struct argument *parameter, const char *mode, const char *slab, lwp_event_t *exit)
+{
+    pid_t pid;
+    int wstatus;
+    nsp_status_t status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        return posix__makeerror(errno);
+    }
+
+    if (0 == pid) {
+        setenv("NAX_SLAB", slab, 1);
+        tcp_init2(2);
+        status = allocbench_run_round(parameter, mode, exit);
+        tcp_uninit();
+        fflush(stdout);
+        _exit(NSP_SUCCESS(status) ? 0 : 1);
+    }
+
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (EINTR != errno) {
+            return posix__makeerror(errno);
+        }
+    }
+
+    return (WIFEXITED(wstatus) && 0 == WEXITSTATUS(wstatus)) ? NSP_STATUS_SUCCESSFUL : NSP_STATUS_FATAL;
+}
+
+nsp_status_t start_allocbench(const struct argument *parameter, lwp_event_t *exit)
+{
+    if (parameter->length <= 0 || parameter->length > ALLOCBENCH_MAXIMUM_LENGTH) {
+        printf("data length must between 1 and %d in allocation benchmark\n", ALLOCBENCH_MAXIMUM_LENGTH);
+        return posix__makeerror(EINVAL);
+    }
+
+    printf("packet %d bytes, %d links with %d packets in flight each\n", parameter->length, ALLOCBENCH_LINKS, ALLOCBENCH_WINDOW);
+    printf("mode\tmessages/s\tcpu(us)/message\n");
+    if (NSP_SUCCESS(allocbench_fork_round(parameter, "zmalloc", "0", exit))) {
+        allocbench_fork_round(parameter, "slab", "1", exit);
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
@@ -21,6 +21,26 @@ enum ope_index {
 
     kOptIndex_UdpMode = 'u',
     kOptIndex_TcpMode = 't',
+
+    kOptIndex_MixedLoad = 'x',
+    kOptIndex_RxBudget = 'b',
+    kOptIndex_UdpGso = 'g',
+    kOptIndex_UdpReuseport = 'r',
+    kOptIndex_ShmBench = 'M',
+    kOptIndex_AllocBench = 'A',
+    kOptIndex_AcceptBench = 'a',
+    kOptIndex_WriteBench = 'W',
+    kOptIndex_FrameBench = 'F',
+    kOptIndex_DelimBench = 'D',
+    kOptIndex_LoadGen = 'L',
+    kOptIndex_LoadThreads = 'T',
+    kOptIndex_LoadDepth = 'd',
+    kOptIndex_LoadRate = 'R',
+    kOptIndex_LoadSeconds = 'S',
+    kOptIndex_LoadStamp = 'K',
+    kOptIndex_Capture = 'C',
+    kOptIndex_Replay = 'P',
+    kOptIndex_ReplaySpeed = 'X',
 };
 
 static const struct option long_options[] = {
@@ -34,6 +54,25 @@ static const struct option long_options[] = {
     {"data-length", required_argument, NULL, kOptIndex_DataLength},
     {"udp", no_argument, NULL, kOptIndex_UdpMode},
     {"tcp", no_argument, NULL, kOptIndex_TcpMode},
+    {"mixed", optional_argument, NULL, kOptIndex_MixedLoad},
+    {"rx-budget", required_argument, NULL, kOptIndex_RxBudget},
+    {"gso", optional_argument, NULL, kOptIndex_UdpGso},
+    {"reuseport", optional_argument, NULL, kOptIndex_UdpReuseport},
+    {"shm-bench", no_argument, NULL, kOptIndex_ShmBench},
+    {"alloc-bench", no_argument, NULL, kOptIndex_AllocBench},
+    {"accept-bench", optional_argument, NULL, kOptIndex_AcceptBench},
+    {"write-bench", optional_argument, NULL, kOptIndex_WriteBench},
+    {"frame-bench", no_argument, NULL, kOptIndex_FrameBench},
+    {"delim-bench", no_argument, NULL, kOptIndex_DelimBench},
+    {"load", optional_argument, NULL, kOptIndex_LoadGen},
+    {"threads", required_argument, NULL, kOptIndex_LoadThreads},
+    {"depth", required_argument, NULL, kOptIndex_LoadDepth},
+    {"rate", required_argument, NULL, kOptIndex_LoadRate},
+    {"seconds", required_argument, NULL, kOptIndex_LoadSeconds},
+    {"kernel-timestamp", no_argument, NULL, kOptIndex_LoadStamp},
+    {"capture", required_argument, NULL, kOptIndex_Capture},
+    {"replay", required_argument, NULL, kOptIndex_Replay},
+    {"speed", required_argument, NULL, kOptIndex_ReplaySpeed},
     {NULL, 0, NULL, 0}
 };
 
@@ -56,6 +95,41 @@ static void arg_display_usage()
             "[-l | --data-length [bytes]]\tset the size of each packets to send(client) or to response(server)\n"
             "[-u | --udp]\tuse UDP mode\n"
             "[-t | --tcp]\tuse TCP mode, this is default mode\n"
+            "[-x | --mixed [[opt]count]]\trun the mixed-load benchmark on loopback in a single Rx thread\n"
+            "\t\tone fire-hose link send packets of [-l] bytes continuously while [count](16 by default) small links play ping-pong,\n"
+            "\t\tthe round trip latency of small links are reported every second\n"
+            "[-b | --rx-budget [bytes]]\tset the per-wakeup receive budget of links in mixed-load benchmark, 0 means unlimited\n"
+            "[-g | --gso [[opt]segments]]\trun the UDP GSO/GRO benchmark on loopback\n"
+            "\t\tdatagrams of [-l] bytes are sent one per write, then [segments](16 by default) per GSO write without/with GRO on receiver\n"
+            "[-r | --reuseport [[opt]senders]]\trun the UDP SO_REUSEPORT fan-in benchmark on loopback\n"
+            "\t\t[senders](8 by default) threads send datagrams of [-l] bytes to a single socket, then to a SO_REUSEPORT group of sockets\n"
+            "[-M | --shm-bench]\trun the same-host transport benchmark, compare IPC: links with SHM: links\n"
+            "\t\tmessages/s of packets in [-l] bytes and the round trip latency of ping-pong are reported\n"
+            "[-A | --alloc-bench]\trun the allocation-heavy echo benchmark on IPC: links, compare zmalloc with the slab cache of Tx nodes\n"
+            "\t\tmessages/s of packets in [-l] bytes and CPU time of each message are reported\n"
+            "[-a | --accept-bench [[opt]clients]]\trun the accept benchmark on loopback port [-p]\n"
+            "\t\t[clients](4 by default) threads connect and close as fast as they can, connections/s accepted by server are reported\n"
+            "[-W | --write-bench [[opt]threads]]\trun the contended writer benchmark on loopback port [-p]\n"
+            "\t\t1, 2, 4 ... [threads](32 by default) threads write packets of [-l] bytes to one link, writes/s of each round are reported\n"
+            "[-F | --frame-bench]\trun the framing benchmark on loopback port [-p], compare the callbacks of stream template with built-in framing\n"
+            "\t\tpackets/s of [-l] bytes parsed by receiver and CPU time of receiving thread for each packet are reported\n"
+            "[-D | --delim-bench]\trun the delimiter benchmark on loopback port [-p], compare memchr(3) loop in callback with delimiter framing\n"
+            "\t\tlines/s of [-l] bytes split by receiver and CPU time of receiving thread for each line are reported\n"
+            "[-L | --load [[opt]connections]]\trun the load generator, [connections](16 by default) links send requests of [-l] bytes\n"
+            "\t\tto the echo server in this process, or to the server started by \"nstest -s -l [-l]\" when [-c] specified,\n"
+            "\t\tthe target is [-s]:[-p], 127.0.0.1 by default, \" -s ipc:/dev/shm/server.sock \" run over IPC link,\n"
+            "\t\tthroughput and p50/p99/p999 round trip time are printed in JSON\n"
+            "[-T | --threads [count]]\tthreads of load generator, also the count of epoll threads, 1 by default\n"
+            "[-d | --depth [count]]\trequests in flight of each link in load generator, 1 by default\n"
+            "[-R | --rate [requests]]\ttotal requests/s on fixed schedule in load generator, the latency of request is count from it's schedule,\n"
+            "\t\t0 by default means closed-loop, the next request is sent when one response arrived\n"
+            "[-S | --seconds [seconds]]\tduration of load generator, 10 by default\n"
+            "[-K | --kernel-timestamp]\tstamp the responses in kernel, the latency from kernel to callback are printed by load generator\n"
+            "[-C | --capture [file]]\trecord the frames of TCP server and the links it accepted to [file], replay it by [-P] later\n"
+            "[-P | --replay [file]]\treplay the inbound frames in capture [file] to [-s]:[-p], 127.0.0.1 by default, one link per captured stream,\n"
+            "\t\tto the sink server in this process, or to the server started by \"nstest -s -m\" when [-c] specified,\n"
+            "\t\tframes, bytes and the maximum lag behind the schedule are printed in JSON\n"
+            "[-X | --speed [factor]]\tscale the pace of replay, 2 for double speed, 0 for as fast as possible, 1 by default\n"
             ;
 
     printf("%s", usage_context);
@@ -93,11 +167,30 @@ nsp_status_t arg_check_startup(int argc, char **argv)
     __startup_parameters.mute = 0;
     __startup_parameters.length = 1024;
     __startup_parameters.mode = 't';
+    __startup_parameters.mixed = 0;
+    __startup_parameters.budget = -1;
+    __startup_parameters.gso = 0;
+    __startup_parameters.reuseport = 0;
+    __startup_parameters.shmbench = 0;
+    __startup_parameters.allocbench = 0;
+    __startup_parameters.acceptbench = 0;
+    __startup_parameters.writebench = 0;
+    __startup_parameters.framebench = 0;
+    __startup_parameters.delimbench = 0;
+    __startup_parameters.load = 0;
+    __startup_parameters.threads = 1;
+    __startup_parameters.depth = 1;
+    __startup_parameters.rate = 0;
+    __startup_parameters.seconds = 10;
+    __startup_parameters.stamp = 0;
+    __startup_parameters.capture[0] = 0;
+    __startup_parameters.replay[0] = 0;
+    __startup_parameters.speed = 1.0;
 
     /* double '::' meat option may have argument or not,
         one ':' meat option MUST have argument,
         no ':' meat option MUST NOT have argument */
-    crt_strcpy(shortopts, sizeof(shortopts), "hvp:es::mc::tl:u");
+    crt_strcpy(shortopts, sizeof(shortopts), "hvp:es::mc::tl:ux::b:g::r::MAa::W::FDL::T:d:R:S:KC:P:X:");
     opt = getopt_long(argc, argv, shortopts, long_options, &opt_index);
     while (opt != -1) {
         switch (opt) {
@@ -136,6 +229,71 @@ nsp_status_t arg_check_startup(int argc, char **argv)
                 assert(optarg);
                 __startup_parameters.length = atoi(optarg);
                 break;
+            case 'x':
+                __startup_parameters.mixed = (optarg) ? atoi(optarg) : 16;
+                break;
+            case 'b':
+                assert(optarg);
+                __startup_parameters.budget = atoi(optarg);
+                break;
+            case 'g':
+                __startup_parameters.gso = (optarg) ? atoi(optarg) : 16;
+                break;
+            case 'r':
+                __startup_parameters.reuseport = (optarg) ? atoi(optarg) : 8;
+                break;
+            case 'M':
+                __startup_parameters.shmbench = opt;
+                break;
+            case 'A':
+                __startup_parameters.allocbench = opt;
+                break;
+            case 'a':
+                __startup_parameters.acceptbench = (optarg) ? atoi(optarg) : 4;
+                break;
+            case 'W':
+                __startup_parameters.writebench = (optarg) ? atoi(optarg) : 32;
+                break;
+            case 'F':
+                __startup_parameters.framebench = opt;
+                break;
+            case 'D':
+                __startup_parameters.delimbench = opt;
+                break;
+            case 'L':
+                __startup_parameters.load = (optarg) ? atoi(optarg) : 16;
+                break;
+            case 'T':
+                assert(optarg);
+                __startup_parameters.threads = atoi(optarg);
+                break;
+            case 'd':
+                assert(optarg);
+                __startup_parameters.depth = atoi(optarg);
+                break;
+            case 'R':
+                assert(optarg);
+                __startup_parameters.rate = atoi(optarg);
+                break;
+            case 'S':
+                assert(optarg);
+                __startup_parameters.seconds = atoi(optarg);
+                break;
+            case 'K':
+                __startup_parameters.stamp = opt;
+                break;
+            case 'C':
+                assert(optarg);
+                crt_strcpy(__startup_parameters.capture, sizeof(__startup_parameters.capture), optarg);
+                break;
+            case 'P':
+                assert(optarg);
+                crt_strcpy(__startup_parameters.replay, sizeof(__startup_parameters.replay), optarg);
+                break;
+            case 'X':
+                assert(optarg);
+                __startup_parameters.speed = strtod(optarg, NULL);
+                break;
             case '?':
                 printf("?\n");
             case 0:
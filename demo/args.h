@@ -12,6 +12,25 @@ struct argument {
     int mute;
     int length;
     int mode;
+    int mixed;
+    int budget;
+    int gso;
+    int reuseport;
+    int shmbench;
+    int allocbench;
+    int acceptbench;
+    int writebench;
+    int framebench;
+    int delimbench;
+    int load;
+    int threads;
+    int depth;
+    int rate;
+    int seconds;
+    int stamp;
+    char capture[255];
+    char replay[255];
+    double speed;
 };
 
 extern nsp_status_t arg_check_startup(int argc, char **argv);
@@ -0,0 +1,227 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+/* delimiter benchmark, the client send CRLF terminated lines in blocks of 64KB, the receiver split them
+ *  by memchr(3) loop over the raw chunks in callback with it's own buffering first, as the text protocols did before,
+ *  then by delimiter framing of library(NI_SETDELIM).
+ *  lines/s split by receiver and CPU time of the receiving thread for each line are reported.
+ */
+
+#define DELIMBENCH_ROUND_SECONDS    (3)
+#define DELIMBENCH_BLOCK_SIZE       (0x10000)
+/* the pending buffer hold a partial line and a whole chunk, chunks are no more than the receive buffer of library(0x11000) */
+#define DELIMBENCH_PENDING_SIZE     (0x40000)
+
+static uint64_t __delimbench_rx = 0;
+static int __delimbench_rxtid = 0;
+static int __delimbench_stop = 0;
+static HTCPLINK __delimbench_client = INVALID_HTCPLINK;
+static unsigned char *__delimbench_block = NULL;
+static int __delimbench_size = 0;
+
+/* the line across chunks in memchr round, only touched by the receiving thread */
+static unsigned char *__delimbench_pending = NULL;
+static int __delimbench_pending_size = 0;
+
+static void delimbench_mark_rxtid()
+{
+    if (0 == __atomic_load_n(&__delimbench_rxtid, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&__delimbench_rxtid, (int)ifos_gettid(), __ATOMIC_RELEASE);
+    }
+}
+
+/* the work on each line, same in both rounds */
+static void delimbench_on_line(const unsigned char *line, int size)
+{
+    atom_addone(&__delimbench_rx);
+}
+
+static void STDCALL delimbench_line_callback(const struct nis_event *event, const void *data)
+{
+    const tcp_data_t *tcp_data;
+
+    if (EVT_RECEIVEDATA == event->Event) {
+        delimbench_mark_rxtid();
+        tcp_data = (const tcp_data_t *)data;
+        delimbench_on_line(tcp_data->e.Packet.Data, tcp_data->e.Packet.Size);
+    }
+}
+
+/* split the lines of chunk in place, the partial line at tail are kept in pending buffer, the next chunk are appended to it */
+static void delimbench_split(const unsigned char *data, int size)
+{
+    const unsigned char *cursor, *end, *cr;
+
+    cursor = data;
+    end = data + size;
+    while (cursor < end) {
+        cr = (const unsigned char *)memchr(cursor, '\r', end - cursor);
+        if (!cr || cr + 1 >= end) {
+            break;
+        }
+        if ('\n' == cr[1]) {
+            delimbench_on_line(cursor, (int)(cr - cursor));
+            cursor = cr + 2;
+        } else {
+            cursor = cr + 1;
+        }
+    }
+
+    __delimbench_pending_size = (int)(end - cursor);
+    if (__delimbench_pending_size > 0 && cursor != __delimbench_pending) {
+        memmove(__delimbench_pending, cursor, __delimbench_pending_size);
+    }
+}
+
+static void STDCALL delimbench_chunk_callback(const struct nis_event *event, const void *data)
+{
+    const tcp_data_t *tcp_data;
+
+    if (EVT_RECEIVEDATA == event->Event) {
+        delimbench_mark_rxtid();
+        tcp_data = (const tcp_data_t *)data;
+        if (__delimbench_pending_size > 0) {
+            memcpy(__delimbench_pending + __delimbench_pending_size, tcp_data->e.Packet.Data, tcp_data->e.Packet.Size);
+            delimbench_split(__delimbench_pending, __delimbench_pending_size + tcp_data->e.Packet.Size);
+        } else {
+            delimbench_split(tcp_data->e.Packet.Data, tcp_data->e.Packet.Size);
+        }
+    }
+}
+
+static void STDCALL delimbench_client_callback(const struct nis_event *event, const void *data)
+{
+    ;
+}
+
+static void *delimbench_sender_proc(void *p)
+{
+    nsp_status_t status;
+
+    while (!__atomic_load_n(&__delimbench_stop, __ATOMIC_ACQUIRE)) {
+        status = tcp_write(__delimbench_client, __delimbench_block, __delimbench_size, NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            lwp_delay(100);
+        } else if (!NSP_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static nsp_status_t delimbench_run_round(const char *name, const struct argument *parameter, nsp_boolean_t framing, lwp_event_t *exit)
+{
+    HTCPLINK server;
+    lwp_t sender;
+    uint64_t begin, elapse, cpu, rx;
+    nsp_status_t status;
+    int i, tid;
+
+    server = tcp_create(framing ? &delimbench_line_callback : &delimbench_chunk_callback, "127.0.0.1", parameter->port);
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    status = NSP_STATUS_FATAL;
+    __delimbench_client = INVALID_HTCPLINK;
+    __delimbench_pending_size = 0;
+    __atomic_store_n(&__delimbench_rxtid, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&__delimbench_stop, 0, __ATOMIC_RELEASE);
+    do {
+        if (framing && nis_cntl(server, NI_SETDELIM, "\r\n", 2) < 0) {
+            break;
+        }
+        nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+        if (!NSP_SUCCESS(tcp_listen(server, 0))) {
+            break;
+        }
+
+        __delimbench_client = tcp_create(&delimbench_client_callback, NULL, 0);
+        if (INVALID_HTCPLINK == __delimbench_client || !NSP_SUCCESS(tcp_connect(__delimbench_client, "127.0.0.1", parameter->port))) {
+            break;
+        }
+
+        lwp_create(&sender, 0, &delimbench_sender_proc, NULL);
+
+        /* the receiving thread are known after the first chunk arrived */
+        for (i = 0; i < 1000 && 0 == (tid = __atomic_load_n(&__delimbench_rxtid, __ATOMIC_ACQUIRE)); i++) {
+            lwp_delay(1000);
+        }
+
+        rx = atom_get64(&__delimbench_rx);
+        cpu = framebench_thread_cputime(tid);
+        begin = clock_monotonic();
+        status = lwp_event_wait(exit, DELIMBENCH_ROUND_SECONDS * 1000);
+        rx = atom_get64(&__delimbench_rx) - rx;
+        cpu = framebench_thread_cputime(tid) - cpu;
+        elapse = clock_monotonic() - begin;
+
+        __atomic_store_n(&__delimbench_stop, 1, __ATOMIC_RELEASE);
+        lwp_join(&sender, NULL);
+
+        if (posix__makeerror(ETIMEDOUT) != status || 0 == tid) {
+            status = NSP_STATUS_FATAL;
+            break;
+        }
+
+        printf("%s\t%.0f\t\t%.1f\n", name, (double)rx * 10000000 / elapse, (rx > 0) ? (double)cpu * 1000 / rx : 0.0);
+        status = NSP_STATUS_SUCCESSFUL;
+    } while (0);
+
+    if (INVALID_HTCPLINK != __delimbench_client) {
+        tcp_destroy(__delimbench_client);
+        __delimbench_client = INVALID_HTCPLINK;
+    }
+    tcp_destroy(server);
+    return status;
+}
+
+nsp_status_t start_delimbench(const struct argument *parameter, lwp_event_t *exit)
+{
+    nsp_status_t status;
+    int line, count, i;
+
+    line = parameter->length + 2;
+    if (parameter->length <= 0 || line > DELIMBENCH_BLOCK_SIZE) {
+        printf("data length must between 1 and %d in delimiter benchmark\n", DELIMBENCH_BLOCK_SIZE - 2);
+        return posix__makeerror(EINVAL);
+    }
+
+    /* the block are filled with whole lines, the text mix a few CR which are not followed by LF */
+    count = DELIMBENCH_BLOCK_SIZE / line;
+    __delimbench_size = count * line;
+    __delimbench_block = (unsigned char *)ztrymalloc(__delimbench_size);
+    __delimbench_pending = (unsigned char *)ztrymalloc(DELIMBENCH_PENDING_SIZE);
+    if (!__delimbench_block || !__delimbench_pending) {
+        zfree(__delimbench_block);
+        zfree(__delimbench_pending);
+        return posix__makeerror(ENOMEM);
+    }
+    for (i = 0; i < __delimbench_size; i++) {
+        __delimbench_block[i] = (0 == i % 97) ? '\r' : 'a' + i % 26;
+    }
+    for (i = 0; i < count; i++) {
+        memcpy(__delimbench_block + i * line + parameter->length, "\r\n", 2);
+    }
+
+    printf("line %d bytes, %d lines each block\n", parameter->length, count);
+    printf("splitter\tlines/s\t\tcpu(ns)/line\n");
+    do {
+        status = delimbench_run_round("memchr", parameter, nsp_false, exit);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+        status = delimbench_run_round("built-in", parameter, nsp_true, exit);
+    } while (0);
+
+    zfree(__delimbench_block);
+    __delimbench_block = NULL;
+    zfree(__delimbench_pending);
+    __delimbench_pending = NULL;
+    return status;
+}
@@ -110,6 +110,103 @@ int main(int argc, char **argv)
         proto_uninit = &tcp_uninit;
     }
 
+	/* mixed-load benchmark run all links in one Rx thread */
+	if (parameter->mixed > 0) {
+		tcp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_mixed(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* GSO/GRO benchmark run on loopback */
+	if (parameter->gso > 0) {
+		udp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_gso(parameter, &__exit);
+		udp_uninit();
+		return 0;
+	}
+
+	/* SO_REUSEPORT benchmark run on loopback with one Rx thread per CPU */
+	if (parameter->reuseport > 0) {
+		udp_init2(ifos_getnprocs());
+		signal(SIGINT, &master_sig_handler);
+		start_reuseport(parameter, &__exit);
+		udp_uninit();
+		return 0;
+	}
+
+	/* same-host transport benchmark, server and client are served by separate Rx threads */
+	if (parameter->shmbench) {
+		tcp_init2(2);
+		signal(SIGINT, &master_sig_handler);
+		start_shmbench(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* allocation benchmark run each mode in a child process, the library are initialized by children */
+	if (parameter->allocbench) {
+		signal(SIGINT, &master_sig_handler);
+		start_allocbench(parameter, &__exit);
+		return 0;
+	}
+
+	/* accept benchmark, the listener and accepted links are served by one Rx thread */
+	if (parameter->acceptbench > 0) {
+		tcp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_acceptbench(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* contended writer benchmark, the writers share one link which drained by the wpool thread */
+	if (parameter->writebench > 0) {
+		tcp_init2(2);
+		signal(SIGINT, &master_sig_handler);
+		start_writebench(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* framing benchmark, the receiving link are served by one Rx thread */
+	if (parameter->framebench) {
+		tcp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_framebench(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* delimiter benchmark, the receiving link are served by one Rx thread */
+	if (parameter->delimbench) {
+		tcp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_delimbench(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* load generator, the links and the echo server are served by [-T] Rx threads */
+	if (parameter->load > 0) {
+		tcp_init2(parameter->threads);
+		signal(SIGINT, &master_sig_handler);
+		start_loadgen(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
+	/* replay of capture file, the replaying links and the sink server are served by one Rx thread */
+	if (parameter->replay[0]) {
+		tcp_init2(1);
+		signal(SIGINT, &master_sig_handler);
+		start_replay(parameter, &__exit);
+		tcp_uninit();
+		return 0;
+	}
+
     proto_init(4);
 	if (parameter->type == 's') {
 		signal(SIGINT, &master_sig_handler);
@@ -9,6 +9,19 @@
 
 extern nsp_status_t start_server(const struct argument *parameter, lwp_event_t *exit);
 extern nsp_status_t start_client(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_mixed(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_gso(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_reuseport(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_shmbench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_allocbench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_acceptbench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_writebench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_framebench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_delimbench(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_loadgen(const struct argument *parameter, lwp_event_t *exit);
+extern nsp_status_t start_replay(const struct argument *parameter, lwp_event_t *exit);
+
+extern uint64_t framebench_thread_cputime(int tid);
 
 extern void display(HTCPLINK link, const unsigned char *data, int size);
 
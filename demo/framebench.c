@@ -0,0 +1,194 @@
+#include "demo.h"
+#include "tst.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <unistd.h>
+
+/* framing benchmark, the client send a stream of packets in blocks of 64KB, the receiver parse it with the callbacks of
+ *  stream template first, then with the built-in framing which describe the same protocol head(nsp__tst_head_t).
+ *  packets/s parsed by receiver and CPU time of the receiving thread for each packet are reported.
+ *  the block are built once and written with LINKATTR_TCP_NO_BUILD, so the cost of sender is same in both rounds.
+ */
+
+#define FRAMEBENCH_ROUND_SECONDS    (3)
+#define FRAMEBENCH_BLOCK_SIZE       (0x10000)
+
+static uint64_t __framebench_rx = 0;
+static int __framebench_rxtid = 0;
+static int __framebench_stop = 0;
+static HTCPLINK __framebench_client = INVALID_HTCPLINK;
+static unsigned char *__framebench_block = NULL;
+static int __framebench_size = 0;
+
+static void STDCALL framebench_server_callback(const struct nis_event *event, const void *data)
+{
+    if (EVT_RECEIVEDATA == event->Event) {
+        if (0 == __atomic_load_n(&__framebench_rxtid, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&__framebench_rxtid, (int)ifos_gettid(), __ATOMIC_RELEASE);
+        }
+        atom_addone(&__framebench_rx);
+    }
+}
+
+static void STDCALL framebench_client_callback(const struct nis_event *event, const void *data)
+{
+    ;
+}
+
+/* CPU time of thread @tid in microseconds, utime and stime are the 14th and 15th field of stat */
+uint64_t framebench_thread_cputime(int tid)
+{
+    char path[64], stat[1024], *cursor;
+    int fd, n, i;
+    unsigned long long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    n = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    stat[n] = 0;
+
+    /* the command name may contain blanks, count the fields after it */
+    cursor = strrchr(stat, ')');
+    for (i = 0; cursor && i < 12; i++) {
+        cursor = strchr(cursor + 1, ' ');
+    }
+    if (!cursor || 2 != sscanf(cursor, "%llu %llu", &utime, &stime)) {
+        return 0;
+    }
+
+    return (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static void *framebench_sender_proc(void *p)
+{
+    nsp_status_t status;
+
+    while (!__atomic_load_n(&__framebench_stop, __ATOMIC_ACQUIRE)) {
+        status = tcp_write(__framebench_client, __framebench_block, __framebench_size, NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            lwp_delay(100);
+        } else if (!NSP_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static nsp_status_t framebench_run_round(const char *name, const struct argument *parameter, const nis_frame_template_t *frame,
+    lwp_event_t *exit)
+{
+    HTCPLINK server;
+    lwp_t sender;
+    uint64_t begin, elapse, cpu, rx;
+    nsp_status_t status;
+    int i, tid;
+
+    server = tcp_create2(&framebench_server_callback, "127.0.0.1", parameter->port, frame ? NULL : gettst());
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    status = NSP_STATUS_FATAL;
+    __framebench_client = INVALID_HTCPLINK;
+    __atomic_store_n(&__framebench_rxtid, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&__framebench_stop, 0, __ATOMIC_RELEASE);
+    do {
+        if (frame && nis_cntl(server, NI_SETFRAME, frame) < 0) {
+            break;
+        }
+        nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+        if (!NSP_SUCCESS(tcp_listen(server, 0))) {
+            break;
+        }
+
+        /* the protocol heads are already in block */
+        __framebench_client = tcp_create(&framebench_client_callback, NULL, 0);
+        if (INVALID_HTCPLINK == __framebench_client || !NSP_SUCCESS(tcp_connect(__framebench_client, "127.0.0.1", parameter->port))) {
+            break;
+        }
+        nis_cntl(__framebench_client, NI_SETATTR, nis_cntl(__framebench_client, NI_GETATTR) | LINKATTR_TCP_NO_BUILD);
+
+        lwp_create(&sender, 0, &framebench_sender_proc, NULL);
+
+        /* the receiving thread are known after the first packet arrived */
+        for (i = 0; i < 1000 && 0 == (tid = __atomic_load_n(&__framebench_rxtid, __ATOMIC_ACQUIRE)); i++) {
+            lwp_delay(1000);
+        }
+
+        rx = atom_get64(&__framebench_rx);
+        cpu = framebench_thread_cputime(tid);
+        begin = clock_monotonic();
+        status = lwp_event_wait(exit, FRAMEBENCH_ROUND_SECONDS * 1000);
+        rx = atom_get64(&__framebench_rx) - rx;
+        cpu = framebench_thread_cputime(tid) - cpu;
+        elapse = clock_monotonic() - begin;
+
+        __atomic_store_n(&__framebench_stop, 1, __ATOMIC_RELEASE);
+        lwp_join(&sender, NULL);
+
+        if (posix__makeerror(ETIMEDOUT) != status || 0 == tid) {
+            status = NSP_STATUS_FATAL;
+            break;
+        }
+
+        printf("%s\t%.0f\t\t%.1f\n", name, (double)rx * 10000000 / elapse, (rx > 0) ? (double)cpu * 1000 / rx : 0.0);
+        status = NSP_STATUS_SUCCESSFUL;
+    } while (0);
+
+    if (INVALID_HTCPLINK != __framebench_client) {
+        tcp_destroy(__framebench_client);
+        __framebench_client = INVALID_HTCPLINK;
+    }
+    tcp_destroy(server);
+    return status;
+}
+
+nsp_status_t start_framebench(const struct argument *parameter, lwp_event_t *exit)
+{
+    static const nis_frame_template_t frame = { sizeof(nsp__tst_head_t), offsetof(nsp__tst_head_t, cb_), sizeof(uint32_t), 0 };
+    nsp_status_t status;
+    int packet, count, i;
+
+    packet = parameter->length + (int)sizeof(nsp__tst_head_t);
+    if (parameter->length <= 0 || packet > FRAMEBENCH_BLOCK_SIZE) {
+        printf("data length must between 1 and %d in frame benchmark\n", FRAMEBENCH_BLOCK_SIZE - (int)sizeof(nsp__tst_head_t));
+        return posix__makeerror(EINVAL);
+    }
+
+    /* the block are filled with whole packets */
+    count = FRAMEBENCH_BLOCK_SIZE / packet;
+    __framebench_size = count * packet;
+    __framebench_block = (unsigned char *)ztrycalloc(__framebench_size);
+    if (!__framebench_block) {
+        return posix__makeerror(ENOMEM);
+    }
+    for (i = 0; i < count; i++) {
+        nsp__tst_builder(__framebench_block + i * packet, parameter->length);
+    }
+
+    printf("packet %d bytes, %d packets each block\n", parameter->length, count);
+    printf("template\tpackets/s\tcpu(ns)/packet\n");
+    do {
+        status = framebench_run_round("callback", parameter, NULL, exit);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+        status = framebench_run_round("built-in", parameter, &frame, exit);
+    } while (0);
+
+    zfree(__framebench_block);
+    __framebench_block = NULL;
+    return status;
+}
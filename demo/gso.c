@@ -0,0 +1,180 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <sys/socket.h>     /* SO_RCVBUF */
+
+/* UDP segmentation/receive offload benchmark:
+ *  a sender thread push datagrams of @length bytes to a receiver link on loopback as fast as it can, in three rounds:
+ *  1. plain, one @udp_write(sendmsg(2)) per datagram
+ *  2. gso, @gso datagrams per @udp_write_gso call
+ *  3. gso+gro, same as 2 but receiver coalesce datagrams by NI_SETUDPGRO
+ *  every round run 3 seconds, the datagrams and bytes arrive at receiver callback are reported.
+ */
+
+#define GSO_ROUND_SECONDS       (3)
+
+static uint64_t __gso_rx_bytes = 0;
+static uint64_t __gso_rx_datagrams = 0;
+static uint64_t __gso_rx_callbacks = 0;
+static int __gso_stop = 0;
+
+struct gso_round {
+    const char *name;
+    HUDPLINK sender;
+    const char *host;
+    uint16_t port;
+    int length;
+    int segments;
+    uint64_t tx_calls;
+};
+
+static void STDCALL gso_receiver_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_udp_data *udpdata;
+
+    udpdata = (struct nis_udp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    atom_increase(&__gso_rx_bytes, udpdata->e.Packet.Size);
+    if (udpdata->e.Packet.Segment > 0) {
+        atom_increase(&__gso_rx_datagrams, (udpdata->e.Packet.Size + udpdata->e.Packet.Segment - 1) / udpdata->e.Packet.Segment);
+    }
+    atom_addone(&__gso_rx_callbacks);
+}
+
+static void *gso_sender_proc(void *p)
+{
+    struct gso_round *round;
+    unsigned char *packet;
+    unsigned int size;
+    nsp_status_t status;
+
+    round = (struct gso_round *)p;
+    size = round->length * round->segments;
+    packet = (unsigned char *)zmalloc(size);
+    memset(packet, 'G', size);
+
+    while (!__atomic_load_n(&__gso_stop, __ATOMIC_ACQUIRE)) {
+        if (round->segments > 1) {
+            status = udp_write_gso(round->sender, packet, size, round->length, round->host, round->port, NULL);
+        } else {
+            status = udp_write(round->sender, packet, size, round->host, round->port, NULL);
+        }
+        if (!NSP_SUCCESS(status)) {
+            if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY) || NSP_FAILED_AND_ERROR_EQUAL(status, ENOBUFS)) {
+                continue;
+            }
+            printf("%s: write failed, error:%ld\n", round->name, status);
+            break;
+        }
+        round->tx_calls++;
+    }
+
+    zfree(packet);
+    return NULL;
+}
+
+static nsp_status_t gso_run_round(struct gso_round *round, lwp_event_t *exit)
+{
+    lwp_t sender_lwp;
+    uint64_t begin, elapse;
+    uint64_t bytes, datagrams, callbacks;
+
+    atom_set64(&__gso_rx_bytes, 0);
+    atom_set64(&__gso_rx_datagrams, 0);
+    atom_set64(&__gso_rx_callbacks, 0);
+    __atomic_store_n(&__gso_stop, 0, __ATOMIC_RELEASE);
+    round->tx_calls = 0;
+
+    begin = clock_monotonic();
+    lwp_create(&sender_lwp, 0, &gso_sender_proc, round);
+    /* SIGINT break the benchmark */
+    if (posix__makeerror(ETIMEDOUT) != lwp_event_wait(exit, GSO_ROUND_SECONDS * 1000)) {
+        __atomic_store_n(&__gso_stop, 1, __ATOMIC_RELEASE);
+        lwp_join(&sender_lwp, NULL);
+        return NSP_STATUS_FATAL;
+    }
+    __atomic_store_n(&__gso_stop, 1, __ATOMIC_RELEASE);
+    lwp_join(&sender_lwp, NULL);
+    /* let the receiver drain the socket */
+    lwp_delay(100000);
+
+    elapse = clock_monotonic() - begin;
+    bytes = atom_get64(&__gso_rx_bytes);
+    datagrams = atom_get64(&__gso_rx_datagrams);
+    callbacks = atom_get64(&__gso_rx_callbacks);
+    printf("%s\t\t%.0f\t\t%.0f\t\t%.0f\t\t%.2f\n", round->name,
+        (double)round->tx_calls * 10000000 / elapse, (double)datagrams * 10000000 / elapse,
+        (double)callbacks * 10000000 / elapse, (double)bytes * 10000000 / elapse / 1048576);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t start_gso(const struct argument *parameter, lwp_event_t *exit)
+{
+    HUDPLINK receiver;
+    struct gso_round round;
+    const char *host;
+    int bufsize;
+    int segments;
+
+    if (parameter->length <= 0 || parameter->length > MAX_UDP_UNIT) {
+        printf("data length must between 1 and %d in GSO benchmark\n", MAX_UDP_UNIT);
+        return posix__makeerror(EINVAL);
+    }
+
+    host = (0 == strcmp(parameter->shost, "0.0.0.0")) ? "127.0.0.1" : parameter->shost;
+    receiver = udp_create(&gso_receiver_callback, host, parameter->port, UDP_FLAG_NONE);
+    if (INVALID_HUDPLINK == receiver) {
+        return NSP_STATUS_FATAL;
+    }
+    nis_cntl(receiver, NI_SETATTR, nis_cntl(receiver, NI_GETATTR) | LINKATTR_NONBLOCK);
+    bufsize = 0x800000;
+    udp_setopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char *)&bufsize, sizeof(bufsize));
+
+    memset(&round, 0, sizeof(round));
+    round.sender = udp_create(NULL, NULL, 0, UDP_FLAG_NONE);
+    if (INVALID_HUDPLINK == round.sender) {
+        udp_destroy(receiver);
+        return NSP_STATUS_FATAL;
+    }
+    round.host = host;
+    round.port = parameter->port;
+    round.length = parameter->length;
+    segments = (parameter->gso > MAX_UDP_GSO_SEGMENTS) ? MAX_UDP_GSO_SEGMENTS : parameter->gso;
+    if (segments * parameter->length > MAX_UDP_GSO_SIZE) {
+        segments = MAX_UDP_GSO_SIZE / parameter->length;
+    }
+
+    printf("datagram %d bytes, %d segments per GSO write\n", round.length, segments);
+    printf("mode\t\twrite/s\t\tdatagram/s\tcallback/s\tMB/s\n");
+    do {
+        round.name = "plain";
+        round.segments = 1;
+        if (!NSP_SUCCESS(gso_run_round(&round, exit))) {
+            break;
+        }
+
+        round.name = "gso";
+        round.segments = segments;
+        if (!NSP_SUCCESS(gso_run_round(&round, exit))) {
+            break;
+        }
+
+        if (!NSP_SUCCESS(nis_cntl(receiver, NI_SETUDPGRO, 1))) {
+            printf("UDP_GRO are not supported by kernel\n");
+            break;
+        }
+        round.name = "gso+gro";
+        gso_run_round(&round, exit);
+    } while (0);
+
+    udp_destroy(round.sender);
+    udp_destroy(receiver);
+    return NSP_STATUS_SUCCESSFUL;
+}
@@ -0,0 +1,432 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+
+#include <time.h>
+#include <sched.h>
+
+/* load generator, [connections] links are opened across [-T] threads and keep [-d] requests in flight each,
+ *  every request of [-l] bytes is answered by one response, the round trip time of each request are recorded.
+ *  closed-loop mode(the default) send the next request from the callback of response,
+ *  fixed-rate mode([-R] requests/s in total) send on schedule, a request held back by the full pipeline is still timed from
+ *  it's scheduled moment, so a stalled server are not hidden by the generator waiting for it(coordinated omission).
+ *  the echo server are in this process unless [-c] specified, in that case the target is the server started by "nstest -s -l [-l]".
+ *  "-s ipc:/path" run over AF_UNIX socket, otherwise over TCP at [-s]:[-p], loopback by default.
+ *  the summary are printed in JSON after [-S] seconds.
+ *  [-K] stamp the responses in kernel(LINKATTR_RX_TIMESTAMP), the time from kernel to callback are reported as "rx_queue_us",
+ *  it's the part of round trip spent in socket buffer and the Rx thread of generator.
+ */
+
+#define LOADGEN_MAXIMUM_CONNECTIONS     (0x10000)
+#define LOADGEN_MAXIMUM_THREADS         (256)
+#define LOADGEN_MAXIMUM_DEPTH           (0x1000)
+#define LOADGEN_MAXIMUM_LENGTH          (0x100000)
+
+/* log-linear histogram of round trip time in nanoseconds, each power of 2 split into 32 buckets, about 3% precision */
+#define LOADGEN_SUB_BITS                (5)
+#define LOADGEN_BUCKETS                 (64 << LOADGEN_SUB_BITS)
+
+struct loadgen_conn {
+    HTCPLINK link;
+    lwp_mutex_t lock;
+    uint64_t *stamps;   /* the scheduled time of requests in flight, ring of [-d] */
+    int head;
+    int count;
+    uint64_t next;      /* the scheduled time of next request, fixed-rate only, visit by it's thread */
+};
+
+static struct loadgen_conn *__loadgen_conns = NULL;
+static int __loadgen_nconns = 0;
+static int __loadgen_depth = 0;
+static unsigned char *__loadgen_packet = NULL;
+static int __loadgen_length = 0;
+static int __loadgen_rate = 0;
+static int __loadgen_stop = 0;
+
+struct loadgen_histogram {
+    uint64_t buckets[LOADGEN_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t maximum;
+};
+
+static struct loadgen_histogram __loadgen_rtt;
+static struct loadgen_histogram __loadgen_rxq;     /* kernel receive to callback of responses, [-K] only */
+static uint64_t __loadgen_requests = 0;
+static uint64_t __loadgen_errors = 0;
+
+struct loadgen_worker {
+    lwp_t thread;
+    int first;  /* connections of this worker are [first, first + count) */
+    int count;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t interval;
+};
+
+static uint64_t loadgen_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int loadgen_bucket(uint64_t ns)
+{
+    int shift;
+
+    if (ns < (1 << LOADGEN_SUB_BITS)) {
+        return (int)ns;
+    }
+    shift = 63 - __builtin_clzll(ns) - LOADGEN_SUB_BITS;
+    return ((shift + 1) << LOADGEN_SUB_BITS) + (int)((ns >> shift) & ((1 << LOADGEN_SUB_BITS) - 1));
+}
+
+/* the middle of bucket @index */
+static uint64_t loadgen_bucket_value(int index)
+{
+    int shift;
+
+    if (index < (1 << LOADGEN_SUB_BITS)) {
+        return index;
+    }
+    shift = (index >> LOADGEN_SUB_BITS) - 1;
+    return ((uint64_t)((1 << LOADGEN_SUB_BITS) | (index & ((1 << LOADGEN_SUB_BITS) - 1))) << shift) + ((1ULL << shift) >> 1);
+}
+
+static void loadgen_record(struct loadgen_histogram *histogram, uint64_t ns)
+{
+    uint64_t maximum;
+
+    __atomic_add_fetch(&histogram->buckets[loadgen_bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->total, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    maximum = __atomic_load_n(&histogram->maximum, __ATOMIC_RELAXED);
+    while (ns > maximum &&
+        !__atomic_compare_exchange_n(&histogram->maximum, &maximum, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ;
+    }
+}
+
+static uint64_t loadgen_percentile(const struct loadgen_histogram *histogram, uint64_t count, double ratio)
+{
+    uint64_t rank, sum;
+    int i;
+
+    rank = (uint64_t)(count * ratio);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0, sum = 0; i < LOADGEN_BUCKETS; i++) {
+        sum += histogram->buckets[i];
+        if (sum >= rank) {
+            return loadgen_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+/* the request are written under the lock of connection, so it's response always find it's stamp in ring */
+static void loadgen_send_locked(struct loadgen_conn *conn, uint64_t scheduled)
+{
+    nsp_status_t status;
+
+    conn->stamps[(conn->head + conn->count) % __loadgen_depth] = scheduled;
+    conn->count++;
+    status = tcp_write(conn->link, __loadgen_packet, __loadgen_length, NULL);
+    if (NSP_SUCCESS(status)) {
+        atom_addone(&__loadgen_requests);
+    } else {
+        conn->count--;
+        atom_addone(&__loadgen_errors);
+    }
+}
+
+static void STDCALL loadgen_client_callback(const struct nis_event *event, const void *data)
+{
+    struct loadgen_conn *conn;
+    uint64_t now, scheduled, timestamp;
+    struct timespec ts;
+
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    conn = NULL;
+    if (nis_cntl(event->Ln.Tcp.Link, NI_GETCTX, &conn) < 0 || !conn) {
+        return;
+    }
+
+    /* the kernel stamp is wall clock */
+    timestamp = ((const struct nis_tcp_data *)data)->e.Packet.Timestamp;
+    if (timestamp > 0 && !__atomic_load_n(&__loadgen_stop, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        loadgen_record(&__loadgen_rxq, (now > timestamp) ? now - timestamp : 0);
+    }
+
+    now = loadgen_now();
+    lwp_mutex_lock(&conn->lock);
+    if (conn->count > 0) {
+        scheduled = conn->stamps[conn->head];
+        conn->head = (conn->head + 1) % __loadgen_depth;
+        conn->count--;
+        if (!__atomic_load_n(&__loadgen_stop, __ATOMIC_ACQUIRE)) {
+            loadgen_record(&__loadgen_rtt, now - scheduled);
+            /* closed-loop, the next request replace the answered one at once */
+            if (0 == __loadgen_rate) {
+                loadgen_send_locked(conn, now);
+            }
+        }
+    }
+    lwp_mutex_unlock(&conn->lock);
+}
+
+/* one response per request, the content is not concerned */
+static void STDCALL loadgen_server_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA == event->Event) {
+        tcp_write(event->Ln.Tcp.Link, tcpdata->e.Packet.Data, tcpdata->e.Packet.Size, NULL);
+    }
+}
+
+static void *loadgen_closed_proc(void *p)
+{
+    struct loadgen_worker *worker;
+    struct loadgen_conn *conn;
+    uint64_t now;
+    int i, j;
+
+    worker = (struct loadgen_worker *)p;
+    for (i = worker->first; i < worker->first + worker->count; i++) {
+        conn = &__loadgen_conns[i];
+        lwp_mutex_lock(&conn->lock);
+        for (j = 0; j < __loadgen_depth && conn->count < __loadgen_depth; j++) {
+            now = loadgen_now();
+            loadgen_send_locked(conn, now);
+        }
+        lwp_mutex_unlock(&conn->lock);
+    }
+
+    return NULL;
+}
+
+static void *loadgen_rate_proc(void *p)
+{
+    struct loadgen_worker *worker;
+    struct loadgen_conn *conn;
+    uint64_t now, earliest;
+    int i;
+
+    worker = (struct loadgen_worker *)p;
+    for (i = 0; i < worker->count; i++) {
+        /* the connections are staggered across the interval */
+        __loadgen_conns[worker->first + i].next = worker->begin + worker->interval * (worker->first + i) / __loadgen_nconns;
+    }
+
+    while (!__atomic_load_n(&__loadgen_stop, __ATOMIC_ACQUIRE)) {
+        now = loadgen_now();
+        if (now >= worker->end) {
+            break;
+        }
+
+        earliest = worker->end;
+        for (i = worker->first; i < worker->first + worker->count; i++) {
+            conn = &__loadgen_conns[i];
+            lwp_mutex_lock(&conn->lock);
+            /* the requests fall behind schedule are sent as soon as the pipeline allowed, with their scheduled time */
+            while (conn->next <= now && conn->count < __loadgen_depth) {
+                loadgen_send_locked(conn, conn->next);
+                conn->next += worker->interval;
+            }
+            lwp_mutex_unlock(&conn->lock);
+            if (conn->next < earliest) {
+                earliest = conn->next;
+            }
+        }
+
+        /* the pipeline is full when the earliest one already due */
+        now = loadgen_now();
+        if (earliest > now + 1000) {
+            lwp_delay((earliest - now) / 1000);
+        } else {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static nsp_status_t loadgen_connect(const struct argument *parameter, const char *target, int ipc)
+{
+    struct loadgen_conn *conn;
+    int i;
+
+    for (i = 0; i < __loadgen_nconns; i++) {
+        conn = &__loadgen_conns[i];
+        conn->link = tcp_create2(&loadgen_client_callback, ipc ? "IPC:" : NULL, 0, gettst());
+        if (INVALID_HTCPLINK == conn->link) {
+            return NSP_STATUS_FATAL;
+        }
+        nis_cntl(conn->link, NI_SETCTX, conn);
+        if (parameter->stamp) {
+            nis_cntl(conn->link, NI_SETATTR, nis_cntl(conn->link, NI_GETATTR) | LINKATTR_RX_TIMESTAMP);
+        }
+        if (!NSP_SUCCESS(tcp_connect(conn->link, target, ipc ? 0 : parameter->port))) {
+            printf("failed connect to %s\n", target);
+            return NSP_STATUS_FATAL;
+        }
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* "name":{"mean":.., "p50":.., "p99":.., "p999":.., "max":..} in microseconds */
+static void loadgen_print_histogram(const char *name, const struct loadgen_histogram *histogram)
+{
+    uint64_t count;
+
+    count = atom_get64(&histogram->count);
+    printf("\"%s\":{\"mean\":%.2f,\"p50\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f}", name,
+        (count > 0) ? (double)histogram->total / count / 1000 : 0.0,
+        (double)loadgen_percentile(histogram, count, 0.5) / 1000, (double)loadgen_percentile(histogram, count, 0.99) / 1000,
+        (double)loadgen_percentile(histogram, count, 0.999) / 1000, (double)histogram->maximum / 1000);
+}
+
+static void loadgen_summary(const struct argument *parameter, const char *target, int ipc, uint64_t elapse)
+{
+    uint64_t responses;
+
+    responses = atom_get64(&__loadgen_rtt.count);
+    printf("{\"transport\":\"%s\",\"target\":\"%s\",\"connections\":%d,\"threads\":%d,\"depth\":%d,"
+        "\"mode\":\"%s\",\"rate\":%d,\"length\":%d,\"seconds\":%.3f,"
+        "\"requests\":%llu,\"responses\":%llu,\"errors\":%llu,\"throughput\":%.1f,\"bytes_per_second\":%.1f,",
+        ipc ? "ipc" : "tcp", target, __loadgen_nconns, parameter->threads, __loadgen_depth,
+        (parameter->rate > 0) ? "fixed-rate" : "closed-loop", parameter->rate, __loadgen_length, (double)elapse / 1000000000,
+        (unsigned long long)atom_get64(&__loadgen_requests), (unsigned long long)responses,
+        (unsigned long long)atom_get64(&__loadgen_errors),
+        (double)responses * 1000000000 / elapse, (double)responses * __loadgen_length * 2 * 1000000000 / elapse);
+    loadgen_print_histogram("latency_us", &__loadgen_rtt);
+    if (parameter->stamp) {
+        printf(",\"rx_stamped\":%llu,", (unsigned long long)atom_get64(&__loadgen_rxq.count));
+        loadgen_print_histogram("rx_queue_us", &__loadgen_rxq);
+    }
+    printf("}\n");
+}
+
+nsp_status_t start_loadgen(const struct argument *parameter, lwp_event_t *exit)
+{
+    struct loadgen_worker workers[LOADGEN_MAXIMUM_THREADS];
+    HTCPLINK server;
+    char target[255];
+    uint64_t begin, elapse;
+    nsp_status_t status;
+    int i, ipc, nthreads, started;
+
+    if (parameter->load > LOADGEN_MAXIMUM_CONNECTIONS || parameter->threads <= 0 || parameter->threads > LOADGEN_MAXIMUM_THREADS ||
+        parameter->depth <= 0 || parameter->depth > LOADGEN_MAXIMUM_DEPTH || parameter->rate < 0 || parameter->seconds <= 0 ||
+        parameter->length <= 0 || parameter->length > LOADGEN_MAXIMUM_LENGTH)
+    {
+        printf("connections must between 1 and %d, threads between 1 and %d, depth between 1 and %d, data length between 1 and %d\n",
+            LOADGEN_MAXIMUM_CONNECTIONS, LOADGEN_MAXIMUM_THREADS, LOADGEN_MAXIMUM_DEPTH, LOADGEN_MAXIMUM_LENGTH);
+        return posix__makeerror(EINVAL);
+    }
+
+    ipc = (0 == strncasecmp(parameter->shost, "IPC:", 4));
+    crt_strcpy(target, sizeof(target), (ipc || 0 != strcmp(parameter->shost, "0.0.0.0")) ? parameter->shost : "127.0.0.1");
+
+    __loadgen_nconns = parameter->load;
+    __loadgen_depth = parameter->depth;
+    __loadgen_length = parameter->length;
+    __loadgen_rate = parameter->rate;
+    nthreads = (parameter->threads < __loadgen_nconns) ? parameter->threads : __loadgen_nconns;
+    __loadgen_conns = (struct loadgen_conn *)ztrycalloc(__loadgen_nconns * sizeof(struct loadgen_conn));
+    __loadgen_packet = (unsigned char *)ztrycalloc(__loadgen_length);
+    if (!__loadgen_conns || !__loadgen_packet) {
+        zfree(__loadgen_conns);
+        zfree(__loadgen_packet);
+        return posix__makeerror(ENOMEM);
+    }
+    for (i = 0; i < __loadgen_nconns; i++) {
+        lwp_mutex_init(&__loadgen_conns[i].lock, 0);
+        __loadgen_conns[i].link = INVALID_HTCPLINK;
+        __loadgen_conns[i].stamps = (uint64_t *)ztrycalloc(__loadgen_depth * sizeof(uint64_t));
+    }
+
+    server = INVALID_HTCPLINK;
+    status = NSP_STATUS_FATAL;
+    started = 0;
+    do {
+        /* the echo server in this process, the IPC file are removed by library when it closed */
+        if ('c' != parameter->type) {
+            server = tcp_create2(&loadgen_server_callback, target, ipc ? 0 : parameter->port, gettst());
+            if (INVALID_HTCPLINK == server) {
+                break;
+            }
+            nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+            if (!NSP_SUCCESS(tcp_listen(server, 0))) {
+                break;
+            }
+        }
+
+        for (i = 0; i < __loadgen_nconns; i++) {
+            if (!__loadgen_conns[i].stamps) {
+                break;
+            }
+        }
+        if (i < __loadgen_nconns || !NSP_SUCCESS(loadgen_connect(parameter, target, ipc))) {
+            break;
+        }
+
+        /* connections are split into contiguous ranges, one range per thread */
+        __atomic_store_n(&__loadgen_stop, 0, __ATOMIC_RELEASE);
+        begin = loadgen_now();
+        for (started = 0; started < nthreads; started++) {
+            workers[started].first = __loadgen_nconns * started / nthreads;
+            workers[started].count = __loadgen_nconns * (started + 1) / nthreads - workers[started].first;
+            workers[started].begin = begin;
+            workers[started].end = begin + (uint64_t)parameter->seconds * 1000000000;
+            workers[started].interval = (parameter->rate > 0) ? (uint64_t)1000000000 * __loadgen_nconns / parameter->rate : 0;
+            lwp_create(&workers[started].thread, 0, (parameter->rate > 0) ? &loadgen_rate_proc : &loadgen_closed_proc, &workers[started]);
+        }
+
+        status = lwp_event_wait(exit, parameter->seconds * 1000);
+        __atomic_store_n(&__loadgen_stop, 1, __ATOMIC_RELEASE);
+        elapse = loadgen_now() - begin;
+        for (i = 0; i < started; i++) {
+            lwp_join(&workers[i].thread, NULL);
+        }
+
+        loadgen_summary(parameter, target, ipc, elapse);
+        status = (posix__makeerror(ETIMEDOUT) == status) ? NSP_STATUS_SUCCESSFUL : status;
+    } while (0);
+
+    for (i = 0; i < __loadgen_nconns; i++) {
+        if (INVALID_HTCPLINK != __loadgen_conns[i].link) {
+            tcp_destroy(__loadgen_conns[i].link);
+        }
+    }
+    if (INVALID_HTCPLINK != server) {
+        tcp_destroy(server);
+    }
+
+    /* the callbacks may still running on links which are closing */
+    lwp_delay(100000);
+    for (i = 0; i < __loadgen_nconns; i++) {
+        if (__loadgen_conns[i].stamps) {
+            zfree(__loadgen_conns[i].stamps);
+        }
+        lwp_mutex_uninit(&__loadgen_conns[i].lock);
+    }
+    zfree(__loadgen_conns);
+    zfree(__loadgen_packet);
+    __loadgen_conns = NULL;
+    __loadgen_packet = NULL;
+    return status;
+}
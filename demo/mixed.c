@@ -0,0 +1,228 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+/* mixed-load benchmark:
+ *  one fire-hose link keep pushing packets of @length bytes to server as fast as it can,
+ *  at the same time, @mixed small links play ping-pong with server, each round trip time are sampled.
+ *  server and all clients are in this process and share the same Rx thread, so the tail latency of small links
+ *  reflect how fair the Rx thread serve the links when one of them is extremely busy.
+ */
+
+#define MIXED_MAGIC_SMALL       ('S')
+#define MIXED_MAGIC_HOSE        ('H')
+#define MIXED_MAXIMUM_SAMPLES   (0x10000)
+
+#pragma pack(push, 1)
+struct mixed_ping {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t timestamp;
+};
+#pragma pack(pop)
+
+static HTCPLINK __hose = INVALID_HTCPLINK;
+static int __hose_stop = 0;
+static uint64_t __hose_rx = 0;
+
+/* round trip samples of small links in 100ns, protected by @__samples_lock */
+static lwp_mutex_t __samples_lock;
+static uint64_t __samples[MIXED_MAXIMUM_SAMPLES];
+static int __samples_count = 0;
+
+static void mixed_sample(uint64_t rtt)
+{
+    lwp_mutex_lock(&__samples_lock);
+    if (__samples_count < MIXED_MAXIMUM_SAMPLES) {
+        __samples[__samples_count++] = rtt;
+    }
+    lwp_mutex_unlock(&__samples_lock);
+}
+
+static int mixed_compare(const void *left, const void *right)
+{
+    uint64_t l, r;
+
+    l = *(const uint64_t *)left;
+    r = *(const uint64_t *)right;
+    return (l > r) - (l < r);
+}
+
+static nsp_status_t mixed_ping(HTCPLINK link)
+{
+    struct mixed_ping ping;
+
+    ping.magic = MIXED_MAGIC_SMALL;
+    ping.reserved = 0;
+    ping.timestamp = clock_monotonic();
+    return tcp_write(link, &ping, sizeof(ping), NULL);
+}
+
+static void STDCALL mixed_server_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+    const struct mixed_ping *ping;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    ping = (const struct mixed_ping *)tcpdata->e.Packet.Data;
+    if (tcpdata->e.Packet.Size == sizeof(*ping) && MIXED_MAGIC_SMALL == ping->magic) {
+        tcp_write(event->Ln.Tcp.Link, ping, sizeof(*ping), NULL);
+    } else {
+        atom_increase(&__hose_rx, tcpdata->e.Packet.Size);
+    }
+}
+
+static void STDCALL mixed_client_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+    const struct mixed_ping *ping;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    ping = (const struct mixed_ping *)tcpdata->e.Packet.Data;
+    if (tcpdata->e.Packet.Size == sizeof(*ping) && MIXED_MAGIC_SMALL == ping->magic) {
+        mixed_sample(clock_monotonic() - ping->timestamp);
+        mixed_ping(event->Ln.Tcp.Link);
+    }
+}
+
+static void *mixed_hose_proc(void *p)
+{
+    const struct argument *parameter;
+    unsigned char *packet;
+    nsp_status_t status;
+
+    parameter = (const struct argument *)p;
+    packet = (unsigned char *)zmalloc(parameter->length);
+    memset(packet, MIXED_MAGIC_HOSE, parameter->length);
+
+    while (!__atomic_load_n(&__hose_stop, __ATOMIC_ACQUIRE)) {
+        status = tcp_write(__hose, packet, parameter->length, NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            lwp_delay(100);
+            continue;
+        }
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    zfree(packet);
+    return NULL;
+}
+
+static HTCPLINK mixed_connect(const struct argument *parameter, const char *host)
+{
+    HTCPLINK link;
+
+    link = tcp_create2(&mixed_client_callback, NULL, 0, gettst());
+    if (INVALID_HTCPLINK == link) {
+        return INVALID_HTCPLINK;
+    }
+
+    if (!NSP_SUCCESS(tcp_connect(link, host, parameter->port))) {
+        tcp_destroy(link);
+        return INVALID_HTCPLINK;
+    }
+
+    return link;
+}
+
+static void mixed_report(lwp_event_t *exit)
+{
+    static uint64_t sorted[MIXED_MAXIMUM_SAMPLES];
+    int count;
+    uint64_t pre_rx, now_rx;
+
+    printf("hose(MB/s)\tsamples\tp50(us)\tp99(us)\tp999(us)\tmax(us)\n");
+    pre_rx = atom_get(&__hose_rx);
+    while( posix__makeerror(ETIMEDOUT) == lwp_event_wait(exit, 1000) ) {
+        lwp_mutex_lock(&__samples_lock);
+        count = __samples_count;
+        memcpy(sorted, __samples, count * sizeof(uint64_t));
+        __samples_count = 0;
+        lwp_mutex_unlock(&__samples_lock);
+
+        now_rx = atom_get(&__hose_rx);
+        if (count > 0) {
+            qsort(sorted, count, sizeof(uint64_t), &mixed_compare);
+            printf("%.2f\t\t%d\t%.1f\t%.1f\t%.1f\t\t%.1f\n", (double)(now_rx - pre_rx) / 1048576, count,
+                (double)sorted[count / 2] / 10, (double)sorted[count * 99 / 100] / 10,
+                (double)sorted[count * 999 / 1000] / 10, (double)sorted[count - 1] / 10);
+        } else {
+            printf("%.2f\t\t0\t-\t-\t-\t\t-\n", (double)(now_rx - pre_rx) / 1048576);
+        }
+        pre_rx = now_rx;
+    }
+}
+
+nsp_status_t start_mixed(const struct argument *parameter, lwp_event_t *exit)
+{
+    HTCPLINK server;
+    HTCPLINK *smalls;
+    const char *host;
+    lwp_t hose_lwp;
+    int attr;
+    int i;
+
+    host = (0 == strcmp(parameter->shost, "0.0.0.0")) ? "127.0.0.1" : parameter->shost;
+    lwp_mutex_init(&__samples_lock, NO);
+
+    server = tcp_create2(&mixed_server_callback, host, parameter->port, gettst());
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    /* accepted links inherit the tst and the receive budget of listener */
+    attr = nis_cntl(server, NI_GETATTR);
+    if (attr >= 0 ) {
+        nis_cntl(server, NI_SETATTR, attr | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+    }
+    if (parameter->budget >= 0) {
+        nis_cntl(server, NI_SETRXBUDGET, parameter->budget, 0);
+    }
+
+    if (!NSP_SUCCESS(tcp_listen(server, 100))) {
+        tcp_destroy(server);
+        return NSP_STATUS_FATAL;
+    }
+
+    smalls = (HTCPLINK *)zmalloc(parameter->mixed * sizeof(HTCPLINK));
+    for (i = 0; i < parameter->mixed; i++) {
+        smalls[i] = mixed_connect(parameter, host);
+        if (INVALID_HTCPLINK != smalls[i]) {
+            mixed_ping(smalls[i]);
+        }
+    }
+
+    __hose = mixed_connect(parameter, host);
+    if (INVALID_HTCPLINK != __hose) {
+        lwp_create(&hose_lwp, 0, &mixed_hose_proc, (void *)parameter);
+    }
+
+    mixed_report(exit);
+
+    if (INVALID_HTCPLINK != __hose) {
+        __atomic_store_n(&__hose_stop, 1, __ATOMIC_RELEASE);
+        lwp_join(&hose_lwp, NULL);
+        tcp_destroy(__hose);
+    }
+    for (i = 0; i < parameter->mixed; i++) {
+        if (INVALID_HTCPLINK != smalls[i]) {
+            tcp_destroy(smalls[i]);
+        }
+    }
+    zfree(smalls);
+    tcp_destroy(server);
+    return NSP_STATUS_SUCCESSFUL;
+}
@@ -0,0 +1,344 @@
+#include "demo.h"
+
+#include "zmalloc.h"
+#include "atom.h"
+
+#include <time.h>
+#include <endian.h>
+
+/* replay a capture file of NI_SETCAPTURE, the inbound frames of every captured stream are written to [-s]:[-p] through
+ *  one link per stream, spaced as they were captured and scaled by [-X], 0 write them as fast as possible.
+ *  the outbound frames are the responses of captured server, they are skipped.
+ *  the stream are rebuilt by the framing in capture head:
+ *      built-in framing    link with the same frame template
+ *      delimiter           the delimiter are appended to the user data
+ *      stream template     link with the template of demo, a foreign protocol should be captured with LINKATTR_TCP_FULLY_RECEIVE,
+ *                          so the frames include their head and are written as they are
+ *      raw                 written as they are
+ *  the frames captured with their head or delimiter(NIS_CAPTURE_HEAD) are written by LINKATTR_TCP_NO_BUILD.
+ *  the sink server in this process count the frames it received unless [-c] specified, in that case the target is a server
+ *  started by "nstest -s -m".
+ */
+
+#define REPLAY_MAXIMUM_STREAMS      (0x1000)
+#define REPLAY_MAXIMUM_FRAME        (0x4000000)
+
+struct replay_stream {
+    uint32_t stream;
+    HTCPLINK link;
+    int attr;
+};
+
+static struct replay_stream *__replay_streams = NULL;
+static int __replay_nstreams = 0;
+static uint64_t __replay_received = 0;
+static uint64_t __replay_received_bytes = 0;
+
+static uint64_t replay_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char *replay_framing_name(int framing)
+{
+    static const char *names[] = { "tst", "frame", "delimiter", "raw" };
+
+    return (framing >= 0 && framing < (int)(sizeof(names) / sizeof(names[0]))) ? names[framing] : "unknown";
+}
+
+static void STDCALL replay_client_callback(const struct nis_event *event, const void *data)
+{
+    ;
+}
+
+static void STDCALL replay_server_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA == event->Event) {
+        atom_addone(&__replay_received);
+        __atomic_add_fetch(&__replay_received_bytes, tcpdata->e.Packet.Size, __ATOMIC_RELAXED);
+    }
+}
+
+/* the link are created and set to the framing of head */
+static nsp_status_t replay_create_link(const struct nis_capture_head *head, const char *host, uint16_t port, int ipc, HTCPLINK *output)
+{
+    HTCPLINK link;
+    nsp_status_t status;
+
+    link = tcp_create2((host ? &replay_server_callback : &replay_client_callback), host ? host : (ipc ? "IPC:" : NULL),
+        host ? port : 0, (NIS_CAPTURE_FRAMING_TST == head->framing) ? gettst() : NULL);
+    if (INVALID_HTCPLINK == link) {
+        return NSP_STATUS_FATAL;
+    }
+
+    status = NSP_STATUS_SUCCESSFUL;
+    if (NIS_CAPTURE_FRAMING_FRAME == head->framing) {
+        status = nis_cntl(link, NI_SETFRAME, &head->frame);
+    } else if (NIS_CAPTURE_FRAMING_DELIMITER == head->framing && host) {
+        status = nis_cntl(link, NI_SETDELIM, head->delimiter, head->delimiter_cb);
+    }
+
+    if (!NSP_SUCCESS(status)) {
+        tcp_destroy(link);
+        return status;
+    }
+
+    *output = link;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static struct replay_stream *replay_lookup(const struct nis_capture_head *head, uint32_t stream, const char *target, uint16_t port, int ipc)
+{
+    struct replay_stream *rs;
+    int i;
+
+    for (i = 0; i < __replay_nstreams; i++) {
+        if (__replay_streams[i].stream == stream) {
+            return (INVALID_HTCPLINK == __replay_streams[i].link) ? NULL : &__replay_streams[i];
+        }
+    }
+
+    if (__replay_nstreams >= REPLAY_MAXIMUM_STREAMS) {
+        return NULL;
+    }
+
+    /* the stream which failed to connect are remembered, the frames of it are skipped */
+    rs = &__replay_streams[__replay_nstreams++];
+    rs->stream = stream;
+    rs->link = INVALID_HTCPLINK;
+    rs->attr = 0;
+    if (!NSP_SUCCESS(replay_create_link(head, NULL, 0, ipc, &rs->link))) {
+        return NULL;
+    }
+    if (!NSP_SUCCESS(tcp_connect(rs->link, target, port))) {
+        printf("failed connect to %s\n", target);
+        tcp_destroy(rs->link);
+        rs->link = INVALID_HTCPLINK;
+        return NULL;
+    }
+    rs->attr = nis_cntl(rs->link, NI_GETATTR);
+    return rs;
+}
+
+static nsp_status_t replay_read_head(FILE *fp, struct nis_capture_head *head)
+{
+    if (1 != fread(head, sizeof(*head), 1, fp) || 0 != memcmp(head->magic, NIS_CAPTURE_MAGIC, sizeof(head->magic))) {
+        return posix__makeerror(EINVAL);
+    }
+
+    head->realtime = le64toh(head->realtime);
+    head->frame.cb_ = (int)le32toh(head->frame.cb_);
+    head->frame.offset = (int)le32toh(head->frame.offset);
+    head->frame.width = (int)le32toh(head->frame.width);
+    head->frame.flags = (int)le32toh(head->frame.flags);
+    head->delimiter_cb = (int)le32toh(head->delimiter_cb);
+    head->framing = (int)le32toh(head->framing);
+
+    if (head->framing < NIS_CAPTURE_FRAMING_TST || head->framing > NIS_CAPTURE_FRAMING_RAW ||
+        head->delimiter_cb < 0 || head->delimiter_cb > NIS_MAXIMUM_DELIMITER)
+    {
+        return posix__makeerror(EINVAL);
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t start_replay(const struct argument *parameter, lwp_event_t *exit)
+{
+    FILE *fp;
+    struct nis_capture_head head;
+    struct nis_capture_record record;
+    struct replay_stream *rs;
+    HTCPLINK server;
+    char target[255];
+    unsigned char *frame;
+    int capacity, size, attr, ipc, i;
+    uint64_t first, begin, scheduled, now, lag, maximum_lag;
+    uint64_t frames, bytes, skipped, received;
+    nsp_status_t status, written;
+
+    if (parameter->speed < 0) {
+        printf("speed must not be negative\n");
+        return posix__makeerror(EINVAL);
+    }
+
+    fp = fopen(parameter->replay, "rb");
+    if (!fp) {
+        printf("failed open capture file %s\n", parameter->replay);
+        return posix__makeerror(errno);
+    }
+
+    status = replay_read_head(fp, &head);
+    if (!NSP_SUCCESS(status)) {
+        printf("%s is not a capture file\n", parameter->replay);
+        fclose(fp);
+        return status;
+    }
+
+    ipc = (0 == strncasecmp(parameter->shost, "IPC:", 4));
+    crt_strcpy(target, sizeof(target), (ipc || 0 != strcmp(parameter->shost, "0.0.0.0")) ? parameter->shost : "127.0.0.1");
+
+    __replay_streams = (struct replay_stream *)ztrycalloc(REPLAY_MAXIMUM_STREAMS * sizeof(struct replay_stream));
+    capacity = 0x10000;
+    frame = (unsigned char *)ztrymalloc(capacity);
+    if (!__replay_streams || !frame) {
+        zfree(__replay_streams);
+        zfree(frame);
+        fclose(fp);
+        return posix__makeerror(ENOMEM);
+    }
+    __replay_nstreams = 0;
+
+    server = INVALID_HTCPLINK;
+    frames = bytes = skipped = 0;
+    maximum_lag = 0;
+    first = begin = 0;
+    status = NSP_STATUS_SUCCESSFUL;
+    do {
+        /* the sink server in this process, it split the stream in the way of capture */
+        if ('c' != parameter->type) {
+            status = replay_create_link(&head, target, ipc ? 0 : parameter->port, ipc, &server);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+            nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+            status = tcp_listen(server, 0);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+        }
+
+        while (1 == fread(&record, sizeof(record), 1, fp)) {
+            record.timestamp = le64toh(record.timestamp);
+            record.stream = le32toh(record.stream);
+            record.size = le32toh(record.size);
+            record.flags = le32toh(record.flags);
+
+            size = (int)record.size;
+            if (record.size > REPLAY_MAXIMUM_FRAME) {
+                status = posix__makeerror(EINVAL);
+                break;
+            }
+
+            /* room for the delimiter appended */
+            if (size + NIS_MAXIMUM_DELIMITER > capacity) {
+                capacity = size + NIS_MAXIMUM_DELIMITER;
+                zfree(frame);
+                if (NULL == (frame = (unsigned char *)ztrymalloc(capacity))) {
+                    status = posix__makeerror(ENOMEM);
+                    break;
+                }
+            }
+            if (size > 0 && 1 != fread(frame, size, 1, fp)) {
+                status = posix__makeerror(EINVAL);
+                break;
+            }
+
+            if (record.flags & NIS_CAPTURE_OUTBOUND) {
+                skipped++;
+                continue;
+            }
+
+            rs = replay_lookup(&head, record.stream, target, ipc ? 0 : parameter->port, ipc);
+            if (!rs) {
+                skipped++;
+                continue;
+            }
+
+            /* the time line start from the first inbound frame */
+            if (0 == frames) {
+                first = record.timestamp;
+                begin = replay_now();
+            }
+            if (parameter->speed > 0) {
+                scheduled = begin + (uint64_t)((double)(record.timestamp - first) / parameter->speed);
+                now = replay_now();
+                /* @lwp_event_wait take 0 as infinite, the gap less than 2ms are slept by @lwp_delay and the last tens of
+                    microseconds are spun */
+                if (scheduled > now + 2000000) {
+                    if (NSP_SUCCESS(lwp_event_wait(exit, (int)((scheduled - now) / 1000000) - 1))) {
+                        break;
+                    }
+                    now = replay_now();
+                }
+                if (scheduled > now + 100000) {
+                    lwp_delay((scheduled - now - 100000) / 1000);
+                }
+                while ((now = replay_now()) < scheduled) {
+                    ;
+                }
+                lag = now - scheduled;
+                maximum_lag = (lag > maximum_lag) ? lag : maximum_lag;
+            }
+
+            attr = rs->attr;
+            if (record.flags & NIS_CAPTURE_HEAD) {
+                attr |= LINKATTR_TCP_NO_BUILD;
+            } else if (NIS_CAPTURE_FRAMING_DELIMITER == head.framing) {
+                memcpy(frame + size, head.delimiter, head.delimiter_cb);
+                size += head.delimiter_cb;
+            }
+            if (attr != rs->attr) {
+                nis_cntl(rs->link, NI_SETATTR, attr);
+            }
+            written = tcp_write(rs->link, frame, size, NULL);
+            if (attr != rs->attr) {
+                nis_cntl(rs->link, NI_SETATTR, rs->attr);
+            }
+
+            if (!NSP_SUCCESS(written)) {
+                skipped++;
+                continue;
+            }
+            frames++;
+            bytes += size;
+        }
+    } while (0);
+
+    now = replay_now();
+
+    /* the sink server may still behind, the raw stream are not split in the way of capture, count the bytes of it */
+    if (INVALID_HTCPLINK != server) {
+        for (i = 0; i < 50; i++) {
+            if ((NIS_CAPTURE_FRAMING_RAW == head.framing) ? (atom_get64(&__replay_received_bytes) >= bytes) :
+                (atom_get64(&__replay_received) >= frames))
+            {
+                break;
+            }
+            if (NSP_SUCCESS(lwp_event_wait(exit, 100))) {
+                break;
+            }
+        }
+    }
+    received = atom_get64(&__replay_received);
+
+    printf("{\"file\":\"%s\",\"framing\":\"%s\",\"speed\":%.3f,\"target\":\"%s\",\"streams\":%d,\"frames\":%llu,\"bytes\":%llu,"
+        "\"skipped\":%llu,\"seconds\":%.3f,\"frames_per_second\":%.1f,\"max_lag_us\":%.2f,\"received\":%llu,\"received_bytes\":%llu}\n",
+        parameter->replay, replay_framing_name(head.framing), parameter->speed, target, __replay_nstreams,
+        (unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)skipped,
+        (frames > 0) ? (double)(now - begin) / 1000000000 : 0.0,
+        (frames > 0 && now > begin) ? (double)frames * 1000000000 / (now - begin) : 0.0, (double)maximum_lag / 1000,
+        (unsigned long long)received, (unsigned long long)atom_get64(&__replay_received_bytes));
+
+    for (i = 0; i < __replay_nstreams; i++) {
+        if (INVALID_HTCPLINK != __replay_streams[i].link) {
+            tcp_destroy(__replay_streams[i].link);
+        }
+    }
+    if (INVALID_HTCPLINK != server) {
+        tcp_destroy(server);
+    }
+
+    /* the callbacks may still running on links which are closing */
+    lwp_delay(100000);
+    zfree(__replay_streams);
+    __replay_streams = NULL;
+    zfree(frame);
+    fclose(fp);
+    return status;
+}
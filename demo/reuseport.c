@@ -0,0 +1,226 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <sys/socket.h>     /* SO_RCVBUF */
+
+/* UDP SO_REUSEPORT fan-in benchmark:
+ *  @senders threads, each own a standalone UDP socket, push datagrams of @length bytes to a receiver on loopback, in two rounds:
+ *  1. single, receiver is one socket served by exactly one epoll thread
+ *  2. reuseport, receiver create with UDP_FLAG_REUSEPORT, one socket per epoll thread share the same port
+ *  every round run 3 seconds, datagrams/s arrive at receiver callback and the distribution over Rx threads are reported.
+ */
+
+#define REUSEPORT_ROUND_SECONDS     (3)
+#define REUSEPORT_MAXIMUM_THREADS   (64)
+
+struct reuseport_slot {
+    pid_t tid;
+    uint64_t datagrams;
+};
+
+static struct reuseport_slot __reuseport_slots[REUSEPORT_MAXIMUM_THREADS];
+static int __reuseport_nslots = 0;
+static int __reuseport_stop = 0;
+static int __reuseport_round = 0;
+static __thread int __reuseport_slot_index = -1;
+static __thread int __reuseport_slot_round = 0;
+
+struct reuseport_sender {
+    HUDPLINK link;
+    const char *host;
+    uint16_t port;
+    int length;
+    lwp_t lwp;
+    uint64_t tx_datagrams;
+};
+
+static void STDCALL reuseport_receiver_callback(const struct nis_event *event, const void *data)
+{
+    int index;
+
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    /* each Rx thread pick one slot at the first datagram it deliver */
+    if (__reuseport_slot_round != __atomic_load_n(&__reuseport_round, __ATOMIC_ACQUIRE)) {
+        index = __atomic_fetch_add(&__reuseport_nslots, 1, __ATOMIC_SEQ_CST);
+        if (index >= REUSEPORT_MAXIMUM_THREADS) {
+            return;
+        }
+        __reuseport_slots[index].tid = ifos_gettid();
+        __reuseport_slot_index = index;
+        __reuseport_slot_round = __atomic_load_n(&__reuseport_round, __ATOMIC_ACQUIRE);
+    }
+
+    atom_addone(&__reuseport_slots[__reuseport_slot_index].datagrams);
+}
+
+static void *reuseport_sender_proc(void *p)
+{
+    struct reuseport_sender *sender;
+    unsigned char *packet;
+    nsp_status_t status;
+
+    sender = (struct reuseport_sender *)p;
+    packet = (unsigned char *)zmalloc(sender->length);
+    memset(packet, 'R', sender->length);
+
+    while (!__atomic_load_n(&__reuseport_stop, __ATOMIC_ACQUIRE)) {
+        status = udp_write(sender->link, packet, sender->length, sender->host, sender->port, NULL);
+        if (!NSP_SUCCESS(status)) {
+            if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY) || NSP_FAILED_AND_ERROR_EQUAL(status, ENOBUFS)) {
+                continue;
+            }
+            printf("sender link:%ld write failed, error:%ld\n", sender->link, status);
+            break;
+        }
+        sender->tx_datagrams++;
+    }
+
+    zfree(packet);
+    return NULL;
+}
+
+static nsp_status_t reuseport_run_round(const char *name, struct reuseport_sender *senders, int count, lwp_event_t *exit)
+{
+    int i;
+    int nslots;
+    uint64_t begin, elapse;
+    uint64_t tx_datagrams, rx_datagrams;
+    nsp_status_t status;
+
+    memset(__reuseport_slots, 0, sizeof(__reuseport_slots));
+    __atomic_store_n(&__reuseport_nslots, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&__reuseport_stop, 0, __ATOMIC_RELEASE);
+    /* Rx threads are reused across rounds, a new round make them pick slots again */
+    __atomic_add_fetch(&__reuseport_round, 1, __ATOMIC_SEQ_CST);
+
+    begin = clock_monotonic();
+    for (i = 0; i < count; i++) {
+        senders[i].tx_datagrams = 0;
+        lwp_create(&senders[i].lwp, 0, &reuseport_sender_proc, &senders[i]);
+    }
+
+    /* SIGINT break the benchmark */
+    status = lwp_event_wait(exit, REUSEPORT_ROUND_SECONDS * 1000);
+    __atomic_store_n(&__reuseport_stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < count; i++) {
+        lwp_join(&senders[i].lwp, NULL);
+    }
+    if (posix__makeerror(ETIMEDOUT) != status) {
+        return NSP_STATUS_FATAL;
+    }
+    /* let the receiver drain the sockets */
+    lwp_delay(100000);
+    elapse = clock_monotonic() - begin;
+
+    tx_datagrams = 0;
+    for (i = 0; i < count; i++) {
+        tx_datagrams += senders[i].tx_datagrams;
+    }
+    rx_datagrams = 0;
+    nslots = __atomic_load_n(&__reuseport_nslots, __ATOMIC_ACQUIRE);
+    if (nslots > REUSEPORT_MAXIMUM_THREADS) {
+        nslots = REUSEPORT_MAXIMUM_THREADS;
+    }
+    for (i = 0; i < nslots; i++) {
+        rx_datagrams += atom_get64(&__reuseport_slots[i].datagrams);
+    }
+
+    printf("%s\t\t%.0f\t\t%.0f\t\t%d\n", name,
+        (double)tx_datagrams * 10000000 / elapse, (double)rx_datagrams * 10000000 / elapse, nslots);
+    for (i = 0; i < nslots; i++) {
+        printf("\tRx thread %d\t%llu datagrams(%.1f%%)\n", __reuseport_slots[i].tid,
+            (unsigned long long)__reuseport_slots[i].datagrams,
+            rx_datagrams ? (double)__reuseport_slots[i].datagrams * 100 / rx_datagrams : 0);
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static HUDPLINK reuseport_create_receiver(const char *host, uint16_t port, int flag)
+{
+    HUDPLINK receiver;
+    int bufsize;
+
+    receiver = udp_create(&reuseport_receiver_callback, host, port, flag);
+    if (INVALID_HUDPLINK == receiver) {
+        return INVALID_HUDPLINK;
+    }
+
+    /* attribute and socket options of the receiver propagate to every socket in the group */
+    nis_cntl(receiver, NI_SETATTR, nis_cntl(receiver, NI_GETATTR) | LINKATTR_NONBLOCK | LINKATTR_UDP_BINARY_ADDRESS);
+    bufsize = 0x800000;
+    udp_setopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char *)&bufsize, sizeof(bufsize));
+    return receiver;
+}
+
+nsp_status_t start_reuseport(const struct argument *parameter, lwp_event_t *exit)
+{
+    HUDPLINK receiver;
+    struct reuseport_sender *senders;
+    const char *host;
+    int count;
+    int i;
+
+    if (parameter->length <= 0 || parameter->length > MAX_UDP_UNIT) {
+        printf("data length must between 1 and %d in SO_REUSEPORT benchmark\n", MAX_UDP_UNIT);
+        return posix__makeerror(EINVAL);
+    }
+
+    count = parameter->reuseport;
+    senders = (struct reuseport_sender *)ztrycalloc(sizeof(*senders) * count);
+    if (!senders) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    host = (0 == strcmp(parameter->shost, "0.0.0.0")) ? "127.0.0.1" : parameter->shost;
+    for (i = 0; i < count; i++) {
+        senders[i].link = udp_create(NULL, NULL, 0, UDP_FLAG_NONE);
+        if (INVALID_HUDPLINK == senders[i].link) {
+            break;
+        }
+        senders[i].host = host;
+        senders[i].port = parameter->port;
+        senders[i].length = parameter->length;
+    }
+
+    printf("datagram %d bytes, %d senders\n", parameter->length, count);
+    printf("mode\t\ttx/s\t\trx/s\t\tRx threads\n");
+    do {
+        if (i < count) {
+            count = i;
+            break;
+        }
+
+        receiver = reuseport_create_receiver(host, parameter->port, UDP_FLAG_NONE);
+        if (INVALID_HUDPLINK == receiver) {
+            break;
+        }
+        if (!NSP_SUCCESS(reuseport_run_round("single", senders, count, exit))) {
+            udp_destroy(receiver);
+            break;
+        }
+        udp_destroy(receiver);
+        /* wait for the closed socket release the port */
+        lwp_delay(100000);
+
+        receiver = reuseport_create_receiver(host, parameter->port, UDP_FLAG_REUSEPORT);
+        if (INVALID_HUDPLINK == receiver) {
+            break;
+        }
+        reuseport_run_round("reuseport", senders, count, exit);
+        udp_destroy(receiver);
+    } while (0);
+
+    for (i = 0; i < count; i++) {
+        udp_destroy(senders[i].link);
+    }
+    zfree(senders);
+    return NSP_STATUS_SUCCESSFUL;
+}
@@ -202,6 +202,13 @@ static nsp_status_t start_tcp_server(const struct argument *parameter, lwp_event
         attr = nis_cntl(server, NI_SETATTR, attr);
     }
 
+    /* the links accepted after this are recorded to the same file */
+    if (parameter->capture[0]) {
+        if (!NSP_SUCCESS(nis_cntl(server, NI_SETCAPTURE, parameter->capture))) {
+            printf("failed capture to %s\n", parameter->capture);
+        }
+    }
+
     /* begin listen */
     tcp_listen(server, 100);
     /* block the program auto exit */
@@ -0,0 +1,234 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+/* same-host transport benchmark, compare "IPC:" links(AF_UNIX socket) with "SHM:" links(shared memory rings):
+ *  1. throughput, one client push packets of @length bytes to server as fast as it can, messages/s arrive at server are reported
+ *  2. latency, one client play ping-pong with server, the percentiles of round trip time are reported
+ *  each phase run 3 seconds, server and client are in this process.
+ */
+
+#define SHMBENCH_ROUND_SECONDS      (3)
+#define SHMBENCH_MAGIC_PING         ('P')
+#define SHMBENCH_MAGIC_FLOOD        ('F')
+#define SHMBENCH_MAXIMUM_SAMPLES    (0x100000)
+#define SHMBENCH_MAXIMUM_LENGTH     (0x100000)
+
+#pragma pack(push, 1)
+struct shmbench_ping {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t timestamp;
+};
+#pragma pack(pop)
+
+static uint64_t __shmbench_rx = 0;
+static int __shmbench_stop = 0;
+static uint64_t *__shmbench_samples = NULL;
+static int __shmbench_count = 0;
+
+static int shmbench_compare(const void *left, const void *right)
+{
+    uint64_t l, r;
+
+    l = *(const uint64_t *)left;
+    r = *(const uint64_t *)right;
+    return (l > r) - (l < r);
+}
+
+static nsp_status_t shmbench_ping(HTCPLINK link)
+{
+    struct shmbench_ping ping;
+
+    ping.magic = SHMBENCH_MAGIC_PING;
+    ping.reserved = 0;
+    ping.timestamp = clock_monotonic();
+    return tcp_write(link, &ping, sizeof(ping), NULL);
+}
+
+static void STDCALL shmbench_server_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+    const struct shmbench_ping *ping;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    ping = (const struct shmbench_ping *)tcpdata->e.Packet.Data;
+    if (tcpdata->e.Packet.Size == sizeof(*ping) && SHMBENCH_MAGIC_PING == ping->magic) {
+        tcp_write(event->Ln.Tcp.Link, ping, sizeof(*ping), NULL);
+    } else {
+        atom_addone(&__shmbench_rx);
+    }
+}
+
+static void STDCALL shmbench_client_callback(const struct nis_event *event, const void *data)
+{
+    struct nis_tcp_data *tcpdata;
+    const struct shmbench_ping *ping;
+
+    tcpdata = (struct nis_tcp_data *)data;
+    if (EVT_RECEIVEDATA != event->Event) {
+        return;
+    }
+
+    /* only one ping in flight, samples are written by the Rx thread of client exclusively */
+    ping = (const struct shmbench_ping *)tcpdata->e.Packet.Data;
+    if (tcpdata->e.Packet.Size == sizeof(*ping) && SHMBENCH_MAGIC_PING == ping->magic) {
+        if (__shmbench_count < SHMBENCH_MAXIMUM_SAMPLES) {
+            __shmbench_samples[__shmbench_count++] = clock_monotonic() - ping->timestamp;
+        }
+        if (!__atomic_load_n(&__shmbench_stop, __ATOMIC_ACQUIRE)) {
+            shmbench_ping(event->Ln.Tcp.Link);
+        }
+    }
+}
+
+static void *shmbench_flood_proc(void *p)
+{
+    HTCPLINK link;
+    const struct argument *parameter;
+    unsigned char *packet;
+    nsp_status_t status;
+
+    link = *(HTCPLINK *)p;
+    parameter = arg_get_parameter();
+    packet = (unsigned char *)zmalloc(parameter->length);
+    memset(packet, SHMBENCH_MAGIC_FLOOD, parameter->length);
+
+    while (!__atomic_load_n(&__shmbench_stop, __ATOMIC_ACQUIRE)) {
+        status = tcp_write(link, packet, parameter->length, NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            lwp_delay(100);
+            continue;
+        }
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    zfree(packet);
+    return NULL;
+}
+
+static HTCPLINK shmbench_connect(const char *prefix, const char *target)
+{
+    HTCPLINK link;
+
+    link = tcp_create2(&shmbench_client_callback, prefix, 0, gettst());
+    if (INVALID_HTCPLINK == link) {
+        return INVALID_HTCPLINK;
+    }
+
+    if (!NSP_SUCCESS(tcp_connect(link, target, 0))) {
+        tcp_destroy(link);
+        return INVALID_HTCPLINK;
+    }
+
+    return link;
+}
+
+static nsp_status_t shmbench_run_round(const char *prefix, lwp_event_t *exit)
+{
+    HTCPLINK server, client;
+    char target[128];
+    lwp_t flood_lwp;
+    uint64_t begin, elapse, rx;
+    nsp_status_t status;
+    int count;
+
+    crt_sprintf(target, sizeof(target), "%s/tmp/nax-shmbench-%d.sock", prefix, ifos_getpid());
+    server = tcp_create2(&shmbench_server_callback, target, 0, gettst());
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    status = NSP_STATUS_FATAL;
+    client = INVALID_HTCPLINK;
+    do {
+        /* accepted links inherit the tst of listener */
+        nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+        if (!NSP_SUCCESS(tcp_listen(server, 100))) {
+            break;
+        }
+
+        client = shmbench_connect(prefix, target);
+        if (INVALID_HTCPLINK == client) {
+            break;
+        }
+
+        /* throughput */
+        __atomic_store_n(&__shmbench_stop, 0, __ATOMIC_RELEASE);
+        atom_set64(&__shmbench_rx, 0);
+        begin = clock_monotonic();
+        lwp_create(&flood_lwp, 0, &shmbench_flood_proc, &client);
+        status = lwp_event_wait(exit, SHMBENCH_ROUND_SECONDS * 1000);
+        __atomic_store_n(&__shmbench_stop, 1, __ATOMIC_RELEASE);
+        lwp_join(&flood_lwp, NULL);
+        rx = atom_get64(&__shmbench_rx);
+        elapse = clock_monotonic() - begin;
+        if (posix__makeerror(ETIMEDOUT) != status) {
+            status = NSP_STATUS_FATAL;
+            break;
+        }
+        /* let the server drain the backlog before the ping-pong */
+        lwp_delay(500000);
+
+        /* latency */
+        __shmbench_count = 0;
+        __atomic_store_n(&__shmbench_stop, 0, __ATOMIC_RELEASE);
+        shmbench_ping(client);
+        status = lwp_event_wait(exit, SHMBENCH_ROUND_SECONDS * 1000);
+        __atomic_store_n(&__shmbench_stop, 1, __ATOMIC_RELEASE);
+        lwp_delay(100000);
+        if (posix__makeerror(ETIMEDOUT) != status) {
+            status = NSP_STATUS_FATAL;
+            break;
+        }
+
+        count = __shmbench_count;
+        if (count > 0) {
+            qsort(__shmbench_samples, count, sizeof(uint64_t), &shmbench_compare);
+            printf("%s\t%.0f\t\t%d\t%.1f\t%.1f\t%.1f\t\t%.1f\n", prefix, (double)rx * 10000000 / elapse, count,
+                (double)__shmbench_samples[count / 2] / 10, (double)__shmbench_samples[count * 99 / 100] / 10,
+                (double)__shmbench_samples[count * 999 / 1000] / 10, (double)__shmbench_samples[count - 1] / 10);
+        } else {
+            printf("%s\t%.0f\t\t0\t-\t-\t-\t\t-\n", prefix, (double)rx * 10000000 / elapse);
+        }
+        status = NSP_STATUS_SUCCESSFUL;
+    } while (0);
+
+    if (INVALID_HTCPLINK != client) {
+        tcp_destroy(client);
+    }
+    tcp_destroy(server);
+    return status;
+}
+
+nsp_status_t start_shmbench(const struct argument *parameter, lwp_event_t *exit)
+{
+    if (parameter->length < (int)sizeof(struct shmbench_ping) || parameter->length > SHMBENCH_MAXIMUM_LENGTH) {
+        printf("data length must between %d and %d in shared memory benchmark\n", (int)sizeof(struct shmbench_ping), SHMBENCH_MAXIMUM_LENGTH);
+        return posix__makeerror(EINVAL);
+    }
+
+    __shmbench_samples = (uint64_t *)ztrymalloc(SHMBENCH_MAXIMUM_SAMPLES * sizeof(uint64_t));
+    if (!__shmbench_samples) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    printf("packet %d bytes\n", parameter->length);
+    printf("mode\tmessages/s\tsamples\tp50(us)\tp99(us)\tp999(us)\tmax(us)\n");
+    if (NSP_SUCCESS(shmbench_run_round("IPC:", exit))) {
+        shmbench_run_round("SHM:", exit);
+    }
+
+    zfree(__shmbench_samples);
+    __shmbench_samples = NULL;
+    return NSP_STATUS_SUCCESSFUL;
+}
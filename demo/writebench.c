@@ -0,0 +1,159 @@
+#include "demo.h"
+
+#include "ifos.h"
+#include "zmalloc.h"
+#include "atom.h"
+#include "clock.h"
+
+#include <sched.h>
+
+/* contended writer benchmark, [threads] threads call @tcp_write on one link as fast as they can,
+ *  the round run with 1, 2, 4 ... [threads] writers, writes/s accepted by the library, the ratio of writes rejected by full queue(-EBUSY)
+ *  and packets/s arrived at server are reported.
+ *  the link stay in Tx overflow most of the time, so nearly every write go through the Tx fifo of link.
+ */
+
+#define WRITEBENCH_ROUND_SECONDS    (2)
+#define WRITEBENCH_MAXIMUM_THREADS  (256)
+
+static uint64_t __writebench_written = 0;
+static uint64_t __writebench_busy = 0;
+static uint64_t __writebench_rx = 0;
+static int __writebench_stop = 0;
+static HTCPLINK __writebench_client = INVALID_HTCPLINK;
+static unsigned char *__writebench_packet = NULL;
+static int __writebench_length = 0;
+
+static void STDCALL writebench_server_callback(const struct nis_event *event, const void *data)
+{
+    if (EVT_RECEIVEDATA == event->Event) {
+        atom_addone(&__writebench_rx);
+    }
+}
+
+static void STDCALL writebench_client_callback(const struct nis_event *event, const void *data)
+{
+    ;
+}
+
+static void *writebench_writer_proc(void *p)
+{
+    nsp_status_t status;
+
+    while (!__atomic_load_n(&__writebench_stop, __ATOMIC_ACQUIRE)) {
+        status = tcp_write(__writebench_client, __writebench_packet, __writebench_length, NULL);
+        if (NSP_SUCCESS(status)) {
+            atom_addone(&__writebench_written);
+        } else if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            atom_addone(&__writebench_busy);
+            sched_yield();
+        } else {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static nsp_status_t writebench_run_round(int threads, lwp_event_t *exit)
+{
+    lwp_t writers[WRITEBENCH_MAXIMUM_THREADS];
+    uint64_t begin, elapse, written, busy, rx;
+    nsp_status_t status;
+    int i, count;
+
+    __atomic_store_n(&__writebench_stop, 0, __ATOMIC_RELEASE);
+    atom_set64(&__writebench_written, 0);
+    atom_set64(&__writebench_busy, 0);
+    atom_set64(&__writebench_rx, 0);
+    begin = clock_monotonic();
+    for (i = 0; i < threads; i++) {
+        lwp_create(&writers[i], 0, &writebench_writer_proc, NULL);
+    }
+
+    status = lwp_event_wait(exit, WRITEBENCH_ROUND_SECONDS * 1000);
+    written = atom_get64(&__writebench_written);
+    busy = atom_get64(&__writebench_busy);
+    rx = atom_get64(&__writebench_rx);
+    elapse = clock_monotonic() - begin;
+    __atomic_store_n(&__writebench_stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < threads; i++) {
+        lwp_join(&writers[i], NULL);
+    }
+
+    /* the queued packets of this round are not count to the next one */
+    do {
+        count = 0;
+        nis_cntl(__writebench_client, NI_GETTXQUEUE, &count, NULL);
+        if (count > 0) {
+            lwp_delay(1000);
+        }
+    } while (count > 0);
+
+    if (posix__makeerror(ETIMEDOUT) != status) {
+        return NSP_STATUS_FATAL;
+    }
+
+    printf("%d\t%.0f\t\t%.2f\t\t%.0f\n", threads, (double)written * 10000000 / elapse,
+        (written + busy > 0) ? (double)busy * 100 / (written + busy) : 0.0, (double)rx * 10000000 / elapse);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t start_writebench(const struct argument *parameter, lwp_event_t *exit)
+{
+    HTCPLINK server;
+    nsp_status_t status;
+    int threads;
+
+    if (parameter->writebench > WRITEBENCH_MAXIMUM_THREADS || parameter->length <= 0) {
+        printf("writers must between 1 and %d and data length must greater than zero in write benchmark\n", WRITEBENCH_MAXIMUM_THREADS);
+        return posix__makeerror(EINVAL);
+    }
+
+    server = tcp_create2(&writebench_server_callback, "127.0.0.1", parameter->port, gettst());
+    if (INVALID_HTCPLINK == server) {
+        return NSP_STATUS_FATAL;
+    }
+
+    status = NSP_STATUS_FATAL;
+    do {
+        nis_cntl(server, NI_SETATTR, nis_cntl(server, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT);
+        if (!NSP_SUCCESS(tcp_listen(server, 0))) {
+            break;
+        }
+
+        __writebench_client = tcp_create2(&writebench_client_callback, NULL, 0, gettst());
+        if (INVALID_HTCPLINK == __writebench_client || !NSP_SUCCESS(tcp_connect(__writebench_client, "127.0.0.1", parameter->port))) {
+            break;
+        }
+        /* writers MUST NOT block in kernel, otherwise they never meet each other in Tx fifo */
+        nis_cntl(__writebench_client, NI_SETATTR, nis_cntl(__writebench_client, NI_GETATTR) | LINKATTR_NONBLOCK);
+
+        __writebench_packet = (unsigned char *)ztrymalloc(parameter->length);
+        if (!__writebench_packet) {
+            break;
+        }
+        memset(__writebench_packet, 'W', parameter->length);
+        __writebench_length = parameter->length;
+
+        printf("packet %d bytes, writers share one link\n", parameter->length);
+        printf("writers\twrites/s\tbusy(%%)\t\tpackets/s received\n");
+        for (threads = 1; threads <= parameter->writebench; threads <<= 1) {
+            status = writebench_run_round(threads, exit);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+        }
+    } while (0);
+
+    if (INVALID_HTCPLINK != __writebench_client) {
+        tcp_destroy(__writebench_client);
+        __writebench_client = INVALID_HTCPLINK;
+    }
+    tcp_destroy(server);
+    if (__writebench_packet) {
+        zfree(__writebench_packet);
+        __writebench_packet = NULL;
+    }
+    return status;
+}
@@ -84,6 +84,9 @@ PORTABLEAPI(nsp_status_t) ifos_setaffinity_process(int mask);
 PORTABLEAPI(nsp_status_t) ifos_getaffinity_process(int *mask);
 /* obtain the CPU core-count in this machine */
 PORTABLEAPI(int) ifos_getnprocs();
+/* obtain the CPU core-count this process can actually use, that's the CPUs in affinity mask and limited by the CPU quota of cgroup(v1 or v2),
+ * 	on MS-API, it's equivalent to @ifos_getnprocs */
+PORTABLEAPI(int) ifos_getnprocs_quota();
 
 /* ifos-mm */
 typedef struct {
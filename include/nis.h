@@ -26,6 +26,38 @@ PORTABLEAPI(nsp_status_t) DEPRECATED("use tcp_init2 or later function instead it
 PORTABLEAPI(nsp_status_t) tcp_init2(int nprocs);
 PORTABLEAPI(void) tcp_uninit();
 
+/* @tcp_resize grow or shrink the epoll threads of TCP framework at runtime, @tcp_getnprocs obtain the count of them.
+	@nprocs zero to follow the CPU quota of cgroup which this process belong to, it's also the default of @tcp_init2(0),
+		applications which CPU allocation change at runtime can call @tcp_resize(0) when they are notified.
+	when thread set changed, links are spread over the new set by their handle again, each link are migrated by it's current Rx thread,
+		links on the retired threads are migrated before @tcp_resize return, the others are migrated asynchronously.
+		no event lost during migration, but the callback of a link may run on a different thread(NI_GETRXTID) after that.
+	potential return value including:
+	-EINVAL: @nprocs negative or exceed the upper bound(256).
+	-EDEADLK: shrink in the callback which running on a thread going to retire.
+	-EPROTOTYPE: TCP framework are not initialized.
+*/
+PORTABLEAPI(nsp_status_t) tcp_resize(int nprocs);
+PORTABLEAPI(int) tcp_getnprocs();
+
+/* @nis_dispatch_init start @nworkers dispatch workers, @nis_dispatch_uninit stop them.
+	EVT_RECEIVEDATA of the TCP link which has attribute LINKATTR_TCP_DISPATCH are handed to the workers instead of calling on the epoll thread,
+		so a slow callback only stall it's own link. each link run on one worker at a time, packets of a link are delivered in order,
+		different links are delivered concurrently. the other events are still called on the epoll thread.
+	the packet parsed in place of Rx buffer or large-block are lent to worker without copy, the others are copied once,
+		the @Data of packet is valid during callback only as usual.
+	EVT_PRE_CLOSE and EVT_CLOSED of a link are deferred until the packets already parsed have been delivered.
+	the link fallback to deliver on the epoll thread when workers are not running,
+		the packets pending at @nis_dispatch_uninit are delivered on the calling thread before it return.
+	@nworkers zero to follow the CPU quota of cgroup which this process belong to.
+	potential return value including:
+	-EINVAL: @nworkers negative or exceed the upper bound(64).
+	-EALREADY: workers has been started.
+	@nis_dispatch_uninit do nothing when it's called in callback running on dispatch worker.
+*/
+PORTABLEAPI(nsp_status_t) nis_dispatch_init(int nworkers);
+PORTABLEAPI(void) nis_dispatch_uninit();
+
 /* @tcp_create and @tcp_create2 use to create a TCP object point to by return value @HTCPLINK, this link will use everywhere which employ TCP functions.
 	@tcp_destroy notify framework close the TCP connection and release resource of this link as soon as possible.
 				in fact, the link usually can NOT be close completely immediately,
@@ -57,6 +89,17 @@ PORTABLEAPI(void) tcp_uninit();
 		associated file will be specified postpone to @connect time point
 		failed if calling thread invoke @listen next
 	in IPC pattern, @port have been ignored.
+
+	update:(Linux Only)
+	prefix "SHM:" create a IPC link which carry the data by shared memory rather than the AF_UNIX socket, the semantic are the same as "IPC:"
+	"SHM:/dev/shm/target.sock"
+	"shm:"
+	the socket only use to rendezvous and detect close of the peer, after connection established, the connector create two SPSC byte rings
+	in anonymous shared memory(one per direction) and send them to the acceptor, all of the data flow through these rings,
+	each ring are 4MB and packets larger than it are transfer in pieces.
+	SHM link must have a callback, Rx data are deliver by EVT_RECEIVEDATA and framing by @tst exactly as the stream socket,
+	@tcp_read is not supported on SHM link.
+	both sides of a connection must use the "SHM:" prefix.
 */
 PORTABLEAPI(HTCPLINK) tcp_create(tcp_io_fp callback, const char* ipstr, uint16_t port);
 PORTABLEAPI(HTCPLINK) tcp_create2(tcp_io_fp callback, const char* ipstr, uint16_t port, const tst_t *tst);
@@ -79,7 +122,9 @@ PORTABLEAPI(void) tcp_destroy(HTCPLINK link);
 
 	update:(Linux Only)
 	if @link target to a IPC file, @ipstr and @port are all ignored
+	-EINVAL if @link is a SHM link without callback
 */
+
 PORTABLEAPI(nsp_status_t) tcp_connect(HTCPLINK link, const char* ipstr, uint16_t port);
 PORTABLEAPI(nsp_status_t) tcp_connect2(HTCPLINK link, const char* ipstr, uint16_t port);
 
@@ -132,6 +177,110 @@ PORTABLEAPI(nsp_status_t) tcp_listen(HTCPLINK link, int block);
 */
 PORTABLEAPI(nsp_status_t) tcp_write(HTCPLINK link, const void *origin, int size, const nis_serializer_fp serializer);
 
+/* @tcp_write2 is the same as @tcp_write but allow calling thread to batch small packets by @flags.
+	when @flags contain NIS_MORE, the packet is built into a contiguous cork buffer of @link instead of sending immediately,
+	the first following write without NIS_MORE appends it's packet and then send the whole buffer in one syscall.
+	the cork buffer are also sent when it accumulate more than 64KB, or when @tcp_flush called.
+	data remain in the cork buffer when @link closed are discarded.
+
+	@tcp_flush send all data accumulated by NIS_MORE immediately,
+	on -EBUSY, the data are kept and calling thread can try again later.
+
+	when @flags contain NIS_URGENT, the packet queue in the urgent lane of @link when the kernel send-buffer is full,
+	urgent packets are written before any pending normal packet(include the corked data), but never split a packet which is partially written.
+	it's helpful for heartbeat or cancel message which can not wait behind bulk data, each lane has it's own pending limit(-EBUSY).
+*/
+
+PORTABLEAPI(nsp_status_t) tcp_write2(HTCPLINK link, const void *origin, int size, const nis_serializer_fp serializer, int flags);
+PORTABLEAPI(nsp_status_t) tcp_flush(HTCPLINK link);
+
+/* @tcp_sendfile write @length bytes of file @fd start at @offset to @link as one packet, the file content never copy into user space.
+	the packet are:
+	1. protocol head built by tst builder of @link, the size pass to builder is @header_len + @length, it's omitted if there is no builder
+	2. @header_len bytes of @header, optional, can be NULL when @header_len is zero
+	3. the file content write by sendfile(2)
+	@fd are duplicated by framework, calling thread can close it immediately after return.
+	zero @length means from @offset to the end of file.
+	the request queue in the same order with @tcp_write, when kernel send-buffer is full, it's resumed by EPOLLOUT.
+
+	after the whole file has been written, or the request are canceled by link close or failed, a EVT_TCP_SENDFILE event are post to callback,
+	nis_tcp_data::e::SendFile report the result, the event may be post before @tcp_sendfile return when the request complete immediately.
+	no event post when @tcp_sendfile return negative value.
+
+	potential errors including:
+	-EINVAL : the input parameter illegal, or the packet larger than 50MB when tst builder are in use
+	-EOPNOTSUPP : @link is a SHM link
+	-EBUSY : the cache queue of framework arrived maximum pending limit
+	any other errors of syscall fstat(2), fcntl(2) and sendfile(2)
+*/
+PORTABLEAPI(nsp_status_t) tcp_sendfile(HTCPLINK link, int fd, int64_t offset, int64_t length, const void *header, int header_len);
+
+/* @nis_buffer_create build a packet once and share it with many Tx requests, it's useful to push the same notification to lots of links.
+	@origin, @cb and @serializer have the same meaning as @tcp_write, protocol head are built by builder of @tst when it's not NULL,
+	notes that the tst of link are NOT used by @tcp_write_buffer/@tcp_broadcast, the packet are sent exactly as built here.
+	the buffer are reference counted, it's created with one reference owned by calling thread,
+	@nis_buffer_ref add one reference and @nis_buffer_release drop one, memory are freed when the last reference dropped.
+	queued Tx requests hold their own references, so calling thread can release the buffer immediately after write.
+	return NULL when the input parameter illegal, or memory insufficient, or @tst builder/@serializer failed.
+
+	@tcp_write_buffer write @buffer to @link without copy, the return value and errors are the same as @tcp_write
+	@tcp_broadcast write @buffer to each of @count links in @links, failure of any link never interrupt the others,
+		return the count of links which the request are accepted, or -EINVAL when the input parameter illegal.
+*/
+PORTABLEAPI(nis_buffer_t *) nis_buffer_create(const void *origin, int cb, const nis_serializer_fp serializer, const tst_t *tst);
+PORTABLEAPI(nis_buffer_t *) nis_buffer_ref(nis_buffer_t *buffer);
+PORTABLEAPI(void) nis_buffer_release(nis_buffer_t *buffer);
+PORTABLEAPI(nsp_status_t) tcp_write_buffer(HTCPLINK link, nis_buffer_t *buffer);
+PORTABLEAPI(int) tcp_broadcast(const HTCPLINK *links, int count, nis_buffer_t *buffer);
+
+/* @tcp_pool_create create a pool of client links, so the request path pick a established connection instead of connect on demand.
+	links are grouped by the remote endpoint, each endpoint keep at least @min and at most @max links,
+	all links are created by @tcp_create2 with @callback and @tst, and connect by @tcp_connect2, events are delivered to @callback as usual.
+	return NULL when the input parameter illegal(@callback is NULL, @min < 0, @max < 1 or @min > @max), or memory insufficient.
+
+	@tcp_pool_prewarm start asynchronous connect to endpoint @ipstr:@port until it has @min links, connects are in flight at the same time.
+		it's also the way to restore @min links after some of them closed, the pool never connect from the Rx thread.
+	@tcp_pool_acquire select the established link which has the least outstanding requests of endpoint, and count one request on it.
+		the link is shared, many requests can be outstanding on one link, calling thread match the responses by it's own protocol.
+		when all established links are busy and the endpoint has less than @max links, one more link start to connect in background.
+		if the endpoint has no established link yet, the connects are started and -EAGAIN return,
+		-EHOSTDOWN return instead when the last connect failed, connect retry backoff from 100ms to 5s on consecutive failures.
+	@tcp_pool_release finish the request counted on @link, the link stay in pool.
+	health of links are tracked by the close of them(EVT_CLOSED), the closed link leave the pool immediately,
+		the link closed before connection established count as a failure of it's endpoint.
+		calling thread can @tcp_destroy a pooled link which it regard as unhealthy, a timeout response for example.
+	@tcp_pool_getstat obtain the state of endpoint @ipstr:@port, -ENOENT if the endpoint never used.
+	@tcp_pool_destroy close all links of @pool and release it, EVT_CLOSED of these links may be delivered after return.
+
+	only IPv4 endpoint are supported, potential errors including:
+	-EINVAL : the input parameter illegal
+	-ENOMEM : framework can not allocate virtual memory from system-kernel
+	-EAGAIN/-EHOSTDOWN : see above
+	-ENOENT : @link already closed, or the endpoint never used
+	-ECANCELED : @pool is destroying
+*/
+PORTABLEAPI(tcp_pool_t *) tcp_pool_create(tcp_io_fp callback, const tst_t *tst, int min, int max);
+PORTABLEAPI(void) tcp_pool_destroy(tcp_pool_t *pool);
+PORTABLEAPI(nsp_status_t) tcp_pool_prewarm(tcp_pool_t *pool, const char *ipstr, uint16_t port);
+PORTABLEAPI(nsp_status_t) tcp_pool_acquire(tcp_pool_t *pool, const char *ipstr, uint16_t port, HTCPLINK *link);
+PORTABLEAPI(nsp_status_t) tcp_pool_release(tcp_pool_t *pool, HTCPLINK link);
+PORTABLEAPI(nsp_status_t) tcp_pool_getstat(tcp_pool_t *pool, const char *ipstr, uint16_t port, tcp_pool_stat_t *stat);
+
+/* @nis_filter_reserve give a stage of filter pipeline a pooled buffer of at least @size bytes to output into,
+	the buffer never overlap @frame->data, so the stage read it's input while writing the output.
+	there are a few spare bytes behind @size, the next stage can append a short trailer in place.
+	stage set @frame->data to the buffer and @frame->size to the output length after transform, the buffer are owned by framework.
+	return NULL when memory insufficient.
+
+	@nis_filter_crc32c and @nis_filter_lz return the built-in stages:
+	crc32c append the CRC32C of data as 4 bytes little-endian trailer on Tx, verify and strip it on Rx.
+	lz compress data with a LZ77 variant on Tx, the data which can not be compressed are sent stored with one byte overhead.
+	put crc32c ahead of lz in the pipeline so the checksum cover the compressed bytes on wire.
+*/
+PORTABLEAPI(unsigned char *) nis_filter_reserve(nis_filter_frame_t *frame, int size);
+PORTABLEAPI(const nis_filter_stage_t *) nis_filter_crc32c();
+PORTABLEAPI(const nis_filter_stage_t *) nis_filter_lz();
+
 /* this is a optional but not recommended function, it's only use for some special case.
  *	1. the @link shall be a synchronous TCP object which created by @tcp_create or @tcp_create2
  *  2. calling thread ignore the tst function to parse the incoming data, it's MUST be a complete frame.
@@ -201,6 +350,12 @@ PORTABLEAPI(nsp_status_t) DEPRECATED("use udp_init2 instead it") udp_init();
 PORTABLEAPI(nsp_status_t) udp_init2(int nprocs);
 PORTABLEAPI(void) udp_uninit();
 
+/* @udp_resize and @udp_getnprocs are the UDP version of @tcp_resize and @tcp_getnprocs, the default of UDP is a half of CPU quota.
+	the sockets of SO_REUSEPORT group(UDP_FLAG_REUSEPORT) are created by the thread count at that time,
+		after thread set changed, they share the threads in service, groups created later follow the new count */
+PORTABLEAPI(nsp_status_t) udp_resize(int nprocs);
+PORTABLEAPI(int) udp_getnprocs();
+
 /* NOTE: New applications should NOT set the @flag when calling @udp_create  (available since version 9.8.1),
  			every udp link can change the attributes(flag) any time by interface @nis_cntl call with parameter @NI_SETATTR,
  			more useful: that broadcast attributes can now be cancelled.
@@ -227,7 +382,15 @@ PORTABLEAPI(void) udp_uninit();
 		in this case means using IPC communication but this peer didn't want to recv any data
 		so, the IPC file will not be create but Tx operation will not affected.
 	in IPC pattern, @port and @flag parameters have been ignored.
+
+	update:(Linux Only)
+	@flag UDP_FLAG_REUSEPORT ask framework to open one SO_REUSEPORT socket per UDP epoll thread(@udp_init2), all of them bind on @ipstr:@port,
+	the kernel spread incoming flows over these sockets so that the receive load of one port can use every epoll thread.
+	the group are still one @HUDPLINK, datagrams received by any socket are reported with it, @udp_write use the first socket.
+	attributes set by NI_SETATTR and NI_SETUDPGRO apply to the whole group, other @nis_cntl requests affect the first socket only.
+	NI_SETUDPSTEER change how the kernel pick socket for incoming datagram. this flag is ignored when @callback is NULL.
 */
+
 PORTABLEAPI(HUDPLINK) udp_create(udp_io_fp user_callback, const char* ipstr, uint16_t port, int flag);
 PORTABLEAPI(void) udp_destroy(HUDPLINK link);
 
@@ -235,7 +398,7 @@ PORTABLEAPI(void) udp_destroy(HUDPLINK link);
  *	@udpdata is a structure pointer to @nis_udp_data, so, this macro shall be used in callback function of any UDP object
  *	test !udp_not_domain_received(udpdata) can obtain the received data are from UNIX domain peer
  */
-#define udp_not_domain_received(udpdata)	( (0 != (udpdata)->RemoteAddress[0]) && ((udpdata)->Domain == (udpdata)->RemoteAddress) )
+#define udp_not_domain_received(udpdata)	( (0 != (udpdata)->RemoteIpv4) && ((udpdata)->Domain == (udpdata)->RemoteAddress) )
 
 /* @udp_write send @size bytes of user datagram @origin from local address tuple associated by @link to remote target host @ipstr and it's UDP port @port.
 		@udp_write using synchronous model but NOT-blocking calling thread and return immediately,
@@ -273,6 +436,15 @@ PORTABLEAPI(void) udp_destroy(HUDPLINK link);
 */
 PORTABLEAPI(nsp_status_t) udp_write(HUDPLINK link, const void *origin, unsigned int size, const char* ipstr, uint16_t port, const nis_serializer_fp serializer);
 
+/* @udp_write_gso send @size bytes of @origin as a train of datagrams, each of them carry @segment bytes except the last one may be shorter.
+ *	on Linux 4.18 and later, the whole train are submit to kernel by one sendmsg(2) with UDP_SEGMENT(generic segmentation offload),
+ *	the per-datagram cost of syscall and protocol stack are paid only once, otherwise the datagrams are sent one by one.
+ *	@segment shall not larger than MAX_UDP_UNIT, @size shall not larger than MAX_UDP_GSO_SIZE and no more than MAX_UDP_GSO_SEGMENTS segments.
+ *	all datagrams of a train are queued and written as a whole, the other semantic are same as @udp_write.
+ *	the receiver see @size / @segment ordinary datagrams, or a coalesced buffer when it enable NI_SETUDPGRO by @nis_cntl */
+PORTABLEAPI(nsp_status_t) udp_write_gso(HUDPLINK link, const void *origin, unsigned int size, int segment, const char* ipstr, uint16_t port,
+	const nis_serializer_fp serializer);
+
 /* this is a optional but not recommended function, it's only use for some special case.
  *	1. the @link shall be a synchronous UDP object which created by @udp_create or @udp_create2
  *  2. when read request explicit invoke by caller, the callback function which specified by @udp_create or @udp_create2 will NOT be trigger.
@@ -389,6 +561,16 @@ PORTABLEAPI(int) nis_getifmisc(ifmisc_t *ifv, int *cbifv);
 */
 PORTABLEAPI(nsp_status_t) nis_getifmac(const char *eth_name, abuff_mac_t *phyaddr);
 
+/*  @nis_getstat fill @stat with the runtime statistics of library, it's a snapshot, counters are not consistent with each other strictly.
+ *	@stat->Pool is the occupancy of the buffer pool which hold Rx buffers of links, large-block of TCP and big Tx packets,
+ *		the pool map it's regions with MAP_HUGETLB when huge page reserved, or advise them to transparent huge page,
+ *		@stat->Pool.HugeTlb and @stat->Pool.Advised both zero indicate the buffers are in plain pages.
+ *	@stat->Dispatch is the counters of dispatch workers(@nis_dispatch_init) since process start, include the hand-off latency of packets.
+ *	@stat->Rx is the latency from kernel to callback of packets received by the links with attribute LINKATTR_RX_TIMESTAMP.
+ *	on success, the return value should be zero, otherwise, negative integer number return, it's absolute value indicate the error number definied in <errno.h>
+*/
+PORTABLEAPI(nsp_status_t) nis_getstat(nis_statistics_t *stat);
+
 /*
  *	NI_SETATTR(int)
  *		set the attributes of specify object, return the operation result
@@ -423,7 +605,73 @@ PORTABLEAPI(nsp_status_t) nis_getifmac(const char *eth_name, abuff_mac_t *phyadd
  *		on success, return value canbe one of : IPPROTO_TCP IPPROTO_UDP IPPROTO_ARP, otherwise, -1 returned
  *	NI_GETRXTID()
  *		query the Rx thread-id of @link which bind and managed in epoll or IOCP
+ *	NI_SETRXBUDGET(int bytes, int frames)
+ *	NI_GETRXBUDGET(int *bytes, int *frames)
+ *		the receive budget limit how many bytes and how many frames(recv calls for TCP, datagrams for UDP) will be read from @link
+ *		during one wakeup of the Rx thread, zero means unlimited. the link which exhaust it's budget are put back to the ready list
+ *		of it's Rx thread and resume after all other ready links have been served once, negative values are rejected with -EINVAL.
+ *		accepted link inherit the budget of it's listener.
+ *	NI_PAUSERX(void)
+ *	NI_RESUMERX(void)
+ *		stop or restart reading from @link, while paused, no more EVT_RECEIVEDATA will be posted and the data stay in kernel buffer,
+ *		so the TCP receive window closes and the remote sender are blocked by flow control, datagrams overflow the buffer of UDP link are dropped.
+ *		it's safe to call them inside the event handler of @link.
+ *	NI_SETRXWATERMARK(int high, int low)
+ *		enable automatic pause/resume for @link, zero @high disable it.
+ *	NI_REPORTRXDEPTH(int depth)
+ *		report the count of items which application queued but not yet consumed for @link,
+ *		@link paused automatically when @depth reach the high watermark and resumed when it drop to the low watermark.
+ *		return 1 if @link is paused after this report, otherwise 0.
+ *	NI_SETTXRATE(int rate, int burst)
+ *	NI_GETTXRATE(int *rate, int *burst)
+ *		limit the Tx bandwidth of @link to @rate bytes per second, zero @rate remove the limit.
+ *		TCP link over IPv4 use kernel pacing(SO_MAX_PACING_RATE) and the @burst are ignored,
+ *		otherwise a token bucket with @burst bytes depth(zero for 100ms of @rate) are used, data exceed the rate are queued like a full
+ *		kernel buffer and written later, so @tcp_write/@udp_write still return -EBUSY when the queue of @link is full.
+ *	NI_SETUDPGRO(int enable)
+ *	NI_GETUDPGRO
+ *		enable/disable UDP generic receive offload(Linux 5.0 and later) on IPv4 UDP @link, or obtain the current state.
+ *		when enabled, the kernel may coalesce several datagrams of same sender into one EVT_RECEIVEDATA callback,
+ *		nis_udp_data::e::Packet::Segment carry the size of each datagram in the coalesced buffer, the last one may be shorter.
+ *	NI_SETUDPSTEER(int mode)
+ *		only for link created with UDP_FLAG_REUSEPORT, @mode UDP_STEER_CPU attach a classic BPF program to the group which select
+ *		socket by the CPU receiving the datagram, so a flow stay on one epoll thread as long as it's interrupts stay on one CPU,
+ *		UDP_STEER_HASH detach the program and restore the kernel default 4-tuple hash.
+ *	NI_GETTXQUEUE(int *count, int64_t *bytes)
+ *		obtain the count of packets and the total bytes of them which queued by framework and waiting for the kernel buffer of @link,
+ *		either pointer can be NULL. the value is only a snapshot while the other threads are writing.
+ *	NI_SETFRAME(const nis_frame_template_t *)
+ *	NI_GETFRAME(nis_frame_template_t *)
+ *		TCP only, use the built-in length-prefixed framing instead of the tcp stream template, the callbacks of tst_t are no longer called.
+ *		the head are built for every @tcp_write and several complete frames in one receive are parsed in a tight loop,
+ *		packet larger than the length field can describe are refused with -EINVAL. @NI_SETTST switch back to the stream template.
+ *		accepted links inherit the framing of listener when LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT set.
+ *		@NI_GETFRAME return -ENOENT when the link use stream template.
+ *		@NI_SETFRAME fail with -EBUSY while part of a packet has been received, change the framing on a packet boundary.
+ *	NI_SETDELIM(const void *delimiter, int length)
+ *	NI_GETDELIM(void *delimiter)
+ *		TCP only, split the received stream into lines by @delimiter of 1 to NIS_MAXIMUM_DELIMITER bytes, "\r\n" or "\0" for example,
+ *		every whole line delivered as one EVT_RECEIVEDATA without the delimiter, or with it when LINKATTR_TCP_FULLY_RECEIVE set,
+ *		empty line are delivered in zero size. stream template and built-in framing are turned off, @length zero turn delimiter framing off.
+ *		line longer than the limit of large-block(50MB) close the link. the delimiter is not appended by @tcp_write.
+ *		@NI_SETTST and @NI_SETFRAME turn delimiter framing off, accepted links inherit it when LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT set.
+ *		@NI_GETDELIM copy the delimiter into buffer of at least NIS_MAXIMUM_DELIMITER bytes and return it's length, zero when not in use.
+ *		@NI_SETDELIM fail with -EBUSY while part of a line or a packet has been received.
+ *	NI_ADDFILTER(const nis_filter_stage_t *)
+ *	NI_CLRFILTER(void)
+ *		TCP only, append a copy of stage to the filter pipeline of @link, at most NIS_MAXIMUM_FILTERS stages, -ENOSPC when it's full.
+ *		@NI_CLRFILTER remove all of them. the pipeline should be set up before data transfer, the stages are not synchronized with I/O.
+ *		filters apply to the user data of @tcp_write/@tcp_write2 and the packets delivered by stream template, built-in framing or
+ *		delimiter framing, the protocol head are built for the filtered data and never delivered even LINKATTR_TCP_FULLY_RECEIVE set.
+ *		writes with LINKATTR_TCP_NO_BUILD bypass the pipeline, @tcp_sendfile and shared buffers fail with -EOPNOTSUPP.
+ *		accepted links inherit the pipeline of listener when LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT set.
+ *	NI_SETCAPTURE(const char *)
+ *		TCP only, record the frames delivered by EVT_RECEIVEDATA and the user data of @tcp_write/@tcp_write2 to file of path,
+ *		with timestamps, the format is described by nis_capture_head. the file is created or truncated, NULL stop the capture.
+ *		frames are recorded after the filter pipeline on Rx and before it on Tx, so a replay through @tcp_write rebuild the same stream.
+ *		the links accepted later by a capturing listener record to the same file, the file is complete after all of them closed.
  */
+
 PORTABLEAPI(int) nis_cntl(objhld_t link, int cmd, ...);
 
 #endif
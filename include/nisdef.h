@@ -20,6 +20,9 @@
 #define IIS_MTU             (576)
 #define IIS_MAX_UDP_UNIT    (IIS_MTU - IP_LATER_SIZE - UDP_LAYER_SIZE)
 #define IIS_MAX_TCP_UNIT    (IIS_MTU - IP_LATER_SIZE - TCP_LAYER_SIZE)
+/* 65507, the maximum payload of one UDP GSO send, and the maximum count of segments in it */
+#define MAX_UDP_GSO_SIZE    (0xFFFF - IP_LATER_SIZE - UDP_LAYER_SIZE)
+#define MAX_UDP_GSO_SEGMENTS (64)
 
 /* types of nshost handle */
 typedef objhld_t HLNK;
@@ -49,6 +52,7 @@ typedef abuff_type(112) abuff_ipc_path_t;   /* a string with maximum length to h
 /* TCP events */
 #define EVT_TCP_ACCEPTED    (0x0013)   /* has been Accepted */
 #define EVT_TCP_CONNECTED   (0x0014)  /* success connect to remote */
+#define EVT_TCP_SENDFILE    (0x0015)  /* request of @tcp_sendfile has been completed */
 
 /* option to get link address */
 #define LINK_ADDR_LOCAL   (1)   /* get local using endpoint pair */
@@ -58,13 +62,36 @@ typedef abuff_type(112) abuff_ipc_path_t;   /* a string with maximum length to h
 #define LINKATTR_TCP_FULLY_RECEIVE                      (1) /* receive fully packet include low-level head */
 #define LINKATTR_TCP_NO_BUILD                           (2) /* not use @tst::builder when calling @tcp_write */
 #define LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT              (4) /* copy tst and attr to accepted link when syn */
+#define LINKATTR_TCP_DISPATCH                           (0x10) /* EVT_RECEIVEDATA run on the dispatch workers, see @nis_dispatch_init */
 
 /* optional  attributes of UDP link */
 #define LINKATTR_UDP_BAORDCAST                          (1)
 #define LINKATTR_UDP_MULTICAST                          (2)
+#define LINKATTR_UDP_BINARY_ADDRESS                     (0x10) /* sender delivered by @RemoteIpv4 only, @RemoteAddress are not formatted */
+#define LINKATTR_UDP_REUSEPORT                          (0x20) /* one SO_REUSEPORT socket per UDP epoll thread, creation only */
 
 /* optional attributes for both TCP/UDP */
 #define LINKATTR_NONBLOCK                               (8) /* set nonblock mode */
+#define LINKATTR_RX_TIMESTAMP                           (0x40) /* kernel software receive timestamp in @Packet.Timestamp of EVT_RECEIVEDATA */
+
+/* optional flags of @tcp_write2 */
+#define NIS_MORE            (1)     /* more data will follow, accumulate it and send with the next write without NIS_MORE or @tcp_flush */
+#define NIS_URGENT          (2)     /* queue ahead of the pending normal data, it's sent at the next packet boundary, NIS_MORE are ignored */
+
+/* the opaque packet built once and shared by many Tx requests, see @nis_buffer_create */
+typedef struct nis_buffer nis_buffer_t;
+
+/* the opaque pool of client links keyed by endpoint, see @tcp_pool_create */
+typedef struct tcp_pool tcp_pool_t;
+
+/* state of one endpoint in pool, see @tcp_pool_getstat */
+struct tcp_pool_stat {
+    int Links;              /* links of the endpoint, include the ones still connecting */
+    int Ready;              /* part of @Links which connection has been established */
+    int Outstanding;        /* requests acquired and not yet released on all links */
+    int Failures;           /* consecutive connect failures, reset by the next established connection */
+} __POSIX_TYPE_ALIGNED__;
+typedef struct tcp_pool_stat tcp_pool_stat_t;
 
 /* the definition control types for @nis_cntl */
 #define NI_SETATTR          (1)     /* set attributes */
@@ -77,6 +104,25 @@ typedef abuff_type(112) abuff_ipc_path_t;   /* a string with maximum length to h
 #define NI_GETAF            (8)     /* obtain address family */
 #define NI_GETPROTO         (9)     /* obtain protocol dependency */
 #define NI_GETRXTID         (10)    /* obtain Rx thread id(which managed in epoll or IOCP)  */
+#define NI_SETRXBUDGET      (11)    /* set the maximum bytes/frames read from a link during one wakeup */
+#define NI_GETRXBUDGET      (12)
+#define NI_PAUSERX          (13)    /* stop reading from link, the kernel receive window closes and back pressure the sender */
+#define NI_RESUMERX         (14)
+#define NI_SETRXWATERMARK   (15)    /* enable automatic pause/resume by the queue depth which application report */
+#define NI_REPORTRXDEPTH    (16)
+#define NI_SETTXRATE        (17)    /* limit the Tx bandwidth of link in bytes per second */
+#define NI_GETTXRATE        (18)
+#define NI_SETUDPGRO        (19)    /* deliver coalesced datagrams(UDP generic receive offload) to callback */
+#define NI_GETUDPGRO        (20)
+#define NI_SETUDPSTEER      (21)    /* attach a steering program to the sockets of UDP_FLAG_REUSEPORT link */
+#define NI_GETTXQUEUE       (22)    /* obtain the count and bytes of Tx packets queued by framework */
+#define NI_SETFRAME         (23)    /* use built-in length-prefixed framing instead of the stream template */
+#define NI_GETFRAME         (24)
+#define NI_SETDELIM         (25)    /* split the TCP stream by delimiter, CRLF or NUL terminated lines for example */
+#define NI_GETDELIM         (26)
+#define NI_ADDFILTER        (27)    /* append a stage to the Rx/Tx filter pipeline of TCP link, compression or integrity check for example */
+#define NI_CLRFILTER        (28)
+#define NI_SETCAPTURE       (29)    /* record the frames of TCP link to file, replay them later to reproduce the traffic */
 
 /* the dotted decimal notation for IPv4 or IPv6 */
 struct nis_inet_addr {
@@ -135,6 +181,103 @@ struct __tcp_stream_template {
 
 typedef struct __tcp_stream_template tst_t;
 
+/*  built-in length-prefixed framing, the protocol head are declared as data instead of the callbacks of tst_t,
+ *  framework parse and build the head inline, the complete frames in one receive are delivered one by one without copy.
+ *           @cb_                bytes of protocol head, no more than 32
+ *           @offset             offset of the length field in protocol head
+ *           @width              bytes of the length field, 2 or 4
+ *           @flags              NIS_FRAME_BIG_ENDIAN: the length field is in network byte order, otherwise little-endian
+ *                               NIS_FRAME_INCLUSIVE: the length field count the protocol head too, otherwise only the user data
+ *   the other bytes of protocol head are zero when build
+ */
+#define NIS_FRAME_BIG_ENDIAN    (1)
+#define NIS_FRAME_INCLUSIVE     (2)
+
+struct nis_frame_template {
+    int cb_;
+    int offset;
+    int width;
+    int flags;
+} __POSIX_TYPE_ALIGNED__;
+
+typedef struct nis_frame_template nis_frame_template_t;
+
+/* the longest delimiter of delimiter framing(NI_SETDELIM) */
+#define NIS_MAXIMUM_DELIMITER   (8)
+
+/*  filter pipeline of TCP link(NI_ADDFILTER), stages are ordered from the wire to the application:
+ *  the user data of received packet pass @on_rx of stage 0, 1 ... n-1 on the Rx thread before EVT_RECEIVEDATA,
+ *  the data of @tcp_write pass @on_tx of stage n-1 ... 0 on the calling thread before the protocol head are built.
+ *           @on_rx/@on_tx       transform @frame, NULL bypass the direction.
+ *                               a stage rewrite @frame->data and @frame->size in place, or output to the buffer of @nis_filter_reserve.
+ *                               the first Tx stage may see the memory of caller, it MUST NOT be modified in place.
+ *                               @on_tx may be called by several writing threads at the same time.
+ *                               failure of @on_rx close the link, failure of @on_tx fail the write.
+ *           @context            pass to the hooks as is
+ *   @buffer and @capacity of nis_filter_frame are maintained by framework, they are released after the last stage.
+ */
+#define NIS_MAXIMUM_FILTERS     (8)
+
+struct nis_filter_frame {
+    unsigned char *data;
+    int size;
+    unsigned char *buffer[2];
+    int capacity[2];
+};
+
+typedef struct nis_filter_frame nis_filter_frame_t;
+typedef nsp_status_t( STDCALL *nis_filter_fp)(void *context, nis_filter_frame_t *frame);
+
+struct nis_filter_stage {
+    nis_filter_fp on_rx;
+    nis_filter_fp on_tx;
+    void *context;
+} __POSIX_TYPE_ALIGNED__;
+
+typedef struct nis_filter_stage nis_filter_stage_t;
+
+/*  traffic capture file(NI_SETCAPTURE), a struct nis_capture_head followed by records, each record is a struct nis_capture_record
+ *  followed by @size bytes of frame. all integers are little-endian.
+ *           @magic              NIS_CAPTURE_MAGIC
+ *           @realtime           wall clock in nanoseconds when capture start
+ *           @framing            NIS_CAPTURE_FRAMING_*, how the frames are split from stream when they were captured,
+ *                               with @frame for built-in framing and @delimiter for delimiter framing
+ *           @timestamp          nanoseconds since capture start
+ *           @stream             the link which the frame belong to, accepted links of a capturing listener share it's file
+ *           @flags              NIS_CAPTURE_OUTBOUND: written by @tcp_write/@tcp_write2, otherwise delivered by EVT_RECEIVEDATA
+ *                               NIS_CAPTURE_HEAD: the frame include the protocol head or the delimiter(LINKATTR_TCP_FULLY_RECEIVE,
+ *                               LINKATTR_TCP_NO_BUILD), otherwise it's the user data
+ */
+#define NIS_CAPTURE_MAGIC               "NAXCAP01"
+
+#define NIS_CAPTURE_FRAMING_TST         (0)
+#define NIS_CAPTURE_FRAMING_FRAME       (1)
+#define NIS_CAPTURE_FRAMING_DELIMITER   (2)
+#define NIS_CAPTURE_FRAMING_RAW         (3)
+
+#define NIS_CAPTURE_OUTBOUND    (1)
+#define NIS_CAPTURE_HEAD        (2)
+
+struct nis_capture_head {
+    char magic[8];
+    uint64_t realtime;
+    struct nis_frame_template frame;
+    unsigned char delimiter[NIS_MAXIMUM_DELIMITER];
+    int delimiter_cb;
+    int framing;
+} __POSIX_TYPE_ALIGNED__;
+
+struct nis_capture_record {
+    uint64_t timestamp;
+    uint32_t stream;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t reserved;
+} __POSIX_TYPE_ALIGNED__;
+
+typedef struct nis_capture_head nis_capture_head_t;
+typedef struct nis_capture_record nis_capture_record_t;
+
 /*  @nis_serializer_fp target object use for @tcp_write or @udp_write procedure call,
  *  when:
  *  @origin is a pointer to a C-style strcuture object without 1 byte aligned,
@@ -155,6 +298,10 @@ struct nis_tcp_data {
         struct {
             const unsigned char *Data;
             int Size;
+            /* wall clock in nanoseconds when the kernel received the last segment of this packet, zero when link has no attribute
+                LINKATTR_RX_TIMESTAMP or the kernel not report it(IPC link, or the first packets after the attribute set since kernel
+                turn on the stamping asynchronously) */
+            uint64_t Timestamp;
         } Packet;
 
         /* only used in case of EVT_TCP_ACCEPTED,
@@ -168,6 +315,18 @@ struct nis_tcp_data {
         struct {
             void *Context;
         } PreClose;
+
+        /* only used in case of EVT_TCP_SENDFILE,
+            @Fd, @Offset and @Length are the same as the request of @tcp_sendfile,
+            @Sent of bytes of file has been written to kernel, it less than @Length when the request are canceled,
+            @Status is zero on success, -ECANCELED when link closed before completion, otherwise the error of syscall */
+        struct {
+            int Fd;
+            nsp_status_t Status;
+            int64_t Offset;
+            int64_t Length;
+            int64_t Sent;
+        } SendFile;
     } e;
 }__POSIX_TYPE_ALIGNED__;
 
@@ -180,18 +339,33 @@ typedef struct nis_tcp_data tcp_data_t;
 #define UDP_FLAG_UNITCAST       (UDP_FLAG_NONE)
 #define UDP_FLAG_BROADCAST      (LINKATTR_UDP_BAORDCAST)
 #define UDP_FLAG_MULTICAST      (LINKATTR_UDP_MULTICAST)
+#define UDP_FLAG_REUSEPORT      (LINKATTR_UDP_REUSEPORT)
+
+/* how the kernel pick one socket of a UDP_FLAG_REUSEPORT link for incoming datagram, see NI_SETUDPSTEER */
+#define UDP_STEER_HASH          (0)     /* kernel default, hash of the 4-tuple, a flow always arrive at the same socket */
+#define UDP_STEER_CPU           (1)     /* classic BPF select the socket by the CPU which receive the datagram */
 
 struct nis_udp_data {
     union {
         /* only used in case of EVT_RECEIVEDATA,
             @Size of bytes of data storage in @Data has been received from kernel,
-            the sender endpoint is @RemoteAddress:@RemotePort */
+            the sender endpoint is @RemoteAddress:@RemotePort, or @RemoteIpv4:@RemotePort in binary.
+            @RemoteAddress is empty when link has attribute LINKATTR_UDP_BINARY_ADDRESS, use naos_ipv4tos(@RemoteIpv4) on demand */
         struct {
             const unsigned char *Data;
             int Size;
             char RemoteAddress[16];
             const char *Domain;
             unsigned short RemotePort;
+            /* IPv4 address of sender in host byte order, same as @udp_getaddr, zero when received from UNIX domain */
+            uint32_t RemoteIpv4;
+
+            /* size of each datagram coalesced in @Data when UDP GRO enabled by NI_SETUDPGRO, the last one may be shorter,
+                equal to @Size when @Data is a single datagram */
+            int Segment;
+
+            /* wall clock in nanoseconds when the kernel received this datagram, zero when link has no attribute LINKATTR_RX_TIMESTAMP */
+            uint64_t Timestamp;
         } Packet;
 
         /* only used in case of EVT_PRE_CLOSE,
@@ -246,4 +420,43 @@ struct __ifmisc {
 }__POSIX_TYPE_ALIGNED__;
 typedef struct __ifmisc ifmisc_t;
 
+/* occupancy of the central buffer pool, all counters in bytes except @Regions */
+struct nis_pool_statistics {
+    uint64_t Mapped;        /* total size of regions mapped by pool */
+    uint64_t HugeTlb;       /* part of @Mapped which backed by reserved huge page(MAP_HUGETLB) */
+    uint64_t Advised;       /* part of @Mapped which advised to transparent huge page */
+    uint64_t Inuse;         /* buffers carved from regions and hold by links */
+    uint64_t Cached;        /* buffers carved from regions and wait for reuse in free list */
+    uint64_t Fallback;      /* buffers hold by links but served by heap, the request larger than pool or the pool disabled */
+    int Regions;
+} __POSIX_TYPE_ALIGNED__;
+
+struct nis_dispatch_statistics {
+    uint64_t Dispatched;    /* packets delivered by dispatch workers */
+    uint64_t Lent;          /* part of @Dispatched which buffer handed over to worker without copy */
+    uint64_t Copied;        /* part of @Dispatched which copied out of the parse cache or shared memory ring */
+    uint64_t Latency;       /* total nanoseconds between the packet parsed and it's callback begin, divide by @Dispatched for average */
+    uint64_t MaximumLatency;
+    int Workers;            /* zero when dispatch workers are not running */
+} __POSIX_TYPE_ALIGNED__;
+
+/* packets of the links with attribute LINKATTR_RX_TIMESTAMP, the latency count from the kernel receive to the callback begin,
+    so it include the time spent in socket buffer, the Rx thread and the dispatch workers.
+    @Histogram[0] count the latency less than 1us, @Histogram[i] count [2^(i-1), 2^i) us, the last one count all above */
+#define NIS_RX_LATENCY_BUCKETS  (32)
+
+struct nis_rx_statistics {
+    uint64_t Stamped;       /* packets delivered with kernel timestamp */
+    uint64_t Latency;       /* total nanoseconds, divide by @Stamped for average */
+    uint64_t MaximumLatency;
+    uint64_t Histogram[NIS_RX_LATENCY_BUCKETS];
+} __POSIX_TYPE_ALIGNED__;
+
+struct nis_statistics {
+    struct nis_pool_statistics Pool;
+    struct nis_dispatch_statistics Dispatch;
+    struct nis_rx_statistics Rx;
+} __POSIX_TYPE_ALIGNED__;
+typedef struct nis_statistics nis_statistics_t;
+
 #endif
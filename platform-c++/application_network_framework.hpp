@@ -7,6 +7,7 @@
 #include <mutex>
 
 #include "network_handler.h"
+#include "swnet.h"
 #include "serialize.hpp"
 #include "log.h"
 #include "old.hpp"
@@ -276,6 +277,115 @@ namespace nsp {
         };
         typedef tcp_application_client<nsp::proto::nspdef::protocol> nsp_application_client;
 
+        // the client sessions to backends keep established in pool(@tcp_pool_create), request path acquire a connected session
+        // instead of connect on demand, the sessions are shared by requests, the least busy one is handed out.
+        // @T is the session class like @tcp_application_client, it MUST be constructible by HTCPLINK,
+        // the object are created when connection established and owned by framework as well as the other sessions,
+        // so @on_connected/@on_disconnected of T are called as usual.
+        template<class T>
+        class tcp_application_pool
+        {
+            tcp_pool_t *pool_ = nullptr;
+
+            tcp_application_pool(const tcp_application_pool &) = delete;
+            tcp_application_pool &operator=(const tcp_application_pool &) = delete;
+
+            // bind session object to the link as soon as it established, then redirect to the common dispatcher
+            static void STDCALL tcp_io(const nis_event_t *tcp_evt, const void *data)
+            {
+                if (tcp_evt && EVT_TCP_CONNECTED == tcp_evt->Event) {
+                    try {
+                        std::shared_ptr<T> sptr = std::make_shared<T>(tcp_evt->Ln.Tcp.Link);
+                        if (sptr->attach().expired()) {
+                            ::tcp_destroy(tcp_evt->Ln.Tcp.Link);
+                            return;
+                        }
+                    } catch (...) {
+                        ::tcp_destroy(tcp_evt->Ln.Tcp.Link);
+                        return;
+                    }
+                }
+                swnet::tcp_io(tcp_evt, data);
+            }
+
+        public:
+            tcp_application_pool()
+            {
+                ::tcp_init2(0);
+            }
+
+            virtual ~tcp_application_pool()
+            {
+                close();
+            }
+
+            // each endpoint keep at least @min and at most @max sessions
+            nsp_status_t create(int min, int max)
+            {
+                if (pool_) {
+                    return posix__makeerror(EEXIST);
+                }
+
+                pool_ = ::tcp_pool_create(&tcp_application_pool<T>::tcp_io, NULL, min, max);
+                return pool_ ? NSP_STATUS_SUCCESSFUL : posix__makeerror(EINVAL);
+            }
+
+            void close()
+            {
+                if (pool_) {
+                    ::tcp_pool_destroy(pool_);
+                    pool_ = nullptr;
+                }
+            }
+
+            // connect the minimum sessions to @ep ahead of the first request
+            nsp_status_t prewarm(const endpoint &ep)
+            {
+                if (!pool_) {
+                    return NSP_STATUS_FATAL;
+                }
+                return ::tcp_pool_prewarm(pool_, ep.ipv4(), ep.port());
+            }
+
+            // nullptr when there is no established session to @ep yet, the connects have been started in background
+            std::shared_ptr<T> acquire(const endpoint &ep)
+            {
+                HTCPLINK lnk;
+                std::shared_ptr<obtcp> object;
+
+                if (!pool_) {
+                    return nullptr;
+                }
+
+                if (!NSP_SUCCESS(::tcp_pool_acquire(pool_, ep.ipv4(), ep.port(), &lnk))) {
+                    return nullptr;
+                }
+
+                // the pool know the connection earlier than the session object attached
+                if (!NSP_SUCCESS(nsp::toolkit::singleton<swnet>::instance()->tcp_search(lnk, object))) {
+                    ::tcp_pool_release(pool_, lnk);
+                    return nullptr;
+                }
+                return std::static_pointer_cast<T>(object);
+            }
+
+            // the request on @session finished, the session stay in pool
+            void release(const std::shared_ptr<T> &session)
+            {
+                if (pool_ && session) {
+                    ::tcp_pool_release(pool_, session->link());
+                }
+            }
+
+            nsp_status_t getstat(const endpoint &ep, tcp_pool_stat_t &stat) const
+            {
+                if (!pool_) {
+                    return NSP_STATUS_FATAL;
+                }
+                return ::tcp_pool_getstat(pool_, ep.ipv4(), ep.port(), &stat);
+            }
+        };
+
         class udp_application_client : public obudp
         {
         public:
@@ -315,6 +315,14 @@ namespace nsp {
 			return epstr;
 		}
 
+		endpoint inet4_endpoint::to_endpoint() const
+		{
+			endpoint ep;
+			ep.ipv4( address );
+			ep.port( port );
+			return ep;
+		}
+
 		nsp_status_t endpoint::build( const std::string &epstr, endpoint &ep )
 		{
 			std::string ipstr;
@@ -73,6 +73,14 @@ namespace nsp {
             u32_ipv4_t address_;
         };
 
+        // 二进制形式的地址端口, 可平凡拷贝, 接收路径上直接传递, 仅在需要时才由 to_endpoint 格式化为字符串
+        struct inet4_endpoint {
+            u32_ipv4_t address; // 主机字节序, 与 udp_getaddr 一致
+            port_t port;
+
+            endpoint to_endpoint() const;
+        };
+
     } // namespace tcpip
 } // nsp
 
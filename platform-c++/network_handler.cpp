@@ -256,6 +256,23 @@ namespace nsp {
             return NSP_STATUS_FATAL;
         }
 
+        // 累积小包, 在下一次 send 或 flush 时一次性发出
+        nsp_status_t obtcp::sendmore(const unsigned char *data, int cb)
+        {
+            if (INVALID_HTCPLINK != lnk_ && cb > 0 && data) {
+                return ::tcp_write2(lnk_, data, cb, NULL, NIS_MORE);
+            }
+            return NSP_STATUS_FATAL;
+        }
+
+        nsp_status_t obtcp::flush()
+        {
+            if (INVALID_HTCPLINK != lnk_) {
+                return ::tcp_flush(lnk_);
+            }
+            return NSP_STATUS_FATAL;
+        }
+
         const endpoint &obtcp::local() const
         {
             return local_;
@@ -266,6 +283,11 @@ namespace nsp {
             return remote_;
         }
 
+        HTCPLINK obtcp::link() const
+        {
+            return lnk_;
+        }
+
         void obtcp::on_pre_close(void *context)
         {
             ;
@@ -439,6 +461,13 @@ namespace nsp {
             }
         }
 
+        void obudp::on_recvdata(const unsigned char *data, const int cb, const inet4_endpoint &r_ep)
+        {
+            if (INVALID_HUDPLINK != lnk_ && data && cb > 0 && r_ep.port > 0) {
+                on_recvdata(std::basic_string<unsigned char>(data, cb), r_ep.to_endpoint());
+            }
+        }
+
         void obudp::on_pre_close(void *context)
         {
             ;
@@ -35,8 +35,11 @@ namespace nsp {
             nsp_status_t listen();
             nsp_status_t send(const void *origin, int cb, const nis_serializer_fp serializer);
             nsp_status_t send(const unsigned char *data, int cb);
+            nsp_status_t sendmore(const unsigned char *data, int cb);
+            nsp_status_t flush();
             const endpoint &local() const;
             const endpoint &remote() const;
+            HTCPLINK link() const;
 
             template<class T>
             void settst() {
@@ -90,6 +93,8 @@ namespace nsp {
             const endpoint &local() const;
             void setlnk(const HUDPLINK lnk);
             void on_recvdata(const unsigned char *data, const int cb, const char *ipaddr, const port_t port);
+            // 默认实现在此时才构造数据串和 endpoint, 并转到 on_recvdata(data, r_ep), 高频接收的派生类应重写此函数避免字符串往返
+            virtual void on_recvdata(const unsigned char *data, const int cb, const inet4_endpoint &r_ep);
             void on_closed();
             virtual void on_pre_close(void *context);
 
@@ -53,11 +53,10 @@ namespace nsp {
             switch (udp_evt->Event) {
                 case EVT_RECEIVEDATA:
                     toolkit::singleton<swnet>::instance()->udp_refobj(udp_evt->Ln.Udp.Link, [&] (const std::shared_ptr<obudp> &object) {
-                        object->on_recvdata(
-                                ((udp_data_t *) data)->e.Packet.Data,
-                                ((udp_data_t *) data)->e.Packet.Size,
-                                ((udp_data_t *) data)->e.Packet.RemoteAddress,
-                                ((udp_data_t *) data)->e.Packet.RemotePort);
+                        inet4_endpoint r_ep;
+                        r_ep.address = ((udp_data_t *) data)->e.Packet.RemoteIpv4;
+                        r_ep.port = ((udp_data_t *) data)->e.Packet.RemotePort;
+                        object->on_recvdata(((udp_data_t *) data)->e.Packet.Data, ((udp_data_t *) data)->e.Packet.Size, r_ep);
                     });
                     break;
                 case EVT_PRE_CLOSE:
@@ -143,6 +142,12 @@ namespace nsp {
                 return NSP_STATUS_FATAL;
             }
 
+            // udp_io 只使用二进制的对端地址, 不需要底层逐包格式化字符串
+            int attr = ::nis_cntl(lnk, NI_GETATTR);
+            if (attr >= 0) {
+                ::nis_cntl(lnk, NI_SETATTR, attr | LINKATTR_UDP_BINARY_ADDRESS);
+            }
+
             object->setlnk(lnk);
 
             std::lock_guard < decltype(this->lock_udp_redirection_) > guard(lock_udp_redirection_);
@@ -34,6 +34,8 @@ namespace nsp {
 
             // c-d
             friend class nsp::toolkit::singleton<swnet>;
+            // the pool redirect the events of links it created, and search the object of link it handed out
+            template<class T> friend class tcp_application_pool;
             swnet();
             ~swnet();
 
@@ -334,7 +334,7 @@ static struct avltree_node_t *_avldoublerotateright(struct avltree_node_t *tree)
     return newtree;
 }
 
-struct avltree_node_t * avllowerbound(avltree_node_t *tree, avltree_node_t *node, int( *compare)(const void *, const void *))
+struct avltree_node_t * avllowerbound(struct avltree_node_t *tree, struct avltree_node_t *node, int( *compare)(const void *, const void *))
 {
     int ret;
     struct avltree_node_t *cursor;
@@ -354,7 +354,7 @@ struct avltree_node_t * avllowerbound(avltree_node_t *tree, avltree_node_t *node
     }
 }
 
-struct avltree_node_t * avlupperbound(avltree_node_t *tree, avltree_node_t *node, int( *compare)(const void *, const void *))
+struct avltree_node_t * avlupperbound(struct avltree_node_t *tree, struct avltree_node_t *node, int( *compare)(const void *, const void *))
 {
     int ret;
     struct avltree_node_t *cursor;
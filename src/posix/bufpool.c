@@ -0,0 +1,237 @@
+#include "bufpool.h"
+
+#include "zmalloc.h"
+#include "mxx.h"
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* size classes in 512 bytes step until 128KB, then power of 2 until 1MB */
+#define BUFPOOL_FINE_SHIFT          (9)
+#define BUFPOOL_FINE_LIMIT          (0x20000)
+#define BUFPOOL_FINE_CLASSES        (BUFPOOL_FINE_LIMIT >> BUFPOOL_FINE_SHIFT)
+#define BUFPOOL_COARSE_CLASSES      (3)
+#define BUFPOOL_CLASSES             (BUFPOOL_FINE_CLASSES + BUFPOOL_COARSE_CLASSES)
+#define BUFPOOL_MAXIMUM_SIZE        (0x100000)
+#define BUFPOOL_HEAP                (0xFFFF)
+#define BUFPOOL_MAGIC               (0x4250)
+
+/* regions are multiple of huge page and aligned to it, a region hold 8 buffers at least */
+#define BUFPOOL_HUGE_PAGE_SIZE      (0x200000)
+#define BUFPOOL_REGION_SIZE         (0x400000)
+#define BUFPOOL_REGION_BUFFERS      (8)
+
+/* placed before each buffer, keep the buffer 16 bytes aligned as malloc(3) does */
+struct bufpool_head {
+    uint16_t klass;
+    uint16_t magic;
+    uint32_t reserved;
+    uint64_t size;  /* size of the whole block, include this head */
+};
+
+struct bufpool_free_node {
+    struct bufpool_free_node *next;
+};
+
+struct bufpool_class {
+    pthread_mutex_t lock;
+    struct bufpool_free_node *free;
+    unsigned char *cursor;  /* the next buffer carve from current region */
+    unsigned char *limit;
+    size_t size;    /* size of each buffer in this class, include the head */
+};
+
+static struct bufpool_class __bufpool_class[BUFPOOL_CLASSES];
+static struct nis_pool_statistics __bufpool_stat;
+static pthread_once_t __bufpool_once = PTHREAD_ONCE_INIT;
+static int __bufpool_enabled = 0;
+
+static void _bufpool_init()
+{
+    const char *env;
+    int i;
+
+    env = getenv("NAX_BUFPOOL");
+    __bufpool_enabled = (env && '0' == env[0]) ? 0 : 1;
+
+    for (i = 0; i < BUFPOOL_CLASSES; i++) {
+        if (i < BUFPOOL_FINE_CLASSES) {
+            __bufpool_class[i].size = (size_t)(i + 1) << BUFPOOL_FINE_SHIFT;
+        } else {
+            __bufpool_class[i].size = (size_t)BUFPOOL_FINE_LIMIT << (i - BUFPOOL_FINE_CLASSES + 1);
+        }
+        __bufpool_class[i].free = NULL;
+        __bufpool_class[i].cursor = NULL;
+        __bufpool_class[i].limit = NULL;
+        pthread_mutex_init(&__bufpool_class[i].lock, NULL);
+    }
+}
+
+static int _bufpool_class(size_t size)
+{
+    int klass;
+
+    if (size <= BUFPOOL_FINE_LIMIT) {
+        return (int)((size + (1 << BUFPOOL_FINE_SHIFT) - 1) >> BUFPOOL_FINE_SHIFT) - 1;
+    }
+
+    klass = BUFPOOL_FINE_CLASSES;
+    while (klass < BUFPOOL_CLASSES && __bufpool_class[klass].size < size) {
+        klass++;
+    }
+    return klass;
+}
+
+/* map a region aligned to huge page, try the reserved huge page first, then advise the plain pages to THP */
+static unsigned char *_bufpool_map_region(size_t size)
+{
+    unsigned char *region, *aligned;
+    size_t head, tail;
+
+    region = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED != region) {
+        __atomic_add_fetch(&__bufpool_stat.HugeTlb, size, __ATOMIC_RELAXED);
+        return region;
+    }
+
+    /* over map one huge page and trim both side for the alignment */
+    region = (unsigned char *)mmap(NULL, size + BUFPOOL_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == region) {
+        mxx_call_ecr("Fatal syscall mmap(2) for buffer pool, size:%zu, error:%d", size, errno);
+        return NULL;
+    }
+
+    aligned = (unsigned char *)(((uintptr_t)region + BUFPOOL_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)BUFPOOL_HUGE_PAGE_SIZE - 1));
+    head = aligned - region;
+    tail = BUFPOOL_HUGE_PAGE_SIZE - head;
+    if (head > 0) {
+        munmap(region, head);
+    }
+    if (tail > 0) {
+        munmap(aligned + size, tail);
+    }
+
+    if (0 == madvise(aligned, size, MADV_HUGEPAGE)) {
+        __atomic_add_fetch(&__bufpool_stat.Advised, size, __ATOMIC_RELAXED);
+    }
+    return aligned;
+}
+
+static struct bufpool_head *_bufpool_carve(int klass)
+{
+    struct bufpool_class *bc;
+    struct bufpool_head *head;
+    unsigned char *region;
+    size_t size;
+
+    bc = &__bufpool_class[klass];
+
+    pthread_mutex_lock(&bc->lock);
+    do {
+        if (bc->free) {
+            head = (struct bufpool_head *)bc->free;
+            bc->free = bc->free->next;
+            __atomic_sub_fetch(&__bufpool_stat.Cached, bc->size, __ATOMIC_RELAXED);
+            break;
+        }
+
+        /* the tail of exhausted region are wasted, it's less than one buffer */
+        if (!bc->cursor || bc->cursor + bc->size > bc->limit) {
+            size = bc->size * BUFPOOL_REGION_BUFFERS;
+            size = (size < BUFPOOL_REGION_SIZE) ? BUFPOOL_REGION_SIZE : (size + BUFPOOL_HUGE_PAGE_SIZE - 1) & ~((size_t)BUFPOOL_HUGE_PAGE_SIZE - 1);
+            region = _bufpool_map_region(size);
+            if (!region) {
+                head = NULL;
+                break;
+            }
+            bc->cursor = region;
+            bc->limit = region + size;
+            __atomic_add_fetch(&__bufpool_stat.Mapped, size, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&__bufpool_stat.Regions, 1, __ATOMIC_RELAXED);
+        }
+
+        head = (struct bufpool_head *)bc->cursor;
+        bc->cursor += bc->size;
+    } while (0);
+    pthread_mutex_unlock(&bc->lock);
+
+    return head;
+}
+
+void *bufpool_alloc(size_t size)
+{
+    struct bufpool_head *head;
+    int klass;
+
+    pthread_once(&__bufpool_once, &_bufpool_init);
+
+    size += sizeof(struct bufpool_head);
+    head = NULL;
+    klass = BUFPOOL_HEAP;
+    if (likely(__bufpool_enabled) && size <= BUFPOOL_MAXIMUM_SIZE) {
+        klass = _bufpool_class(size);
+        head = _bufpool_carve(klass);
+        if (likely(head)) {
+            size = __bufpool_class[klass].size;
+            __atomic_add_fetch(&__bufpool_stat.Inuse, size, __ATOMIC_RELAXED);
+        } else {
+            klass = BUFPOOL_HEAP;
+        }
+    }
+
+    /* pool disabled, size beyond the pool or the pool exhausted */
+    if (BUFPOOL_HEAP == klass) {
+        head = (struct bufpool_head *)ztrymalloc(size);
+        if (unlikely(!head)) {
+            return NULL;
+        }
+        __atomic_add_fetch(&__bufpool_stat.Fallback, size, __ATOMIC_RELAXED);
+    }
+
+    head->klass = (uint16_t)klass;
+    head->magic = BUFPOOL_MAGIC;
+    head->size = size;
+    return (void *)(head + 1);
+}
+
+void bufpool_free(void *ptr)
+{
+    struct bufpool_head *head;
+    struct bufpool_class *bc;
+    struct bufpool_free_node *node;
+
+    if (unlikely(!ptr)) {
+        return;
+    }
+
+    head = ((struct bufpool_head *)ptr) - 1;
+    assert(BUFPOOL_MAGIC == head->magic);
+
+    if (BUFPOOL_HEAP == head->klass) {
+        __atomic_sub_fetch(&__bufpool_stat.Fallback, head->size, __ATOMIC_RELAXED);
+        zfree(head);
+        return;
+    }
+
+    bc = &__bufpool_class[head->klass];
+    __atomic_sub_fetch(&__bufpool_stat.Inuse, bc->size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&__bufpool_stat.Cached, bc->size, __ATOMIC_RELAXED);
+
+    node = (struct bufpool_free_node *)head;
+    pthread_mutex_lock(&bc->lock);
+    node->next = bc->free;
+    bc->free = node;
+    pthread_mutex_unlock(&bc->lock);
+}
+
+void bufpool_getstat(struct nis_pool_statistics *stat)
+{
+    stat->Mapped = __atomic_load_n(&__bufpool_stat.Mapped, __ATOMIC_RELAXED);
+    stat->HugeTlb = __atomic_load_n(&__bufpool_stat.HugeTlb, __ATOMIC_RELAXED);
+    stat->Advised = __atomic_load_n(&__bufpool_stat.Advised, __ATOMIC_RELAXED);
+    stat->Inuse = __atomic_load_n(&__bufpool_stat.Inuse, __ATOMIC_RELAXED);
+    stat->Cached = __atomic_load_n(&__bufpool_stat.Cached, __ATOMIC_RELAXED);
+    stat->Fallback = __atomic_load_n(&__bufpool_stat.Fallback, __ATOMIC_RELAXED);
+    stat->Regions = __atomic_load_n(&__bufpool_stat.Regions, __ATOMIC_RELAXED);
+}
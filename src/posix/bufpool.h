@@ -0,0 +1,26 @@
+#ifndef BUFPOOL_H_20231021
+#define BUFPOOL_H_20231021
+
+#include "compiler.h"
+#include "nisdef.h"
+
+/*
+ *  central pool of the network buffers(Rx buffers of TCP/UDP links, large-block of TCP, big objects of Tx slab),
+ *  tens of thousands of these buffers scattered across the heap cause heavy TLB pressure.
+ *
+ *  buffers are carved in fixed size from regions which mapped with MAP_HUGETLB, or advised to transparent huge page when
+ *  no huge page reserved, or plain pages at last. each size class carve it's own regions, freed buffers go back to free list of class
+ *  and regions never return to system.
+ *  the size are rounded up to 512 bytes until 128KB, then power of 2 until 1MB, request larger than that forward to @ztrymalloc.
+ *
+ *  environment variable NAX_BUFPOOL=0 disable the pool, every request forward to @ztrymalloc, it's only useful for comparison.
+ */
+
+extern
+void *bufpool_alloc(size_t size);
+extern
+void bufpool_free(void *ptr);
+extern
+void bufpool_getstat(struct nis_pool_statistics *stat);
+
+#endif
@@ -0,0 +1,270 @@
+#include "capture.h"
+
+#include "mxx.h"
+#include "zmalloc.h"
+#include "threading.h"
+#include "atom.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <time.h>
+
+/* records are accumulate here before written to file, a larger record are written directly */
+#define CAPTURE_BUFFER_SIZE     (0x10000)
+
+struct capture {
+    int refcnt;
+    /* serialize the recording links, the timestamps are taken under it so they are ordered in file */
+    lwp_mutex_t lock;
+    int fd;
+    uint64_t begin;
+    unsigned char *buffer;
+    int used;
+    /* nonzero after a write failure, the later records are dropped */
+    int failed;
+};
+
+static uint64_t _capture_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _capture_write(struct capture *capture, const void *data, int cb)
+{
+    int offset;
+    int wcb;
+
+    offset = 0;
+    while (!capture->failed && offset < cb) {
+        wcb = write(capture->fd, (const unsigned char *)data + offset, cb - offset);
+        if (wcb < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            mxx_call_ecr("Fatal syscall write(2) on capture file, error:%d", errno);
+            capture->failed = 1;
+            break;
+        }
+        offset += wcb;
+    }
+}
+
+static void _capture_flush(struct capture *capture)
+{
+    if (capture->used > 0) {
+        _capture_write(capture, capture->buffer, capture->used);
+        capture->used = 0;
+    }
+}
+
+static void _capture_release(struct capture *capture)
+{
+    if (0 != atom_subone(&capture->refcnt)) {
+        return;
+    }
+
+    lwp_mutex_lock(&capture->lock);
+    _capture_flush(capture);
+    lwp_mutex_unlock(&capture->lock);
+
+    close(capture->fd);
+    lwp_mutex_uninit(&capture->lock);
+    zfree(capture->buffer);
+    zfree(capture);
+}
+
+/* the file head describe how the frames were split from stream, the replayer build the stream in same way */
+static void _capture_head(const ncb_t *ncb, struct nis_capture_head *head)
+{
+    struct timespec ts;
+
+    memset(head, 0, sizeof(*head));
+    memcpy(head->magic, NIS_CAPTURE_MAGIC, sizeof(head->magic));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    head->realtime = htole64((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+
+    if (__atomic_load_n(&ncb->u.tcp.delimiter_cb, __ATOMIC_ACQUIRE) > 0) {
+        head->framing = htole32(NIS_CAPTURE_FRAMING_DELIMITER);
+        memcpy(head->delimiter, ncb->u.tcp.delimiter, sizeof(head->delimiter));
+        head->delimiter_cb = htole32(ncb->u.tcp.delimiter_cb);
+    } else if (__atomic_load_n(&ncb->u.tcp.frame.width, __ATOMIC_ACQUIRE) > 0) {
+        head->framing = htole32(NIS_CAPTURE_FRAMING_FRAME);
+        head->frame.cb_ = htole32(ncb->u.tcp.frame.cb_);
+        head->frame.offset = htole32(ncb->u.tcp.frame.offset);
+        head->frame.width = htole32(ncb->u.tcp.frame.width);
+        head->frame.flags = htole32(ncb->u.tcp.frame.flags);
+    } else if (0 == ncb->u.tcp.template.cb_ && !ncb->u.tcp.template.parser_) {
+        head->framing = htole32(NIS_CAPTURE_FRAMING_RAW);
+    } else {
+        head->framing = htole32(NIS_CAPTURE_FRAMING_TST);
+    }
+}
+
+static nsp_status_t _capture_create(const ncb_t *ncb, const char *path, struct capture **output)
+{
+    struct capture *capture;
+    struct nis_capture_head head;
+
+    capture = (struct capture *)ztrymalloc(sizeof(*capture));
+    if (!capture) {
+        return posix__makeerror(ENOMEM);
+    }
+    memset(capture, 0, sizeof(*capture));
+
+    capture->buffer = (unsigned char *)ztrymalloc(CAPTURE_BUFFER_SIZE);
+    if (!capture->buffer) {
+        zfree(capture);
+        return posix__makeerror(ENOMEM);
+    }
+
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fd < 0) {
+        mxx_call_ecr("Fatal syscall open(2) for capture file \"%s\", error:%d", path, errno);
+        zfree(capture->buffer);
+        zfree(capture);
+        return posix__makeerror(errno);
+    }
+
+    _capture_head(ncb, &head);
+    memcpy(capture->buffer, &head, sizeof(head));
+    capture->used = sizeof(head);
+    capture->begin = _capture_now();
+    capture->refcnt = 1;
+    lwp_mutex_init(&capture->lock, nsp_false);
+
+    *output = capture;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+void capture_init_link(ncb_t *ncb)
+{
+    ncb->capture = NULL;
+    lwp_mutex_init(&ncb->capture_lock, nsp_false);
+}
+
+void capture_uninit_link(ncb_t *ncb)
+{
+    struct capture *capture;
+
+    lwp_mutex_lock(&ncb->capture_lock);
+    capture = __atomic_exchange_n(&ncb->capture, NULL, __ATOMIC_ACQ_REL);
+    lwp_mutex_unlock(&ncb->capture_lock);
+
+    if (capture) {
+        _capture_release(capture);
+    }
+    lwp_mutex_uninit(&ncb->capture_lock);
+}
+
+nsp_status_t capture_start(ncb_t *ncb, const char *path)
+{
+    struct capture *capture, *previous;
+    nsp_status_t status;
+
+    capture = NULL;
+    if (path) {
+        status = _capture_create(ncb, path, &capture);
+        if (!NSP_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    lwp_mutex_lock(&ncb->capture_lock);
+    previous = __atomic_exchange_n(&ncb->capture, capture, __ATOMIC_ACQ_REL);
+    lwp_mutex_unlock(&ncb->capture_lock);
+
+    if (previous) {
+        _capture_release(previous);
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+void capture_inherit(ncb_t *ncb, ncb_t *ncb_server)
+{
+    struct capture *capture;
+
+    lwp_mutex_lock(&ncb_server->capture_lock);
+    capture = ncb_server->capture;
+    if (capture) {
+        atom_addone(&capture->refcnt);
+    }
+    lwp_mutex_unlock(&ncb_server->capture_lock);
+
+    if (capture) {
+        lwp_mutex_lock(&ncb->capture_lock);
+        __atomic_store_n(&ncb->capture, capture, __ATOMIC_RELEASE);
+        lwp_mutex_unlock(&ncb->capture_lock);
+    }
+}
+
+static void _capture_record(struct capture *capture, objhld_t link, int flags, const void *data, int cb,
+    const nis_serializer_fp serializer)
+{
+    struct nis_capture_record record;
+    unsigned char *frame;
+    int size;
+
+    if (capture->failed) {
+        return;
+    }
+
+    record.timestamp = htole64(_capture_now() - capture->begin);
+    record.stream = htole32((uint32_t)link);
+    record.size = htole32((uint32_t)cb);
+    record.flags = htole32((uint32_t)flags);
+    record.reserved = 0;
+
+    size = (int)sizeof(record) + cb;
+    if (capture->used + size > CAPTURE_BUFFER_SIZE) {
+        _capture_flush(capture);
+    }
+
+    if (size <= CAPTURE_BUFFER_SIZE) {
+        frame = capture->buffer + capture->used + sizeof(record);
+        if (serializer) {
+            if (!NSP_SUCCESS(serializer(frame, data, cb))) {
+                return;
+            }
+        } else {
+            memcpy(frame, data, cb);
+        }
+        memcpy(capture->buffer + capture->used, &record, sizeof(record));
+        capture->used += size;
+        return;
+    }
+
+    /* too large to buffer, the serialized one go through a temporary buffer */
+    frame = NULL;
+    if (serializer) {
+        if (NULL == (frame = (unsigned char *)ztrymalloc(cb))) {
+            return;
+        }
+        if (!NSP_SUCCESS(serializer(frame, data, cb))) {
+            zfree(frame);
+            return;
+        }
+    }
+    _capture_write(capture, &record, sizeof(record));
+    _capture_write(capture, frame ? frame : data, cb);
+    if (frame) {
+        zfree(frame);
+    }
+}
+
+void capture_frame(ncb_t *ncb, int flags, const void *data, int cb, const nis_serializer_fp serializer)
+{
+    struct capture *capture;
+
+    lwp_mutex_lock(&ncb->capture_lock);
+    capture = ncb->capture;
+    if (capture) {
+        lwp_mutex_lock(&capture->lock);
+        _capture_record(capture, ncb->hld, flags, data, cb, serializer);
+        lwp_mutex_unlock(&capture->lock);
+    }
+    lwp_mutex_unlock(&ncb->capture_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef CAPTURE_H_20231110
+#define CAPTURE_H_20231110
+
+#include "ncb.h"
+
+/*
+ *  traffic capture of TCP link(NI_SETCAPTURE).
+ *  the frames are recorded into a buffer of the capture object and written to file when it's full, or when the last link
+ *  which share the object release it. the object is shared by the listener and the links it accepted while capturing,
+ *  so the records of all of them are in one file and distinguished by the stream field.
+ */
+
+extern
+void capture_init_link(ncb_t *ncb);
+extern
+void capture_uninit_link(ncb_t *ncb);
+
+/* start capture @ncb to file @path, or stop it when @path is NULL */
+extern
+nsp_status_t capture_start(ncb_t *ncb, const char *path);
+
+/* the link accepted by a capturing listener record to the same file */
+extern
+void capture_inherit(ncb_t *ncb, ncb_t *ncb_server);
+
+#define ncb_capturing(ncb)  (NULL != __atomic_load_n(&(ncb)->capture, __ATOMIC_ACQUIRE))
+
+/* record @cb bytes of @data with NIS_CAPTURE_* @flags, @serializer convert @data to bytes when it's not NULL */
+extern
+void capture_frame(ncb_t *ncb, int flags, const void *data, int cb, const nis_serializer_fp serializer);
+
+#endif
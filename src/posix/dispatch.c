@@ -0,0 +1,520 @@
+#include "dispatch.h"
+
+#include "mxx.h"
+#include "bufpool.h"
+#include "slab.h"
+#include "zmalloc.h"
+#include "ifos.h"
+#include "threading.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+
+#define DISPATCH_MAXIMUM_WORKERS    (64)
+
+/* packets delivered for one link before the worker turn to the next link in it's run queue */
+#define DISPATCH_BATCH              (64)
+
+/* the buffer handed over to packets, freed when the last reference dropped */
+struct rx_block {
+    int refcnt;
+    unsigned char *buffer;
+    unsigned char *replacement; /* the new Rx buffer of link, NULL for large-block */
+};
+
+struct rx_item {
+    struct rx_link link;
+    const unsigned char *data;
+    int size;
+    struct rx_block *block; /* NULL when @data are copied behind this item */
+    uint64_t stamp;
+    uint64_t timestamp;     /* kernel receive timestamp, see LINKATTR_RX_TIMESTAMP */
+};
+
+struct dispatch_counter {
+    uint64_t dispatched;
+    uint64_t latency;
+    uint64_t maximum;
+};
+
+struct dispatch_worker {
+    lwp_t thread;
+    lwp_event_t signal;
+    struct rx_lane runq;    /* links scheduled on this worker, ncb_t::dispatch.runq */
+    int sleeping;
+    int actived;
+    struct dispatch_counter counter;
+};
+
+/* @__dispatch_lock guard the worker set against the scheduling Rx threads, @__dispatch_mutex serialize start and stop */
+static struct dispatch_worker *__dispatch_workers = NULL;
+static int __dispatch_nworkers = 0;
+static unsigned int __dispatch_next = 0;
+static pthread_rwlock_t __dispatch_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t __dispatch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct dispatch_worker *__dispatch_self = NULL;
+
+/* packets delivered out of workers, and the counters of stopped workers */
+static struct dispatch_counter __dispatch_inline = { 0, 0, 0 };
+static struct dispatch_counter __dispatch_retired = { 0, 0, 0 };
+static uint64_t __dispatch_lent = 0;
+static uint64_t __dispatch_copied = 0;
+
+static void _dispatch_lane_init(struct rx_lane *lane)
+{
+    lane->stub.next = NULL;
+    lane->head = &lane->stub;
+    lane->tail = &lane->stub;
+}
+
+static void _dispatch_lane_push(struct rx_lane *lane, struct rx_link *link)
+{
+    struct rx_link *prev;
+
+    __atomic_store_n(&link->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&lane->tail, link, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, link, __ATOMIC_RELEASE);
+}
+
+/* consumer only, return the front node of @lane or NULL when nothing are reachable now */
+static struct rx_link *_dispatch_lane_front(struct rx_lane *lane)
+{
+    struct rx_link *head, *next;
+
+    head = lane->head;
+    if (head == &lane->stub) {
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+        if (!next) {
+            return NULL;
+        }
+        lane->head = next;
+        head = next;
+    }
+    return head;
+}
+
+/* consumer only, take @front which return by @_dispatch_lane_front out of @lane */
+static void _dispatch_lane_shift(struct rx_lane *lane, struct rx_link *front)
+{
+    struct rx_link *next;
+
+    next = __atomic_load_n(&front->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        if (__atomic_load_n(&lane->tail, __ATOMIC_ACQUIRE) == front) {
+            _dispatch_lane_push(lane, &lane->stub);
+        }
+        while (NULL == (next = __atomic_load_n(&front->next, __ATOMIC_ACQUIRE))) {
+            sched_yield();
+        }
+    }
+    lane->head = next;
+}
+
+static uint64_t _dispatch_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _dispatch_count(struct dispatch_counter *counter, uint64_t latency)
+{
+    uint64_t maximum;
+
+    __atomic_add_fetch(&counter->dispatched, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->latency, latency, __ATOMIC_RELAXED);
+    maximum = __atomic_load_n(&counter->maximum, __ATOMIC_RELAXED);
+    while (latency > maximum &&
+        !__atomic_compare_exchange_n(&counter->maximum, &maximum, latency, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ;
+    }
+}
+
+static void _dispatch_block_release(struct rx_block *block)
+{
+    if (0 == __atomic_sub_fetch(&block->refcnt, 1, __ATOMIC_ACQ_REL)) {
+        bufpool_free(block->buffer);
+        if (block->replacement) {
+            bufpool_free(block->replacement);
+        }
+        slab_free(block);
+    }
+}
+
+/* the Rx buffer are shared by all packets parsed in place of it during current receive,
+ *  the link hold one reference until @dispatch_detach give it a new buffer */
+static struct rx_block *_dispatch_lend(ncb_t *ncb)
+{
+    struct rx_block *block;
+
+    block = ncb->dispatch.lent;
+    if (!block) {
+        block = (struct rx_block *)slab_alloc(sizeof(*block));
+        if (!block) {
+            return NULL;
+        }
+        block->replacement = (unsigned char *)bufpool_alloc(ncb->rx_buffer_size);
+        if (!block->replacement) {
+            slab_free(block);
+            return NULL;
+        }
+        block->buffer = ncb->rx_buffer;
+        block->refcnt = 1;
+        ncb->dispatch.lent = block;
+    }
+
+    __atomic_add_fetch(&block->refcnt, 1, __ATOMIC_RELAXED);
+    return block;
+}
+
+/* the large-block belong to the packet alone, the link forget it like it has been delivered */
+static struct rx_block *_dispatch_transfer(ncb_t *ncb)
+{
+    struct rx_block *block;
+
+    block = (struct rx_block *)slab_alloc(sizeof(*block));
+    if (!block) {
+        return NULL;
+    }
+    block->buffer = ncb->u.tcp.lbdata;
+    block->replacement = NULL;
+    block->refcnt = 1;
+
+    ncb->u.tcp.lbdata = NULL;
+    ncb->u.tcp.lboffset = 0;
+    ncb->u.tcp.lbsize = 0;
+    return block;
+}
+
+static struct rx_item *_dispatch_item(ncb_t *ncb, const unsigned char *data, int cb)
+{
+    struct rx_item *item;
+    int lend, transfer;
+
+    lend = (ncb->rx_buffer && data >= ncb->rx_buffer && data + cb <= ncb->rx_buffer + ncb->rx_buffer_size);
+    transfer = (!lend && ncb->u.tcp.lbdata && data >= ncb->u.tcp.lbdata && data + cb <= ncb->u.tcp.lbdata + ncb->u.tcp.lbsize);
+
+    if (lend || transfer) {
+        item = (struct rx_item *)slab_alloc(sizeof(*item));
+        if (!item) {
+            return NULL;
+        }
+        item->block = lend ? _dispatch_lend(ncb) : _dispatch_transfer(ncb);
+        if (item->block) {
+            item->data = data;
+            item->size = cb;
+            __atomic_add_fetch(&__dispatch_lent, 1, __ATOMIC_RELAXED);
+            return item;
+        }
+        slab_free(item);
+    }
+
+    /* the packet in parse cache, shared memory ring or the buffers of filter are copied */
+    item = (struct rx_item *)slab_alloc(sizeof(*item) + cb);
+    if (!item) {
+        return NULL;
+    }
+    memcpy(item + 1, data, cb);
+    item->data = (const unsigned char *)(item + 1);
+    item->size = cb;
+    item->block = NULL;
+    __atomic_add_fetch(&__dispatch_copied, 1, __ATOMIC_RELAXED);
+    return item;
+}
+
+/* deliver at most @batch packets of @ncb, return the count delivered */
+static int _dispatch_drain(ncb_t *ncb, int batch, struct dispatch_counter *counter)
+{
+    struct rx_link *link;
+    struct rx_item *item;
+    int n;
+
+    for (n = 0; n < batch && NULL != (link = _dispatch_lane_front(&ncb->dispatch.items)); n++) {
+        _dispatch_lane_shift(&ncb->dispatch.items, link);
+        item = containing_record(link, struct rx_item, link);
+        _dispatch_count(counter, _dispatch_now() - item->stamp);
+        ncb_call_recvdata(ncb, item->size, item->data, item->timestamp);
+        if (item->block) {
+            _dispatch_block_release(item->block);
+        }
+        slab_free(item);
+    }
+
+    return n;
+}
+
+/* deliver the packets of @ncb on calling thread until nothing pending */
+static void _dispatch_drain_inline(ncb_t *ncb)
+{
+    int n;
+
+    do {
+        n = _dispatch_drain(ncb, INT_MAX, &__dispatch_inline);
+    } while (__atomic_sub_fetch(&ncb->dispatch.pending, n, __ATOMIC_ACQ_REL) > 0);
+}
+
+static void _dispatch_schedule(ncb_t *ncb)
+{
+    struct dispatch_worker *worker;
+
+    worker = NULL;
+    pthread_rwlock_rdlock(&__dispatch_lock);
+    /* the reference keep the link alive and defer it's close events while it's scheduled */
+    if (__dispatch_nworkers > 0 && objrefr(ncb->hld)) {
+        worker = &__dispatch_workers[__atomic_fetch_add(&__dispatch_next, 1, __ATOMIC_RELAXED) % __dispatch_nworkers];
+        _dispatch_lane_push(&worker->runq, &ncb->dispatch.runq);
+        /* pair with the worker which announce @sleeping and then check the run queue again */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST)) {
+            lwp_event_awaken(&worker->signal);
+        }
+    }
+    pthread_rwlock_unlock(&__dispatch_lock);
+
+    /* workers are not running or the link is closing */
+    if (!worker) {
+        _dispatch_drain_inline(ncb);
+    }
+}
+
+static void _dispatch_serve(struct dispatch_worker *worker, ncb_t *ncb)
+{
+    int n;
+
+    n = _dispatch_drain(ncb, DISPATCH_BATCH, &worker->counter);
+    if (__atomic_sub_fetch(&ncb->dispatch.pending, n, __ATOMIC_ACQ_REL) > 0) {
+        /* more packets are pending, give the other links a chance first */
+        _dispatch_lane_push(&worker->runq, &ncb->dispatch.runq);
+        return;
+    }
+
+    /* the link is idle now, the next packet schedule it again */
+    objdefr(ncb->hld);
+}
+
+static void *_dispatch_run(void *p)
+{
+    struct dispatch_worker *worker;
+    struct rx_link *link;
+
+    worker = (struct dispatch_worker *)p;
+    __dispatch_self = worker;
+
+    while (__atomic_load_n(&worker->actived, __ATOMIC_ACQUIRE)) {
+        link = _dispatch_lane_front(&worker->runq);
+        if (!link) {
+            /* announce before check again, the scheduling thread which push after our check see it and awaken us */
+            __atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (!_dispatch_lane_front(&worker->runq)) {
+                lwp_event_wait(&worker->signal, 10);
+                lwp_event_block(&worker->signal);
+            }
+            __atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        _dispatch_lane_shift(&worker->runq, link);
+        _dispatch_serve(worker, containing_record(link, ncb_t, dispatch.runq));
+    }
+
+    return NULL;
+}
+
+static void _dispatch_stop(struct dispatch_worker *workers, int nworkers)
+{
+    struct dispatch_worker *worker;
+    struct rx_link *link;
+    ncb_t *ncb;
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        worker = &workers[i];
+        __atomic_store_n(&worker->actived, 0, __ATOMIC_RELEASE);
+        lwp_event_awaken(&worker->signal);
+        lwp_join(&worker->thread, NULL);
+    }
+
+    /* nobody schedule on these workers now, the links remain in their run queues are drained here */
+    for (i = 0; i < nworkers; i++) {
+        worker = &workers[i];
+        while (NULL != (link = _dispatch_lane_front(&worker->runq))) {
+            _dispatch_lane_shift(&worker->runq, link);
+            ncb = containing_record(link, ncb_t, dispatch.runq);
+            _dispatch_drain_inline(ncb);
+            objdefr(ncb->hld);
+        }
+
+        __atomic_add_fetch(&__dispatch_retired.dispatched, worker->counter.dispatched, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&__dispatch_retired.latency, worker->counter.latency, __ATOMIC_RELAXED);
+        if (worker->counter.maximum > __atomic_load_n(&__dispatch_retired.maximum, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&__dispatch_retired.maximum, worker->counter.maximum, __ATOMIC_RELAXED);
+        }
+        lwp_event_uninit(&worker->signal);
+    }
+}
+
+nsp_status_t nis_dispatch_init(int nworkers)
+{
+    struct dispatch_worker *workers;
+    nsp_status_t status;
+    int i;
+
+    if (nworkers < 0 || nworkers > DISPATCH_MAXIMUM_WORKERS) {
+        return posix__makeerror(EINVAL);
+    }
+
+    if (0 == nworkers) {
+        nworkers = ifos_getnprocs_quota();
+        nworkers = (nworkers <= 0) ? 1 : ((nworkers > DISPATCH_MAXIMUM_WORKERS) ? DISPATCH_MAXIMUM_WORKERS : nworkers);
+    }
+
+    pthread_mutex_lock(&__dispatch_mutex);
+    do {
+        if (__dispatch_workers) {
+            status = posix__makeerror(EALREADY);
+            break;
+        }
+
+        workers = (struct dispatch_worker *)ztrycalloc(nworkers * sizeof(*workers));
+        if (!workers) {
+            status = posix__makeerror(ENOMEM);
+            break;
+        }
+
+        status = NSP_STATUS_SUCCESSFUL;
+        for (i = 0; i < nworkers; i++) {
+            _dispatch_lane_init(&workers[i].runq);
+            lwp_event_init(&workers[i].signal, LWPEC_NOTIFY);
+            workers[i].actived = 1;
+            if (lwp_create(&workers[i].thread, 0, &_dispatch_run, &workers[i]) < 0) {
+                mxx_call_ecr("Fails create dispatch worker %d", i);
+                lwp_event_uninit(&workers[i].signal);
+                status = NSP_STATUS_FATAL;
+                break;
+            }
+        }
+
+        if (!NSP_SUCCESS(status)) {
+            _dispatch_stop(workers, i);
+            zfree(workers);
+            break;
+        }
+
+        pthread_rwlock_wrlock(&__dispatch_lock);
+        __dispatch_workers = workers;
+        __dispatch_nworkers = nworkers;
+        pthread_rwlock_unlock(&__dispatch_lock);
+    } while (0);
+    pthread_mutex_unlock(&__dispatch_mutex);
+
+    return status;
+}
+
+void nis_dispatch_uninit()
+{
+    struct dispatch_worker *workers;
+    int nworkers;
+
+    /* a worker can not join itself */
+    if (__dispatch_self) {
+        mxx_call_ecr("Dispatch workers can not stop in their callback");
+        return;
+    }
+
+    pthread_mutex_lock(&__dispatch_mutex);
+    pthread_rwlock_wrlock(&__dispatch_lock);
+    workers = __dispatch_workers;
+    nworkers = __dispatch_nworkers;
+    __dispatch_workers = NULL;
+    __dispatch_nworkers = 0;
+    pthread_rwlock_unlock(&__dispatch_lock);
+
+    if (workers) {
+        _dispatch_stop(workers, nworkers);
+        zfree(workers);
+    }
+    pthread_mutex_unlock(&__dispatch_mutex);
+}
+
+void dispatch_init_link(ncb_t *ncb)
+{
+    _dispatch_lane_init(&ncb->dispatch.items);
+    ncb->dispatch.lent = NULL;
+    ncb->dispatch.pending = 0;
+}
+
+void dispatch_uninit_link(ncb_t *ncb)
+{
+    /* the parse of last receive failed, the lent buffer are not replaced */
+    dispatch_detach(ncb);
+}
+
+void dispatch_post(ncb_t *ncb, const unsigned char *data, int cb, uint64_t timestamp)
+{
+    struct rx_item *item;
+
+    item = _dispatch_item(ncb, data, cb);
+    if (unlikely(!item)) {
+        /* no memory to hold the packet, it's delivered here after the packets ahead of it */
+        while (dispatch_pending(ncb)) {
+            sched_yield();
+        }
+        ncb_call_recvdata(ncb, cb, data, timestamp);
+        return;
+    }
+
+    item->stamp = _dispatch_now();
+    item->timestamp = timestamp;
+    _dispatch_lane_push(&ncb->dispatch.items, &item->link);
+
+    /* the first packet of a idle link schedule it */
+    if (0 == __atomic_fetch_add(&ncb->dispatch.pending, 1, __ATOMIC_ACQ_REL)) {
+        _dispatch_schedule(ncb);
+    }
+}
+
+void dispatch_detach(ncb_t *ncb)
+{
+    struct rx_block *block;
+
+    block = ncb->dispatch.lent;
+    if (block) {
+        ncb->dispatch.lent = NULL;
+        ncb->rx_buffer = block->replacement;
+        block->replacement = NULL;
+        _dispatch_block_release(block);
+    }
+}
+
+static void _dispatch_sum(struct nis_dispatch_statistics *stat, struct dispatch_counter *counter)
+{
+    uint64_t maximum;
+
+    stat->Dispatched += __atomic_load_n(&counter->dispatched, __ATOMIC_RELAXED);
+    stat->Latency += __atomic_load_n(&counter->latency, __ATOMIC_RELAXED);
+    maximum = __atomic_load_n(&counter->maximum, __ATOMIC_RELAXED);
+    if (maximum > stat->MaximumLatency) {
+        stat->MaximumLatency = maximum;
+    }
+}
+
+void dispatch_getstat(struct nis_dispatch_statistics *stat)
+{
+    int i;
+
+    _dispatch_sum(stat, &__dispatch_inline);
+    _dispatch_sum(stat, &__dispatch_retired);
+
+    pthread_rwlock_rdlock(&__dispatch_lock);
+    for (i = 0; i < __dispatch_nworkers; i++) {
+        _dispatch_sum(stat, &__dispatch_workers[i].counter);
+    }
+    stat->Workers = __dispatch_nworkers;
+    pthread_rwlock_unlock(&__dispatch_lock);
+
+    stat->Lent = __atomic_load_n(&__dispatch_lent, __ATOMIC_RELAXED);
+    stat->Copied = __atomic_load_n(&__dispatch_copied, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,33 @@
+#ifndef DISPATCH_H_20231106
+#define DISPATCH_H_20231106
+
+#include "ncb.h"
+
+/*
+ *  offload of EVT_RECEIVEDATA to dispatch workers.
+ *  the Rx thread push the parsed packet into the lane of it's link, the push which find the link idle schedule it
+ *  on the run queue of a worker(round-robin), the worker deliver a batch of packets of the link and then requeue it
+ *  or set it idle, so one link run on one worker at a time and it's packets keep in order, no lock on the way.
+ *  the worker hold a reference of the link while it's scheduled, so the close events wait for the packets already parsed.
+ */
+
+extern
+void dispatch_init_link(ncb_t *ncb);
+extern
+void dispatch_uninit_link(ncb_t *ncb);
+
+/* hand @cb bytes of @data to the worker, fallback to deliver it on the calling thread when workers are not running */
+extern
+void dispatch_post(ncb_t *ncb, const unsigned char *data, int cb, uint64_t timestamp);
+
+/* nonzero when packets of @ncb are pending in dispatch, the later ones MUST go the same way to keep them in order */
+#define dispatch_pending(ncb)   (0 != __atomic_load_n(&(ncb)->dispatch.pending, __ATOMIC_ACQUIRE))
+
+/* Rx thread call it after parse, the Rx buffer lent to packets are replaced by a new one */
+extern
+void dispatch_detach(ncb_t *ncb);
+
+extern
+void dispatch_getstat(struct nis_dispatch_statistics *stat);
+
+#endif
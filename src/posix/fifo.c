@@ -3,74 +3,202 @@
 #include "mxx.h"
 #include "io.h"
 #include "zmalloc.h"
+#include "clock.h"
+#include "slab.h"
+#include "wpool.h"
 
+#include <sched.h>
+
+/* the pending limit of each lane */
 #define MAXIMUM_FIFO_SIZE       (100)
 
+static void _fifo_lane_init(struct tx_lane *lane)
+{
+    lane->stub.next = NULL;
+    lane->head = &lane->stub;
+    lane->tail = &lane->stub;
+    lane->size = 0;
+}
+
+/* wait-free for producers, the previous tail are linked to @link after exchange,
+ *  so the consumer may see a node in @tail which not yet reachable from @head for a few instructions */
+static void _fifo_lane_push(struct tx_lane *lane, struct tx_link *link)
+{
+    struct tx_link *prev;
+
+    __atomic_store_n(&link->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&lane->tail, link, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, link, __ATOMIC_RELEASE);
+}
+
+/* consumer only, return the front node of @lane or NULL when nothing are reachable now */
+static struct tx_link *_fifo_lane_front(struct tx_lane *lane)
+{
+    struct tx_link *head, *next;
+
+    head = lane->head;
+    if (head == &lane->stub) {
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+        if (!next) {
+            return NULL;
+        }
+        lane->head = next;
+        head = next;
+    }
+    return head;
+}
+
+/* consumer only, take @front which return by @_fifo_lane_front out of @lane */
+static void _fifo_lane_shift(struct tx_lane *lane, struct tx_link *front)
+{
+    struct tx_link *next;
+
+    next = __atomic_load_n(&front->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        /* @front is the last one, push the stub behind it, then @head never point to a node which has been released */
+        if (__atomic_load_n(&lane->tail, __ATOMIC_ACQUIRE) == front) {
+            _fifo_lane_push(lane, &lane->stub);
+        }
+        /* either the stub or a node of producer which exchanged the tail but not yet link it */
+        while (NULL == (next = __atomic_load_n(&front->next, __ATOMIC_ACQUIRE))) {
+            sched_yield();
+        }
+    }
+    lane->head = next;
+}
+
 void fifo_init(ncb_t *ncb)
 {
     struct tx_fifo *fifo;
+    int i;
 
     fifo = &ncb->fifo;
     fifo->tx_overflow = NO;
     fifo->size = 0;
+    fifo->bytes = 0;
+    fifo->current = NULL;
+    fifo->partial = NULL;
+    fifo->writer = 0;
+    fifo->turned = 0;
     lwp_mutex_init(&fifo->lock, nsp_true);
-    INIT_LIST_HEAD(&fifo->head);
+    for (i = 0; i < TX_LANES; i++) {
+        _fifo_lane_init(&fifo->lanes[i]);
+    }
 }
 
 void fifo_uninit(ncb_t *ncb)
 {
-    struct tx_node *node;
+    struct tx_link *link;
     struct tx_fifo *fifo;
+    int i;
 
     fifo = &ncb->fifo;
-    /* cleanup entire FIFO data queue */
+    /* cleanup entire FIFO data queue, no reference of link remain now, so nobody queue concurrently */
     lwp_mutex_lock(&fifo->lock);
-    while ((node = list_first_entry_or_null(&fifo->head, struct tx_node, link)) != NULL) {
-        list_del(&node->link);
-        INIT_LIST_HEAD(&node->link);
-        if (node->data) {
-            zfree(node->data);
+    fifo->current = NULL;
+    if (fifo->partial) {
+        fifo_release(ncb, fifo->partial);
+        fifo->partial = NULL;
+    }
+    for (i = 0; i < TX_LANES; i++) {
+        while (NULL != (link = _fifo_lane_front(&fifo->lanes[i]))) {
+            _fifo_lane_shift(&fifo->lanes[i], link);
+            fifo_release(ncb, container_of(link, struct tx_node, link));
         }
-        zfree(node);
+        fifo->lanes[i].size = 0;
     }
+    fifo->size = 0;
+    fifo->bytes = 0;
     lwp_mutex_unlock(&fifo->lock);
     /* uninitialize the fifo mutex lock */
     lwp_mutex_uninit(&fifo->lock);
 }
 
+/* any byte of @node has been written */
+static nsp_boolean_t _fifo_node_started(const struct tx_node *node)
+{
+    return (node->offset > 0 || (node->file && node->file->sent > 0)) ? nsp_true : nsp_false;
+}
+
+/* consumer only, the partial written node first, then the front of the highest non-empty lane */
+static struct tx_node *_fifo_front(struct tx_fifo *fifo)
+{
+    struct tx_node *front;
+    struct tx_link *link;
+    int i;
+
+    while (1) {
+        front = __atomic_load_n(&fifo->partial, __ATOMIC_ACQUIRE);
+        if (front) {
+            return front;
+        }
+
+        for (i = TX_LANES - 1; i >= 0; i--) {
+            link = _fifo_lane_front(&fifo->lanes[i]);
+            if (link) {
+                return container_of(link, struct tx_node, link);
+            }
+        }
+
+        if (0 == __atomic_load_n(&fifo->size, __ATOMIC_SEQ_CST)) {
+            return NULL;
+        }
+
+        /* a producer has count the node but not yet link it, it's a few instructions away */
+        sched_yield();
+    }
+}
+
 nsp_status_t fifo_queue(ncb_t *ncb, struct tx_node *node)
 {
     nsp_status_t status;
     struct tx_fifo *fifo;
+    struct tx_node *expect;
+    int lane;
 
     fifo = &ncb->fifo;
-    status = NSP_STATUS_SUCCESSFUL;
+    lane = (node->lane >= 0 && node->lane < TX_LANES) ? node->lane : TX_LANE_NORMAL;
+    node->lane = lane;
 
-    lwp_mutex_lock(&fifo->lock);
-    do {
-        if ( unlikely(fifo->size >= MAXIMUM_FIFO_SIZE) ) {
-            status = posix__makeerror(EBUSY);
-            break;
-        }
-        list_add_tail(&node->link, &fifo->head);
+    if ( unlikely(__atomic_fetch_add(&fifo->lanes[lane].size, 1, __ATOMIC_ACQ_REL) >= MAXIMUM_FIFO_SIZE) ) {
+        __atomic_sub_fetch(&fifo->lanes[lane].size, 1, __ATOMIC_ACQ_REL);
+        return posix__makeerror(EBUSY);
+    }
 
-        /* previous Tx request can not complete immediately trigger this function call,
-         * so, the IO blocking flag should set, likewise, EPOLLOUT event should assicoated with this @ncb object */
+    /* @size MUST increase before test @tx_overflow, see @fifo_pop */
+    __atomic_add_fetch(&fifo->size, 1, __ATOMIC_SEQ_CST);
+
+    /* previous Tx request can not complete immediately trigger this function call,
+     * so, the IO blocking flag should set, likewise, EPOLLOUT event should assicoated with this @ncb object,
+     * accepted link which not attach to epoll yet(write in the accepted callback) get EPOLLOUT when it attach */
+    if (!__atomic_load_n(&fifo->tx_overflow, __ATOMIC_SEQ_CST)) {
+        lwp_mutex_lock(&fifo->lock);
         if (!fifo->tx_overflow) {
-            status = io_modify(ncb, EPOLLIN | EPOLLOUT);
+            status = (ncb->epfd > 0) ? io_modify(ncb, EPOLLIN | EPOLLOUT) : NSP_STATUS_SUCCESSFUL;
             if (!NSP_SUCCESS(status)) {
-                list_del(&node->link);
-                INIT_LIST_HEAD(&node->link);
-                break;
+                __atomic_sub_fetch(&fifo->size, 1, __ATOMIC_SEQ_CST);
+                __atomic_sub_fetch(&fifo->lanes[lane].size, 1, __ATOMIC_ACQ_REL);
+                lwp_mutex_unlock(&fifo->lock);
+                return status;
             }
-            fifo->tx_overflow = nsp_true;
+            __atomic_store_n(&fifo->tx_overflow, nsp_true, __ATOMIC_SEQ_CST);
             mxx_call_ecr("Link:%lld, Tx overflow", ncb->hld);
         }
-        ++fifo->size;
-    } while(0);
+        lwp_mutex_unlock(&fifo->lock);
+    }
 
-    lwp_mutex_unlock(&fifo->lock);
-    return status;
+    __atomic_add_fetch(&fifo->bytes, node->wcb, __ATOMIC_RELAXED);
+
+    /* the remain part of a partial written node are the first to write, it never wait in lane behind the others */
+    if (_fifo_node_started(node)) {
+        expect = NULL;
+        if (__atomic_compare_exchange_n(&fifo->partial, &expect, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return NSP_STATUS_SUCCESSFUL;
+        }
+    }
+
+    _fifo_lane_push(&fifo->lanes[lane], &node->link);
+    return NSP_STATUS_SUCCESSFUL;
 }
 
 nsp_status_t fifo_top(ncb_t *ncb, struct tx_node **node)
@@ -79,13 +207,16 @@ nsp_status_t fifo_top(ncb_t *ncb, struct tx_node **node)
     struct tx_fifo *fifo;
 
     fifo = &ncb->fifo;
-    front = NULL;
 
-    lwp_mutex_lock(&fifo->lock);
-    if (NULL != (front = list_first_entry_or_null(&fifo->head, struct tx_node, link))) {
+    /* the partial written node MUST complete before any other node, even if it's in a lower lane */
+    front = fifo->current;
+    if (!front || !_fifo_node_started(front)) {
+        front = _fifo_front(fifo);
+    }
+    fifo->current = front;
+    if (front) {
         *node = front;
     }
-    lwp_mutex_unlock(&fifo->lock);
 
     return posix__makeerror( ((NULL == front) ? ENOENT : NSP_STATUS_SUCCESSFUL) );
 }
@@ -97,49 +228,61 @@ nsp_status_t fifo_pop(ncb_t *ncb, struct tx_node **node)
     nsp_boolean_t tx_overflow_canceled;
 
     fifo = &ncb->fifo;
-    front = NULL;
     tx_overflow_canceled = nsp_false;
 
-    lwp_mutex_lock(&fifo->lock);
-    if (NULL != (front = list_first_entry_or_null(&fifo->head, struct tx_node, link))) {
-        /* pop node out from queue */
-        list_del(&front->link);
-        /* after certain no any other items in the queue but the IO blocking state are still presences,
-         * the IO blocking flag should cancel and EPOLLOUT event should disassociation with this @ncb object */
-        if (0 == --fifo->size) {
-            if (fifo->tx_overflow) {
-                fifo->tx_overflow = nsp_false;
+    /* nodes of higher lane may queued after @fifo_top, the node to pop is the one has been written */
+    front = fifo->current;
+    if (!front) {
+        front = _fifo_front(fifo);
+    }
+    fifo->current = NULL;
+    if (!front) {
+        return posix__makeerror(ENOENT);
+    }
+
+    /* pop node out from queue */
+    if (front == __atomic_load_n(&fifo->partial, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&fifo->partial, NULL, __ATOMIC_RELEASE);
+    } else {
+        _fifo_lane_shift(&fifo->lanes[front->lane], &front->link);
+    }
+    __atomic_sub_fetch(&fifo->lanes[front->lane].size, 1, __ATOMIC_ACQ_REL);
+    __atomic_sub_fetch(&fifo->bytes, front->wcb, __ATOMIC_RELAXED);
+
+    /* after certain no any other items in the queue but the IO blocking state are still presences,
+     * the IO blocking flag should cancel and EPOLLOUT event should disassociation with this @ncb object */
+    if (0 == __atomic_sub_fetch(&fifo->size, 1, __ATOMIC_SEQ_CST)) {
+        lwp_mutex_lock(&fifo->lock);
+        if (fifo->tx_overflow && 0 == __atomic_load_n(&fifo->size, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&fifo->tx_overflow, nsp_false, __ATOMIC_SEQ_CST);
+            /* a producer count it's node before we clear the flag may saw the flag still set and skip EPOLLOUT,
+             * test @size again after the flag cleared, keep the flag for that producer if any */
+            if (0 == __atomic_load_n(&fifo->size, __ATOMIC_SEQ_CST)) {
                 tx_overflow_canceled = nsp_true;
+                /* modify under the lock, keep consistent with receive pause/resume */
+                io_modify(ncb, EPOLLIN);
+            } else {
+                __atomic_store_n(&fifo->tx_overflow, nsp_true, __ATOMIC_SEQ_CST);
             }
         }
+        lwp_mutex_unlock(&fifo->lock);
     }
-    lwp_mutex_unlock(&fifo->lock);
 
     if (tx_overflow_canceled) {
-        io_modify(ncb, EPOLLIN);
         mxx_call_ecr("Link:%lld, Tx overflow canceled.", ncb->hld);
     }
 
-    if (front) {
-        INIT_LIST_HEAD(&front->link);
-        if (node) {
-            *node = front;
-        } else {
-            if (front->data) {
-                zfree(front->data);
-            }
-            zfree(front);
-        }
-        return NSP_STATUS_SUCCESSFUL;
+    if (node) {
+        *node = front;
+    } else {
+        fifo_release(ncb, front);
     }
-
-    return posix__makeerror(ENOENT);
+    return NSP_STATUS_SUCCESSFUL;
 }
 
 nsp_boolean_t fifo_tx_overflow(ncb_t *ncb)
 {
     struct tx_fifo *fifo;
-    nsp_boolean_t tx_overflow;
 
     /* synchronous file descriptor will never cause Tx overflow  */
     if (0 == (ncb_getattr_r(ncb) & LINKATTR_NONBLOCK)) {
@@ -148,9 +291,186 @@ nsp_boolean_t fifo_tx_overflow(ncb_t *ncb)
 
     fifo = &ncb->fifo;
 
+    /* the flag stay set while the queue is busy, that's the case of contended writers */
+    if (__atomic_load_n(&fifo->tx_overflow, __ATOMIC_SEQ_CST)) {
+        return nsp_true;
+    }
+
+    /* @fifo_pop clear the flag for a moment before it test @size again, the node counted in that moment are still queued,
+     *  both are seq_cst in @fifo_pop and @fifo_queue, the flag or the count is visible here, no lock needed */
+    return (__atomic_load_n(&fifo->size, __ATOMIC_SEQ_CST) > 0) ? nsp_true : nsp_false;
+}
+
+nsp_boolean_t fifo_tx_direct(ncb_t *ncb)
+{
+    struct tx_fifo *fifo;
+    int expect;
+
+    fifo = &ncb->fifo;
+
+    /* the queue are busy, it's the case of contended writers */
+    if (__atomic_load_n(&fifo->tx_overflow, __ATOMIC_ACQUIRE)) {
+        return nsp_false;
+    }
+
+    expect = 0;
+    if (!__atomic_compare_exchange_n(&fifo->writer, &expect, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return nsp_false;
+    }
+
+    /* the previous writer may queue it's remain part just before release, check again after the right is held */
+    if (fifo_tx_overflow(ncb)) {
+        fifo_tx_release(ncb);
+        return nsp_false;
+    }
+    return nsp_true;
+}
+
+nsp_boolean_t fifo_tx_acquire(ncb_t *ncb)
+{
+    struct tx_fifo *fifo;
+    int expect;
+
+    fifo = &ncb->fifo;
+
+    expect = 0;
+    if (__atomic_compare_exchange_n(&fifo->writer, &expect, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return nsp_true;
+    }
+
+    /* leave a mark for the holder, then try again, the holder either saw the mark or has been released before the second try */
+    __atomic_store_n(&fifo->turned, 1, __ATOMIC_SEQ_CST);
+    expect = 0;
+    return __atomic_compare_exchange_n(&fifo->writer, &expect, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? nsp_true : nsp_false;
+}
+
+void fifo_tx_release(ncb_t *ncb)
+{
+    struct tx_fifo *fifo;
+
+    fifo = &ncb->fifo;
+
+    __atomic_store_n(&fifo->writer, 0, __ATOMIC_SEQ_CST);
+    /* no EPOLLOUT will bring the wpool thread back, the queued nodes are waiting for it */
+    if (__atomic_exchange_n(&fifo->turned, 0, __ATOMIC_SEQ_CST)) {
+        wp_queued(ncb);
+    }
+}
+
+void fifo_getqueue(ncb_t *ncb, int *count, int64_t *bytes)
+{
+    if (count) {
+        *count = __atomic_load_n(&ncb->fifo.size, __ATOMIC_ACQUIRE);
+    }
+    if (bytes) {
+        *bytes = __atomic_load_n(&ncb->fifo.bytes, __ATOMIC_ACQUIRE);
+    }
+}
+
+void fifo_release(ncb_t *ncb, struct tx_node *node)
+{
+    struct tx_file *file;
+    nsp_status_t status;
+
+    file = node->file;
+    if (file) {
+        status = file->status;
+        if (NSP_SUCCESS(status) && file->sent < file->length) {
+            status = posix__makeerror(ECANCELED);
+        }
+        close(file->fd);
+        ncb_post_sendfile(ncb, file->origin_fd, file->offset, file->length, file->sent, status);
+        zfree(file);
+    }
+
+    /* the packet allocated together with node are freed with it */
+    if (node->shared) {
+        nis_buffer_release(node->shared);
+    } else if (node->data && node->data != fifo_inline_data(node)) {
+        zfree(node->data);
+    }
+    slab_free(node);
+}
+
+/* the minimum burst of token bucket, large enough to hold one receive buffer of TCP */
+#define MINIMUM_RATE_BURST      (0x11000)
+
+void fifo_set_rate(ncb_t *ncb, int rate, int burst)
+{
+    struct tx_fifo *fifo;
+
+    fifo = &ncb->fifo;
+
     lwp_mutex_lock(&fifo->lock);
-    tx_overflow = fifo->tx_overflow;
+    if (rate > 0) {
+        /* the default burst allow 100ms traffic */
+        if (burst <= 0) {
+            burst = rate / 10;
+        }
+        fifo->burst = (burst < MINIMUM_RATE_BURST) ? MINIMUM_RATE_BURST : burst;
+        fifo->tokens = fifo->burst;
+        fifo->stamp = clock_monotonic();
+    } else {
+        fifo->burst = 0;
+        fifo->tokens = 0;
+    }
+    __atomic_store_n(&fifo->rate, (rate > 0) ? rate : 0, __ATOMIC_RELEASE);
     lwp_mutex_unlock(&fifo->lock);
+}
 
-    return tx_overflow;
+int fifo_rate_quota(ncb_t *ncb, int want, nsp_boolean_t split)
+{
+    struct tx_fifo *fifo;
+    uint64_t now, elapse;
+    int quota;
+
+    fifo = &ncb->fifo;
+
+    /* no limit on this link */
+    if (likely(0 == __atomic_load_n(&fifo->rate, __ATOMIC_ACQUIRE))) {
+        return want;
+    }
+
+    lwp_mutex_lock(&fifo->lock);
+    now = clock_monotonic();
+    if (fifo->rate > 0 && now > fifo->stamp) {
+        /* clock in 100ns, limit the elapse to 100 seconds avoid overflow */
+        elapse = now - fifo->stamp;
+        if (elapse > 1000000000ULL) {
+            elapse = 1000000000ULL;
+        }
+        fifo->tokens += (int64_t)(elapse * fifo->rate / 10000000);
+        if (fifo->tokens > fifo->burst) {
+            fifo->tokens = fifo->burst;
+        }
+        fifo->stamp = now;
+    }
+
+    if (fifo->rate <= 0) {
+        quota = want;
+    } else if (fifo->tokens <= 0) {
+        quota = 0;
+    } else if (!split || fifo->tokens >= want) {
+        quota = want;
+    } else {
+        quota = (int)fifo->tokens;
+    }
+    lwp_mutex_unlock(&fifo->lock);
+
+    return quota;
+}
+
+void fifo_rate_consume(ncb_t *ncb, int bytes)
+{
+    struct tx_fifo *fifo;
+
+    fifo = &ncb->fifo;
+
+    if (likely(0 == __atomic_load_n(&fifo->rate, __ATOMIC_ACQUIRE))) {
+        return;
+    }
+
+    lwp_mutex_lock(&fifo->lock);
+    fifo->tokens -= bytes;
+    lwp_mutex_unlock(&fifo->lock);
 }
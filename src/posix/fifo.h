@@ -3,30 +3,56 @@
 
 #include "ncb.h"
 
+/* the file part of node queued by @tcp_sendfile, it is written by sendfile(2) after @data of node */
+struct tx_file {
+    int fd; /* duplicate of the file descriptor specified by caller, closed on release */
+    int origin_fd; /* the file descriptor specified by caller, only use for completion event */
+    int64_t offset; /* the offset in file of request */
+    int64_t length; /* the count of bytes of file need to write */
+    int64_t sent; /* the count of bytes of file has been written */
+    nsp_status_t status; /* the error occurred during write, report by completion event */
+};
+
+/* the packet shared by Tx nodes of many links, @data freed when the last reference dropped */
+struct nis_buffer {
+    int refcnt;
+    int size;
+    unsigned char data[0];
+};
+
 struct tx_node {
     unsigned char *data; /* data buffer for Tx */
     int wcb; /* the total count of bytes need to write */
     int offset; /* the current offset of @data after success written */
+    int segment; /* the size of each datagram which @data are split into by GSO, zero for a single datagram, UDP only */
+    int lane; /* the priority lane this node queue in, TX_LANE_NORMAL by default */
+
     struct sockaddr_in udp_target; /* the Tx target address, UDP only */
     struct sockaddr_un domain_target; /* the Tx target address, UNIX only */
-    struct list_head link;
+    struct tx_file *file; /* file to write after @data, TCP only, NULL for the others */
+    struct nis_buffer *shared; /* @data point into this shared buffer and not owned by node, TCP only, NULL for the others */
+    struct tx_link link;
 };
 
 extern void fifo_init(ncb_t *ncb);
 extern void fifo_uninit(ncb_t *ncb);
 
-/* atomic implememnt get the top node of current fifo,
+/* get the top node of current fifo, @fifo_top and @fifo_pop are called by the wpool thread of the link only,
  *	@node MUST be a effective pointer to retrieve the queued item.
  *	calling thread with responsibility to manage the memory buffer return by *node
+ *  the front of the highest non-empty lane is the top, except the previous top has been partially written,
+ *  in that case, the previous top are return again until it complete, so a packet never interleave with another one.
  */
 extern nsp_status_t fifo_top(ncb_t *ncb, struct tx_node **node);
 
 /* after syscall write(2) or send(2) failed with error EAGAIN, low-level cache of operation system kernel cannot hold more data buffer,
  *	in this situation, application should preserve these data and waitting for the kernel state change to idle.
- *	@fifo_queue be responsible for associated object @ncb with EPOLLOUT event, and storage data buffer @node->data to the tail of fifo queue */
+ *	@fifo_queue be responsible for associated object @ncb with EPOLLOUT event, and storage data buffer @node->data to the tail of lane @node->lane
+ *  each lane has it's own pending limit, -EBUSY when the lane is full
+ *  any thread can queue without lock, the lock of fifo is taken only when EPOLLOUT need to be associated */
 extern nsp_status_t fifo_queue(ncb_t *ncb, struct tx_node *node);
 
-/* multi-thread safe implememnt to get the top node of current fifo and then pop it out,
+/* get the top node(the one return by previous @fifo_top) of current fifo and then pop it out,
  * 	in this procedure, after certain no any other items in the queue but the IO blocking state are still presences
  *	@fifo_pop be responsible for disassociation object @ncb with EPOLLOUT event.
  *  notes: @node is a option parameter, it canbe null-ptr,
@@ -39,4 +65,31 @@ extern nsp_status_t fifo_pop(ncb_t *ncb, struct tx_node **node);
  *	return 0: the IO is non-blocking  */
 extern nsp_boolean_t fifo_tx_overflow(ncb_t *ncb);
 
+/* the right to write the socket of TCP link, the direct write of producers and the wpool thread exclude each other by it,
+ *  so the remain part of a partial written packet never follow the bytes of another one.
+ *  @fifo_tx_direct acquire it for producer, it fail when the link is in Tx overflow or another thread hold the right, queue the packet in this case.
+ *  @fifo_tx_acquire acquire it for the wpool thread, it fail when a producer hold the right, the producer bring the wpool thread back on release.
+ *  the holder which get EAGAIN MUST queue the remain part before release */
+extern nsp_boolean_t fifo_tx_direct(ncb_t *ncb);
+extern nsp_boolean_t fifo_tx_acquire(ncb_t *ncb);
+extern void fifo_tx_release(ncb_t *ncb);
+
+/* obtain the count of nodes and total bytes of packets queued in all lanes, the value is a snapshot while other threads are writing */
+extern void fifo_getqueue(ncb_t *ncb, int *count, int64_t *bytes);
+
+/* node are allocated by @slab_alloc, when the packet are small enough, it's allocated in the same block immediately behind the node */
+#define fifo_inline_data(node)  ((unsigned char *)((node) + 1))
+
+/* free @node and the buffer it owned, completion event of @tcp_sendfile are posted here when @node carry a file */
+extern void fifo_release(ncb_t *ncb, struct tx_node *node);
+
+/* token bucket for Tx rate limit, @rate in bytes per second, zero @rate disable the limit.
+ *  @fifo_rate_quota return how many bytes are allowed to write now, less than or equal to zero means the link are throttled,
+ *      in this case, the writer should return -EINPROGRESS and the wpool thread retry it on next tick.
+ *      when @split is false, the whole @want bytes are allowed as long as any token remain, the bucket run into debt.
+ *  @fifo_rate_consume take the bytes actually written out of the bucket */
+extern void fifo_set_rate(ncb_t *ncb, int rate, int burst);
+extern int fifo_rate_quota(ncb_t *ncb, int want, nsp_boolean_t split);
+extern void fifo_rate_consume(ncb_t *ncb, int bytes);
+
 #endif
@@ -0,0 +1,530 @@
+#include "filter.h"
+
+#include "tcp.h"
+#include "mxx.h"
+#include "bufpool.h"
+
+#include <pthread.h>
+#include <endian.h>
+
+#if defined __x86_64__
+#include <immintrin.h>
+#endif
+
+/* spare bytes behind each reserved buffer, the next stage append it's trailer in place */
+#define FILTER_SPARE                (16)
+#define FILTER_CRC32C_SIZE          (4)
+
+/* lz stream: method byte, original size in 4 bytes little-endian when packed, then the sequences.
+ *  each sequence is a token(high 4 bits literal length, low 4 bits match length - 4, 15 means more bytes follow),
+ *  the extra length bytes, the literals, 2 bytes little-endian offset and the extra match length bytes.
+ *  the last sequence carry literals only and end the stream */
+#define FILTER_LZ_STORED            (0)
+#define FILTER_LZ_PACKED            (1)
+#define FILTER_LZ_HEAD              (5)
+#define FILTER_LZ_HASH_BITS         (12)
+#define FILTER_LZ_MINIMUM_MATCH     (4)
+#define FILTER_LZ_MAXIMUM_OFFSET    (0xFFFF)
+
+typedef uint32_t (*filter_crc32c_fp)(uint32_t crc, const unsigned char *data, size_t cb);
+
+static filter_crc32c_fp __filter_crc32c_kernel = NULL;
+static pthread_once_t __filter_once = PTHREAD_ONCE_INIT;
+static uint32_t __filter_crc32c_table[256];
+
+static uint32_t _filter_crc32c_generic(uint32_t crc, const unsigned char *data, size_t cb)
+{
+    while (cb-- > 0) {
+        crc = __filter_crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined __x86_64__
+__attribute__((target("sse4.2")))
+static uint32_t _filter_crc32c_sse42(uint32_t crc, const unsigned char *data, size_t cb)
+{
+    uint64_t crc64, u64;
+
+    crc64 = crc;
+    while (cb >= sizeof(u64)) {
+        memcpy(&u64, data, sizeof(u64));
+        crc64 = _mm_crc32_u64(crc64, u64);
+        data += sizeof(u64);
+        cb -= sizeof(u64);
+    }
+
+    crc = (uint32_t)crc64;
+    while (cb-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+static void _filter_init()
+{
+    uint32_t crc;
+    int i, j;
+
+    /* reflected polynomial of Castagnoli */
+    for (i = 0; i < 256; i++) {
+        crc = (uint32_t)i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+        }
+        __filter_crc32c_table[i] = crc;
+    }
+
+#if defined __x86_64__
+    __builtin_cpu_init();
+    __filter_crc32c_kernel = __builtin_cpu_supports("sse4.2") ? &_filter_crc32c_sse42 : &_filter_crc32c_generic;
+#else
+    __filter_crc32c_kernel = &_filter_crc32c_generic;
+#endif
+}
+
+uint32_t filter_crc32c(uint32_t crc, const unsigned char *data, size_t cb)
+{
+    if (unlikely(!__filter_crc32c_kernel)) {
+        pthread_once(&__filter_once, &_filter_init);
+    }
+    return ~(*__filter_crc32c_kernel)(~crc, data, cb);
+}
+
+unsigned char *nis_filter_reserve(nis_filter_frame_t *frame, int size)
+{
+    int i;
+
+    if (!frame || size < 0) {
+        return NULL;
+    }
+
+    /* the buffer hold the current data are kept for the stage to read */
+    i = (frame->buffer[0] && frame->data >= frame->buffer[0] && frame->data < frame->buffer[0] + frame->capacity[0]) ? 1 : 0;
+    if (!frame->buffer[i] || frame->capacity[i] < size + FILTER_SPARE) {
+        bufpool_free(frame->buffer[i]);
+        frame->buffer[i] = (unsigned char *)bufpool_alloc(size + FILTER_SPARE);
+        frame->capacity[i] = frame->buffer[i] ? size + FILTER_SPARE : 0;
+    }
+    return frame->buffer[i];
+}
+
+void filter_release(nis_filter_frame_t *frame)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (frame->buffer[i]) {
+            bufpool_free(frame->buffer[i]);
+            frame->buffer[i] = NULL;
+            frame->capacity[i] = 0;
+        }
+    }
+}
+
+/* nonzero when the data lay in a buffer of framework with @cb bytes room behind it */
+static int _filter_tail_room(const nis_filter_frame_t *frame, int cb)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (frame->buffer[i] && frame->data >= frame->buffer[i] &&
+            frame->data + frame->size + cb <= frame->buffer[i] + frame->capacity[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static nsp_status_t STDCALL _filter_crc32c_rx(void *context, nis_filter_frame_t *frame)
+{
+    uint32_t crc;
+
+    if (frame->size < FILTER_CRC32C_SIZE) {
+        mxx_call_ecr("packet too short for CRC32C, size:%d", frame->size);
+        return posix__makeerror(EBADMSG);
+    }
+
+    /* the trailer are stripped in place */
+    memcpy(&crc, frame->data + frame->size - FILTER_CRC32C_SIZE, sizeof(crc));
+    if (le32toh(crc) != filter_crc32c(0, frame->data, frame->size - FILTER_CRC32C_SIZE)) {
+        mxx_call_ecr("CRC32C mismatch, size:%d", frame->size);
+        return posix__makeerror(EBADMSG);
+    }
+    frame->size -= FILTER_CRC32C_SIZE;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t STDCALL _filter_crc32c_tx(void *context, nis_filter_frame_t *frame)
+{
+    unsigned char *output;
+    uint32_t crc;
+
+    crc = htole32(filter_crc32c(0, frame->data, frame->size));
+
+    /* the output of previous stage usually have room for the trailer, otherwise it's copied once */
+    if (!_filter_tail_room(frame, FILTER_CRC32C_SIZE)) {
+        output = nis_filter_reserve(frame, frame->size + FILTER_CRC32C_SIZE);
+        if (!output) {
+            return posix__makeerror(ENOMEM);
+        }
+        memcpy(output, frame->data, frame->size);
+        frame->data = output;
+    }
+
+    memcpy(frame->data + frame->size, &crc, sizeof(crc));
+    frame->size += FILTER_CRC32C_SIZE;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static inline uint32_t _filter_read32(const unsigned char *p)
+{
+    uint32_t u32;
+
+    memcpy(&u32, p, sizeof(u32));
+    return u32;
+}
+
+/* length of the common bytes of @ip and @ref, 8 bytes a time */
+static inline int _filter_lz_extend(const unsigned char *ip, const unsigned char *ref, const unsigned char *end, int length)
+{
+    uint64_t a, b;
+
+    while (ip + length + sizeof(a) <= end) {
+        memcpy(&a, ip + length, sizeof(a));
+        memcpy(&b, ref + length, sizeof(b));
+        if (a != b) {
+            return length + (__builtin_ctzll(le64toh(a) ^ le64toh(b)) >> 3);
+        }
+        length += sizeof(a);
+    }
+
+    while (ip + length < end && ip[length] == ref[length]) {
+        length++;
+    }
+    return length;
+}
+
+static unsigned char *_filter_lz_length(unsigned char *op, int length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/* emit @literals bytes of literal and a match of @match bytes at @offset back, zero @match for the last sequence,
+ *  return NULL when the output exceed @limit */
+static unsigned char *_filter_lz_sequence(unsigned char *op, const unsigned char *limit, const unsigned char *literal, int literals,
+    int offset, int match)
+{
+    unsigned char *token;
+
+    if (limit - op < 1 + literals + literals / 255 + 1 + 2 + match / 255 + 1) {
+        return NULL;
+    }
+
+    token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = _filter_lz_length(op, literals - 15);
+    } else {
+        *token = (unsigned char)(literals << 4);
+    }
+    memcpy(op, literal, literals);
+    op += literals;
+
+    if (0 == match) {
+        return op;
+    }
+
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    match -= FILTER_LZ_MINIMUM_MATCH;
+    if (match >= 15) {
+        *token |= 15;
+        op = _filter_lz_length(op, match - 15);
+    } else {
+        *token |= (unsigned char)match;
+    }
+    return op;
+}
+
+/* greedy LZ77 with a hash table of the last position of each 4 bytes sequence,
+ *  return the compressed size, or -1 when it's not less than @capacity */
+static int _filter_lz_compress(const unsigned char *src, int cb, unsigned char *dst, int capacity)
+{
+    uint32_t table[1 << FILTER_LZ_HASH_BITS];
+    const unsigned char *ip, *anchor, *ref, *end;
+    unsigned char *op, *limit;
+    uint32_t sequence, h;
+    int length, miss;
+
+    memset(table, 0, sizeof(table));
+    ip = anchor = src;
+    end = src + cb;
+    op = dst;
+    limit = dst + capacity;
+    miss = 0;
+
+    while (end - ip >= FILTER_LZ_MINIMUM_MATCH) {
+        sequence = _filter_read32(ip);
+        h = (sequence * 2654435761U) >> (32 - FILTER_LZ_HASH_BITS);
+        ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+
+        if (ref < ip && ip - ref <= FILTER_LZ_MAXIMUM_OFFSET && _filter_read32(ref) == sequence) {
+            length = _filter_lz_extend(ip, ref, end, FILTER_LZ_MINIMUM_MATCH);
+            op = _filter_lz_sequence(op, limit, anchor, (int)(ip - anchor), (int)(ip - ref), length);
+            if (!op) {
+                return -1;
+            }
+            ip += length;
+            anchor = ip;
+            miss = 0;
+        } else {
+            /* step faster and faster in the data which do not compress */
+            ip += 1 + (miss++ >> 5);
+        }
+    }
+
+    op = _filter_lz_sequence(op, limit, anchor, (int)(end - anchor), 0, 0);
+    return op ? (int)(op - dst) : -1;
+}
+
+static int _filter_lz_getlength(const unsigned char **ip, const unsigned char *end, int length, int limit)
+{
+    unsigned char u8;
+
+    do {
+        if (*ip >= end || length > limit) {
+            return -1;
+        }
+        u8 = *(*ip)++;
+        length += u8;
+    } while (255 == u8);
+    return length;
+}
+
+/* the stream come from wire, every length and offset are checked, return zero only when exactly @size bytes are restored */
+static int _filter_lz_decompress(const unsigned char *src, int cb, unsigned char *dst, int size)
+{
+    const unsigned char *ip, *end, *match;
+    unsigned char *op, *limit;
+    int literals, length, offset;
+    unsigned char token;
+
+    ip = src;
+    end = src + cb;
+    op = dst;
+    limit = dst + size;
+
+    while (ip < end) {
+        token = *ip++;
+        literals = token >> 4;
+        if (15 == literals && (literals = _filter_lz_getlength(&ip, end, literals, size)) < 0) {
+            return -1;
+        }
+        if (literals > end - ip || literals > limit - op) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        /* the last sequence */
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (0 == offset || offset > op - dst) {
+            return -1;
+        }
+
+        length = token & 15;
+        if (15 == length && (length = _filter_lz_getlength(&ip, end, length, size)) < 0) {
+            return -1;
+        }
+        length += FILTER_LZ_MINIMUM_MATCH;
+        if (length > limit - op) {
+            return -1;
+        }
+
+        /* the overlapped match repeat the bytes just written */
+        match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            while (length-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (op == limit) ? 0 : -1;
+}
+
+static nsp_status_t STDCALL _filter_lz_rx(void *context, nis_filter_frame_t *frame)
+{
+    unsigned char *output;
+    uint32_t size;
+
+    if (frame->size >= 1 && FILTER_LZ_STORED == frame->data[0]) {
+        frame->data++;
+        frame->size--;
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    if (frame->size < FILTER_LZ_HEAD || FILTER_LZ_PACKED != frame->data[0]) {
+        mxx_call_ecr("Illegal lz stream, size:%d", frame->size);
+        return posix__makeerror(EBADMSG);
+    }
+
+    memcpy(&size, frame->data + 1, sizeof(size));
+    size = le32toh(size);
+    if (0 == size || size > TCP_MAXIMUM_PACKET_SIZE) {
+        mxx_call_ecr("Illegal lz original size:%u", size);
+        return posix__makeerror(EBADMSG);
+    }
+
+    output = nis_filter_reserve(frame, (int)size);
+    if (!output) {
+        return posix__makeerror(ENOMEM);
+    }
+    if (0 != _filter_lz_decompress(frame->data + FILTER_LZ_HEAD, frame->size - FILTER_LZ_HEAD, output, (int)size)) {
+        mxx_call_ecr("Corrupt lz stream, size:%d", frame->size);
+        return posix__makeerror(EBADMSG);
+    }
+    frame->data = output;
+    frame->size = (int)size;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t STDCALL _filter_lz_tx(void *context, nis_filter_frame_t *frame)
+{
+    unsigned char *output;
+    uint32_t size;
+    int packed;
+
+    /* large enough for the stored one, the packed one are used only when it's smaller */
+    output = nis_filter_reserve(frame, frame->size + 1);
+    if (!output) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    packed = -1;
+    if (frame->size > FILTER_LZ_HEAD) {
+        packed = _filter_lz_compress(frame->data, frame->size, output + FILTER_LZ_HEAD, frame->size - FILTER_LZ_HEAD);
+    }
+
+    if (packed > 0) {
+        output[0] = FILTER_LZ_PACKED;
+        size = htole32((uint32_t)frame->size);
+        memcpy(output + 1, &size, sizeof(size));
+        frame->size = packed + FILTER_LZ_HEAD;
+    } else {
+        output[0] = FILTER_LZ_STORED;
+        memcpy(output + 1, frame->data, frame->size);
+        frame->size += 1;
+    }
+    frame->data = output;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static const nis_filter_stage_t __filter_crc32c_stage = { &_filter_crc32c_rx, &_filter_crc32c_tx, NULL };
+static const nis_filter_stage_t __filter_lz_stage = { &_filter_lz_rx, &_filter_lz_tx, NULL };
+
+const nis_filter_stage_t *nis_filter_crc32c()
+{
+    return &__filter_crc32c_stage;
+}
+
+const nis_filter_stage_t *nis_filter_lz()
+{
+    return &__filter_lz_stage;
+}
+
+nsp_status_t filter_rx(ncb_t *ncb, const unsigned char *data, int cb)
+{
+    nis_filter_frame_t frame;
+    const struct nis_filter_stage *stage;
+    nsp_status_t status;
+    int i, n;
+
+    /* the data are in parse buffer or large-block of this link, stages are allowed to transform it in place */
+    memset(&frame, 0, sizeof(frame));
+    frame.data = (unsigned char *)data;
+    frame.size = cb;
+
+    status = NSP_STATUS_SUCCESSFUL;
+    n = __atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++) {
+        stage = &ncb->u.tcp.filters[i];
+        if (stage->on_rx) {
+            status = (*stage->on_rx)(stage->context, &frame);
+            if (!NSP_SUCCESS(status)) {
+                mxx_call_ecr("Fails on Rx filter %d of link:%lld, error:%d", i, ncb->hld, status);
+                break;
+            }
+        }
+    }
+
+    if (NSP_SUCCESS(status)) {
+        ncb_post_recvdata(ncb, frame.size, frame.data);
+    }
+
+    filter_release(&frame);
+    return status;
+}
+
+nsp_status_t filter_tx(const ncb_t *ncb, const void *origin, int cb, const nis_serializer_fp serializer, nis_filter_frame_t *frame)
+{
+    const struct nis_filter_stage *stage;
+    unsigned char *output;
+    nsp_status_t status;
+    int i;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->data = (unsigned char *)origin;
+    frame->size = cb;
+
+    if (serializer) {
+        output = nis_filter_reserve(frame, cb);
+        if (!output) {
+            return posix__makeerror(ENOMEM);
+        }
+        status = (*serializer)(output, origin, cb);
+        if (!NSP_SUCCESS(status)) {
+            mxx_call_ecr("Fails on user define serialize.");
+            return status;
+        }
+        frame->data = output;
+    }
+
+    status = NSP_STATUS_SUCCESSFUL;
+    for (i = __atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) - 1; i >= 0; i--) {
+        stage = &ncb->u.tcp.filters[i];
+        if (stage->on_tx) {
+            status = (*stage->on_tx)(stage->context, frame);
+            if (!NSP_SUCCESS(status)) {
+                mxx_call_ecr("Fails on Tx filter %d of link:%lld, error:%d", i, ncb->hld, status);
+                return status;
+            }
+        }
+    }
+
+    if (frame->size <= 0 || frame->size > TCP_MAXIMUM_PACKET_SIZE) {
+        mxx_call_ecr("Illegal size of filtered packet:%d", frame->size);
+        return posix__makeerror(EMSGSIZE);
+    }
+    return status;
+}
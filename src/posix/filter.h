@@ -0,0 +1,29 @@
+#ifndef FILTER_H_20231102
+#define FILTER_H_20231102
+
+#include "ncb.h"
+
+/*
+ *  filter pipeline of TCP link.
+ *  Rx stages run on the Rx thread inside @tcp_parse_pkt, the packet are transformed in place of the parse buffer when the stage can,
+ *  Tx stages run on the writing thread inside @tcp_write before the protocol head are built.
+ *  the intermediate results are kept in two pooled buffers of the frame, each stage read one of them and write the other,
+ *  so the data stay hot in cache from the first stage to the last.
+ */
+
+/* run the Rx stages on @cb bytes of user data and post the output to application */
+extern
+nsp_status_t filter_rx(ncb_t *ncb, const unsigned char *data, int cb);
+
+/* run the Tx stages on the user data, @serializer are called first when it's not NULL.
+ *  the output are in @frame->data and @frame->size, release @frame by @filter_release no matter the result */
+extern
+nsp_status_t filter_tx(const ncb_t *ncb, const void *origin, int cb, const nis_serializer_fp serializer, nis_filter_frame_t *frame);
+extern
+void filter_release(nis_filter_frame_t *frame);
+
+/* CRC32C(Castagnoli) of @cb bytes, continue from @crc, zero for a new one */
+extern
+uint32_t filter_crc32c(uint32_t crc, const unsigned char *data, size_t cb);
+
+#endif
@@ -3,6 +3,8 @@
 #include <fcntl.h>
 
 #include <sys/signal.h>
+#include <sys/eventfd.h>
+#include <sched.h>
 #include <signal.h>
 
 #include "threading.h"
@@ -14,10 +16,27 @@
 #include "wpool.h"
 #include "mxx.h"
 #include "pipe.h"
+#include "shm.h"
 
 /* 1024 is just a hint for the kernel */
 #define EPOLL_SIZE    (1024)
 
+/* upper bound of epoll threads of each protocol */
+#define IO_MAXIMUM_NPROCS   (256)
+
+/* user data of the wakeup eventfd of each epoll thread, no link own this handle */
+#define IO_WAKEUP_EVENT     ((uint64_t)INVALID_OBJHLD)
+
+/* links which exhaust their receive budget during one wakeup, only visit by the owner epoll thread */
+struct io_ready_list
+{
+    objhld_t *links;
+    int count;
+    int capacity;
+};
+
+struct io_object_block;
+
 struct epoll_object_block
 {
     int epfd;
@@ -26,14 +45,34 @@ struct epoll_object_block
     lwp_event_t exit;
     int pipefdw;
     pid_t tid;
+    struct io_ready_list ready[2];
+    int ready_index;
+    /* the read side of pipe, it's a link and migrate like the others when thread set change */
+    objhld_t pipelink;
+    /* eventfd attach to @epfd directly, awaken this thread when the thread set change or terminate */
+    int wakefd;
+    /* the thread has been removed from thread set, it hand over all links before exit */
+    nsp_boolean_t retired;
+    /* generation of thread set which the links of this thread are balanced to */
+    int generation;
+    /* keep @io_attach away from the retiring thread */
+    lwp_mutex_t lock;
+    struct io_object_block *obptr;
 } ;
 
 struct io_object_block
 {
     refs_t ref;
-    struct epoll_object_block *epoptr;
+    /* blocks are allocate when thread set grow to them and kept until uninit, so the pointers are stable without lock */
+    struct epoll_object_block *epoptr[IO_MAXIMUM_NPROCS];
+    /* threads in [0, nprocs) are in service, the others are retired */
     int nprocs;
+    int nblocks;
+    /* increase on each change of thread set, threads rebalance their links when they found it changed */
+    int generation;
     int protocol;
+    /* serialize @io_resize */
+    lwp_mutex_t resize;
 };
 
 struct io_manager
@@ -77,8 +116,11 @@ static void _io_rdhup(ncb_t *ncb)
          * therefore, data send from client will pending in kernel buffer.RDHUP will arrived before EPOLLIN, this may cause data drop.
          * */
         if ( likely(0 == ioctl(ncb->sockfd, FIONREAD, &rx_pending)) ) {
-            if (rx_pending > 0 && ncb->ncb_read) {
-                ncb->ncb_read(ncb);
+            /* ignore the receive budget and pause state, the link are going to close */
+            __atomic_store_n(&ncb->rx_paused, 0, __ATOMIC_RELEASE);
+            /* the data of SHM link are pending in the ring rather than kernel buffer */
+            if ((rx_pending > 0 || ncb_shm_ready(ncb)) && ncb->ncb_read) {
+                while (NSP_SUCCESS(ncb->ncb_read(ncb))) ;
             }
         }
         io_close(ncb);
@@ -124,12 +166,79 @@ enum EPOLL_EVENTS
 #define EPOLLET EPOLLET
   };
 */
-static void _iorun(const struct epoll_event *eventptr)
+static void _io_ready_queue(struct epoll_object_block *epoptr, ncb_t *ncb)
+{
+    struct io_ready_list *list;
+    objhld_t *links;
+    int capacity;
+
+    list = &epoptr->ready[epoptr->ready_index];
+    if (list->count == list->capacity) {
+        capacity = (list->capacity > 0) ? (list->capacity << 1) : 64;
+        links = (objhld_t *)ztryrealloc(list->links, sizeof(objhld_t) * capacity);
+        if (unlikely(!links)) {
+            /* nothing we can do, data pending on this link will be read on next edge trigger */
+            mxx_call_ecr("Failed to queue ready link:%lld", ncb->hld);
+            return;
+        }
+        list->links = links;
+        list->capacity = capacity;
+    }
+
+    list->links[list->count++] = ncb->hld;
+    ncb->rx_ready = 1;
+}
+
+static void _io_read(struct epoll_object_block *epoptr, ncb_t *ncb)
+{
+    ncb_rw_t ncb_read;
+    nsp_status_t status;
+
+    ncb_read = __atomic_load_n(&ncb->ncb_read, __ATOMIC_ACQUIRE);
+    if ( likely(ncb_read) ) {
+        status = ncb_read(ncb);
+        /* receive budget exhausted, data still pending in kernel buffer.
+            EPOLLET will not report again for these data, so the link MUST be served by the ready list */
+        if (NSP_SUCCESS(status)) {
+            _io_ready_queue(epoptr, ncb);
+        } else if (!NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN)) {
+            objclos(ncb->hld);
+        }
+    }
+}
+
+/* serve each link which queued in last round once, in the order they are queued.
+ * link which still exhaust it's budget will be queued to the tail again, so all busy links share the thread in round-robin */
+static void _io_ready_run(struct epoll_object_block *epoptr)
+{
+    struct io_ready_list *list;
+    ncb_t *ncb;
+    int i;
+
+    list = &epoptr->ready[epoptr->ready_index];
+    epoptr->ready_index ^= 1;
+
+    for (i = 0; i < list->count; i++) {
+        ncb = (ncb_t *)objrefr(list->links[i]);
+        if (unlikely(!ncb)) {
+            continue;
+        }
+        /* the link has been migrated to another thread since it queued */
+        if (unlikely(ncb->epfd != epoptr->epfd)) {
+            objdefr(list->links[i]);
+            continue;
+        }
+        ncb->rx_ready = 0;
+        _io_read(epoptr, ncb);
+        objdefr(list->links[i]);
+    }
+    list->count = 0;
+}
+
+static void _iorun(struct epoll_object_block *epoptr, const struct epoll_event *eventptr)
 {
     ncb_t *ncb;
     objhld_t hld;
-    nsp_status_t status;
-    ncb_rw_t ncb_read;
     int error;
 
     do {
@@ -169,12 +278,9 @@ static void _iorun(const struct epoll_event *eventptr)
 
         /* system width input cache change from empty to readable */
         if (eventptr->events & EPOLLIN) {
-            ncb_read = __atomic_load_n(&ncb->ncb_read, __ATOMIC_ACQUIRE);
-            if ( likely(ncb_read) ) {
-                status = ncb_read(ncb);
-                if (!NSP_SUCCESS_OR_ERROR_EQUAL(status, EAGAIN)) {
-                    objclos(ncb->hld);
-                }
+            /* the link which already waiting on the ready list will be served there, keep fairness of the round */
+            if (!ncb->rx_ready) {
+                _io_read(epoptr, ncb);
             }
         }
 
@@ -211,6 +317,178 @@ static void _iorun(const struct epoll_event *eventptr)
     objdefr(hld);
 }
 
+/* links are spread over epoll threads in service by their handle, unless a explicit thread specified by @rx_affinity */
+static struct epoll_object_block *_io_select_epoll(struct io_object_block *obptr, const ncb_t *ncb)
+{
+    int nprocs;
+
+    nprocs = __atomic_load_n(&obptr->nprocs, __ATOMIC_ACQUIRE);
+    if (unlikely(nprocs <= 0)) {
+        return NULL;
+    }
+
+    if (ncb->rx_affinity >= 0) {
+        return obptr->epoptr[ncb->rx_affinity % nprocs];
+    }
+    return obptr->epoptr[ncb->hld % nprocs];
+}
+
+/* select and lock the epoll thread for @ncb, the thread which retire after selection is skipped */
+static struct epoll_object_block *_io_lock_epoll(struct io_object_block *obptr, const ncb_t *ncb)
+{
+    struct epoll_object_block *epoptr;
+
+    while (NULL != (epoptr = _io_select_epoll(obptr, ncb))) {
+        lwp_mutex_lock(&epoptr->lock);
+        if (!epoptr->retired) {
+            break;
+        }
+        lwp_mutex_unlock(&epoptr->lock);
+    }
+
+    return epoptr;
+}
+
+static nsp_status_t _io_epoll_add(struct epoll_object_block *epoptr, ncb_t *ncb, int mask)
+{
+    struct epoll_event epevt;
+
+    memset(&epevt, 0, sizeof(epevt));
+    epevt.data.u64 = (uint64_t)ncb->hld;
+    epevt.events = (EPOLLET | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+    epevt.events |= mask;
+    if (ncb_rx_paused(ncb)) {
+        epevt.events &= ~EPOLLIN;
+    }
+
+    ncb->epfd = epoptr->epfd;
+    if ( epoll_ctl(ncb->epfd, EPOLL_CTL_ADD, ncb->sockfd, &epevt) < 0 && errno != EEXIST ) {
+        mxx_call_ecr("Fatal syscall epoll_ctl(2),link:%lld,sockfd:%d,epfd:%d,mask:%d,error:%d",
+            ncb->hld, ncb->sockfd, ncb->epfd, mask, errno);
+        ncb->epfd = -1;
+        return posix__makeerror(errno);
+    }
+
+    ncb->epmask = mask;
+    ncb->rx_tid = epoptr->tid;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* move @ncb from epoll thread @from to the thread it belong to now, caller hold the lock of Tx fifo(except pipe link).
+    pending events on the old epoll are discard by EPOLL_CTL_DEL, and EPOLL_CTL_ADD report the current state of socket on the new one,
+    so nothing lost for edge trigger, the ready list entry of old thread are skipped by @_io_ready_run */
+static nsp_status_t _io_migrate(struct epoll_object_block *from, ncb_t *ncb)
+{
+    struct epoll_object_block *to;
+    struct epoll_event evt;
+    nsp_status_t status;
+
+    to = _io_lock_epoll(from->obptr, ncb);
+    if (!to) {
+        return posix__makeerror(EPROTOTYPE);
+    }
+
+    status = NSP_STATUS_SUCCESSFUL;
+    do {
+        if (to == from) {
+            break;
+        }
+
+        if (epoll_ctl(from->epfd, EPOLL_CTL_DEL, ncb->sockfd, &evt) < 0) {
+            mxx_call_ecr("Fatal syscall epoll_ctl(2) link:%lld,sockfd:%d,epfd:%d,error:%d", ncb->hld, ncb->sockfd, from->epfd, errno);
+        }
+
+        status = _io_epoll_add(to, ncb, ncb->epmask);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+        ncb->rx_ready = 0;
+        status = shm_migrate(ncb);
+    } while (0);
+
+    lwp_mutex_unlock(&to->lock);
+    return status;
+}
+
+static int _io_rebalance_link(struct epoll_object_block *epoptr, objhld_t hld, nsp_boolean_t pipe)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+    int migrated;
+
+    ncb = (ncb_t *)objrefr(hld);
+    if (!ncb) {
+        return 0;
+    }
+
+    /* @epfd of link are stable under the lock of Tx fifo, see @fifo_queue and @ncb_pause_rx.
+        pipe link are touch by it's Rx thread only, and the lock of it never initialized */
+    migrated = 0;
+    if (!pipe) {
+        lwp_mutex_lock(&ncb->fifo.lock);
+    }
+    if (ncb->epfd == epoptr->epfd) {
+        status = _io_migrate(epoptr, ncb);
+        if (NSP_SUCCESS(status)) {
+            migrated = (ncb->epfd != epoptr->epfd) ? 1 : 0;
+        } else {
+            objclos(hld);
+        }
+    }
+    if (!pipe) {
+        lwp_mutex_unlock(&ncb->fifo.lock);
+    }
+
+    objdefr(hld);
+    return migrated;
+}
+
+/* thread set changed, links of this thread which belong to another thread now are moved there,
+    retired thread move all of it's links */
+static void _io_rebalance(struct epoll_object_block *epoptr)
+{
+    struct io_object_block *obptr;
+    objhld_t *hlds;
+    int count, nblocks, migrated;
+    int i;
+
+    obptr = epoptr->obptr;
+    epoptr->generation = __atomic_load_n(&obptr->generation, __ATOMIC_ACQUIRE);
+    migrated = 0;
+
+    /* pipe are not in the link list of ncb */
+    nblocks = __atomic_load_n(&obptr->nblocks, __ATOMIC_ACQUIRE);
+    for (i = 0; i < nblocks; i++) {
+        if (INVALID_OBJHLD != obptr->epoptr[i]->pipelink) {
+            migrated += _io_rebalance_link(epoptr, obptr->epoptr[i]->pipelink, nsp_true);
+        }
+    }
+
+    if (!NSP_SUCCESS(ncb_query_epoll_links(epoptr->epfd, &hlds, &count))) {
+        mxx_call_ecr("Failed to query links of Ep:%d", epoptr->epfd);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        migrated += _io_rebalance_link(epoptr, hlds[i], nsp_false);
+    }
+    if (hlds) {
+        zfree(hlds);
+    }
+
+    mxx_call_ecr("Ep:%d generation:%d, %d links migrated", epoptr->epfd, epoptr->generation, migrated);
+}
+
+static void _io_wakeup(struct epoll_object_block *epoptr)
+{
+    uint64_t n;
+
+    n = 1;
+    if (write(epoptr->wakefd, &n, sizeof(n)) < 0) {
+        mxx_call_ecr("Fatal syscall write(2) for wakeup of Ep:%d, error:%d", epoptr->epfd, errno);
+    }
+}
+
 static void *_epoll_proc(void *argv)
 {
     static const int EP_TIMEDOUT = -1;//1000;
@@ -218,15 +496,19 @@ static void *_epoll_proc(void *argv)
     int sigcnt;
     struct epoll_object_block *epoptr;
     int i;
+    int timeout;
+    uint64_t n;
 
     epoptr = (struct epoll_object_block *)argv;
     assert(NULL != epoptr);
 
     mxx_call_ecr("Lwp for Ep:%d", epoptr->epfd);
-    epoptr->tid = ifos_gettid();
+    __atomic_store_n(&epoptr->tid, ifos_gettid(), __ATOMIC_RELEASE);
 
     while (YES == epoptr->actived) {
-        SYSCALL_WHILE_EINTR(sigcnt, epoll_wait(epoptr->epfd, evts, EPOLL_SIZE, EP_TIMEDOUT));
+        /* do not block when there are links waiting on the ready list */
+        timeout = (epoptr->ready[epoptr->ready_index].count > 0) ? 0 : EP_TIMEDOUT;
+        SYSCALL_WHILE_EINTR(sigcnt, epoll_wait(epoptr->epfd, evts, EPOLL_SIZE, timeout));
         if (sigcnt < 0) {
             mxx_call_ecr("Fatal syscall epoll_wait(2), epfd:%d, error:%d", epoptr->epfd, errno);
             break;
@@ -235,49 +517,186 @@ static void *_epoll_proc(void *argv)
         /* at least one signal is awakened,
             otherwise, timeout trigger. */
         for (i = 0; i < sigcnt; i++) {
-            _iorun(&evts[i]);
+            /* awaken for thread set change or terminate, they are checked after this round */
+            if (unlikely(IO_WAKEUP_EVENT == evts[i].data.u64)) {
+                while (read(epoptr->wakefd, &n, sizeof(n)) > 0) ;
+                continue;
+            }
+            _iorun(epoptr, &evts[i]);
+        }
+
+        /* links exhaust their budget in previous round, serve them once before next epoll_wait(2) */
+        _io_ready_run(epoptr);
+
+        if (unlikely(epoptr->generation != __atomic_load_n(&epoptr->obptr->generation, __ATOMIC_ACQUIRE))) {
+            _io_rebalance(epoptr);
         }
     }
 
+    /* removed from thread set, none of the links belong to this thread now, the pending data are reported on their new thread */
+    if (epoptr->retired) {
+        _io_rebalance(epoptr);
+        epoptr->ready[0].count = 0;
+        epoptr->ready[1].count = 0;
+    }
+
     mxx_call_ecr("Lwp exit Ep:%d", epoptr->epfd);
     lwp_exit( (void *)0 );
     return NULL;
 }
 
-static nsp_status_t _io_init(struct io_object_block *obptr)
+static nsp_status_t _io_alloc_epoll(struct io_object_block *obptr, int index)
 {
-    int i;
     struct epoll_object_block *epoptr;
+    struct epoll_event epevt;
+    nsp_status_t status;
 
-    obptr->epoptr = (struct epoll_object_block *)ztrycalloc(sizeof(struct epoll_object_block) * obptr->nprocs);
-    if (!obptr->epoptr) {
+    epoptr = (struct epoll_object_block *)ztrycalloc(sizeof(struct epoll_object_block));
+    if (!epoptr) {
         return posix__makeerror(ENOMEM);
     }
+    epoptr->obptr = obptr;
+    epoptr->pipefdw = -1;
+    epoptr->pipelink = INVALID_OBJHLD;
+    epoptr->actived = NO;
+    epoptr->retired = NO;
+
+    epoptr->epfd = epoll_create(EPOLL_SIZE); /* kernel don't care about the parameter @size, but request it MUST be large than zero */
+    if (epoptr->epfd < 0) {
+        mxx_call_ecr("Fatal syscall epoll_create(2), error:%d", errno);
+        status = posix__makeerror(errno);
+        zfree(epoptr);
+        return status;
+    }
 
-    for (i = 0; i < obptr->nprocs; i++) {
-        epoptr = &obptr->epoptr[i];
-        epoptr->epfd = epoll_create(EPOLL_SIZE); /* kernel don't care about the parameter @size, but request it MUST be large than zero */
-        if (epoptr->epfd < 0) {
-            mxx_call_ecr("Fatal syscall epoll_create(2), error:%d", errno);
-            continue;
+    epoptr->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    memset(&epevt, 0, sizeof(epevt));
+    epevt.data.u64 = IO_WAKEUP_EVENT;
+    epevt.events = (EPOLLET | EPOLLIN);
+    if (epoptr->wakefd < 0 || epoll_ctl(epoptr->epfd, EPOLL_CTL_ADD, epoptr->wakefd, &epevt) < 0) {
+        mxx_call_ecr("Fatal syscall for wakeup eventfd of Ep:%d, error:%d", epoptr->epfd, errno);
+        status = posix__makeerror(errno);
+        if (epoptr->wakefd >= 0) {
+            close(epoptr->wakefd);
         }
+        close(epoptr->epfd);
+        zfree(epoptr);
+        return status;
+    }
 
-        /* @actived is the flag for io thread terminate */
-        epoptr->actived = YES;
-        if (lwp_create(&epoptr->lwp, 0, &_epoll_proc, epoptr) < 0) {
-            mxx_call_ecr("Fatal syscall pthread_create(3), error:%d", errno);
-            close(epoptr->epfd);
-            epoptr->epfd = -1;
-            epoptr->actived = NO;
-            continue;
+    lwp_mutex_init(&epoptr->lock, nsp_false);
+    obptr->epoptr[index] = epoptr;
+    __atomic_store_n(&obptr->nblocks, index + 1, __ATOMIC_RELEASE);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t _io_start_epoll(struct epoll_object_block *epoptr)
+{
+    lwp_mutex_lock(&epoptr->lock);
+    /* @actived is the flag for io thread terminate */
+    epoptr->actived = YES;
+    epoptr->retired = NO;
+    epoptr->generation = __atomic_load_n(&epoptr->obptr->generation, __ATOMIC_ACQUIRE);
+    lwp_mutex_unlock(&epoptr->lock);
+
+    if (lwp_create(&epoptr->lwp, 0, &_epoll_proc, epoptr) < 0) {
+        mxx_call_ecr("Fatal syscall pthread_create(3), error:%d", errno);
+        epoptr->actived = NO;
+        return posix__makeerror(errno);
+    }
+
+    /* links attach to this thread record it's thread-id, wait it published */
+    while (0 == __atomic_load_n(&epoptr->tid, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* threads in [@obptr->nprocs, @nprocs) are start and put into service, the blocks are allocate at the first time.
+    when failed in halfway, the threads already started are keep in service */
+static nsp_status_t _io_grow(struct io_object_block *obptr, int nprocs)
+{
+    int i, current;
+    nsp_status_t status;
+
+    current = obptr->nprocs;
+    status = NSP_STATUS_SUCCESSFUL;
+    for (i = current; i < nprocs; i++) {
+        if (i >= obptr->nblocks) {
+            status = _io_alloc_epoll(obptr, i);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+        }
+
+        status = _io_start_epoll(obptr->epoptr[i]);
+        if (!NSP_SUCCESS(status)) {
+            break;
         }
     }
 
-     /* function @io_attach will be invoke during @pipe_create called, so the epoll file-descriptor must create before it */
-    for (i = 0; i < obptr->nprocs; i++) {
-        epoptr = &obptr->epoptr[i];
-        /* create a pipe object for this thread */
-        pipe_create(obptr->protocol, &epoptr->pipefdw);
+    if (i == current) {
+        return status;
+    }
+
+    __atomic_store_n(&obptr->nprocs, i, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&obptr->generation, 1, __ATOMIC_RELEASE);
+
+    /* pipe of new thread created after it's in service, so it attach to it's own thread directly.
+        function @io_attach will be invoke during @pipe_create called, so the epoll file-descriptor must create before it */
+    for (i = current; i < obptr->nprocs; i++) {
+        if (INVALID_OBJHLD == obptr->epoptr[i]->pipelink) {
+            pipe_create(obptr->protocol, i, &obptr->epoptr[i]->pipefdw, &obptr->epoptr[i]->pipelink);
+        }
+    }
+
+    /* the threads already in service move part of their links to the new ones */
+    for (i = 0; i < current; i++) {
+        _io_wakeup(obptr->epoptr[i]);
+    }
+
+    return status;
+}
+
+/* threads in [@nprocs, @obptr->nprocs) are retired, they hand over their links to the remain threads before exit.
+    the blocks of them are keep for next growth */
+static nsp_status_t _io_shrink(struct io_object_block *obptr, int nprocs)
+{
+    int i, current;
+    pid_t tid;
+    struct epoll_object_block *epoptr;
+
+    current = obptr->nprocs;
+
+    /* retired thread can not wait for itself */
+    tid = ifos_gettid();
+    for (i = nprocs; i < current; i++) {
+        if (obptr->epoptr[i]->tid == tid) {
+            return posix__makeerror(EDEADLK);
+        }
+    }
+
+    __atomic_store_n(&obptr->nprocs, nprocs, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&obptr->generation, 1, __ATOMIC_RELEASE);
+
+    /* @io_attach select thread again when it found the selected one retired */
+    for (i = nprocs; i < current; i++) {
+        epoptr = obptr->epoptr[i];
+        lwp_mutex_lock(&epoptr->lock);
+        epoptr->retired = YES;
+        epoptr->actived = NO;
+        lwp_mutex_unlock(&epoptr->lock);
+    }
+
+    for (i = 0; i < current; i++) {
+        _io_wakeup(obptr->epoptr[i]);
+    }
+
+    for (i = nprocs; i < current; i++) {
+        epoptr = obptr->epoptr[i];
+        lwp_join(&epoptr->lwp, NULL);
+        __atomic_store_n(&epoptr->tid, 0, __ATOMIC_RELEASE);
     }
 
     return NSP_STATUS_SUCCESSFUL;
@@ -285,47 +704,55 @@ static nsp_status_t _io_init(struct io_object_block *obptr)
 
 static nsp_status_t _io_exit_epo(struct epoll_object_block *epoptr)
 {
-    struct pipe_package_head pipemsg;
-    ssize_t n;
-
-    n = 0;
     if (YES == epoptr->actived) {
         /* mark exit */
         epoptr->actived = NO;
-        /* awaken thread thougth a pipe message*/
-        pipemsg.length = 0;
-        pipemsg.link = -1;
-        n = write(epoptr->pipefdw, &pipemsg, sizeof(pipemsg));
+        /* awaken thread thougth the eventfd */
+        _io_wakeup(epoptr);
+        return NSP_STATUS_SUCCESSFUL;
     }
 
-    return n > 0 ? NSP_STATUS_SUCCESSFUL : NSP_STATUS_FATAL;
+    return NSP_STATUS_FATAL;
 }
 
 static void _io_uninit(struct io_object_block *obptr)
 {
-    int i;
+    int i, j;
     struct epoll_object_block *epoptr;
 
     ILLEGAL_PARAMETER_STOP(!obptr);
-    ILLEGAL_PARAMETER_STOP(!obptr->epoptr);
 
+    /* the retired threads have been joined when they retire */
     for (i = 0; i < obptr->nprocs; i++) {
-        _io_exit_epo(&obptr->epoptr[i]);
+        _io_exit_epo(obptr->epoptr[i]);
     }
 
     /* waitting for thread safe terminated */
     for (i = 0; i < obptr->nprocs; i++) {
-        epoptr = &obptr->epoptr[i];
-        lwp_join(&epoptr->lwp, NULL);
+        lwp_join(&obptr->epoptr[i]->lwp, NULL);
+    }
+    obptr->nprocs = 0;
 
+    for (i = 0; i < obptr->nblocks; i++) {
+        epoptr = obptr->epoptr[i];
         if (epoptr->epfd > 0){
             close(epoptr->epfd);
             epoptr->epfd = -1;
         }
-    }
+        close(epoptr->wakefd);
+
+        for (j = 0; j < 2; j++) {
+            if (epoptr->ready[j].links) {
+                zfree(epoptr->ready[j].links);
+                epoptr->ready[j].links = NULL;
+            }
+        }
 
-    zfree(obptr->epoptr);
-    obptr->epoptr = NULL;
+        lwp_mutex_uninit(&epoptr->lock);
+        zfree(epoptr);
+        obptr->epoptr[i] = NULL;
+    }
+    obptr->nblocks = 0;
 }
 
 static struct io_object_block **_io_locate_protocol(int protocol)
@@ -372,10 +799,26 @@ static void _io_close_protocol(refs_t *ref)
     obptr = container_of(ref, struct io_object_block, ref);
     if (obptr) {
         _io_uninit(obptr);
+        lwp_mutex_uninit(&obptr->resize);
         zfree(obptr);
     }
 }
 
+/* follow the CPU quota of cgroup rather than all processors of machine, UDP take a half of it */
+static int _io_default_nprocs(int protocol)
+{
+    int nprocs;
+
+    nprocs = ifos_getnprocs_quota();
+    if (IPPROTO_TCP != protocol ) {
+        nprocs >>= 1;
+    }
+    if (nprocs <= 0) {
+        nprocs = 1;
+    }
+    return (nprocs > IO_MAXIMUM_NPROCS) ? IO_MAXIMUM_NPROCS : nprocs;
+}
+
 nsp_status_t io_init(int protocol, int nprocs)
 {
     nsp_status_t status;
@@ -394,29 +837,32 @@ nsp_status_t io_init(int protocol, int nprocs)
 
     /* initialize shared object reference */
     ref_init(&obptr->ref, &_io_close_protocol);
+    lwp_mutex_init(&obptr->resize, nsp_false);
     /* determine how many threads are there IO module acquire */
     obptr->protocol = protocol;
     if (0 == nprocs) {
-        obptr->nprocs = ifos_getnprocs();
-        if (IPPROTO_TCP != protocol ) {
-            obptr->nprocs >>= 1;
-        }
+        nprocs = _io_default_nprocs(protocol);
     } else {
-        obptr->nprocs = (nprocs < 0) ? 1 : nprocs;
+        nprocs = (nprocs < 0) ? 1 : ((nprocs > IO_MAXIMUM_NPROCS) ? IO_MAXIMUM_NPROCS : nprocs);
     }
 
     expect = NULL;
     if (!__atomic_compare_exchange_n(locate, &expect, obptr, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+        lwp_mutex_uninit(&obptr->resize);
         zfree(obptr);
         return EEXIST; /* not a error */
     }
 
     /* create IO thread */
     lwp_mutex_lock(&_iomgr.mutex);
-    status = _io_init(obptr);
-    if ( unlikely(!NSP_SUCCESS(status)) ) {
+    lwp_mutex_lock(&obptr->resize);
+    status = _io_grow(obptr, nprocs);
+    lwp_mutex_unlock(&obptr->resize);
+    if ( unlikely(0 == obptr->nprocs) ) {
         __atomic_store_n(locate, NULL, __ATOMIC_RELEASE);
         ref_close(&obptr->ref);
+    } else {
+        status = NSP_STATUS_SUCCESSFUL;
     }
     lwp_mutex_unlock(&_iomgr.mutex);
 
@@ -517,7 +963,6 @@ nsp_status_t io_set_nonblock(int fd, int set)
 
 nsp_status_t io_attach(void *ncbptr, int mask)
 {
-    struct epoll_event epevt;
     ncb_t *ncb;
     struct io_object_block *obptr;
     struct epoll_object_block *epoptr;
@@ -533,22 +978,16 @@ nsp_status_t io_attach(void *ncbptr, int mask)
 #if 0   /* we don't initive mark file descriptor to nonblock when it attach to epoll */
         io_set_nonblock(ncb->sockfd, 1);
 #endif
-        memset(&epevt, 0, sizeof(epevt));
-        epevt.data.u64 = (uint64_t)ncb->hld;
-        epevt.events = (EPOLLET | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
-    	epevt.events |= mask;
-
-        epoptr = &obptr->epoptr[ncb->hld % obptr->nprocs];
-    	ncb->epfd = epoptr->epfd;
-        if ( epoll_ctl(ncb->epfd, EPOLL_CTL_ADD, ncb->sockfd, &epevt) < 0 &&
-                errno != EEXIST ) {
-            mxx_call_ecr("Fatal syscall epoll_ctl(2),link:%lld,sockfd:%d,epfd:%d,mask:%d,error:%d",
-                ncb->hld, ncb->sockfd, ncb->epfd, mask, errno);
+        /* the selected thread may retire before the link attached, keep it locked, the retiring thread always see this link */
+        epoptr = _io_lock_epoll(obptr, ncb);
+        if (unlikely(!epoptr)) {
             ncb->epfd = -1;
-    	} else {
-            ncb->rx_tid = epoptr->tid;
+            break;
+        }
+        if (NSP_SUCCESS(_io_epoll_add(epoptr, ncb, mask))) {
             mxx_call_ecr("Success associate link:%lld,sockfd:%d,epfd:%d", ncb->hld, ncb->sockfd, ncb->epfd);
         }
+        lwp_mutex_unlock(&epoptr->lock);
     } while(0);
 
     _io_safe_release(obptr);
@@ -564,6 +1003,10 @@ nsp_status_t io_modify(void *ncbptr, int mask )
     epevt.data.u64 = (uint64_t)ncb->hld;
     epevt.events = (EPOLLET | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
 	epevt.events |= mask;
+    /* receive flow control, the kernel receive window closed when application not reading */
+    if (ncb_rx_paused(ncb)) {
+        epevt.events &= ~EPOLLIN;
+    }
 
     if (epoll_ctl(ncb->epfd, EPOLL_CTL_MOD, ncb->sockfd, &epevt) < 0 ) {
         mxx_call_ecr("Fatal syscall epoll_ctl(2) link:%lld,sockfd:%d,epfd:%d,mask:%d,error:%d",
@@ -571,6 +1014,29 @@ nsp_status_t io_modify(void *ncbptr, int mask )
         return posix__makeerror(errno);
     }
 
+    ncb->epmask = mask;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* extra file-descriptor which report the readable event on behalf of this link, it's removed by the owner before close */
+nsp_status_t io_attach_fd(void *ncbptr, int fd)
+{
+    struct epoll_event epevt;
+    ncb_t *ncb;
+
+    ncb = (ncb_t *)ncbptr;
+    if (ncb->epfd <= 0) {
+        return posix__makeerror(EBADFD);
+    }
+
+    memset(&epevt, 0, sizeof(epevt));
+    epevt.data.u64 = (uint64_t)ncb->hld;
+    epevt.events = (EPOLLET | EPOLLIN);
+    if (epoll_ctl(ncb->epfd, EPOLL_CTL_ADD, fd, &epevt) < 0) {
+        mxx_call_ecr("Fatal syscall epoll_ctl(2) link:%lld,fd:%d,epfd:%d,error:%d", ncb->hld, fd, ncb->epfd, errno);
+        return posix__makeerror(errno);
+    }
+
     return NSP_STATUS_SUCCESSFUL;
 }
 
@@ -628,10 +1094,58 @@ void io_close(void *ncbptr)
     }
 }
 
+int io_nprocs(int protocol)
+{
+    struct io_object_block *obptr;
+    int nprocs;
+
+    obptr = _io_safe_retain(protocol);
+    if (unlikely(!obptr)) {
+        return posix__makeerror(EPROTOTYPE);
+    }
+
+    nprocs = __atomic_load_n(&obptr->nprocs, __ATOMIC_ACQUIRE);
+    _io_safe_release(obptr);
+    return nprocs;
+}
+
+nsp_status_t io_resize(int protocol, int nprocs)
+{
+    struct io_object_block *obptr;
+    nsp_status_t status;
+
+    if (nprocs < 0 || nprocs > IO_MAXIMUM_NPROCS) {
+        return posix__makeerror(EINVAL);
+    }
+
+    obptr = _io_safe_retain(protocol);
+    if (unlikely(!obptr)) {
+        return posix__makeerror(EPROTOTYPE);
+    }
+
+    if (0 == nprocs) {
+        nprocs = _io_default_nprocs(protocol);
+    }
+
+    lwp_mutex_lock(&obptr->resize);
+    if (nprocs > obptr->nprocs) {
+        status = _io_grow(obptr, nprocs);
+    } else if (nprocs < obptr->nprocs) {
+        status = _io_shrink(obptr, nprocs);
+    } else {
+        status = NSP_STATUS_SUCCESSFUL;
+    }
+    lwp_mutex_unlock(&obptr->resize);
+
+    _io_safe_release(obptr);
+    return status;
+}
+
 nsp_status_t io_pipefd(void *ncbptr, int *pipefd)
 {
     ncb_t *ncb;
     struct io_object_block *obptr;
+    struct epoll_object_block *epoptr;
     nsp_status_t status;
 
     ncb = (ncb_t *)ncbptr;
@@ -640,7 +1154,9 @@ nsp_status_t io_pipefd(void *ncbptr, int *pipefd)
         return posix__makeerror(EPROTOTYPE);
     }
 
-    *pipefd = obptr->epoptr[ncb->hld % obptr->nprocs].pipefdw;
+    /* pipe of the selected thread may be serving by another thread when the thread set changing, the message is not lost */
+    epoptr = _io_select_epoll(obptr, ncb);
+    *pipefd = epoptr ? epoptr->pipefdw : -1;
     status = *pipefd > 0 ? NSP_STATUS_SUCCESSFUL : posix__makeerror(EBADFD);
 
     _io_safe_release(obptr);
@@ -24,12 +24,20 @@ nsp_status_t io_attach(void *ncbptr, int mask);
 extern
 nsp_status_t io_modify(void *ncbptr, int mask );
 extern
+nsp_status_t io_attach_fd(void *ncbptr, int fd);
+extern
 void io_detach(void *ncbptr);
 extern
 void io_close(void *ncbptr);
 extern
 nsp_status_t io_pipefd(void *ncbptr, int *pipefd);
 extern
+int io_nprocs(int protocol);
+/* grow or shrink the epoll threads of @protocol to @nprocs, zero to follow the CPU quota,
+    links on the retired threads are migrated to the remain ones before return */
+extern
+nsp_status_t io_resize(int protocol, int nprocs);
+extern
 nsp_status_t io_shutdown(void *ncbptr, int how);
 
 #endif /* IO_H */
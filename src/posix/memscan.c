@@ -0,0 +1,120 @@
+#include "memscan.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined __x86_64__
+#include <immintrin.h>
+#endif
+
+typedef int (*memscan_fp)(const unsigned char *data, int cb, const unsigned char *delim, int dlen);
+
+static memscan_fp __memscan_kernel = NULL;
+static pthread_once_t __memscan_once = PTHREAD_ONCE_INIT;
+
+/* byte-wise search start from @from, the candidates are found by memchr(3) on the first byte of delimiter */
+static int _memscan_scalar(const unsigned char *data, int cb, const unsigned char *delim, int dlen, int from)
+{
+    const unsigned char *cursor, *end;
+
+    if (cb - from < dlen) {
+        return -1;
+    }
+
+    /* the last position where a whole delimiter can start */
+    end = data + cb - dlen + 1;
+    for (cursor = data + from; cursor < end; cursor++) {
+        cursor = (const unsigned char *)memchr(cursor, delim[0], end - cursor);
+        if (!cursor) {
+            return -1;
+        }
+        if (0 == memcmp(cursor + 1, delim + 1, dlen - 1)) {
+            return (int)(cursor - data);
+        }
+    }
+    return -1;
+}
+
+#if defined __x86_64__
+static int _memscan_sse2(const unsigned char *data, int cb, const unsigned char *delim, int dlen)
+{
+    __m128i first, last, head, tail;
+    unsigned int mask;
+    int i, bit;
+
+    first = _mm_set1_epi8((char)delim[0]);
+    last = _mm_set1_epi8((char)delim[dlen - 1]);
+
+    /* bit n of @mask set when position i + n start with the first byte and end with the last byte of delimiter */
+    for (i = 0; i + dlen - 1 + 16 <= cb; i += 16) {
+        head = _mm_loadu_si128((const __m128i *)(data + i));
+        tail = _mm_loadu_si128((const __m128i *)(data + i + dlen - 1));
+        mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            bit = __builtin_ctz(mask);
+            if (dlen <= 2 || 0 == memcmp(data + i + bit + 1, delim + 1, dlen - 2)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return _memscan_scalar(data, cb, delim, dlen, i);
+}
+
+__attribute__((target("avx2")))
+static int _memscan_avx2(const unsigned char *data, int cb, const unsigned char *delim, int dlen)
+{
+    __m256i first, last, head, tail;
+    unsigned int mask;
+    int i, bit;
+
+    first = _mm256_set1_epi8((char)delim[0]);
+    last = _mm256_set1_epi8((char)delim[dlen - 1]);
+
+    for (i = 0; i + dlen - 1 + 32 <= cb; i += 32) {
+        head = _mm256_loadu_si256((const __m256i *)(data + i));
+        tail = _mm256_loadu_si256((const __m256i *)(data + i + dlen - 1));
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        while (mask) {
+            bit = __builtin_ctz(mask);
+            if (dlen <= 2 || 0 == memcmp(data + i + bit + 1, delim + 1, dlen - 2)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return _memscan_scalar(data, cb, delim, dlen, i);
+}
+#else
+static int _memscan_generic(const unsigned char *data, int cb, const unsigned char *delim, int dlen)
+{
+    return _memscan_scalar(data, cb, delim, dlen, 0);
+}
+#endif
+
+static void _memscan_init()
+{
+#if defined __x86_64__
+    __builtin_cpu_init();
+    __memscan_kernel = __builtin_cpu_supports("avx2") ? &_memscan_avx2 : &_memscan_sse2;
+#else
+    __memscan_kernel = &_memscan_generic;
+#endif
+}
+
+int memscan(const unsigned char *data, int cb, const unsigned char *delim, int dlen)
+{
+    const unsigned char *cursor;
+
+    if (1 == dlen) {
+        cursor = (const unsigned char *)memchr(data, delim[0], cb);
+        return cursor ? (int)(cursor - data) : -1;
+    }
+
+    if (unlikely(!__memscan_kernel)) {
+        pthread_once(&__memscan_once, &_memscan_init);
+    }
+    return (*__memscan_kernel)(data, cb, delim, dlen);
+}
@@ -0,0 +1,18 @@
+#ifndef MEMSCAN_H_20231026
+#define MEMSCAN_H_20231026
+
+#include "compiler.h"
+
+/*
+ *  search a short delimiter(1~8 bytes) in a receive buffer.
+ *  multi-byte delimiter are searched 16(SSE2) or 32(AVX2) positions at a time, both the first and the last byte of delimiter
+ *  are compared in one step, so the false candidates which need a full compare are rare.
+ *  AVX2 is selected at runtime when the CPU support it, SSE2 is the baseline of x86_64, the other architectures use memchr(3).
+ *  single byte delimiter always use memchr(3), it's vectorized by libc already.
+ */
+
+/* offset of the first @delim in @data, -1 if not found */
+extern
+int memscan(const unsigned char *data, int cb, const unsigned char *delim, int dlen);
+
+#endif
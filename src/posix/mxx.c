@@ -16,6 +16,10 @@
 
 #include "tcp.h"
 #include "udp.h"
+#include "bufpool.h"
+#include "fifo.h"
+#include "dispatch.h"
+#include "capture.h"
 
 /* use command: strings nshost.so.9.9.1 | grep 'COMPILE DATE'
     to query the compile date of specify ELF file */
@@ -219,6 +223,8 @@ int nis_cntl(objhld_t link, int cmd, ...)
     int retval;
     va_list ap;
     void *context;
+    int iarg;
+    int *ptr;
 
     ILLEGAL_PARAMETER_CHECK(link < 0);
 
@@ -265,6 +271,74 @@ int nis_cntl(objhld_t link, int cmd, ...)
         case NI_GETRXTID:
             retval = (int)ncb->rx_tid;
             break;
+        case NI_SETRXBUDGET:
+            iarg = va_arg(ap, int);
+            retval = ncb_set_rx_budget(ncb, iarg, va_arg(ap, int));
+            break;
+        case NI_GETRXBUDGET:
+            ptr = va_arg(ap, int *);
+            retval = ncb_get_rx_budget(ncb, ptr, va_arg(ap, int *));
+            break;
+        case NI_PAUSERX:
+            retval = ncb_pause_rx(ncb, NCB_RX_PAUSE_MANUAL);
+            break;
+        case NI_RESUMERX:
+            retval = ncb_resume_rx(ncb, NCB_RX_PAUSE_MANUAL);
+            break;
+        case NI_SETRXWATERMARK:
+            iarg = va_arg(ap, int);
+            retval = ncb_set_rx_watermark(ncb, iarg, va_arg(ap, int));
+            break;
+        case NI_REPORTRXDEPTH:
+            retval = ncb_report_rx_depth(ncb, va_arg(ap, int));
+            break;
+        case NI_SETTXRATE:
+            iarg = va_arg(ap, int);
+            retval = ncb_set_tx_rate(ncb, iarg, va_arg(ap, int));
+            break;
+        case NI_GETTXRATE:
+            ptr = va_arg(ap, int *);
+            retval = ncb_get_tx_rate(ncb, ptr, va_arg(ap, int *));
+            break;
+        case NI_SETUDPGRO:
+            if (ncb->protocol == IPPROTO_UDP) {
+                retval = udp_set_gro(ncb, va_arg(ap, int));
+            } else {
+                retval = posix__makeerror(EPROTOTYPE);
+            }
+            break;
+        case NI_GETUDPGRO:
+            retval = (ncb->protocol == IPPROTO_UDP) ? udp_get_gro(ncb) : posix__makeerror(EPROTOTYPE);
+            break;
+        case NI_SETUDPSTEER:
+            retval = (ncb->protocol == IPPROTO_UDP) ? udp_set_steer(ncb, va_arg(ap, int)) : posix__makeerror(EPROTOTYPE);
+            break;
+        case NI_GETTXQUEUE:
+            ptr = va_arg(ap, int *);
+            fifo_getqueue(ncb, ptr, va_arg(ap, int64_t *));
+            break;
+        case NI_SETFRAME:
+            retval = tcp_setframe_r(link, va_arg(ap, const struct nis_frame_template *));
+            break;
+        case NI_GETFRAME:
+            retval = tcp_getframe_r(link, va_arg(ap, struct nis_frame_template *));
+            break;
+        case NI_SETDELIM:
+            context = va_arg(ap, void *);
+            retval = tcp_setdelim_r(link, context, va_arg(ap, int));
+            break;
+        case NI_GETDELIM:
+            retval = tcp_getdelim_r(link, va_arg(ap, void *));
+            break;
+        case NI_ADDFILTER:
+            retval = tcp_addfilter_r(link, va_arg(ap, const struct nis_filter_stage *));
+            break;
+        case NI_CLRFILTER:
+            retval = tcp_clrfilter_r(link);
+            break;
+        case NI_SETCAPTURE:
+            retval = (ncb->protocol == IPPROTO_TCP) ? capture_start(ncb, va_arg(ap, const char *)) : posix__makeerror(EPROTOTYPE);
+            break;
         default:
             retval = posix__makeerror(EINVAL);
             break;
@@ -297,3 +371,14 @@ nsp_status_t nis_getifmac(const char *eth_name, abuff_mac_t *phyaddr)
     }
     return posix__makeerror(errno);
 }
+
+nsp_status_t nis_getstat(nis_statistics_t *stat)
+{
+    ILLEGAL_PARAMETER_CHECK(!stat);
+
+    memset(stat, 0, sizeof(*stat));
+    bufpool_getstat(&stat->Pool);
+    dispatch_getstat(&stat->Dispatch);
+    ncb_getstat_rx(&stat->Rx);
+    return NSP_STATUS_SUCCESSFUL;
+}
@@ -2,15 +2,26 @@
 #include "mxx.h"
 #include "fifo.h"
 #include "io.h"
+#include "shm.h"
+#include "dispatch.h"
+#include "capture.h"
+#include "pool.h"
+#include "bufpool.h"
 #include "zmalloc.h"
 
 #include <pthread.h>
 #include <stdio.h>
+#include <time.h>
+
+#include <linux/net_tstamp.h>
 
 static LIST_HEAD(nl_head);
 static pthread_mutex_t nl_head_locker = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 static int nl_count = 0;
 
+/* kernel to callback latency of the links with LINKATTR_RX_TIMESTAMP */
+static struct nis_rx_statistics __ncb_rx_stat;
+
 static void _ncb_post_preclose(const ncb_t *ncb);
 static void _ncb_post_closed(const ncb_t *ncb);
 
@@ -56,13 +67,46 @@ void ncb_uninit(int protocol)
 
     if (hlds && nl_count_proto > 0) {
         for (i = 0 ; i < nl_count_proto; i++) {
-            mxx_call_ecr("link:%lld close by ncb uninit", ncb->hld);
+            mxx_call_ecr("link:%lld close by ncb uninit", hlds[i]);
             objclos(hlds[i]);
         }
         zfree(hlds);
     }
 }
 
+nsp_status_t ncb_query_epoll_links(int epfd, objhld_t **hlds, int *count)
+{
+    ncb_t *ncb;
+    struct list_head *cursor;
+    objhld_t *dup;
+    int n;
+
+    dup = NULL;
+    n = 0;
+
+    pthread_mutex_lock(&nl_head_locker);
+    if (nl_count > 0) {
+        dup = (objhld_t *)ztrymalloc(nl_count * sizeof(objhld_t));
+        if (dup) {
+            list_for_each(cursor, &nl_head) {
+                ncb = containing_record(cursor, ncb_t, nl_entry);
+                if (ncb->epfd == epfd) {
+                    dup[n++] = ncb->hld;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&nl_head_locker);
+
+    if (!dup && n > 0) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    *hlds = dup;
+    *count = n;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
 int ncb_allocator(void *udata, const void *ctx, int ctxcb)
 {
     ncb_t *ncb;
@@ -70,8 +114,14 @@ int ncb_allocator(void *udata, const void *ctx, int ctxcb)
     ncb = (ncb_t *)udata;
     /* initialize to zero for security reason */
     memset(ncb, 0, sizeof (ncb_t));
+    ncb->rx_budget_bytes = NCB_RX_BUDGET_BYTES;
+    ncb->rx_budget_frames = NCB_RX_BUDGET_FRAMES;
+    ncb->rx_affinity = -1;
     /* initialize the FIFO structure */
+
     fifo_init(ncb);
+    dispatch_init_link(ncb);
+    capture_init_link(ncb);
     /* insert this ncb node into gloabl nl_head */
     pthread_mutex_lock(&nl_head_locker);
     list_add_tail(&ncb->nl_entry, &nl_head);
@@ -84,16 +134,23 @@ int ncb_allocator(void *udata, const void *ctx, int ctxcb)
 void ncb_deconstruct(objhld_t ignore, void *p)
 {
     ncb_t *ncb;
+    int i;
 
     ILLEGAL_PARAMETER_STOP(!p);
 
     ncb = (ncb_t *) p;
 
     /* post pre close event to calling thread, and than,
-        Invalidate the user context pointer, trust calling has been already handled and free @ncb->context  */
-    _ncb_post_preclose(ncb);
+        Invalidate the user context pointer, trust calling has been already handled and free @ncb->context
+        the hidden sockets of SO_REUSEPORT group are invisible to calling thread, so as their close events */
+    if (!ncb_udp_shadow(ncb)) {
+        _ncb_post_preclose(ncb);
+    }
     __atomic_store_n(&ncb->context, NULL, __ATOMIC_RELEASE);
 
+    /* doorbell of SHM link MUST leave epoll before the link itself */
+    shm_close(ncb);
+
     /* stop network service:
      * 1. cancel relation from epoll, if related
      * 2. shutdown socket, if file-descriptor effective
@@ -108,24 +165,45 @@ void ncb_deconstruct(objhld_t ignore, void *p)
         unlink(ncb->domain_addr.sun_path);
     }
 
+    dispatch_uninit_link(ncb);
+    capture_uninit_link(ncb);
+
     /* free packet cache */
     if (ncb->rx_buffer) {
-        zfree(ncb->rx_buffer);
+        bufpool_free(ncb->rx_buffer);
         ncb->rx_buffer = NULL;
     }
 
     if (ncb->u.tcp.rx_parse_buffer && IPPROTO_TCP == ncb->protocol ) {
-        zfree(ncb->u.tcp.rx_parse_buffer);
+        bufpool_free(ncb->u.tcp.rx_parse_buffer);
         ncb->u.tcp.rx_parse_buffer = NULL;
 
         if (ncb_lb_marked(ncb)) {
-            zfree(ncb->u.tcp.lbdata);
+            bufpool_free(ncb->u.tcp.lbdata);
         }
         ncb->u.tcp.lbdata = NULL;
         ncb->u.tcp.lbsize = 0;
         ncb->u.tcp.lboffset = 0;
     }
 
+    /* corked data never flushed are discarded */
+    if (IPPROTO_TCP == ncb->protocol && ncb->u.tcp.cork_buffer) {
+        zfree(ncb->u.tcp.cork_buffer);
+        ncb->u.tcp.cork_buffer = NULL;
+        ncb->u.tcp.cork_size = 0;
+        ncb->u.tcp.cork_capacity = 0;
+    }
+
+    /* the hidden sockets of SO_REUSEPORT group live and die with their master */
+    if (IPPROTO_UDP == ncb->protocol && ncb->u.udp.shadows) {
+        for (i = 0; i < ncb->u.udp.nshadows; i++) {
+            objclos(ncb->u.udp.shadows[i]);
+        }
+        zfree(ncb->u.udp.shadows);
+        ncb->u.udp.shadows = NULL;
+        ncb->u.udp.nshadows = 0;
+    }
+
     /* clear all packages pending in send queue */
     fifo_uninit(ncb);
 
@@ -136,8 +214,13 @@ void ncb_deconstruct(objhld_t ignore, void *p)
     nl_count--;
     pthread_mutex_unlock(&nl_head_locker);
 
+    /* leave the client pool before calling thread know the close, the pool never hand it out again */
+    pool_closed(ncb);
+
     /* post close event to calling thread */
-    _ncb_post_closed(ncb);
+    if (!ncb_udp_shadow(ncb)) {
+        _ncb_post_closed(ncb);
+    }
 
     /* set callback function to ineffectiveness */
     ncb->nis_callback = NULL;
@@ -222,6 +305,92 @@ nsp_status_t ncb_set_linger(const ncb_t *ncb)
     return SYSCALL_ZERO_SUCCESS_CHECK(setsockopt(ncb->sockfd, SOL_SOCKET, SO_LINGER, (char *)&lgr, sizeof (struct linger)));
 }
 
+nsp_status_t ncb_set_rx_timestamp(const ncb_t *ncb, int set)
+{
+    int flags;
+    int off;
+    nsp_status_t status;
+
+    if (!set) {
+        off = 0;
+        setsockopt(ncb->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &off, sizeof(off));
+        return SYSCALL_ZERO_SUCCESS_CHECK(setsockopt(ncb->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &off, sizeof(off)));
+    }
+
+    flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    status = SYSCALL_ZERO_SUCCESS_CHECK(setsockopt(ncb->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)));
+    if (!NSP_SUCCESS(status)) {
+        mxx_call_ecr("SO_TIMESTAMPING refused by kernel, error:%d, link:%lld, fallback to SO_TIMESTAMPNS", errno, ncb->hld);
+        flags = 1;
+        status = SYSCALL_ZERO_SUCCESS_CHECK(setsockopt(ncb->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &flags, sizeof(flags)));
+    }
+    return status;
+}
+
+void ncb_read_rx_timestamp(ncb_t *ncb, struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+    struct timespec ts[3];
+
+    /* a packet without stamp never report the stamp of the previous one */
+    ncb->rx_timestamp = 0;
+
+    /* SCM_TIMESTAMPING carry software stamp in ts[0], the hardware one in ts[2] is not requested */
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (SOL_SOCKET != cmsg->cmsg_level) {
+            continue;
+        }
+        if (SCM_TIMESTAMPING == cmsg->cmsg_type && cmsg->cmsg_len >= CMSG_LEN(sizeof(ts))) {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+        } else if (SCM_TIMESTAMPNS == cmsg->cmsg_type && cmsg->cmsg_len >= CMSG_LEN(sizeof(ts[0]))) {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts[0]));
+        } else {
+            continue;
+        }
+        ncb->rx_timestamp = (uint64_t)ts[0].tv_sec * 1000000000 + ts[0].tv_nsec;
+        return;
+    }
+}
+
+void ncb_count_rx_latency(uint64_t timestamp)
+{
+    struct timespec ts;
+    uint64_t now, latency, maximum, us;
+    int bucket;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    /* wall clock may step back */
+    latency = (now > timestamp) ? now - timestamp : 0;
+
+    us = latency / 1000;
+    bucket = (0 == us) ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= NIS_RX_LATENCY_BUCKETS) {
+        bucket = NIS_RX_LATENCY_BUCKETS - 1;
+    }
+
+    __atomic_add_fetch(&__ncb_rx_stat.Histogram[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&__ncb_rx_stat.Stamped, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&__ncb_rx_stat.Latency, latency, __ATOMIC_RELAXED);
+    maximum = __atomic_load_n(&__ncb_rx_stat.MaximumLatency, __ATOMIC_RELAXED);
+    while (latency > maximum &&
+        !__atomic_compare_exchange_n(&__ncb_rx_stat.MaximumLatency, &maximum, latency, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ;
+    }
+}
+
+void ncb_getstat_rx(struct nis_rx_statistics *stat)
+{
+    int i;
+
+    stat->Stamped = __atomic_load_n(&__ncb_rx_stat.Stamped, __ATOMIC_RELAXED);
+    stat->Latency = __atomic_load_n(&__ncb_rx_stat.Latency, __ATOMIC_RELAXED);
+    stat->MaximumLatency = __atomic_load_n(&__ncb_rx_stat.MaximumLatency, __ATOMIC_RELAXED);
+    for (i = 0; i < NIS_RX_LATENCY_BUCKETS; i++) {
+        stat->Histogram[i] = __atomic_load_n(&__ncb_rx_stat.Histogram[i], __ATOMIC_RELAXED);
+    }
+}
+
 nsp_status_t ncb_get_linger(const ncb_t *ncb, int *onoff, int *lin)
 {
     struct linger lgr;
@@ -321,17 +490,43 @@ static void _ncb_post_closed(const ncb_t *ncb)
     ncb->nis_callback(&c_event, NULL);
 }
 
-void ncb_post_recvdata(const ncb_t *ncb,  int cb, const unsigned char *data)
+void ncb_post_recvdata(ncb_t *ncb,  int cb, const unsigned char *data)
+{
+    uint64_t timestamp;
+
+    /* recorded on Rx thread before dispatch, so the records keep the order of stream */
+    if (ncb_capturing(ncb)) {
+        capture_frame(ncb, ((ncb->attr & LINKATTR_TCP_FULLY_RECEIVE) && 0 == __atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE)) ?
+            NIS_CAPTURE_HEAD : 0, data, cb, NULL);
+    }
+
+    timestamp = (ncb->attr & LINKATTR_RX_TIMESTAMP) ? ncb->rx_timestamp : 0;
+
+    /* the packets ahead of this one may still in dispatch after the attribute cleared, follow them to keep the order */
+    if ((ncb->attr & LINKATTR_TCP_DISPATCH) || dispatch_pending(ncb)) {
+        dispatch_post(ncb, data, cb, timestamp);
+        return;
+    }
+
+    ncb_call_recvdata(ncb, cb, data, timestamp);
+}
+
+void ncb_call_recvdata(const ncb_t *ncb,  int cb, const unsigned char *data, uint64_t timestamp)
 {
     nis_event_t c_event;
     tcp_data_t c_data;
 
     ILLEGAL_PARAMETER_STOP(!ncb->nis_callback);
 
+    if (timestamp > 0) {
+        ncb_count_rx_latency(timestamp);
+    }
+
     c_event.Ln.Tcp.Link = (HTCPLINK) ncb->hld;
     c_event.Event = EVT_RECEIVEDATA;
     c_data.e.Packet.Size = cb;
     c_data.e.Packet.Data = data;
+    c_data.e.Packet.Timestamp = timestamp;
     ncb->nis_callback(&c_event, &c_data);
 }
 
@@ -368,16 +563,38 @@ void ncb_post_connected(const ncb_t *ncb)
 
     ILLEGAL_PARAMETER_STOP(!ncb->nis_callback);
 
+    /* the pooled link can be acquired since now, include the acquire inside the callback */
+    pool_connected(ncb);
+
     c_event.Event = EVT_TCP_CONNECTED;
     c_event.Ln.Tcp.Link = ncb->hld;
     ncb->nis_callback(&c_event, NULL);
 }
 
+void ncb_post_sendfile(const ncb_t *ncb, int fd, int64_t offset, int64_t length, int64_t sent, nsp_status_t status)
+{
+    nis_event_t c_event;
+    tcp_data_t c_data;
+
+    ILLEGAL_PARAMETER_STOP(!ncb->nis_callback);
+
+    c_event.Event = EVT_TCP_SENDFILE;
+    c_event.Ln.Tcp.Link = ncb->hld;
+    c_data.e.SendFile.Fd = fd;
+    c_data.e.SendFile.Status = status;
+    c_data.e.SendFile.Offset = offset;
+    c_data.e.SendFile.Length = length;
+    c_data.e.SendFile.Sent = sent;
+    ncb->nis_callback(&c_event, &c_data);
+}
+
 int ncb_recvdata(ncb_t *ncb, void *data, size_t datalen, struct sockaddr *addr, socklen_t addrlen)
 {
     int cb;
+    int flags;
     struct msghdr msg;
     struct iovec iov[1];
+    char control[NCB_RX_TIMESTAMP_CONTROL];
 
     iov[0].iov_base = data ? data : ncb->rx_buffer;
     iov[0].iov_len = (data && datalen > 0) ? datalen : ncb->rx_buffer_size;
@@ -388,11 +605,18 @@ int ncb_recvdata(ncb_t *ncb, void *data, size_t datalen, struct sockaddr *addr,
     msg.msg_namelen = addrlen;
     msg.msg_iov = iov;
     msg.msg_iovlen = 1;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
+    msg.msg_control = (ncb->attr & LINKATTR_RX_TIMESTAMP) ? control : NULL;
+    msg.msg_controllen = (ncb->attr & LINKATTR_RX_TIMESTAMP) ? sizeof(control) : 0;
     msg.msg_flags = 0;
 
-    SYSCALL_WHILE_EINTR(cb, recvmsg(ncb->sockfd, &msg, (ncb->attr & LINKATTR_NONBLOCK) ? MSG_DONTWAIT : 0 ));
+    /* the Rx thread read into @rx_buffer and loop until EAGAIN, it MUST never block even the socket is not in nonblocking mode,
+        UDP link and the TCP link connected by @tcp_connect for example. the synchronous read of user buffer keep blocking */
+    flags = (!data || (ncb->attr & LINKATTR_NONBLOCK)) ? MSG_DONTWAIT : 0;
+    SYSCALL_WHILE_EINTR(cb, recvmsg(ncb->sockfd, &msg, flags));
+
+    if (cb > 0 && msg.msg_control) {
+        ncb_read_rx_timestamp(ncb, &msg);
+    }
 
     return cb < 0 ? posix__makeerror(errno) : cb;
 }
@@ -461,6 +685,18 @@ int ncb_setattr_r(ncb_t *ncb, int attr)
         }
     }
 
+    if ((attr ^ oldattr) & LINKATTR_RX_TIMESTAMP) {
+        status = ncb_set_rx_timestamp(ncb, attr & LINKATTR_RX_TIMESTAMP);
+        if (!NSP_SUCCESS(status)) {
+            if (attr & LINKATTR_RX_TIMESTAMP) {
+                __atomic_and_fetch(&ncb->attr, ~LINKATTR_RX_TIMESTAMP, __ATOMIC_SEQ_CST);
+            } else {
+                __atomic_or_fetch(&ncb->attr, LINKATTR_RX_TIMESTAMP, __ATOMIC_SEQ_CST);
+            }
+            return status;
+        }
+    }
+
     return oldattr;
 }
 
@@ -468,3 +704,172 @@ int ncb_getattr_r(ncb_t *ncb)
 {
     return __atomic_load_n(&ncb->attr, __ATOMIC_ACQUIRE);
 }
+
+/* the epoll mask are re-calculate under the lock of Tx fifo, because fifo_queue/fifo_pop also change EPOLLOUT of this link */
+static nsp_status_t _ncb_rearm_rx(ncb_t *ncb)
+{
+    nsp_status_t status;
+
+    status = NSP_STATUS_SUCCESSFUL;
+
+    /* link not attach to epoll yet or not readable now(asynchronous connecting),
+        the mask will be correct when it arm EPOLLIN for the first time */
+    if (ncb->epfd <= 0 || !__atomic_load_n(&ncb->ncb_read, __ATOMIC_ACQUIRE)) {
+        return status;
+    }
+
+    /* @io_modify drop EPOLLIN automatically when the link are paused */
+    status = io_modify(ncb, EPOLLIN | (ncb->fifo.tx_overflow ? EPOLLOUT : 0));
+
+    /* data stay in the ring during paused never trigger the doorbell again */
+    if (NSP_SUCCESS(status) && !ncb_rx_paused(ncb)) {
+        shm_kick(ncb);
+    }
+    return status;
+}
+
+nsp_status_t ncb_set_rx_budget(ncb_t *ncb, int bytes, int frames)
+{
+    if (bytes < 0 || frames < 0) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* Rx thread read them at the same time */
+    __atomic_store_n(&ncb->rx_budget_bytes, bytes, __ATOMIC_RELEASE);
+    __atomic_store_n(&ncb->rx_budget_frames, frames, __ATOMIC_RELEASE);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t ncb_get_rx_budget(const ncb_t *ncb, int *bytes, int *frames)
+{
+    ILLEGAL_PARAMETER_CHECK(!bytes || !frames);
+
+    *bytes = __atomic_load_n(&ncb->rx_budget_bytes, __ATOMIC_ACQUIRE);
+    *frames = __atomic_load_n(&ncb->rx_budget_frames, __ATOMIC_ACQUIRE);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t ncb_pause_rx(ncb_t *ncb, int reason)
+{
+    nsp_status_t status;
+    int prev;
+
+    status = NSP_STATUS_SUCCESSFUL;
+
+    lwp_mutex_lock(&ncb->fifo.lock);
+    prev = __atomic_fetch_or(&ncb->rx_paused, reason, __ATOMIC_ACQ_REL);
+    if (0 == prev) {
+        status = _ncb_rearm_rx(ncb);
+        mxx_call_ecr("Link:%lld, Rx paused, reason:%d", ncb->hld, reason);
+    }
+    lwp_mutex_unlock(&ncb->fifo.lock);
+
+    return status;
+}
+
+nsp_status_t ncb_resume_rx(ncb_t *ncb, int reason)
+{
+    nsp_status_t status;
+    int prev;
+
+    status = NSP_STATUS_SUCCESSFUL;
+
+    lwp_mutex_lock(&ncb->fifo.lock);
+    prev = __atomic_fetch_and(&ncb->rx_paused, ~reason, __ATOMIC_ACQ_REL);
+    /* the last reason has been removed, EPOLL_CTL_MOD re-poll the socket,
+        data arrived during paused will trigger a new EPOLLIN event immediately */
+    if ( (prev & reason) && 0 == (prev & ~reason) ) {
+        status = _ncb_rearm_rx(ncb);
+        mxx_call_ecr("Link:%lld, Rx resumed, reason:%d", ncb->hld, reason);
+    }
+    lwp_mutex_unlock(&ncb->fifo.lock);
+
+    return status;
+}
+
+nsp_status_t ncb_set_rx_watermark(ncb_t *ncb, int high, int low)
+{
+    if (high < 0 || low < 0 || (high > 0 && low >= high)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* reported by any thread of application while the Rx thread may be reading them */
+    __atomic_store_n(&ncb->rx_high_watermark, high, __ATOMIC_RELEASE);
+    __atomic_store_n(&ncb->rx_low_watermark, low, __ATOMIC_RELEASE);
+
+    /* automatic mode disabled, the link should not keep paused by it */
+    if (0 == high) {
+        return ncb_resume_rx(ncb, NCB_RX_PAUSE_AUTO);
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+int ncb_report_rx_depth(ncb_t *ncb, int depth)
+{
+    int high;
+
+    high = __atomic_load_n(&ncb->rx_high_watermark, __ATOMIC_ACQUIRE);
+    if (high > 0) {
+        if (depth >= high) {
+            ncb_pause_rx(ncb, NCB_RX_PAUSE_AUTO);
+        } else if (depth <= __atomic_load_n(&ncb->rx_low_watermark, __ATOMIC_ACQUIRE)) {
+            ncb_resume_rx(ncb, NCB_RX_PAUSE_AUTO);
+        }
+    }
+
+    return ncb_rx_paused(ncb) ? 1 : 0;
+}
+
+#if !defined SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE  (47)
+#endif
+
+nsp_status_t ncb_set_tx_rate(ncb_t *ncb, int rate, int burst)
+{
+    unsigned int pacing;
+
+    if (rate < 0) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* TCP over IPv4 are paced by kernel itself(since linux 4.13), no need fq qdisc.
+     * the kernel pacing has no concept of burst, @burst are ignore in this case */
+    if (IPPROTO_TCP == ncb->protocol && AF_UNIX != ncb->local_addr.sin_family) {
+        pacing = (rate > 0) ? (unsigned int)rate : ~0U;
+        if (0 == setsockopt(ncb->sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing, sizeof(pacing))) {
+            ncb->fifo.paced = (rate > 0);
+            fifo_set_rate(ncb, 0, 0);
+            mxx_call_ecr("link:%lld, kernel pacing rate:%d", ncb->hld, rate);
+            return NSP_STATUS_SUCCESSFUL;
+        }
+        mxx_call_ecr("Fatal syscall setsockopt(2) SO_MAX_PACING_RATE link:%lld, error:%d, fallback to token bucket", ncb->hld, errno);
+    }
+
+    ncb->fifo.paced = 0;
+    fifo_set_rate(ncb, rate, burst);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t ncb_get_tx_rate(ncb_t *ncb, int *rate, int *burst)
+{
+    unsigned int pacing;
+    socklen_t optlen;
+
+    ILLEGAL_PARAMETER_CHECK(!rate || !burst);
+
+    if (ncb->fifo.paced) {
+        optlen = sizeof(pacing);
+        if (0 == getsockopt(ncb->sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing, &optlen)) {
+            *rate = (int)pacing;
+            *burst = 0;
+            return NSP_STATUS_SUCCESSFUL;
+        }
+    }
+
+    lwp_mutex_lock(&ncb->fifo.lock);
+    *rate = (int)ncb->fifo.rate;
+    *burst = (int)ncb->fifo.burst;
+    lwp_mutex_unlock(&ncb->fifo.lock);
+    return NSP_STATUS_SUCCESSFUL;
+}
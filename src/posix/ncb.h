@@ -28,15 +28,81 @@
 #include "object.h"
 #include "threading.h"
 
+/* priority lanes of Tx fifo, the higher lane are drained first at packet boundary */
+#define TX_LANE_NORMAL  (0)
+#define TX_LANE_URGENT  (1)
+#define TX_LANES        (2)
+
+/* the hook of Tx node in lane */
+struct tx_link {
+    struct tx_link *next;
+};
+
+/* intrusive multi-producer single-consumer list, producers exchange @tail and then link the previous tail to the new node,
+ * only the consumer(wpool thread of the link) move @head, @stub keep the list never empty */
+struct tx_lane {
+    struct tx_link *tail;
+    struct tx_link *head;
+    struct tx_link stub;
+    int size;   /* count of nodes reserved in this lane, include the ones not yet linked */
+};
+
 struct tx_fifo {
+    /* EPOLLOUT is associated with the link, it's read without lock but only change under @lock together with the epoll mask */
     nsp_boolean_t tx_overflow;
-    int size;
+    int size;   /* total count of nodes in all lanes */
+    int64_t bytes;  /* total bytes of packets in all lanes */
+    /* serialize the change of @tx_overflow and epoll mask of the link, queue and dequeue never take it */
     lwp_mutex_t lock;
-    struct list_head head;
+    struct tx_lane lanes[TX_LANES];
+    /* the node return by the last @fifo_top, it's the node in writing and the one @fifo_pop take out, consumer only */
+    struct tx_node *current;
+    /* the node partially written by @tcp_write and queued after EAGAIN, it's written before any other node */
+    struct tx_node *partial;
+    /* nonzero while a thread write the socket, see @fifo_tx_acquire */
+    int writer;
+    /* nonzero when the wpool thread give up because @writer has been taken by a producer */
+    int turned;
+
+    /* token bucket of Tx rate limit in bytes, zero @rate means unlimited.
+     * @tokens can be negative after a indivisible datagram has been sent */
+    int64_t rate;
+    int64_t burst;
+    int64_t tokens;
+    uint64_t stamp;
+    /* nonzero when kernel pacing(SO_MAX_PACING_RATE) limit the link instead of token bucket */
+    int paced;
+};
+
+/* the hook of packet or link in the queues of dispatch, see dispatch.h */
+struct rx_link {
+    struct rx_link *next;
+};
+
+/* intrusive multi-producer single-consumer list, same as @tx_lane */
+struct rx_lane {
+    struct rx_link *tail;
+    struct rx_link *head;
+    struct rx_link stub;
+};
+
+struct rx_block;
+struct rx_dispatch {
+    /* packets parsed and not yet delivered, the Rx thread push and the worker which the link scheduled on pop */
+    struct rx_lane items;
+    /* the hook of this link in the run queue of worker */
+    struct rx_link runq;
+    /* Rx buffer lent to the packets of current receive, it's replaced after parse, only visit by Rx thread */
+    struct rx_block *lent;
+    /* count of packets pushed and not yet delivered, the push which raise it from zero schedule the link */
+    int pending;
 };
 
 struct _ncb;
 typedef nsp_status_t (*ncb_rw_t)(struct _ncb *);
+struct shm_link;
+struct capture;
+struct pool_member;
 
 struct _ncb {
     /* the object handle of this ncb */
@@ -48,9 +114,15 @@ struct _ncb {
     /* the file-descriptor of epoll object which binding with @sockfd */
     int epfd;
 
+    /* the events mask requested by the last @io_attach/@io_modify, it's applied again when the link migrate to another epoll thread */
+    int epmask;
+
     /* Rx thread-id binding upon epoll */
     pid_t rx_tid;
 
+    /* index of the epoll thread this link attach to, negative to select by handle */
+    int rx_affinity;
+
     /* the IP protocol type of this ncb, only support these two types:IPPROTO_TCP/IPPROTO_UDP */
     int protocol;
 
@@ -87,6 +159,34 @@ struct _ncb {
     /* the attributes of TCP link */
     int attr;
 
+    /* per-wakeup receive budget, zero means unlimited */
+    int rx_budget_bytes;
+    int rx_budget_frames;
+
+    /* nonzero when this link is waiting on the ready list of it's Rx thread, only visit by that thread */
+    int rx_ready;
+
+    /* receive pause reasons(NCB_RX_PAUSE_*), EPOLLIN are drop from epoll mask while any reason present */
+    int rx_paused;
+
+    /* kernel timestamp of the last read(LINKATTR_RX_TIMESTAMP) in wall clock nanoseconds, zero when not reported,
+        set by Rx thread before the packets of that read are posted */
+    uint64_t rx_timestamp;
+
+    /* watermarks of automatic pause/resume on the queue depth reported by application, zero high watermark disable it */
+    int rx_high_watermark;
+    int rx_low_watermark;
+
+    /* offload of EVT_RECEIVEDATA to dispatch workers(LINKATTR_TCP_DISPATCH) */
+    struct rx_dispatch dispatch;
+
+    /* traffic capture(NI_SETCAPTURE), NULL when not in use, @capture_lock protect the swap against the recording threads */
+    struct capture *capture;
+    lwp_mutex_t capture_lock;
+
+    /* the member of client pool(@tcp_pool_create) this link belong to, NULL for the link not pooled */
+    struct pool_member *pool;
+
     /* user definition context pointer */
     void *context;
     void *prcontext;
@@ -107,14 +207,43 @@ struct _ncb {
              /* template for make/build package */
             tst_t template;
             tst_t prtemplate;
+            /* built-in framing, @width is zero when the callbacks of @template are in use */
+            struct nis_frame_template frame;
+            /* delimiter framing, @delimiter_cb is zero when not in use. the pending line stay in @rx_parse_buffer,
+             *  or in @lbdata when it outgrow the parse cache, @lbsize is the capacity then */
+            unsigned char delimiter[NIS_MAXIMUM_DELIMITER];
+            int delimiter_cb;
+
+            /* filter pipeline, @nfilters publish the stages in @filters */
+            struct nis_filter_stage filters[NIS_MAXIMUM_FILTERS];
+            int nfilters;
 
             /* MSS of tcp link */
             int mss;
+
+            /* packets written with NIS_MORE are accumulate here until flush, protected by the lock of fifo */
+            unsigned char *cork_buffer;
+            int cork_size;
+            int cork_capacity;
+
+            /* shared memory rings of "SHM:" link, NULL for the others */
+            struct shm_link *shm;
         } tcp;
 
         struct {
             /* mreq object for IP multicast */
             struct ip_mreq *mreq;
+
+            /* nonzero when the kernel coalesce datagrams for this link(UDP_GRO) */
+            int gro;
+            /* nonzero after the kernel refuse UDP_SEGMENT, GSO write fallback to one datagram per sendmsg(2) */
+            int gso_unsupported;
+
+            /* SO_REUSEPORT group: the link which create this socket are it's @master,
+             *  the extra sockets(one per epoll thread) are hidden links in @shadows of master, zero @master means the link itself is master */
+            objhld_t master;
+            objhld_t *shadows;
+            int nshadows;
         } udp;
 
         struct {
@@ -126,8 +255,30 @@ typedef struct _ncb ncb_t;
 
 #define ncb_lb_marked(ncb) ((ncb) ? ((NULL != ncb->u.tcp.lbdata) && (ncb->u.tcp.lbsize > 0)) : (0))
 
+/* the hidden socket of a SO_REUSEPORT UDP group, events of it are reported on behalf of it's master */
+#define ncb_udp_shadow(ncb) ((IPPROTO_UDP == (ncb)->protocol) && ((ncb)->u.udp.master > 0))
+
+/* default per-wakeup receive budget of a link */
+#define NCB_RX_BUDGET_BYTES     (0x40000)
+#define NCB_RX_BUDGET_FRAMES    (64)
+
+#define ncb_rx_budget_exhausted(ncb, bytes, frames)   \
+    ( (ncb_rx_budget_bytes(ncb) > 0 && (bytes) >= ncb_rx_budget_bytes(ncb)) || \
+        (ncb_rx_budget_frames(ncb) > 0 && (frames) >= ncb_rx_budget_frames(ncb)) )
+#define ncb_rx_budget_bytes(ncb)    __atomic_load_n(&(ncb)->rx_budget_bytes, __ATOMIC_ACQUIRE)
+#define ncb_rx_budget_frames(ncb)   __atomic_load_n(&(ncb)->rx_budget_frames, __ATOMIC_ACQUIRE)
+
+/* reasons of receive pause */
+#define NCB_RX_PAUSE_MANUAL     (1)
+#define NCB_RX_PAUSE_AUTO       (2)
+
+#define ncb_rx_paused(ncb)  (0 != __atomic_load_n(&(ncb)->rx_paused, __ATOMIC_ACQUIRE))
+
 extern
 void ncb_uninit(int protocol);
+/* duplicate handles of the links which attach to epoll @epfd, caller free *@hlds by @zfree */
+extern
+nsp_status_t ncb_query_epoll_links(int epfd, objhld_t **hlds, int *count);
 extern
 int ncb_allocator(void *udata, const void *ctx, int ctxcb);
 extern
@@ -165,14 +316,33 @@ nsp_status_t ncb_set_linger(const ncb_t *ncb);
 extern
 nsp_status_t ncb_get_linger(const ncb_t *ncb, int *onoff, int *lin);
 
+/* kernel receive timestamp(LINKATTR_RX_TIMESTAMP), SO_TIMESTAMPING with software Rx stamp, SO_TIMESTAMPNS when it refused */
+extern
+nsp_status_t ncb_set_rx_timestamp(const ncb_t *ncb, int set);
+/* room of control message for @recvmsg to carry the timestamp */
+#define NCB_RX_TIMESTAMP_CONTROL    CMSG_SPACE(sizeof(struct timespec) * 3)
+/* take the timestamp from control messages of @msg into @ncb->rx_timestamp */
+extern
+void ncb_read_rx_timestamp(ncb_t *ncb, struct msghdr *msg);
+/* count the latency of packet with kernel timestamp, it's called at the begin of callback */
+extern
+void ncb_count_rx_latency(uint64_t timestamp);
+extern
+void ncb_getstat_rx(struct nis_rx_statistics *stat);
+
+extern
+void ncb_post_recvdata(ncb_t *ncb,  int cb, const unsigned char *data);
+/* call EVT_RECEIVEDATA on the calling thread, bypass dispatch, @timestamp is the kernel receive timestamp of packet */
 extern
-void ncb_post_recvdata(const ncb_t *ncb,  int cb, const unsigned char *data);
+void ncb_call_recvdata(const ncb_t *ncb,  int cb, const unsigned char *data, uint64_t timestamp);
 extern
 void ncb_post_pipedata(const ncb_t *ncb,  int cb, const unsigned char *data);
 extern
 void ncb_post_accepted(const ncb_t *ncb, HTCPLINK link);
 extern
 void ncb_post_connected(const ncb_t *ncb);
+extern
+void ncb_post_sendfile(const ncb_t *ncb, int fd, int64_t offset, int64_t length, int64_t sent, nsp_status_t status);
 
 extern
 int ncb_recvdata(ncb_t *ncb, void *data, size_t datalen, struct sockaddr *addr, socklen_t addrlen);
@@ -185,4 +355,26 @@ int ncb_getattr_r(ncb_t *ncb);
 extern
 nsp_status_t ncb_set_nonblock(ncb_t *ncb, int set);
 
+/* per-wakeup receive budget, zero means unlimited */
+extern
+nsp_status_t ncb_set_rx_budget(ncb_t *ncb, int bytes, int frames);
+extern
+nsp_status_t ncb_get_rx_budget(const ncb_t *ncb, int *bytes, int *frames);
+
+/* receive flow control, stop reading from kernel let the receive window close and back pressure the remote peer */
+extern
+nsp_status_t ncb_pause_rx(ncb_t *ncb, int reason);
+extern
+nsp_status_t ncb_resume_rx(ncb_t *ncb, int reason);
+extern
+nsp_status_t ncb_set_rx_watermark(ncb_t *ncb, int high, int low);
+extern
+int ncb_report_rx_depth(ncb_t *ncb, int depth);
+
+/* Tx rate limit, prefer kernel pacing for TCP, otherwise the token bucket in Tx fifo */
+extern
+nsp_status_t ncb_set_tx_rate(ncb_t *ncb, int rate, int burst);
+extern
+nsp_status_t ncb_get_tx_rate(ncb_t *ncb, int *rate, int *burst);
+
 #endif
@@ -35,8 +35,9 @@ static nsp_status_t _pipe_rx(ncb_t *ncb)
 	while (1) {
 		SYSCALL_WHILE_EINTR(n, read(ncb->sockfd, pipebuf, sizeof(pipebuf)));
 		if (n <= 0) {
+			/* pipe has been drained, report EAGAIN to stay out of the ready list of Rx thread */
 			if ( (0 == errno) || (EAGAIN == errno) || (EWOULDBLOCK == errno) ) {
-				return 0;
+				return posix__makeerror(EAGAIN);
 			}
 
 			return NSP_STATUS_FATAL;
@@ -69,7 +70,7 @@ static nsp_status_t _pipe_tx(ncb_t *ncb)
 	return NSP_STATUS_SUCCESSFUL;
 }
 
-nsp_status_t pipe_create(int protocol, int *fdw)
+nsp_status_t pipe_create(int protocol, int rx_affinity, int *fdw, objhld_t *link)
 {
 	int pipefd[2];
 	objhld_t hld;
@@ -116,6 +117,7 @@ nsp_status_t pipe_create(int protocol, int *fdw)
     ncb->sockfd = pipefd[0];
     ncb->hld = hld;
     ncb->protocol = protocol;
+    ncb->rx_affinity = rx_affinity;
 
     /* set data handler function pointer for Rx/Tx */
 	__atomic_store_n(&ncb->ncb_read, &_pipe_rx, __ATOMIC_RELEASE);
@@ -132,6 +134,7 @@ nsp_status_t pipe_create(int protocol, int *fdw)
     /* pipe create successful */
     objdefr(hld);
     *fdw = pipefd[1];
+    *link = hld;
     return NSP_STATUS_SUCCESSFUL;
 }
 
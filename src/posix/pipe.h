@@ -10,8 +10,9 @@ struct pipe_package_head
     unsigned char pipedata[0];
 };
 
+/* the read side of pipe is a link attach to epoll thread @rx_affinity, @link output the handle of it */
 extern
-nsp_status_t pipe_create(int protocol, int *fdw);
+nsp_status_t pipe_create(int protocol, int rx_affinity, int *fdw, objhld_t *link);
 extern
 nsp_status_t pipe_write_message(ncb_t *ncb, const unsigned char *data, unsigned int cb);
 
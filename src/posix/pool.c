@@ -0,0 +1,483 @@
+#include "pool.h"
+
+#include "mxx.h"
+#include "zmalloc.h"
+#include "threading.h"
+#include "atom.h"
+#include "clock.h"
+
+/* retry backoff of endpoint after consecutive connect failures, in 100ns unit of clock_monotonic */
+#define POOL_BACKOFF_MIN    (1000000ULL)
+#define POOL_BACKOFF_MAX    (50000000ULL)
+
+struct pool_endpoint;
+
+struct pool_member {
+    struct list_head entry;
+    struct tcp_pool *pool;
+    struct pool_endpoint *endpoint;
+    HTCPLINK link;
+    int outstanding;
+    int ready;
+    /* nonzero after @tcp_pool_destroy close it */
+    int closing;
+};
+
+struct pool_endpoint {
+    struct list_head entry;
+    struct list_head members;
+    uint32_t ipv4;
+    uint16_t port;
+    char ipstr[INET_ADDRSTRLEN];
+    /* members in list, and the ones reserved to connect but not yet in list */
+    int links;
+    int ready;
+    int outstanding;
+    int failures;
+    /* the connect are not allowed before this time point when @failures is nonzero */
+    uint64_t retry;
+};
+
+struct tcp_pool {
+    /* one for the creator, and one for each member */
+    int refcnt;
+    lwp_mutex_t lock;
+    tcp_io_fp callback;
+    tst_t tst;
+    nsp_boolean_t has_tst;
+    int min;
+    int max;
+    int closing;
+    struct list_head endpoints;
+};
+
+static void _pool_release(struct tcp_pool *pool)
+{
+    struct pool_endpoint *endpoint, *n;
+
+    if (0 != atom_subone(&pool->refcnt)) {
+        return;
+    }
+
+    /* no member left at this point */
+    list_for_each_entry_safe(struct pool_endpoint, endpoint, n, &pool->endpoints, entry) {
+        list_del(&endpoint->entry);
+        zfree(endpoint);
+    }
+    lwp_mutex_uninit(&pool->lock);
+    zfree(pool);
+}
+
+/* search the endpoint under lock, create it if not found and @create is true */
+static struct pool_endpoint *_pool_endpoint(struct tcp_pool *pool, uint32_t ipv4, uint16_t port, nsp_boolean_t create)
+{
+    struct pool_endpoint *endpoint;
+
+    list_for_each_entry(struct pool_endpoint, endpoint, &pool->endpoints, entry) {
+        if (endpoint->ipv4 == ipv4 && endpoint->port == port) {
+            return endpoint;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    endpoint = (struct pool_endpoint *)ztrymalloc(sizeof(*endpoint));
+    if (!endpoint) {
+        return NULL;
+    }
+    memset(endpoint, 0, sizeof(*endpoint));
+    INIT_LIST_HEAD(&endpoint->members);
+    endpoint->ipv4 = ipv4;
+    endpoint->port = port;
+    inet_ntop(AF_INET, &ipv4, endpoint->ipstr, sizeof(endpoint->ipstr));
+    list_add_tail(&endpoint->entry, &pool->endpoints);
+    return endpoint;
+}
+
+/* reserve links to connect under lock until @endpoint has @want links, no more than @max, and nothing during retry backoff */
+static int _pool_reserve(struct tcp_pool *pool, struct pool_endpoint *endpoint, int want)
+{
+    int count;
+
+    if (want > pool->max) {
+        want = pool->max;
+    }
+
+    count = want - endpoint->links;
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (endpoint->failures > 0 && clock_monotonic() < endpoint->retry) {
+        return 0;
+    }
+
+    endpoint->links += count;
+    return count;
+}
+
+static void _pool_unreserve(struct tcp_pool *pool, struct pool_endpoint *endpoint)
+{
+    lwp_mutex_lock(&pool->lock);
+    endpoint->links--;
+    lwp_mutex_unlock(&pool->lock);
+}
+
+/* create one reserved link of @endpoint and start connect, calling thread MUST NOT hold the lock,
+    the connection can be established and reported to pool before @tcp_connect2 return */
+static void _pool_connect(struct tcp_pool *pool, struct pool_endpoint *endpoint)
+{
+    struct pool_member *member;
+    ncb_t *ncb;
+    HTCPLINK link;
+    nsp_status_t status;
+
+    member = (struct pool_member *)ztrymalloc(sizeof(*member));
+    if (!member) {
+        _pool_unreserve(pool, endpoint);
+        return;
+    }
+    memset(member, 0, sizeof(*member));
+    member->pool = pool;
+    member->endpoint = endpoint;
+
+    link = tcp_create2(pool->callback, NULL, 0, pool->has_tst ? &pool->tst : NULL);
+    if (INVALID_HTCPLINK == link) {
+        zfree(member);
+        _pool_unreserve(pool, endpoint);
+        return;
+    }
+    member->link = link;
+
+    ncb = (ncb_t *)objrefr(link);
+    if (!ncb) {
+        zfree(member);
+        _pool_unreserve(pool, endpoint);
+        return;
+    }
+
+    /* @tcp_pool_destroy may have walked the members already */
+    lwp_mutex_lock(&pool->lock);
+    if (pool->closing) {
+        endpoint->links--;
+        lwp_mutex_unlock(&pool->lock);
+        objdefr(link);
+        zfree(member);
+        objclos(link);
+        return;
+    }
+    ncb->pool = member;
+    list_add_tail(&member->entry, &endpoint->members);
+    atom_addone(&pool->refcnt);
+    lwp_mutex_unlock(&pool->lock);
+    objdefr(link);
+
+    status = tcp_connect2(link, endpoint->ipstr, endpoint->port);
+    if (!NSP_SUCCESS(status)) {
+        /* the link leave pool on close and count as a failure */
+        mxx_call_ecr("Pool failed to connect link:%lld to %s:%u, error:%ld", link, endpoint->ipstr, endpoint->port, status);
+        objclos(link);
+    }
+}
+
+static nsp_status_t _pool_parse(const char *ipstr, uint16_t port, uint32_t *ipv4)
+{
+    if ( unlikely(!ipstr || 0 == port || 0xFFFF == port) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    if (1 != inet_pton(AF_INET, ipstr, ipv4)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+tcp_pool_t *tcp_pool_create(tcp_io_fp callback, const tst_t *tst, int min, int max)
+{
+    struct tcp_pool *pool;
+
+    if ( unlikely(!callback || min < 0 || max < 1 || min > max) ) {
+        return NULL;
+    }
+
+    pool = (struct tcp_pool *)ztrymalloc(sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->refcnt = 1;
+    lwp_mutex_init(&pool->lock, nsp_false);
+    pool->callback = callback;
+    if (tst) {
+        memcpy(&pool->tst, tst, sizeof(pool->tst));
+        pool->has_tst = nsp_true;
+    }
+    pool->min = min;
+    pool->max = max;
+    INIT_LIST_HEAD(&pool->endpoints);
+    return pool;
+}
+
+void tcp_pool_destroy(tcp_pool_t *pool)
+{
+    struct pool_endpoint *endpoint;
+    struct pool_member *member, *target;
+    HTCPLINK link;
+
+    if (!pool) {
+        return;
+    }
+
+    /* the members leave the list in @pool_closed, which may run inside @objclos, so the lock is never held when close */
+    do {
+        link = INVALID_HTCPLINK;
+        target = NULL;
+
+        lwp_mutex_lock(&pool->lock);
+        pool->closing = 1;
+        list_for_each_entry(struct pool_endpoint, endpoint, &pool->endpoints, entry) {
+            list_for_each_entry(struct pool_member, member, &endpoint->members, entry) {
+                if (!member->closing) {
+                    target = member;
+                    break;
+                }
+            }
+            if (target) {
+                break;
+            }
+        }
+        if (target) {
+            target->closing = 1;
+            link = target->link;
+        }
+        lwp_mutex_unlock(&pool->lock);
+
+        if (INVALID_HTCPLINK != link) {
+            objclos(link);
+        }
+    } while (INVALID_HTCPLINK != link);
+
+    _pool_release(pool);
+}
+
+nsp_status_t tcp_pool_prewarm(tcp_pool_t *pool, const char *ipstr, uint16_t port)
+{
+    struct pool_endpoint *endpoint;
+    uint32_t ipv4;
+    nsp_status_t status;
+    int count;
+
+    if (!pool) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _pool_parse(ipstr, port, &ipv4);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    lwp_mutex_lock(&pool->lock);
+    if (pool->closing) {
+        lwp_mutex_unlock(&pool->lock);
+        return posix__makeerror(ECANCELED);
+    }
+    endpoint = _pool_endpoint(pool, ipv4, port, nsp_true);
+    count = endpoint ? _pool_reserve(pool, endpoint, pool->min) : 0;
+    lwp_mutex_unlock(&pool->lock);
+
+    if (!endpoint) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    while (count-- > 0) {
+        _pool_connect(pool, endpoint);
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+nsp_status_t tcp_pool_acquire(tcp_pool_t *pool, const char *ipstr, uint16_t port, HTCPLINK *link)
+{
+    struct pool_endpoint *endpoint;
+    struct pool_member *member, *selected;
+    uint32_t ipv4;
+    nsp_status_t status;
+    int want, count;
+
+    if (!pool || !link) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _pool_parse(ipstr, port, &ipv4);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    lwp_mutex_lock(&pool->lock);
+    do {
+        count = 0;
+        if (pool->closing) {
+            status = posix__makeerror(ECANCELED);
+            break;
+        }
+
+        endpoint = _pool_endpoint(pool, ipv4, port, nsp_true);
+        if (!endpoint) {
+            status = posix__makeerror(ENOMEM);
+            break;
+        }
+
+        selected = NULL;
+        list_for_each_entry(struct pool_member, member, &endpoint->members, entry) {
+            if (member->ready && !member->closing && (!selected || member->outstanding < selected->outstanding)) {
+                selected = member;
+            }
+        }
+
+        want = pool->min;
+        if (selected) {
+            selected->outstanding++;
+            endpoint->outstanding++;
+            *link = selected->link;
+            status = NSP_STATUS_SUCCESSFUL;
+            /* even the least loaded link is busy, grow one in background when there is no connect in flight */
+            if (selected->outstanding > 1 && endpoint->links == endpoint->ready && want < endpoint->links + 1) {
+                want = endpoint->links + 1;
+            }
+        } else {
+            status = posix__makeerror((endpoint->failures > 0) ? EHOSTDOWN : EAGAIN);
+            if (want < 1) {
+                want = 1;
+            }
+        }
+
+        /* restore the links closed since last time */
+        count = _pool_reserve(pool, endpoint, want);
+    } while (0);
+    lwp_mutex_unlock(&pool->lock);
+
+    while (count-- > 0) {
+        _pool_connect(pool, endpoint);
+    }
+    return status;
+}
+
+nsp_status_t tcp_pool_release(tcp_pool_t *pool, HTCPLINK link)
+{
+    ncb_t *ncb;
+    struct pool_member *member;
+    nsp_status_t status;
+
+    if (!pool || link < 0) {
+        return posix__makeerror(EINVAL);
+    }
+
+    ncb = (ncb_t *)objrefr(link);
+    if (!ncb) {
+        return posix__makeerror(ENOENT);
+    }
+
+    /* the member never free before the last reference of link dropped */
+    member = ncb->pool;
+    if (member && member->pool == pool) {
+        lwp_mutex_lock(&pool->lock);
+        if (member->outstanding > 0) {
+            member->outstanding--;
+            member->endpoint->outstanding--;
+        }
+        lwp_mutex_unlock(&pool->lock);
+        status = NSP_STATUS_SUCCESSFUL;
+    } else {
+        status = posix__makeerror(EINVAL);
+    }
+
+    objdefr(link);
+    return status;
+}
+
+nsp_status_t tcp_pool_getstat(tcp_pool_t *pool, const char *ipstr, uint16_t port, tcp_pool_stat_t *stat)
+{
+    struct pool_endpoint *endpoint;
+    uint32_t ipv4;
+    nsp_status_t status;
+
+    if (!pool || !stat) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _pool_parse(ipstr, port, &ipv4);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    lwp_mutex_lock(&pool->lock);
+    endpoint = _pool_endpoint(pool, ipv4, port, nsp_false);
+    if (endpoint) {
+        stat->Links = endpoint->links;
+        stat->Ready = endpoint->ready;
+        stat->Outstanding = endpoint->outstanding;
+        stat->Failures = endpoint->failures;
+    }
+    lwp_mutex_unlock(&pool->lock);
+
+    return endpoint ? NSP_STATUS_SUCCESSFUL : posix__makeerror(ENOENT);
+}
+
+void pool_connected(const ncb_t *ncb)
+{
+    struct pool_member *member;
+    struct tcp_pool *pool;
+
+    member = ncb->pool;
+    if (!member) {
+        return;
+    }
+
+    pool = member->pool;
+    lwp_mutex_lock(&pool->lock);
+    if (!member->ready) {
+        member->ready = 1;
+        member->endpoint->ready++;
+        member->endpoint->failures = 0;
+    }
+    lwp_mutex_unlock(&pool->lock);
+}
+
+void pool_closed(ncb_t *ncb)
+{
+    struct pool_member *member;
+    struct pool_endpoint *endpoint;
+    struct tcp_pool *pool;
+    uint64_t backoff;
+    int links;
+
+    member = ncb->pool;
+    if (!member) {
+        return;
+    }
+    ncb->pool = NULL;
+
+    pool = member->pool;
+    endpoint = member->endpoint;
+    lwp_mutex_lock(&pool->lock);
+    list_del(&member->entry);
+    endpoint->links--;
+    if (member->ready) {
+        endpoint->ready--;
+        endpoint->outstanding -= member->outstanding;
+    } else if (!member->closing) {
+        /* the connection never established, delay the next connect of this endpoint */
+        endpoint->failures++;
+        backoff = POOL_BACKOFF_MIN << ((endpoint->failures < 7) ? (endpoint->failures - 1) : 6);
+        endpoint->retry = clock_monotonic() + ((backoff < POOL_BACKOFF_MAX) ? backoff : POOL_BACKOFF_MAX);
+    }
+    links = endpoint->links;
+    lwp_mutex_unlock(&pool->lock);
+
+    mxx_call_ecr("link:%lld leave pool, endpoint %s:%u has %d links", ncb->hld, endpoint->ipstr, endpoint->port, links);
+    zfree(member);
+    _pool_release(pool);
+}
@@ -0,0 +1,20 @@
+#ifndef POOL_H_20231116
+#define POOL_H_20231116
+
+#include "ncb.h"
+
+/*
+ *  pool of client links keyed by remote endpoint(@tcp_pool_create).
+ *  the pooled link carry a pointer to it's member in @ncb->pool, the framework report the connection established and the close
+ *  of link to pool before the EVT_TCP_CONNECTED/EVT_CLOSED post to callback, so the pool never wrap the user callback.
+ */
+
+/* the connection of pooled @ncb has been established */
+extern
+void pool_connected(const ncb_t *ncb);
+
+/* pooled @ncb is closing, it leave the pool now */
+extern
+void pool_closed(ncb_t *ncb);
+
+#endif
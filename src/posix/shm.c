@@ -0,0 +1,517 @@
+#include "shm.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+
+#include "mxx.h"
+#include "io.h"
+#include "zmalloc.h"
+
+#define SHM_MAGIC       (0x4E58534D)    /* "NXSM" */
+#define SHM_VERSION     (1)
+#define SHM_HEAD_SIZE   (0x1000)
+#define SHM_CACHELINE   (64)
+#define SHM_SEALS       (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* the fields of each side of ring are placed in different cache line */
+struct shm_ring {
+    /* written by producer */
+    uint64_t tail;
+    uint32_t producer_waiting;
+    unsigned char producer_pad[SHM_CACHELINE - sizeof(uint64_t) - sizeof(uint32_t)];
+
+    /* written by consumer */
+    uint64_t head;
+    uint32_t consumer_sleeping;
+    unsigned char consumer_pad[SHM_CACHELINE - sizeof(uint64_t) - sizeof(uint32_t)];
+};
+
+/* the first page of shared memory, rings data follow it:
+ *  ring[0] produce by connector and consume by acceptor, ring[1] in the opposite direction */
+struct shm_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    unsigned char pad[SHM_CACHELINE - sizeof(uint32_t) * 3];
+    struct shm_ring ring[2];
+};
+
+/* the only message on socket, followed by SCM_RIGHTS of memfd and doorbells of ring[0] and ring[1] */
+struct shm_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint32_t reserved;
+};
+
+#define SHM_HELLO_FDS   (3)
+
+static size_t _shm_segment_size(uint32_t ring_size)
+{
+    return SHM_HEAD_SIZE + ((size_t)ring_size << 1);
+}
+
+/* @index is the ring which this side produce */
+static void _shm_layout(struct shm_link *shm, int index)
+{
+    struct shm_head *head;
+
+    head = (struct shm_head *)shm->base;
+    shm->tx = &head->ring[index];
+    shm->rx = &head->ring[index ^ 1];
+    shm->tx_data = (unsigned char *)shm->base + SHM_HEAD_SIZE + (size_t)shm->ring_size * index;
+    shm->rx_data = (unsigned char *)shm->base + SHM_HEAD_SIZE + (size_t)shm->ring_size * (index ^ 1);
+}
+
+static void _shm_ring_doorbell(int fd)
+{
+    uint64_t one;
+    ssize_t n;
+
+    one = 1;
+    SYSCALL_WHILE_EINTR(n, write(fd, &one, sizeof(one)));
+    (void)n;
+}
+
+nsp_status_t shm_create(ncb_t *ncb)
+{
+    struct shm_link *shm;
+
+    shm = (struct shm_link *)ztrycalloc(sizeof(*shm));
+    if (!shm) {
+        return posix__makeerror(ENOMEM);
+    }
+
+    shm->rx_doorbell = -1;
+    shm->tx_doorbell = -1;
+    shm->epfd = -1;
+    lwp_mutex_init(&shm->tx_lock, nsp_false);
+    ncb->u.tcp.shm = shm;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+void shm_close(ncb_t *ncb)
+{
+    struct shm_link *shm;
+    struct epoll_event evt;
+
+    if (!ncb_shm(ncb)) {
+        return;
+    }
+    shm = ncb->u.tcp.shm;
+    ncb->u.tcp.shm = NULL;
+
+    /* the doorbell are shared with peer, closing our descriptor do NOT remove it from epoll */
+    if (shm->epfd > 0 && shm->rx_doorbell >= 0) {
+        epoll_ctl(shm->epfd, EPOLL_CTL_DEL, shm->rx_doorbell, &evt);
+    }
+
+    if (shm->rx_doorbell >= 0) {
+        close(shm->rx_doorbell);
+    }
+    if (shm->tx_doorbell >= 0) {
+        close(shm->tx_doorbell);
+    }
+    if (shm->base) {
+        munmap(shm->base, shm->size);
+    }
+    lwp_mutex_uninit(&shm->tx_lock);
+    zfree(shm);
+}
+
+nsp_status_t shm_connect(ncb_t *ncb)
+{
+    struct shm_link *shm;
+    struct shm_head *head;
+    struct shm_hello hello;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int) * SHM_HELLO_FDS)];
+    int fds[SHM_HELLO_FDS];
+    int i;
+    ssize_t n;
+    nsp_status_t status;
+
+    shm = ncb->u.tcp.shm;
+    fds[0] = fds[1] = fds[2] = -1;
+    status = NSP_STATUS_SUCCESSFUL;
+
+    do {
+        shm->ring_size = SHM_RING_SIZE;
+        shm->size = _shm_segment_size(shm->ring_size);
+
+        /* seal the size, peer can neither shrink the segment under our mapping nor remove the seals */
+        fds[0] = memfd_create("nax-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fds[0] < 0 || 0 != ftruncate(fds[0], shm->size) || 0 != fcntl(fds[0], F_ADD_SEALS, SHM_SEALS)) {
+            mxx_call_ecr("Fatal syscall memfd_create(2)/ftruncate(2)/fcntl(2), link:%lld, error:%d", ncb->hld, errno);
+            status = posix__makeerror(errno);
+            break;
+        }
+
+        shm->base = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        if (MAP_FAILED == shm->base) {
+            mxx_call_ecr("Fatal syscall mmap(2), link:%lld, error:%d", ncb->hld, errno);
+            shm->base = NULL;
+            status = posix__makeerror(errno);
+            break;
+        }
+
+        /* ftruncate(2) give a zero filled segment, all indexes start at zero */
+        head = (struct shm_head *)shm->base;
+        head->magic = SHM_MAGIC;
+        head->version = SHM_VERSION;
+        head->ring_size = shm->ring_size;
+
+        for (i = 1; i < SHM_HELLO_FDS; i++) {
+            fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (fds[i] < 0) {
+                mxx_call_ecr("Fatal syscall eventfd(2), link:%lld, error:%d", ncb->hld, errno);
+                status = posix__makeerror(errno);
+                break;
+            }
+        }
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+
+        hello.magic = SHM_MAGIC;
+        hello.version = SHM_VERSION;
+        hello.ring_size = shm->ring_size;
+        hello.reserved = 0;
+        iov.iov_base = &hello;
+        iov.iov_len = sizeof(hello);
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        SYSCALL_WHILE_EINTR(n, sendmsg(ncb->sockfd, &msg, MSG_NOSIGNAL));
+        if (n != sizeof(hello)) {
+            mxx_call_ecr("Fatal syscall sendmsg(2) for SHM hello, link:%lld, error:%d", ncb->hld, errno);
+            status = posix__makeerror(errno);
+            break;
+        }
+
+        /* connector produce ring[0] and consume ring[1] */
+        _shm_layout(shm, 0);
+        shm->tx_doorbell = fds[1];
+        shm->rx_doorbell = fds[2];
+        fds[1] = fds[2] = -1;
+        mxx_call_ecr("Link:%lld SHM rings %u bytes established", ncb->hld, shm->ring_size);
+    } while (0);
+
+    /* mapping keep the memory alive */
+    for (i = 0; i < SHM_HELLO_FDS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    if (!NSP_SUCCESS(status) && shm->base) {
+        munmap(shm->base, shm->size);
+        shm->base = NULL;
+    }
+    return status;
+}
+
+nsp_status_t shm_accept(ncb_t *ncb)
+{
+    struct shm_link *shm;
+    struct shm_head *head;
+    struct shm_hello hello;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct stat st;
+    char control[CMSG_SPACE(sizeof(int) * SHM_HELLO_FDS)];
+    int fds[SHM_HELLO_FDS];
+    int i, seals;
+    ssize_t n;
+    nsp_status_t status;
+
+    shm = ncb->u.tcp.shm;
+    if (shm->base) {
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    SYSCALL_WHILE_EINTR(n, recvmsg(ncb->sockfd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT));
+    if (n < 0) {
+        return posix__makeerror(errno);
+    }
+    if (0 == n) {
+        return posix__makeerror(ECONNRESET);
+    }
+
+    fds[0] = fds[1] = fds[2] = -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+
+    status = NSP_STATUS_SUCCESSFUL;
+    do {
+        /* anything unexpected from peer close the link */
+        if (n != sizeof(hello) || SHM_MAGIC != hello.magic || SHM_VERSION != hello.version ||
+            fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+            0 == hello.ring_size || 0 != (hello.ring_size & (hello.ring_size - 1)) || hello.ring_size > (1U << 30))
+        {
+            mxx_call_ecr("Illegal SHM hello from link:%lld", ncb->hld);
+            status = posix__makeerror(EPROTO);
+            break;
+        }
+
+        shm->ring_size = hello.ring_size;
+        shm->size = _shm_segment_size(shm->ring_size);
+        seals = fcntl(fds[0], F_GET_SEALS);
+        if (0 != fstat(fds[0], &st) || (size_t)st.st_size < shm->size || seals < 0 || SHM_SEALS != (seals & SHM_SEALS)) {
+            mxx_call_ecr("Illegal SHM segment from link:%lld", ncb->hld);
+            status = posix__makeerror(EPROTO);
+            break;
+        }
+
+        shm->base = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        if (MAP_FAILED == shm->base) {
+            mxx_call_ecr("Fatal syscall mmap(2), link:%lld, error:%d", ncb->hld, errno);
+            shm->base = NULL;
+            status = posix__makeerror(errno);
+            break;
+        }
+
+        head = (struct shm_head *)shm->base;
+        if (SHM_MAGIC != head->magic || head->ring_size != shm->ring_size) {
+            mxx_call_ecr("Illegal SHM segment from link:%lld", ncb->hld);
+            munmap(shm->base, shm->size);
+            shm->base = NULL;
+            status = posix__makeerror(EPROTO);
+            break;
+        }
+
+        /* acceptor produce ring[1] and consume ring[0] */
+        shm->rx_doorbell = fds[1];
+        shm->tx_doorbell = fds[2];
+        fds[1] = fds[2] = -1;
+        _shm_layout(shm, 1);
+        mxx_call_ecr("Link:%lld SHM rings %u bytes accepted", ncb->hld, shm->ring_size);
+    } while (0);
+
+    for (i = 0; i < SHM_HELLO_FDS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    return status;
+}
+
+nsp_status_t shm_attach(ncb_t *ncb)
+{
+    struct shm_link *shm;
+    nsp_status_t status;
+
+    shm = ncb->u.tcp.shm;
+
+    /* the link may be migrating to another epoll thread, @ncb->epfd are stable under the lock of Tx fifo */
+    lwp_mutex_lock(&ncb->fifo.lock);
+    status = io_attach_fd(ncb, shm->rx_doorbell);
+    if (NSP_SUCCESS(status)) {
+        shm->epfd = ncb->epfd;
+    }
+    lwp_mutex_unlock(&ncb->fifo.lock);
+
+    /* data may be written before doorbell attached, check the ring once */
+    if (NSP_SUCCESS(status)) {
+        shm_kick(ncb);
+    }
+    return status;
+}
+
+nsp_status_t shm_migrate(ncb_t *ncb)
+{
+    struct shm_link *shm;
+    struct epoll_event evt;
+    nsp_status_t status;
+
+    if (!ncb_shm(ncb)) {
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    shm = ncb->u.tcp.shm;
+    if (shm->epfd <= 0 || shm->rx_doorbell < 0) {
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    epoll_ctl(shm->epfd, EPOLL_CTL_DEL, shm->rx_doorbell, &evt);
+    shm->epfd = -1;
+    status = io_attach_fd(ncb, shm->rx_doorbell);
+    if (NSP_SUCCESS(status)) {
+        shm->epfd = ncb->epfd;
+        /* the doorbell rang before migrate has been consumed or dropped with the old epoll, check the ring on new thread */
+        if (!ncb_rx_paused(ncb)) {
+            shm_kick(ncb);
+        }
+    }
+    return status;
+}
+
+/* @head of Tx ring is controlled by peer, never trust it. the link is closed on corruption */
+static int _shm_tx_head_valid(const ncb_t *ncb, uint64_t head, uint64_t tail)
+{
+    if (tail < head || tail - head > ncb->u.tcp.shm->ring_size) {
+        mxx_call_ecr("Link:%lld SHM ring corrupted, head:%llu, tail:%llu", ncb->hld, (unsigned long long)head, (unsigned long long)tail);
+        objclos(ncb->hld);
+        return 0;
+    }
+    return 1;
+}
+
+int shm_write(ncb_t *ncb, const void *data, int size)
+{
+    struct shm_link *shm;
+    uint64_t head, tail;
+    uint32_t mask, offset, free, n, first;
+
+    shm = ncb->u.tcp.shm;
+    if (!shm->base) {
+        errno = EAGAIN;
+        return -1;
+    }
+    mask = shm->ring_size - 1;
+
+    lwp_mutex_lock(&shm->tx_lock);
+    tail = shm->tx->tail;
+    head = __atomic_load_n(&shm->tx->head, __ATOMIC_ACQUIRE);
+    if (!_shm_tx_head_valid(ncb, head, tail)) {
+        lwp_mutex_unlock(&shm->tx_lock);
+        errno = EBADMSG;
+        return -1;
+    }
+    free = shm->ring_size - (uint32_t)(tail - head);
+    if (0 == free) {
+        /* tell consumer ring the doorbell after it release some space, check again for the race with it */
+        __atomic_store_n(&shm->tx->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&shm->tx->head, __ATOMIC_SEQ_CST);
+        if (!_shm_tx_head_valid(ncb, head, tail)) {
+            lwp_mutex_unlock(&shm->tx_lock);
+            errno = EBADMSG;
+            return -1;
+        }
+        free = shm->ring_size - (uint32_t)(tail - head);
+        if (0 == free) {
+            lwp_mutex_unlock(&shm->tx_lock);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    n = ((uint32_t)size < free) ? (uint32_t)size : free;
+    offset = (uint32_t)tail & mask;
+    first = shm->ring_size - offset;
+    if (first >= n) {
+        memcpy(shm->tx_data + offset, data, n);
+    } else {
+        memcpy(shm->tx_data + offset, data, first);
+        memcpy(shm->tx_data, (const unsigned char *)data + first, n - first);
+    }
+    __atomic_store_n(&shm->tx->tail, tail + n, __ATOMIC_SEQ_CST);
+
+    /* only the first write after consumer fall asleep ring the doorbell */
+    if (__atomic_load_n(&shm->tx->consumer_sleeping, __ATOMIC_SEQ_CST)) {
+        if (__atomic_exchange_n(&shm->tx->consumer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+            _shm_ring_doorbell(shm->tx_doorbell);
+        }
+    }
+    lwp_mutex_unlock(&shm->tx_lock);
+
+    return (int)n;
+}
+
+int shm_peek(ncb_t *ncb, const unsigned char **data, int limit)
+{
+    struct shm_link *shm;
+    uint64_t head, tail;
+    uint32_t offset, used, n;
+
+    shm = ncb->u.tcp.shm;
+    head = shm->rx->head;
+    tail = __atomic_load_n(&shm->rx->tail, __ATOMIC_ACQUIRE);
+    used = (uint32_t)(tail - head);
+    /* indexes are controlled by peer, never trust them */
+    if (tail < head || used > shm->ring_size) {
+        mxx_call_ecr("Link:%lld SHM ring corrupted, head:%llu, tail:%llu", ncb->hld, (unsigned long long)head, (unsigned long long)tail);
+        return -1;
+    }
+
+    offset = (uint32_t)head & (shm->ring_size - 1);
+    n = shm->ring_size - offset;
+    if (n > used) {
+        n = used;
+    }
+    if (n > (uint32_t)limit) {
+        n = (uint32_t)limit;
+    }
+
+    *data = shm->rx_data + offset;
+    return (int)n;
+}
+
+void shm_commit(ncb_t *ncb, int size)
+{
+    struct shm_link *shm;
+
+    shm = ncb->u.tcp.shm;
+    __atomic_store_n(&shm->rx->head, shm->rx->head + size, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&shm->rx->producer_waiting, __ATOMIC_SEQ_CST)) {
+        if (__atomic_exchange_n(&shm->rx->producer_waiting, 0, __ATOMIC_SEQ_CST)) {
+            _shm_ring_doorbell(shm->tx_doorbell);
+        }
+    }
+}
+
+int shm_sleep(ncb_t *ncb)
+{
+    struct shm_link *shm;
+
+    shm = ncb->u.tcp.shm;
+    __atomic_store_n(&shm->rx->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->rx->tail, __ATOMIC_SEQ_CST) == shm->rx->head) {
+        return 1;
+    }
+
+    /* data arrived during announce, keep awake */
+    __atomic_store_n(&shm->rx->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void shm_drain(ncb_t *ncb)
+{
+    uint64_t value;
+    ssize_t n;
+
+    SYSCALL_WHILE_EINTR(n, read(ncb->u.tcp.shm->rx_doorbell, &value, sizeof(value)));
+    (void)n;
+}
+
+void shm_kick(ncb_t *ncb)
+{
+    if (ncb_shm_ready(ncb)) {
+        _shm_ring_doorbell(ncb->u.tcp.shm->rx_doorbell);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef SHM_H_20231018
+#define SHM_H_20231018
+
+#include "ncb.h"
+
+/*
+ *  shared memory transport for "SHM:" links
+ *  the AF_UNIX socket of IPC link only use to rendezvous and detect peer close,
+ *  after connect, the connector create a memfd hold two SPSC byte rings(one per direction) and two eventfd doorbells,
+ *  all of them are transfer to acceptor by SCM_RIGHTS.
+ *  the bytes of packets(include the protocol head built by tst) flow through rings as they do in the stream socket,
+ *  a doorbell only rang when the other side is sleeping on it.
+ */
+
+/* the capacity of each ring, MUST be power of 2 */
+#define SHM_RING_SIZE   (0x400000)
+
+struct shm_ring;
+
+struct shm_link {
+    void *base;
+    size_t size;
+    uint32_t ring_size;
+
+    /* Tx ring produce by this side and Rx ring consume by this side */
+    struct shm_ring *tx;
+    struct shm_ring *rx;
+    unsigned char *tx_data;
+    unsigned char *rx_data;
+
+    /* @rx_doorbell attach to the epoll of this link and rang by the peer,
+     *  @tx_doorbell rang by this side to wake the peer, both for data arrival and free space */
+    int rx_doorbell;
+    int tx_doorbell;
+    int epfd;
+
+    /* more than one thread may write to the same link, the producer side of ring are serialized by this lock */
+    lwp_mutex_t tx_lock;
+};
+
+#define ncb_shm(ncb)    ((IPPROTO_TCP == (ncb)->protocol) && (NULL != (ncb)->u.tcp.shm))
+#define ncb_shm_ready(ncb)  (ncb_shm(ncb) && (NULL != (ncb)->u.tcp.shm->base))
+
+/* mark @ncb as a SHM link, the rings are not available until @shm_connect or @shm_accept success */
+extern
+nsp_status_t shm_create(ncb_t *ncb);
+extern
+void shm_close(ncb_t *ncb);
+
+/* connector side, create rings and doorbells and send them to the peer by the connected socket */
+extern
+nsp_status_t shm_connect(ncb_t *ncb);
+/* acceptor side, receive rings and doorbells from the peer, -EAGAIN when they are not arrive yet */
+extern
+nsp_status_t shm_accept(ncb_t *ncb);
+
+/* attach the doorbell of Rx ring to the epoll which @ncb associated */
+extern
+nsp_status_t shm_attach(ncb_t *ncb);
+/* the link has been moved to another epoll thread, the doorbell follow it, caller hold the lock of Tx fifo */
+extern
+nsp_status_t shm_migrate(ncb_t *ncb);
+
+/* behave like send(2) on nonblocking socket, return the bytes copied into Tx ring, -1 and errno EAGAIN when the ring is full */
+extern
+int shm_write(ncb_t *ncb, const void *data, int size);
+
+/* consumer side of Rx ring:
+ *  @shm_peek return the count of contiguous bytes readable at *data, no more than @limit, negative when the ring are corrupted
+ *  @shm_commit release @size bytes to producer and wake it up if it is waiting for free space
+ *  @shm_sleep announce this side is going to sleep, return nonzero when the ring still empty after announce */
+extern
+int shm_peek(ncb_t *ncb, const unsigned char **data, int limit);
+extern
+void shm_commit(ncb_t *ncb, int size);
+extern
+int shm_sleep(ncb_t *ncb);
+
+/* reset the Rx doorbell before consume */
+extern
+void shm_drain(ncb_t *ncb);
+/* ring the Rx doorbell of this side, force the Rx thread to check the ring again */
+extern
+void shm_kick(ncb_t *ncb);
+
+#endif
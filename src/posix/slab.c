@@ -0,0 +1,360 @@
+#include "slab.h"
+
+#include "zmalloc.h"
+#include "bufpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* size classes are power of 2 from 64 bytes to 64KB */
+#define SLAB_MINIMUM_SHIFT      (6)
+#define SLAB_CLASSES            (11)
+#define SLAB_LARGE              (0xFFFF)
+#define SLAB_HEAP               (0xFFFE)
+#define SLAB_MAGIC              (0x534C)
+
+/* a magazine hold at most 64 objects or 256KB */
+#define SLAB_MAGAZINE_ROUNDS    (64)
+#define SLAB_MAGAZINE_BYTES     (0x40000)
+/* the full magazines keep in depot of each class, no more than 4MB, the others are freed */
+#define SLAB_DEPOT_BYTES        (0x400000)
+/* objects of page size or larger are carved from buffer pool, the small ones stay in heap */
+#define SLAB_POOL_THRESHOLD     (0x1000)
+
+/* placed before each object, keep the object 16 bytes aligned as malloc(3) does */
+struct slab_head {
+    uint16_t klass;
+    uint16_t magic;
+    uint32_t reserved;
+    uint64_t padding;
+};
+
+struct slab_magazine {
+    struct slab_magazine *next;
+    int rounds;
+    void *objs[0];
+};
+
+struct slab_depot {
+    pthread_mutex_t lock;
+    struct slab_magazine *full;
+    struct slab_magazine *empty;
+    int nfull;
+    int maxfull;
+    int capacity; /* rounds of each magazine in this class */
+    size_t size; /* size of each object in this class, include the head */
+    int pooled; /* objects of this class come from buffer pool */
+};
+
+/* loaded is the magazine in use, previous is kept to absorb the alloc/free swing around the magazine boundary */
+struct slab_cache {
+    struct slab_magazine *loaded[SLAB_CLASSES];
+    struct slab_magazine *previous[SLAB_CLASSES];
+};
+
+static struct slab_depot __slab_depot[SLAB_CLASSES];
+static pthread_once_t __slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __slab_key;
+static int __slab_enabled = 0;
+static __thread struct slab_cache *__slab_cache = NULL;
+
+static void *_slab_object_alloc(int klass)
+{
+    return __slab_depot[klass].pooled ? bufpool_alloc(__slab_depot[klass].size) : ztrymalloc(__slab_depot[klass].size);
+}
+
+static void _slab_object_free(int klass, void *obj)
+{
+    if (__slab_depot[klass].pooled) {
+        bufpool_free(obj);
+    } else {
+        zfree(obj);
+    }
+}
+
+static void _slab_free_magazine(int klass, struct slab_magazine *magazine)
+{
+    int i;
+
+    for (i = 0; i < magazine->rounds; i++) {
+        _slab_object_free(klass, magazine->objs[i]);
+    }
+    zfree(magazine);
+}
+
+/* give a magazine back to depot, full or partial magazines are keep for other threads until the depot limit reached */
+static void _slab_put_magazine(int klass, struct slab_magazine *magazine)
+{
+    struct slab_depot *depot;
+
+    depot = &__slab_depot[klass];
+
+    pthread_mutex_lock(&depot->lock);
+    if (0 == magazine->rounds) {
+        magazine->next = depot->empty;
+        depot->empty = magazine;
+        magazine = NULL;
+    } else if (depot->nfull < depot->maxfull) {
+        magazine->next = depot->full;
+        depot->full = magazine;
+        depot->nfull++;
+        magazine = NULL;
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    if (magazine) {
+        _slab_free_magazine(klass, magazine);
+    }
+}
+
+static struct slab_magazine *_slab_get_full(int klass)
+{
+    struct slab_depot *depot;
+    struct slab_magazine *magazine;
+
+    depot = &__slab_depot[klass];
+
+    /* racy peek avoid the lock when depot is empty, it's fine to miss a magazine just arrived */
+    if (0 == __atomic_load_n(&depot->nfull, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&depot->lock);
+    magazine = depot->full;
+    if (magazine) {
+        depot->full = magazine->next;
+        depot->nfull--;
+    }
+    pthread_mutex_unlock(&depot->lock);
+    return magazine;
+}
+
+static struct slab_magazine *_slab_get_empty(int klass)
+{
+    struct slab_depot *depot;
+    struct slab_magazine *magazine;
+
+    depot = &__slab_depot[klass];
+
+    pthread_mutex_lock(&depot->lock);
+    magazine = depot->empty;
+    if (magazine) {
+        depot->empty = magazine->next;
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    if (!magazine) {
+        magazine = (struct slab_magazine *)ztrymalloc(sizeof(struct slab_magazine) + depot->capacity * sizeof(void *));
+        if (magazine) {
+            magazine->rounds = 0;
+        }
+    }
+    return magazine;
+}
+
+/* thread exit, the cached objects go to depot for the other threads */
+static void _slab_cache_destructor(void *p)
+{
+    struct slab_cache *cache;
+    int i;
+
+    cache = (struct slab_cache *)p;
+    __slab_cache = NULL;
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        if (cache->loaded[i]) {
+            _slab_put_magazine(i, cache->loaded[i]);
+        }
+        if (cache->previous[i]) {
+            _slab_put_magazine(i, cache->previous[i]);
+        }
+    }
+    zfree(cache);
+}
+
+static void _slab_init()
+{
+    const char *env;
+    int i;
+    size_t size;
+
+    env = getenv("NAX_SLAB");
+    __slab_enabled = (env && '0' == env[0]) ? 0 : 1;
+
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        size = sizeof(struct slab_head) + ((size_t)1 << (SLAB_MINIMUM_SHIFT + i));
+        __slab_depot[i].size = size;
+        __slab_depot[i].pooled = (size >= SLAB_POOL_THRESHOLD) ? 1 : 0;
+        __slab_depot[i].capacity = (SLAB_MAGAZINE_BYTES / size > SLAB_MAGAZINE_ROUNDS) ? SLAB_MAGAZINE_ROUNDS : (int)(SLAB_MAGAZINE_BYTES / size);
+        __slab_depot[i].maxfull = SLAB_DEPOT_BYTES / (size * __slab_depot[i].capacity);
+        if (__slab_depot[i].maxfull <= 0) {
+            __slab_depot[i].maxfull = 1;
+        }
+        __slab_depot[i].full = NULL;
+        __slab_depot[i].empty = NULL;
+        __slab_depot[i].nfull = 0;
+        pthread_mutex_init(&__slab_depot[i].lock, NULL);
+    }
+
+    pthread_key_create(&__slab_key, &_slab_cache_destructor);
+}
+
+static struct slab_cache *_slab_get_cache()
+{
+    struct slab_cache *cache;
+
+    cache = __slab_cache;
+    if (likely(cache)) {
+        return cache;
+    }
+
+    cache = (struct slab_cache *)ztrycalloc(sizeof(struct slab_cache));
+    if (cache) {
+        pthread_setspecific(__slab_key, cache);
+        __slab_cache = cache;
+    }
+    return cache;
+}
+
+static int _slab_class(size_t size)
+{
+    int klass;
+
+    klass = 0;
+    while (klass < SLAB_CLASSES && ((size_t)1 << (SLAB_MINIMUM_SHIFT + klass)) < size) {
+        klass++;
+    }
+    return klass;
+}
+
+static void *_slab_cache_alloc(struct slab_cache *cache, int klass)
+{
+    struct slab_magazine *magazine;
+
+    magazine = cache->loaded[klass];
+    if (magazine && magazine->rounds > 0) {
+        return magazine->objs[--magazine->rounds];
+    }
+
+    /* previous magazine must be full when it exist, exchange it with the empty loaded one */
+    magazine = cache->previous[klass];
+    if (magazine && magazine->rounds > 0) {
+        cache->previous[klass] = cache->loaded[klass];
+        cache->loaded[klass] = magazine;
+        return magazine->objs[--magazine->rounds];
+    }
+
+    /* both are empty, take a full magazine from depot */
+    magazine = _slab_get_full(klass);
+    if (magazine) {
+        if (cache->previous[klass]) {
+            _slab_put_magazine(klass, cache->previous[klass]);
+        }
+        cache->previous[klass] = cache->loaded[klass];
+        cache->loaded[klass] = magazine;
+        return magazine->objs[--magazine->rounds];
+    }
+
+    return NULL;
+}
+
+static nsp_boolean_t _slab_cache_free(struct slab_cache *cache, int klass, void *obj)
+{
+    struct slab_magazine *magazine;
+    struct slab_depot *depot;
+
+    depot = &__slab_depot[klass];
+
+    magazine = cache->loaded[klass];
+    if (magazine && magazine->rounds < depot->capacity) {
+        magazine->objs[magazine->rounds++] = obj;
+        return nsp_true;
+    }
+
+    magazine = cache->previous[klass];
+    if (magazine && magazine->rounds < depot->capacity) {
+        cache->previous[klass] = cache->loaded[klass];
+        cache->loaded[klass] = magazine;
+        magazine->objs[magazine->rounds++] = obj;
+        return nsp_true;
+    }
+
+    /* both are full, the previous one go to depot and a empty magazine become the loaded */
+    magazine = _slab_get_empty(klass);
+    if (!magazine) {
+        return nsp_false;
+    }
+    if (cache->previous[klass]) {
+        _slab_put_magazine(klass, cache->previous[klass]);
+    }
+    cache->previous[klass] = cache->loaded[klass];
+    cache->loaded[klass] = magazine;
+    magazine->objs[magazine->rounds++] = obj;
+    return nsp_true;
+}
+
+void *slab_alloc(size_t size)
+{
+    struct slab_head *head;
+    struct slab_cache *cache;
+    int klass;
+
+    pthread_once(&__slab_once, &_slab_init);
+
+    head = NULL;
+    if (likely(__slab_enabled)) {
+        klass = _slab_class(size);
+        if (klass < SLAB_CLASSES) {
+            cache = _slab_get_cache();
+            if (likely(cache)) {
+                head = (struct slab_head *)_slab_cache_alloc(cache, klass);
+            }
+            /* nothing cached, the object are allocate in size of class, so it can be reuse by any request in this class */
+            if (!head) {
+                head = (struct slab_head *)_slab_object_alloc(klass);
+            }
+        } else {
+            klass = SLAB_LARGE;
+            head = (struct slab_head *)bufpool_alloc(sizeof(struct slab_head) + size);
+        }
+    } else {
+        klass = SLAB_HEAP;
+        head = (struct slab_head *)ztrymalloc(sizeof(struct slab_head) + size);
+    }
+
+    if (unlikely(!head)) {
+        return NULL;
+    }
+    head->klass = (uint16_t)klass;
+    head->magic = SLAB_MAGIC;
+    return (void *)(head + 1);
+}
+
+void slab_free(void *ptr)
+{
+    struct slab_head *head;
+    struct slab_cache *cache;
+
+    if (unlikely(!ptr)) {
+        return;
+    }
+
+    head = ((struct slab_head *)ptr) - 1;
+    assert(SLAB_MAGIC == head->magic);
+
+    if (head->klass < SLAB_CLASSES) {
+        cache = _slab_get_cache();
+        if (likely(cache)) {
+            if (_slab_cache_free(cache, head->klass, head)) {
+                return;
+            }
+        }
+        _slab_object_free(head->klass, head);
+        return;
+    }
+
+    if (SLAB_LARGE == head->klass) {
+        bufpool_free(head);
+    } else {
+        zfree(head);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef SLAB_H_20231019
+#define SLAB_H_20231019
+
+#include "compiler.h"
+
+/*
+ *  size-classed object cache for the objects of Tx path(struct tx_node with it's packet, struct wptask ...),
+ *  these objects are usually allocated by the thread calling @tcp_write but freed by wpool thread or Rx thread.
+ *
+ *  each thread keep two magazines(a stack of free objects) per size class, allocate and free are served by them without lock,
+ *  a thread which free more than it allocate hand it's full magazine to the global depot of the size class,
+ *  and a thread which allocate more than it free take a full magazine from depot, so objects cross thread in batch.
+ *  objects of page size or larger are carved from the buffer pool(bufpool.h), the smaller ones from heap,
+ *  request larger than the biggest size class are forward to the buffer pool directly.
+ *
+ *  environment variable NAX_SLAB=0 disable the cache, every request forward to @ztrymalloc, it's only useful for comparison.
+ */
+
+extern
+void *slab_alloc(size_t size);
+extern
+void slab_free(void *ptr);
+
+#endif
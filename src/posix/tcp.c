@@ -5,9 +5,17 @@
 #include "io.h"
 #include "wpool.h"
 #include "pipe.h"
+#include "shm.h"
+#include "slab.h"
+#include "bufpool.h"
+#include "filter.h"
+#include "capture.h"
 
 #include "zmalloc.h"
 
+#include <sys/stat.h>
+#include <fcntl.h>
+
 /*
  *  kernel status of tcpi_state
  *  defined in /usr/include/netinet/tcp.h
@@ -65,7 +73,7 @@ nsp_status_t tcp_allocate_rx_buffer(ncb_t *ncb)
 {
     /* allocate package to save parse result */
     if (!ncb->rx_buffer) {
-        if (NULL == (ncb->rx_buffer = (unsigned char *)ztrymalloc(TCP_BUFFER_SIZE))) {
+        if (NULL == (ncb->rx_buffer = (unsigned char *)bufpool_alloc(TCP_BUFFER_SIZE))) {
             mxx_call_ecr("Fails allocate packet memory");
             return posix__makeerror(ENOMEM);
         }
@@ -75,9 +83,9 @@ nsp_status_t tcp_allocate_rx_buffer(ncb_t *ncb)
     /* allocate package to storage Rx kernel buffer, this buffer direct post to recv(2) */
     ncb->u.tcp.rx_parse_offset = 0;
     if (!ncb->u.tcp.rx_parse_buffer) {
-        if (NULL == (ncb->u.tcp.rx_parse_buffer = (unsigned char *)ztrymalloc(TCP_BUFFER_SIZE))) {
+        if (NULL == (ncb->u.tcp.rx_parse_buffer = (unsigned char *)bufpool_alloc(TCP_BUFFER_SIZE))) {
             mxx_call_ecr("Fails allocate Rx buffer memory");
-            zfree(ncb->rx_buffer);
+            bufpool_free(ncb->rx_buffer);
             ncb->rx_buffer = NULL;
             return posix__makeerror(ENOMEM);
         }
@@ -139,6 +147,16 @@ void tcp_uninit()
     _tcp_invoke(wp_uninit);
 }
 
+nsp_status_t tcp_resize(int nprocs)
+{
+    return io_resize(IPPROTO_TCP, nprocs);
+}
+
+int tcp_getnprocs()
+{
+    return io_nprocs(IPPROTO_TCP);
+}
+
 static nsp_status_t _tcp_create_domain(ncb_t *ncb, const char* domain)
 {
     int fd;
@@ -226,6 +244,15 @@ HTCPLINK tcp_create(tcp_io_fp callback, const char* ipstr, uint16_t port)
                 status = _tcp_create_domain(ncb, &ipstr[4]);
                 break;
             }
+
+            /* SHM link rendezvous by the domain socket and than exchange data through shared memory */
+            if (0 == strncasecmp(ipstr, "SHM:", 4)) {
+                status = _tcp_create_domain(ncb, &ipstr[4]);
+                if (NSP_SUCCESS(status)) {
+                    status = shm_create(ncb);
+                }
+                break;
+            }
         }
 
         status = _tcp_create(ncb, ipstr, port);
@@ -278,6 +305,9 @@ nsp_status_t tcp_settst_r(HTCPLINK link, const tst_t *tst)
 
     status = _tcprefr(link, &ncb);
     if ( likely(NSP_SUCCESS(status)) ) {
+        /* switch back from built-in framing or delimiter framing */
+        __atomic_store_n(&ncb->u.tcp.frame.width, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&ncb->u.tcp.delimiter_cb, 0, __ATOMIC_RELEASE);
         ncb->u.tcp.prtemplate.cb_ = __atomic_exchange_n(&ncb->u.tcp.template.cb_, tst->cb_, __ATOMIC_ACQ_REL);
         ncb->u.tcp.prtemplate.builder_ = __atomic_exchange_n(&ncb->u.tcp.template.builder_, tst->builder_, __ATOMIC_ACQ_REL);
         ncb->u.tcp.prtemplate.parser_ = __atomic_exchange_n(&ncb->u.tcp.template.parser_, tst->parser_, __ATOMIC_ACQ_REL);
@@ -286,6 +316,165 @@ nsp_status_t tcp_settst_r(HTCPLINK link, const tst_t *tst)
     return status;
 }
 
+/* the bytes of a packet which not yet complete are parsed in the mode they arrived, they are owned by the Rx thread,
+ *  so the mode can only change on a packet boundary */
+static nsp_boolean_t _tcp_rx_parse_pending(ncb_t *ncb)
+{
+    return (__atomic_load_n(&ncb->u.tcp.rx_parse_offset, __ATOMIC_ACQUIRE) > 0 ||
+        __atomic_load_n(&ncb->u.tcp.lbdata, __ATOMIC_ACQUIRE)) ? nsp_true : nsp_false;
+}
+
+nsp_status_t tcp_setframe_r(HTCPLINK link, const struct nis_frame_template *frame)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    if ( unlikely(!frame) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* the length field must lay inside the protocol head, and the head no more than 32 bytes just like tst */
+    if ( unlikely(frame->cb_ <= 0 || frame->cb_ > TCP_MAXIMUM_TEMPLATE_SIZE || (2 != frame->width && 4 != frame->width) ||
+        frame->offset < 0 || frame->offset + frame->width > frame->cb_ || (frame->flags & ~(NIS_FRAME_BIG_ENDIAN | NIS_FRAME_INCLUSIVE))) ) {
+        mxx_call_ecr("Illegal frame template, cb:%d, offset:%d, width:%d, flags:%d", frame->cb_, frame->offset, frame->width, frame->flags);
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if ( likely(NSP_SUCCESS(status)) ) {
+        if (_tcp_rx_parse_pending(ncb)) {
+            objdefr(link);
+            return posix__makeerror(EBUSY);
+        }
+
+        /* callbacks are cleared, @template.cb_ keep the head size for the large-block and the general parse procedure */
+        ncb->u.tcp.prtemplate.cb_ = __atomic_exchange_n(&ncb->u.tcp.template.cb_, frame->cb_, __ATOMIC_ACQ_REL);
+        ncb->u.tcp.prtemplate.builder_ = __atomic_exchange_n(&ncb->u.tcp.template.builder_, NULL, __ATOMIC_ACQ_REL);
+        ncb->u.tcp.prtemplate.parser_ = __atomic_exchange_n(&ncb->u.tcp.template.parser_, NULL, __ATOMIC_ACQ_REL);
+        ncb->u.tcp.frame.cb_ = frame->cb_;
+        ncb->u.tcp.frame.offset = frame->offset;
+        ncb->u.tcp.frame.flags = frame->flags;
+        /* nonzero width publish the framing */
+        __atomic_store_n(&ncb->u.tcp.frame.width, frame->width, __ATOMIC_RELEASE);
+        __atomic_store_n(&ncb->u.tcp.delimiter_cb, 0, __ATOMIC_RELEASE);
+        objdefr(link);
+    }
+    return status;
+}
+
+nsp_status_t tcp_setdelim_r(HTCPLINK link, const void *delimiter, int length)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    if ( unlikely(length < 0 || length > NIS_MAXIMUM_DELIMITER || (length > 0 && !delimiter)) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if ( likely(NSP_SUCCESS(status)) ) {
+        if (_tcp_rx_parse_pending(ncb)) {
+            objdefr(link);
+            return posix__makeerror(EBUSY);
+        }
+
+        /* lines are delivered without any protocol head, so the template and built-in framing are turned off */
+        __atomic_store_n(&ncb->u.tcp.delimiter_cb, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&ncb->u.tcp.frame.width, 0, __ATOMIC_RELEASE);
+        ncb->u.tcp.prtemplate.cb_ = __atomic_exchange_n(&ncb->u.tcp.template.cb_, 0, __ATOMIC_ACQ_REL);
+        ncb->u.tcp.prtemplate.builder_ = __atomic_exchange_n(&ncb->u.tcp.template.builder_, NULL, __ATOMIC_ACQ_REL);
+        ncb->u.tcp.prtemplate.parser_ = __atomic_exchange_n(&ncb->u.tcp.template.parser_, NULL, __ATOMIC_ACQ_REL);
+        if (length > 0) {
+            memcpy(ncb->u.tcp.delimiter, delimiter, length);
+            __atomic_store_n(&ncb->u.tcp.delimiter_cb, length, __ATOMIC_RELEASE);
+        }
+        objdefr(link);
+    }
+    return status;
+}
+
+int tcp_getdelim_r(HTCPLINK link, void *delimiter)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+    int length;
+
+    if ( unlikely(!delimiter) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if ( unlikely(!NSP_SUCCESS(status)) ) {
+        return status;
+    }
+
+    length = __atomic_load_n(&ncb->u.tcp.delimiter_cb, __ATOMIC_ACQUIRE);
+    if (length > 0) {
+        memcpy(delimiter, ncb->u.tcp.delimiter, length);
+    }
+    objdefr(link);
+    return length;
+}
+
+nsp_status_t tcp_addfilter_r(HTCPLINK link, const struct nis_filter_stage *stage)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+    int n;
+
+    if ( unlikely(!stage) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if ( likely(NSP_SUCCESS(status)) ) {
+        n = __atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE);
+        if (n < NIS_MAXIMUM_FILTERS) {
+            memcpy(&ncb->u.tcp.filters[n], stage, sizeof(*stage));
+            /* the count publish the stage */
+            __atomic_store_n(&ncb->u.tcp.nfilters, n + 1, __ATOMIC_RELEASE);
+        } else {
+            status = posix__makeerror(ENOSPC);
+        }
+        objdefr(link);
+    }
+    return status;
+}
+
+nsp_status_t tcp_clrfilter_r(HTCPLINK link)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    status = _tcprefr(link, &ncb);
+    if ( likely(NSP_SUCCESS(status)) ) {
+        __atomic_store_n(&ncb->u.tcp.nfilters, 0, __ATOMIC_RELEASE);
+        objdefr(link);
+    }
+    return status;
+}
+
+nsp_status_t tcp_getframe_r(HTCPLINK link, struct nis_frame_template *frame)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    if ( unlikely(!frame) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if ( likely(NSP_SUCCESS(status)) ) {
+        if (__atomic_load_n(&ncb->u.tcp.frame.width, __ATOMIC_ACQUIRE) > 0) {
+            memcpy(frame, &ncb->u.tcp.frame, sizeof(*frame));
+        } else {
+            status = posix__makeerror(ENOENT);
+        }
+        objdefr(link);
+    }
+    return status;
+}
+
 nsp_status_t tcp_gettst_r(HTCPLINK link, tst_t *tst, tst_t *previous)
 {
     ncb_t *ncb;
@@ -406,6 +595,12 @@ static nsp_status_t _tcp_connect_domain(ncb_t *ncb, const char *domain)
     int retval;
 
     do {
+        /* nobody can read the ring of SHM link without Rx thread */
+        if (ncb_shm(ncb) && !ncb->nis_callback) {
+            status = posix__makeerror(EINVAL);
+            break;
+        }
+
         if (0 == ncb->domain_addr.sun_path[0]) {
             if (!domain) {
                 status = posix__makeerror(EINVAL);
@@ -417,7 +612,7 @@ static nsp_status_t _tcp_connect_domain(ncb_t *ncb, const char *domain)
                 break;
             }
 
-            if (0 != strncasecmp(domain, "IPC:", 4)) {
+            if (0 != strncasecmp(domain, ncb_shm(ncb) ? "SHM:" : "IPC:", 4)) {
                 status = posix__makeerror(EINVAL);
                 break;
             }
@@ -441,8 +636,17 @@ static nsp_status_t _tcp_connect_domain(ncb_t *ncb, const char *domain)
             break;
         }
 
+        /* hand over the rings to peer, write to ring never block */
+        if (ncb_shm(ncb)) {
+            status = shm_connect(ncb);
+            if ( !NSP_SUCCESS(status) ) {
+                break;
+            }
+            ncb->attr |= LINKATTR_NONBLOCK;
+        }
+
         /* follow tcp rx/tx event */
-        __atomic_store_n(&ncb->ncb_read, &tcp_rx, __ATOMIC_RELEASE);
+        __atomic_store_n(&ncb->ncb_read, ncb_shm(ncb) ? &tcp_shm_rx : &tcp_rx, __ATOMIC_RELEASE);
         __atomic_store_n(&ncb->ncb_write, &tcp_tx, __ATOMIC_RELEASE);
 
         /* if this link is a callback link, it should be attached to epoll */
@@ -453,6 +657,14 @@ static nsp_status_t _tcp_connect_domain(ncb_t *ncb, const char *domain)
             }
         }
 
+        /* the socket only report peer close after then, data arrival are reported by doorbell */
+        if (ncb_shm(ncb)) {
+            status = shm_attach(ncb);
+            if ( !NSP_SUCCESS(status) ) {
+                break;
+            }
+        }
+
         mxx_call_ecr("Link:%lld established domain:%s", ncb->hld,ncb->domain_addr.sun_path);
         ncb_post_connected(ncb);
     }while( 0 );
@@ -811,10 +1023,19 @@ nsp_status_t tcp_listen(HTCPLINK link, int block)
             break;
         }
 
-        /* On individual connections, the socket buffer size must be set prior to the listen(2) or connect(2) calls in order to have it take effect. */
-#if 0
+        /* On individual connections, the socket buffer size must be set prior to the listen(2) or connect(2) calls in order to have it take effect.
+         * the options set on listener are inherited by accepted sockets, it save these syscalls for each accept:
+         *  1. the low-level [TCP Keep-ALive] are usable.
+         *  2. l_onoff on and l_linger zero, TCP drop any data cached in the kernel buffer of this socket file descriptor when close(2) called.
+         *      post a TCP-RST to peer, do not use FIN-FINACK, using this flag to avoid TIME_WAIT stauts
+         *  3. disable delay optimization
+         *  4. adjust TCP window size to mimimum require. */
+        if (AF_UNIX != ncb->local_addr.sin_family) {
+            tcp_set_keepalive(ncb, 9);
+            ncb_set_linger(ncb);
+            tcp_set_nodelay(ncb, 1);
+        }
         ncb_set_buffsize(ncb);
-#endif
         /* /proc/sys/net/core/somaxconn' in POSIX.1 this value default to 128
          *  so,for ensure high concurrency performance in the establishment phase of the TCP connection,
          *  we will ignore the @block argument and use macro SOMAXCONN which defined in /usr/include/bits/socket.h anyway */
@@ -834,7 +1055,7 @@ nsp_status_t tcp_listen(HTCPLINK link, int block)
 
         /* set file descriptor to asynchronous mode and attach to it's own epoll object,
          *  ncb object willbe destroy on fatal. */
-        status = io_set_nonblock(ncb, 1);
+        status = io_set_nonblock(ncb->sockfd, 1);
         if (!NSP_SUCCESS(status)) {
             break;
         }
@@ -883,21 +1104,241 @@ nsp_status_t tcp_awaken(HTCPLINK link, const void *pipedata, unsigned int cb)
     return status;
 }
 
-nsp_status_t tcp_write(HTCPLINK link, const void *origin, int cb, const nis_serializer_fp serializer)
+static int _tcp_packet_length(const ncb_t *ncb, int cb)
+{
+    if (ncb->attr & LINKATTR_TCP_NO_BUILD) {
+        return cb;
+    }
+
+    if (__atomic_load_n(&ncb->u.tcp.frame.width, __ATOMIC_ACQUIRE) > 0) {
+        return cb + ncb->u.tcp.frame.cb_;
+    }
+
+    /* if @template.builder is not null then use it, otherwise,
+        indicate that calling thread want to specify the packet length through input parameter @cb */
+    if (!(*ncb->u.tcp.template.builder_)) {
+        return cb;
+    }
+    return cb + ncb->u.tcp.template.cb_;
+}
+
+/* build protocol head for @cb bytes of user data, by built-in framing when it's in use, otherwise by the tst builder,
+ *  return the size of protocol head in @offset */
+static nsp_status_t _tcp_build_head(const ncb_t *ncb, unsigned char *head, int cb, int *offset)
+{
+    nsp_status_t status;
+
+    if (__atomic_load_n(&ncb->u.tcp.frame.width, __ATOMIC_ACQUIRE) > 0) {
+        *offset = ncb->u.tcp.frame.cb_;
+        return tcp_build_frame(&ncb->u.tcp.frame, head, cb);
+    }
+
+    *offset = ncb->u.tcp.template.cb_;
+    status = (*ncb->u.tcp.template.builder_)(head, cb);
+    if (!NSP_SUCCESS(status)) {
+        mxx_call_ecr("Fails on user tst builder");
+    }
+    return status;
+}
+
+/* build protocol head and serialize user data into @buffer, @buffer MUST large enough to hold @_tcp_packet_length bytes */
+static nsp_status_t _tcp_build_packet(ncb_t *ncb, unsigned char *buffer, const void *origin, int cb, const nis_serializer_fp serializer)
+{
+    nsp_status_t status;
+    int offset;
+
+    offset = 0;
+    if (_tcp_packet_length(ncb, cb) > cb) {
+        /* build protocol head */
+        status = _tcp_build_head(ncb, buffer, cb, &offset);
+        if (!NSP_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    /* serialize data into packet or direct use data pointer by @origin */
+    if (serializer) {
+        status = (*serializer)(buffer + offset, origin, cb);
+        if (!NSP_SUCCESS(status)) {
+            mxx_call_ecr("Fails on user define serialize.");
+            return status;
+        }
+    } else {
+        memcpy(buffer + offset, origin, cb);
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* write the node out directly or queue it, on success, the ownership of @node are transfer to framework,
+    otherwise, calling thread has responsibility to free @node and everything it owned */
+static nsp_status_t _tcp_post_node(ncb_t *ncb, struct tx_node *node)
+{
+    nsp_status_t status;
+    nsp_boolean_t direct;
+
+    do {
+        /* only one thread write the socket at a time, the others queue their packets without lock */
+        direct = fifo_tx_direct(ncb);
+        if (direct) {
+
+            /* the write buffer is full, active EPOLLOUT and waitting for epoll event trigger
+             * at this point, we need to deal with the queue header node and restore the unprocessed node back to the queue header.
+             * the way 'oneshot' focus on the write operation completion point
+             *
+             * the return value means direct failed when it equal to -1 or success when it greater than zero.
+             * in these case, destroy memory resource outside loop, no matter what the actually result it is.
+             */
+            status = tcp_txn(ncb, node);
+
+            /* break if success or failed without EAGAIN,
+                EINPROGRESS means the link are throttled by Tx rate limit, the remain part are queued like EAGAIN */
+            if (!NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN) && !NSP_FAILED_AND_ERROR_EQUAL(status, EINPROGRESS)) {
+                fifo_tx_release(ncb);
+                break;
+            }
+        }
+
+        /*
+         * 1. when the IO state is blocking, any send or write call certain to be fail immediately,
+         *
+         * 2. the meaning of -EAGAIN return by @tcp_txn is send or write operation cannot be complete immediately,
+         *      IO state should change to blocking now
+         *
+         * one way to handle the above two aspects, queue data to the tail of fifo manager, preserve the sequence of output order
+         * in this case, memory of @buffer and @node cannot be destroy until asynchronous completed
+         *
+         * after @fifo_queue success called, IO blocking flag is set, and EPOLLOUT event has been associated with ncb object.
+         * wpool thread canbe awaken by any kernel cache writable event trigger
+         *
+         * on failure of function call, @node and it's owned buffer MUST be free
+         *
+         * the remain part are queued before release the right, nobody write the socket between the two parts
+         */
+        status = fifo_queue(ncb, node);
+        if (direct) {
+            fifo_tx_release(ncb);
+        }
+        if (NSP_SUCCESS(status)) {
+            return status;
+        }
+    } while (0);
+
+    if (NSP_SUCCESS(status)) {
+        fifo_release(ncb, node);
+    }
+    return status;
+}
+
+/* allocate Tx node with @packet_length bytes of packet behind it in one block, free it by @slab_free */
+static struct tx_node *_tcp_alloc_node(int packet_length)
+{
+    struct tx_node *node;
+
+    node = (struct tx_node *)slab_alloc(sizeof(struct tx_node) + packet_length);
+    if (node) {
+        memset(node, 0, sizeof(struct tx_node));
+        node->data = (packet_length > 0) ? fifo_inline_data(node) : NULL;
+        node->wcb = packet_length;
+    }
+    return node;
+}
+
+/* write the packet out directly or queue it, on success, the ownership of @buffer are transfer to framework,
+    otherwise, calling thread has responsibility to free @buffer */
+static nsp_status_t _tcp_post_packet(ncb_t *ncb, unsigned char *buffer, int packet_length, int lane)
+{
+    struct tx_node *node;
+    nsp_status_t status;
+
+    if (NULL == (node = _tcp_alloc_node(0))) {
+        return posix__makeerror(ENOMEM);
+    }
+    node->data = buffer;
+    node->wcb = packet_length;
+    node->lane = lane;
+
+    status = _tcp_post_node(ncb, node);
+    if (!NSP_SUCCESS(status)) {
+        slab_free(node);
+    }
+    return status;
+}
+
+/* take the corked data out and post it as one packet, calling thread MUST hold the lock of fifo */
+static nsp_status_t _tcp_flush_r(ncb_t *ncb)
+{
+    unsigned char *buffer;
+    int size;
+    nsp_status_t status;
+
+    buffer = ncb->u.tcp.cork_buffer;
+    size = ncb->u.tcp.cork_size;
+    if (!buffer || size <= 0) {
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    ncb->u.tcp.cork_buffer = NULL;
+    ncb->u.tcp.cork_size = 0;
+    ncb->u.tcp.cork_capacity = 0;
+
+    status = _tcp_post_packet(ncb, buffer, size, TX_LANE_NORMAL);
+    if (!NSP_SUCCESS(status)) {
+        /* nothing has been written when the queue is full, keep the corked data for next flush */
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY) || NSP_FAILED_AND_ERROR_EQUAL(status, ENOMEM)) {
+            ncb->u.tcp.cork_buffer = buffer;
+            ncb->u.tcp.cork_size = size;
+            ncb->u.tcp.cork_capacity = size;
+        } else {
+            zfree(buffer);
+        }
+    }
+
+    return status;
+}
+
+/* append one packet to the cork buffer, calling thread MUST hold the lock of fifo */
+static nsp_status_t _tcp_cork_packet(ncb_t *ncb, const void *origin, int cb, const nis_serializer_fp serializer, int packet_length)
 {
-    ncb_t *ncb;
     unsigned char *buffer;
+    int capacity;
+    nsp_status_t status;
+
+    if (ncb->u.tcp.cork_size + packet_length > ncb->u.tcp.cork_capacity) {
+        capacity = (ncb->u.tcp.cork_capacity > 0) ? ncb->u.tcp.cork_capacity : TCP_CORK_THRESHOLD;
+        while (capacity < ncb->u.tcp.cork_size + packet_length) {
+            capacity <<= 1;
+        }
+        buffer = (unsigned char *)ztryrealloc(ncb->u.tcp.cork_buffer, capacity);
+        if (!buffer) {
+            return posix__makeerror(ENOMEM);
+        }
+        ncb->u.tcp.cork_buffer = buffer;
+        ncb->u.tcp.cork_capacity = capacity;
+    }
+
+    status = _tcp_build_packet(ncb, ncb->u.tcp.cork_buffer + ncb->u.tcp.cork_size, origin, cb, serializer);
+    if (NSP_SUCCESS(status)) {
+        ncb->u.tcp.cork_size += packet_length;
+    }
+    return status;
+}
+
+nsp_status_t tcp_write2(HTCPLINK link, const void *origin, int cb, const nis_serializer_fp serializer, int flags)
+{
+    ncb_t *ncb;
+    struct tx_node *node;
     int packet_length;
     struct tcp_info ktcp;
-    struct tx_node *node;
+    nis_filter_frame_t filtered;
     nsp_status_t status;
 
     if ( unlikely(link < 0 || cb <= 0 || cb > TCP_MAXIMUM_PACKET_SIZE || !origin)) {
         return -EINVAL;
     }
 
-    buffer = NULL;
     node = NULL;
+    memset(&filtered, 0, sizeof(filtered));
 
     status = _tcprefr(link, &ncb);
     if (!NSP_SUCCESS(status)) {
@@ -916,121 +1357,380 @@ nsp_status_t tcp_write(HTCPLINK link, const void *origin, int cb, const nis_seri
             }
         }
 
-        /* if @template.builder is not null then use it, otherwise,
-            indicate that calling thread want to specify the packet length through input parameter @cb */
-        if (!(*ncb->u.tcp.template.builder_) || (ncb->attr & LINKATTR_TCP_NO_BUILD)) {
-            packet_length = cb;
-            if (NULL == (buffer = (unsigned char *)ztrymalloc(packet_length))) {
-                status = posix__makeerror(ENOMEM);
+        /* recorded before the Tx filters as the Rx side after them, the data written with LINKATTR_TCP_NO_BUILD include the head */
+        if (ncb_capturing(ncb)) {
+            capture_frame(ncb, NIS_CAPTURE_OUTBOUND | ((ncb->attr & LINKATTR_TCP_NO_BUILD) ? NIS_CAPTURE_HEAD : 0), origin, cb, serializer);
+        }
+
+        /* the filtered data are written as the user data, @serializer already called by the pipeline */
+        if (__atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) > 0 && !(ncb->attr & LINKATTR_TCP_NO_BUILD)) {
+            status = filter_tx(ncb, origin, cb, serializer, &filtered);
+            if (!NSP_SUCCESS(status)) {
                 break;
             }
+            origin = filtered.data;
+            cb = filtered.size;
+        }
 
-            /* serialize data into packet or direct use data pointer by @origin */
-            if (serializer) {
-                status = (*serializer)(buffer, origin, cb);
-                if ( !NSP_SUCCESS(status) ) {
-                    mxx_call_ecr("Fails on user define serialize.");
-                    break;
+        packet_length = _tcp_packet_length(ncb, cb);
+
+        /* packet with NIS_MORE are accumulate in the cork buffer, the packet without NIS_MORE behind them
+            are appended too and flush them all in one syscall, so the order of output are preserved.
+            urgent packet never wait for the corked data */
+        if (!(flags & NIS_URGENT) && ((flags & NIS_MORE) || __atomic_load_n(&ncb->u.tcp.cork_size, __ATOMIC_ACQUIRE) > 0)) {
+            lwp_mutex_lock(&ncb->fifo.lock);
+            status = _tcp_cork_packet(ncb, origin, cb, filtered.data ? NULL : serializer, packet_length);
+            if (NSP_SUCCESS(status)) {
+                if (!(flags & NIS_MORE) || ncb->u.tcp.cork_size >= TCP_CORK_THRESHOLD) {
+                    status = _tcp_flush_r(ncb);
+                    /* the corked data are kept when the queue is full, leave this packet out of them,
+                        caller going to retry it after -EBUSY and it MUST NOT be sent twice */
+                    if (!NSP_SUCCESS(status) && ncb->u.tcp.cork_buffer) {
+                        ncb->u.tcp.cork_size -= packet_length;
+                    }
                 }
-            } else {
-                memcpy(buffer, origin, cb);
             }
+            lwp_mutex_unlock(&ncb->fifo.lock);
+            break;
+        }
 
-        } else {
-            packet_length = cb + ncb->u.tcp.template.cb_;
-            if (NULL == (buffer = (unsigned char *)ztrymalloc(packet_length))) {
-                status = posix__makeerror(ENOMEM);
+        /* node and packet in one allocation */
+        if (NULL == (node = _tcp_alloc_node(packet_length))) {
+            status = posix__makeerror(ENOMEM);
+            break;
+        }
+        node->lane = (flags & NIS_URGENT) ? TX_LANE_URGENT : TX_LANE_NORMAL;
+
+        status = _tcp_build_packet(ncb, node->data, origin, cb, filtered.data ? NULL : serializer);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+
+        status = _tcp_post_node(ncb, node);
+        if (NSP_SUCCESS(status)) {
+            node = NULL;
+        }
+    } while (0);
+
+    if (node) {
+        slab_free(node);
+    }
+    filter_release(&filtered);
+
+    objdefr(link);
+
+    /* @fifo_queue may raise a EBUSY error indicate the user-level cache of sender is full.
+     * in this case, current send request is going to be ignore but link shall not be close.
+     * otherwise, close link nomatter what error code it is
+    if ( !NSP_SUCCESS_OR_ERROR_EQUAL(status, EBUSY)) {
+        objclos(link);
+    }*/
+
+    return status;
+}
+
+nsp_status_t tcp_write(HTCPLINK link, const void *origin, int cb, const nis_serializer_fp serializer)
+{
+    return tcp_write2(link, origin, cb, serializer, 0);
+}
+
+nsp_status_t tcp_flush(HTCPLINK link)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    status = _tcprefr(link, &ncb);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    lwp_mutex_lock(&ncb->fifo.lock);
+    status = _tcp_flush_r(ncb);
+    lwp_mutex_unlock(&ncb->fifo.lock);
+
+    objdefr(link);
+    return status;
+}
+
+nsp_status_t tcp_sendfile(HTCPLINK link, int fd, int64_t offset, int64_t length, const void *header, int header_len)
+{
+    ncb_t *ncb;
+    struct tx_node *node;
+    struct tx_file *file;
+    struct tcp_info ktcp;
+    struct stat st;
+    int packet_length;
+    int head_size;
+    nsp_status_t status;
+
+    if ( unlikely(link < 0 || fd < 0 || offset < 0 || length < 0 || header_len < 0 || header_len > TCP_MAXIMUM_PACKET_SIZE ||
+        (header_len > 0 && !header)) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    node = NULL;
+    file = NULL;
+    do {
+        status = tcp_save_info(ncb, &ktcp);
+        if (NSP_SUCCESS(status)) {
+            if (ktcp.tcpi_state != TCP_ESTABLISHED) {
+                mxx_call_ecr("Link:%lld, kernel states error:%s.", link, tcp_state2name(ktcp.tcpi_state));
+                status = NSP_STATUS_FATAL;
                 break;
             }
+        }
 
-            /* build protocol head */
-            status = (*ncb->u.tcp.template.builder_)(buffer, cb);
-            if (!NSP_SUCCESS(status)) {
-                mxx_call_ecr("Fails on user tst builder");
+        /* rings of SHM link are not a socket, sendfile(2) can not write to them, and the file never pass the filters */
+        if (ncb_shm(ncb) || __atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) > 0) {
+            status = posix__makeerror(EOPNOTSUPP);
+            break;
+        }
+
+        /* zero @length means from @offset to the end of file */
+        if (0 == length) {
+            if (fstat(fd, &st) < 0) {
+                status = posix__makeerror(errno);
                 break;
             }
-
-            /* serialize data into packet or direct use data pointer by @origin */
-            if (serializer) {
-                status = (*serializer)(buffer + ncb->u.tcp.template.cb_, origin, cb);
-                if (!NSP_SUCCESS(status)) {
-                    mxx_call_ecr("Fails on user define serialize.");
-                    break;
-                }
-            } else {
-                memcpy(buffer + ncb->u.tcp.template.cb_, origin, cb );
+            length = (int64_t)st.st_size - offset;
+            if (length <= 0) {
+                status = posix__makeerror(EINVAL);
+                break;
             }
         }
 
-        if (NULL == (node = (struct tx_node *)ztrymalloc(sizeof (struct tx_node)))) {
+        /* the whole packet must be describable by the protocol head when tst builder are in use */
+        packet_length = _tcp_packet_length(ncb, header_len);
+        if (packet_length > header_len && length + header_len > TCP_MAXIMUM_PACKET_SIZE) {
+            status = posix__makeerror(EINVAL);
+            break;
+        }
+
+        if (NULL == (node = _tcp_alloc_node(packet_length))) {
             status = posix__makeerror(ENOMEM);
             break;
         }
-        memset(node, 0, sizeof(struct tx_node));
-        node->data = buffer;
-        node->wcb = packet_length;
-        node->offset = 0;
+        if (NULL == (file = (struct tx_file *)ztrycalloc(sizeof(struct tx_file)))) {
+            status = posix__makeerror(ENOMEM);
+            break;
+        }
+        file->fd = -1;
 
-        if (!fifo_tx_overflow(ncb)) {
+        /* protocol head built for the whole packet, followed by @header, the file part follow them */
+        if (packet_length > header_len) {
+            status = _tcp_build_head(ncb, node->data, (int)(header_len + length), &head_size);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+        }
+        if (header_len > 0) {
+            memcpy(node->data + packet_length - header_len, header, header_len);
+        }
 
-            /* the write buffer is full, active EPOLLOUT and waitting for epoll event trigger
-             * at this point, we need to deal with the queue header node and restore the unprocessed node back to the queue header.
-             * the way 'oneshot' focus on the write operation completion point
-             *
-             * the return value means direct failed when it equal to -1 or success when it greater than zero.
-             * in these case, destroy memory resource outside loop, no matter what the actually result it is.
-             */
-            status = tcp_txn(ncb, node);
+        /* duplicate the file descriptor, so calling thread can close @fd immediately after return */
+        file->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (file->fd < 0) {
+            status = posix__makeerror(errno);
+            break;
+        }
+        file->origin_fd = fd;
+        file->offset = offset;
+        file->length = length;
+        node->file = file;
+
+        /* corked data are written before the file, keep the order of output */
+        if (__atomic_load_n(&ncb->u.tcp.cork_size, __ATOMIC_ACQUIRE) > 0) {
+            lwp_mutex_lock(&ncb->fifo.lock);
+            status = _tcp_flush_r(ncb);
+            lwp_mutex_unlock(&ncb->fifo.lock);
+            if (!NSP_SUCCESS(status)) {
+                break;
+            }
+        }
+
+        status = _tcp_post_node(ncb, node);
+        if (NSP_SUCCESS(status)) {
+            node = NULL;
+            file = NULL;
+        }
+    } while (0);
+
+    if (file) {
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        zfree(file);
+    }
+    if (node) {
+        slab_free(node);
+    }
+
+    objdefr(link);
+    return status;
+}
+
+nis_buffer_t *nis_buffer_create(const void *origin, int cb, const nis_serializer_fp serializer, const tst_t *tst)
+{
+    struct nis_buffer *buffer;
+    int offset;
+    nsp_status_t status;
+
+    if ( unlikely(cb <= 0 || cb > TCP_MAXIMUM_PACKET_SIZE || !origin) ) {
+        return NULL;
+    }
+
+    offset = 0;
+    if (tst && tst->builder_) {
+        if (tst->cb_ < 0 || tst->cb_ > TCP_MAXIMUM_TEMPLATE_SIZE) {
+            return NULL;
+        }
+        offset = tst->cb_;
+    }
+
+    buffer = (struct nis_buffer *)ztrymalloc(sizeof(struct nis_buffer) + offset + cb);
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->refcnt = 1;
+    buffer->size = offset + cb;
 
-            /* break if success or failed without EAGAIN */
-            if (!NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN)) {
+    do {
+        if (offset > 0) {
+            status = tst->builder_(buffer->data, cb);
+            if (!NSP_SUCCESS(status)) {
+                mxx_call_ecr("Fails on user tst builder");
                 break;
             }
         }
 
-        /*
-         * 1. when the IO state is blocking, any send or write call certain to be fail immediately,
-         *
-         * 2. the meaning of -EAGAIN return by @tcp_txn is send or write operation cannot be complete immediately,
-         *      IO state should change to blocking now
-         *
-         * one way to handle the above two aspects, queue data to the tail of fifo manager, preserve the sequence of output order
-         * in this case, memory of @buffer and @node cannot be destroy until asynchronous completed
-         *
-         * after @fifo_queue success called, IO blocking flag is set, and EPOLLOUT event has been associated with ncb object.
-         * wpool thread canbe awaken by any kernel cache writable event trigger
-         *
-         * on failure of function call, @node and it's owned buffer MUST be free
-         */
-        status = fifo_queue(ncb, node);
-        if (!NSP_SUCCESS(status)) {
-            break;
+        if (serializer) {
+            status = (*serializer)(buffer->data + offset, origin, cb);
+            if (!NSP_SUCCESS(status)) {
+                mxx_call_ecr("Fails on user define serialize.");
+                break;
+            }
+        } else {
+            memcpy(buffer->data + offset, origin, cb);
         }
 
-        objdefr(link);
-        return status;
+        return buffer;
     } while (0);
 
-    if (likely(buffer)) {
-        zfree(buffer);
+    zfree(buffer);
+    return NULL;
+}
+
+nis_buffer_t *nis_buffer_ref(nis_buffer_t *buffer)
+{
+    if (buffer) {
+        __atomic_add_fetch(&buffer->refcnt, 1, __ATOMIC_RELAXED);
     }
+    return buffer;
+}
 
-    if (likely(node)) {
-        zfree(node);
+void nis_buffer_release(nis_buffer_t *buffer)
+{
+    if (buffer) {
+        if (0 == __atomic_sub_fetch(&buffer->refcnt, 1, __ATOMIC_ACQ_REL)) {
+            zfree(buffer);
+        }
     }
+}
 
-    objdefr(link);
+/* post @buffer to @ncb without copy, the Tx node hold a reference of @buffer until it has been written */
+static nsp_status_t _tcp_post_buffer(ncb_t *ncb, struct nis_buffer *buffer)
+{
+    struct tx_node *node;
+    struct tcp_info ktcp;
+    nsp_status_t status;
 
-    /* @fifo_queue may raise a EBUSY error indicate the user-level cache of sender is full.
-     * in this case, current send request is going to be ignore but link shall not be close.
-     * otherwise, close link nomatter what error code it is
-    if ( !NSP_SUCCESS_OR_ERROR_EQUAL(status, EBUSY)) {
-        objclos(link);
-    }*/
+    /* the shared packet are built once, it can not pass the filters of each link */
+    if (__atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) > 0) {
+        return posix__makeerror(EOPNOTSUPP);
+    }
+
+    status = tcp_save_info(ncb, &ktcp);
+    if (NSP_SUCCESS(status)) {
+        if (ktcp.tcpi_state != TCP_ESTABLISHED) {
+            mxx_call_ecr("Link:%lld, kernel states error:%s.", ncb->hld, tcp_state2name(ktcp.tcpi_state));
+            return NSP_STATUS_FATAL;
+        }
+    }
+
+    /* corked data are written before the buffer, keep the order of output */
+    if (__atomic_load_n(&ncb->u.tcp.cork_size, __ATOMIC_ACQUIRE) > 0) {
+        lwp_mutex_lock(&ncb->fifo.lock);
+        status = _tcp_flush_r(ncb);
+        lwp_mutex_unlock(&ncb->fifo.lock);
+        if (!NSP_SUCCESS(status)) {
+            return status;
+        }
+    }
 
+    if (NULL == (node = _tcp_alloc_node(0))) {
+        return posix__makeerror(ENOMEM);
+    }
+    node->data = buffer->data;
+    node->wcb = buffer->size;
+    node->shared = nis_buffer_ref(buffer);
+
+    status = _tcp_post_node(ncb, node);
+    if (!NSP_SUCCESS(status)) {
+        nis_buffer_release(buffer);
+        slab_free(node);
+    }
     return status;
 }
 
+nsp_status_t tcp_write_buffer(HTCPLINK link, nis_buffer_t *buffer)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+
+    if ( unlikely(link < 0 || !buffer) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    status = _tcprefr(link, &ncb);
+    if (!NSP_SUCCESS(status)) {
+        return status;
+    }
+
+    status = _tcp_post_buffer(ncb, buffer);
+    objdefr(link);
+    return status;
+}
+
+int tcp_broadcast(const HTCPLINK *links, int count, nis_buffer_t *buffer)
+{
+    ncb_t *ncb;
+    int i;
+    int success;
+
+    if ( unlikely(!links || count <= 0 || !buffer) ) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* failure on any link never interrupt the others, a link with error is going to close by itself */
+    success = 0;
+    for (i = 0; i < count; i++) {
+        if (!NSP_SUCCESS(_tcprefr(links[i], &ncb))) {
+            continue;
+        }
+        if (NSP_SUCCESS(_tcp_post_buffer(ncb, buffer))) {
+            ++success;
+        }
+        objdefr(links[i]);
+    }
+
+    return success;
+}
+
 nsp_status_t tcp_read(HTCPLINK link, void *data, int size)
 {
     ncb_t *ncb;
@@ -1053,7 +1753,8 @@ nsp_status_t tcp_read(HTCPLINK link, void *data, int size)
 nsp_status_t tcp_getaddr(HTCPLINK link, int type, uint32_t* ipv4, uint16_t* port)
 {
     ncb_t *ncb;
-    struct sockaddr_in *addr;
+    struct sockaddr_in *addr, local;
+    socklen_t addrlen;
     nsp_status_t status;
 
     status = _tcprefr(link, &ncb);
@@ -1071,6 +1772,14 @@ nsp_status_t tcp_getaddr(HTCPLINK link, int type, uint32_t* ipv4, uint16_t* port
             ((LINK_ADDR_REMOTE == type) ? &ncb->remot_addr : NULL);
     }
 
+    /* link accepted from listener which bound on INADDR_ANY know nothing about it's actual local address until now */
+    if (addr == &ncb->local_addr && INADDR_ANY == addr->sin_addr.s_addr && ncb->sockfd > 0) {
+        addrlen = sizeof(local);
+        if (0 == getsockname(ncb->sockfd, (struct sockaddr *)&local, &addrlen)) {
+            addr = &local;
+        }
+    }
+
     if (addr) {
         if (ipv4) {
             *ipv4 = htonl(addr->sin_addr.s_addr);
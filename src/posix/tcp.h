@@ -6,6 +6,10 @@
 #define TCP_BUFFER_SIZE   ( 0x11000 )
 #define TCP_MAXIMUM_PACKET_SIZE  ( 50 << 20 )
 #define TCP_MAXIMUM_TEMPLATE_SIZE   (32)
+/* the corked data are flushed automatically when they accumulate to this size */
+#define TCP_CORK_THRESHOLD  ( 0x10000 )
+/* the maximum bytes of file handed to each sendfile(2) call */
+#define TCP_SENDFILE_CHUNK  ( 0x100000 )
 
 #define TCP_KERNEL_STATE_LIST_SIZE (12)
 extern const char *TCP_KERNEL_STATE_NAME[TCP_KERNEL_STATE_LIST_SIZE];
@@ -21,6 +25,18 @@ nsp_status_t tcp_settst_r(HTCPLINK link, const tst_t *tst);
 extern
 nsp_status_t tcp_gettst_r(HTCPLINK link, tst_t *tst, tst_t *previous);
 extern
+nsp_status_t tcp_setframe_r(HTCPLINK link, const struct nis_frame_template *frame);
+extern
+nsp_status_t tcp_getframe_r(HTCPLINK link, struct nis_frame_template *frame);
+extern
+nsp_status_t tcp_setdelim_r(HTCPLINK link, const void *delimiter, int length);
+extern
+int tcp_getdelim_r(HTCPLINK link, void *delimiter);
+extern
+nsp_status_t tcp_addfilter_r(HTCPLINK link, const struct nis_filter_stage *stage);
+extern
+nsp_status_t tcp_clrfilter_r(HTCPLINK link);
+extern
 void tcp_setattr_r(ncb_t *ncb, int attr);
 extern
 void tcp_relate_address(ncb_t *ncb);
@@ -31,6 +47,8 @@ nsp_status_t tcp_syn(ncb_t *ncb_server);
 extern
 nsp_status_t tcp_rx(ncb_t *ncb);
 extern
+nsp_status_t tcp_shm_rx(ncb_t *ncb);
+extern
 nsp_status_t tcp_txn(ncb_t *ncb, void *node/*struct tx_node*/);
 extern
 nsp_status_t tcp_tx(ncb_t *ncb);
@@ -42,6 +60,9 @@ nsp_status_t tcp_rx_syn(ncb_t *ncb);
 /* tcp al */
 extern
 int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb);
+/* build the protocol head of built-in framing for @cb bytes of user data */
+extern
+nsp_status_t tcp_build_frame(const struct nis_frame_template *frame, unsigned char *head, int cb);
 
 /*
 for TCP_INFO socket option
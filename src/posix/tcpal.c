@@ -1,10 +1,74 @@
 #include "tcp.h"
 #include "mxx.h"
+#include "bufpool.h"
 #include "zmalloc.h"
+#include "memscan.h"
+#include "filter.h"
+
+#include <endian.h>
+
+/* user data size described by the head of built-in framing, negative for the value can not be a legal packet */
+static inline int _tcp_frame_decode(const struct nis_frame_template *frame, const unsigned char *head)
+{
+    uint16_t u16;
+    uint32_t u32;
+
+    if (2 == frame->width) {
+        memcpy(&u16, head + frame->offset, sizeof(u16));
+        u32 = (frame->flags & NIS_FRAME_BIG_ENDIAN) ? be16toh(u16) : le16toh(u16);
+    } else {
+        memcpy(&u32, head + frame->offset, sizeof(u32));
+        u32 = (frame->flags & NIS_FRAME_BIG_ENDIAN) ? be32toh(u32) : le32toh(u32);
+        if (u32 > TCP_MAXIMUM_PACKET_SIZE + TCP_MAXIMUM_TEMPLATE_SIZE) {
+            return -1;
+        }
+    }
+
+    return (int)u32 - ((frame->flags & NIS_FRAME_INCLUSIVE) ? frame->cb_ : 0);
+}
+
+nsp_status_t tcp_build_frame(const struct nis_frame_template *frame, unsigned char *head, int cb)
+{
+    uint16_t u16;
+    uint32_t u32;
+
+    u32 = (uint32_t)cb + ((frame->flags & NIS_FRAME_INCLUSIVE) ? frame->cb_ : 0);
+    memset(head, 0, frame->cb_);
+
+    if (2 == frame->width) {
+        if (u32 > 0xFFFF) {
+            mxx_call_ecr("packet size %d can not be described by 16 bits length field", cb);
+            return posix__makeerror(EINVAL);
+        }
+        u16 = (frame->flags & NIS_FRAME_BIG_ENDIAN) ? htobe16((uint16_t)u32) : htole16((uint16_t)u32);
+        memcpy(head + frame->offset, &u16, sizeof(u16));
+    } else {
+        u32 = (frame->flags & NIS_FRAME_BIG_ENDIAN) ? htobe32(u32) : htole32(u32);
+        memcpy(head + frame->offset, &u32, sizeof(u32));
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* deliver one packet with @head bytes of protocol head at the front, the filter pipeline see the user data only */
+static nsp_status_t _tcp_deliver(ncb_t *ncb, const unsigned char *packet, int total, int head)
+{
+    if (__atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) > 0) {
+        return filter_rx(ncb, packet + head, total - head);
+    }
+
+    if (ncb->attr & LINKATTR_TCP_FULLY_RECEIVE) {
+        ncb_post_recvdata(ncb, total, packet);
+    } else {
+        ncb_post_recvdata(ncb, total - head, packet + head);
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
 
 static int _tcp_parse_marked_lb(ncb_t *ncb, const unsigned char *cpbuff, int cpcb)
 {
     int overplus;
+    nsp_status_t status;
 
     /* The arrival data are not enough to fill the large-block. */
     if (cpcb + ncb->u.tcp.lboffset < ncb->u.tcp.lbsize) {
@@ -17,18 +81,148 @@ static int _tcp_parse_marked_lb(ncb_t *ncb, const unsigned char *cpbuff, int cpc
     overplus = ncb->u.tcp.lbsize - ncb->u.tcp.lboffset;
     memcpy(ncb->u.tcp.lbdata + ncb->u.tcp.lboffset, cpbuff, overplus);
 
-    if (ncb->attr & LINKATTR_TCP_FULLY_RECEIVE) {
-        ncb_post_recvdata(ncb, ncb->u.tcp.lbsize, ncb->u.tcp.lbdata);
-    } else {
-        ncb_post_recvdata(ncb, ncb->u.tcp.lbsize - ncb->u.tcp.template.cb_, ncb->u.tcp.lbdata + ncb->u.tcp.template.cb_);
-    }
+    status = _tcp_deliver(ncb, ncb->u.tcp.lbdata, ncb->u.tcp.lbsize, ncb->u.tcp.template.cb_);
 
     /* free the large-block buffer */
-    zfree(ncb->u.tcp.lbdata);
+    bufpool_free(ncb->u.tcp.lbdata);
     ncb->u.tcp.lbdata = NULL;
     ncb->u.tcp.lboffset = 0;
     ncb->u.tcp.lbsize = 0;
-    return (cpcb - overplus);
+    return NSP_SUCCESS(status) ? (cpcb - overplus) : -1;
+}
+
+/* append @cb bytes to the pending line, it move from parse cache to large-block which grow on demand when the line getting long */
+static nsp_status_t _tcp_delimited_append(ncb_t *ncb, const unsigned char *data, int cb)
+{
+    unsigned char *buffer;
+    int length, capacity;
+
+    if (!ncb->u.tcp.lbdata) {
+        if (ncb->u.tcp.rx_parse_offset + cb <= TCP_BUFFER_SIZE) {
+            memcpy(ncb->u.tcp.rx_parse_buffer + ncb->u.tcp.rx_parse_offset, data, cb);
+            ncb->u.tcp.rx_parse_offset += cb;
+            return NSP_STATUS_SUCCESSFUL;
+        }
+        length = ncb->u.tcp.rx_parse_offset;
+    } else {
+        length = ncb->u.tcp.lboffset;
+    }
+
+    /* the limit of large-block guard the length of line, the delimiter are not count */
+    if (length + cb > TCP_MAXIMUM_PACKET_SIZE + ncb->u.tcp.delimiter_cb) {
+        mxx_call_ecr("line exceed the limit of large-block, length:%d", length + cb);
+        return posix__makeerror(EMSGSIZE);
+    }
+
+    if (!ncb->u.tcp.lbdata || length + cb > ncb->u.tcp.lbsize) {
+        capacity = (ncb->u.tcp.lbsize > 0) ? ncb->u.tcp.lbsize : TCP_BUFFER_SIZE;
+        while (capacity < length + cb) {
+            capacity <<= 1;
+        }
+        buffer = (unsigned char *)bufpool_alloc(capacity);
+        if (!buffer) {
+            return posix__makeerror(ENOMEM);
+        }
+        if (ncb->u.tcp.lbdata) {
+            memcpy(buffer, ncb->u.tcp.lbdata, length);
+            bufpool_free(ncb->u.tcp.lbdata);
+        } else {
+            memcpy(buffer, ncb->u.tcp.rx_parse_buffer, length);
+            ncb->u.tcp.rx_parse_offset = 0;
+        }
+        ncb->u.tcp.lbdata = buffer;
+        ncb->u.tcp.lbsize = capacity;
+    }
+
+    memcpy(ncb->u.tcp.lbdata + length, data, cb);
+    ncb->u.tcp.lboffset = length + cb;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t _tcp_delimited_post(ncb_t *ncb, const unsigned char *line, int cb, int dlen)
+{
+    if (__atomic_load_n(&ncb->u.tcp.nfilters, __ATOMIC_ACQUIRE) > 0) {
+        return filter_rx(ncb, line, cb - dlen);
+    }
+
+    ncb_post_recvdata(ncb, (ncb->attr & LINKATTR_TCP_FULLY_RECEIVE) ? cb : cb - dlen, line);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+/* bytes at the head of @data which complete the delimiter begin at the tail of pending line, zero if there is not */
+static int _tcp_delimiter_straddle(const unsigned char *pending, int length, const unsigned char *data, int cpcb,
+    const unsigned char *delimiter, int dlen)
+{
+    int k;
+
+    /* the more bytes in pending line, the earlier the delimiter begin */
+    for (k = ((dlen - 1 < length) ? dlen - 1 : length); k > 0; k--) {
+        if (cpcb >= dlen - k && 0 == memcmp(pending + length - k, delimiter, k) && 0 == memcmp(data, delimiter + k, dlen - k)) {
+            return dlen - k;
+        }
+    }
+    return 0;
+}
+
+/* delimiter framing consume all of @data, lines complete in @data are delivered in place,
+ *  only the line across receives are copied */
+static int _tcp_parse_delimited(ncb_t *ncb, const unsigned char *data, int cpcb, int dlen)
+{
+    unsigned char delimiter[NIS_MAXIMUM_DELIMITER];
+    const unsigned char *cursor, *end, *pending;
+    int pos, length;
+    nsp_status_t status;
+
+    memcpy(delimiter, ncb->u.tcp.delimiter, dlen);
+    cursor = data;
+    end = data + cpcb;
+
+    pending = ncb->u.tcp.lbdata ? ncb->u.tcp.lbdata : ncb->u.tcp.rx_parse_buffer;
+    length = ncb->u.tcp.lbdata ? ncb->u.tcp.lboffset : ncb->u.tcp.rx_parse_offset;
+    if (length > 0) {
+        pos = _tcp_delimiter_straddle(pending, length, data, cpcb, delimiter, dlen);
+        if (0 == pos) {
+            pos = memscan(data, cpcb, delimiter, dlen);
+            pos = (pos < 0) ? cpcb : pos + dlen;
+        }
+
+        if (!NSP_SUCCESS(_tcp_delimited_append(ncb, data, pos))) {
+            return -1;
+        }
+        cursor += pos;
+
+        pending = ncb->u.tcp.lbdata ? ncb->u.tcp.lbdata : ncb->u.tcp.rx_parse_buffer;
+        length = ncb->u.tcp.lbdata ? ncb->u.tcp.lboffset : ncb->u.tcp.rx_parse_offset;
+        if (length >= dlen && 0 == memcmp(pending + length - dlen, delimiter, dlen)) {
+            status = _tcp_delimited_post(ncb, pending, length, dlen);
+            if (ncb->u.tcp.lbdata) {
+                bufpool_free(ncb->u.tcp.lbdata);
+                ncb->u.tcp.lbdata = NULL;
+                ncb->u.tcp.lboffset = 0;
+                ncb->u.tcp.lbsize = 0;
+            }
+            ncb->u.tcp.rx_parse_offset = 0;
+            if (!NSP_SUCCESS(status)) {
+                return -1;
+            }
+        }
+    }
+
+    while (cursor < end) {
+        pos = memscan(cursor, (int)(end - cursor), delimiter, dlen);
+        if (pos < 0) {
+            if (!NSP_SUCCESS(_tcp_delimited_append(ncb, cursor, (int)(end - cursor)))) {
+                return -1;
+            }
+            break;
+        }
+        if (!NSP_SUCCESS(_tcp_delimited_post(ncb, cursor, pos + dlen, dlen))) {
+            return -1;
+        }
+        cursor += pos + dlen;
+    }
+
+    return 0;
 }
 
 int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
@@ -40,6 +234,7 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
     int user_data_size;
     int retcb;
     nsp_status_t status;
+    struct nis_frame_template frame;
 
     if ( unlikely(!ncb || !data || 0 == cpcb)) {
         return -1;
@@ -47,11 +242,16 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
 
     cpbuff = data;
 
+    /* delimiter framing */
+    used = __atomic_load_n(&ncb->u.tcp.delimiter_cb, __ATOMIC_ACQUIRE);
+    if (used > 0) {
+        return _tcp_parse_delimited(ncb, data, cpcb, used);
+    }
+
     /* no template specified, direct give the whole packet */
     if (0 == ncb->u.tcp.template.cb_ && !(*ncb->u.tcp.template.parser_)) {
-        ncb_post_recvdata(ncb, cpcb, data);
         ncb->u.tcp.rx_parse_offset = 0;
-        return 0;
+        return NSP_SUCCESS(_tcp_deliver(ncb, data, cpcb, 0)) ? 0 : -1;
     }
 
     /* it is in the large-block status */
@@ -59,6 +259,40 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
         return _tcp_parse_marked_lb(ncb, cpbuff, cpcb);
     }
 
+    /* built-in framing and nothing pending in parse cache, the complete frames are delivered in place one after another,
+     *  the incomplete tail and the large-block fall through to the general procedure below */
+    frame.width = __atomic_load_n(&ncb->u.tcp.frame.width, __ATOMIC_ACQUIRE);
+    if (frame.width > 0) {
+        frame.cb_ = ncb->u.tcp.frame.cb_;
+        frame.offset = ncb->u.tcp.frame.offset;
+        frame.flags = ncb->u.tcp.frame.flags;
+
+        if (0 == ncb->u.tcp.rx_parse_offset) {
+            while (cpcb >= frame.cb_) {
+                user_data_size = _tcp_frame_decode(&frame, cpbuff);
+                if ((user_data_size > TCP_MAXIMUM_PACKET_SIZE) || (user_data_size <= 0)) {
+                    mxx_call_ecr("bad data size:%d.", user_data_size);
+                    return -1;
+                }
+
+                total_packet_length = user_data_size + frame.cb_;
+                if (total_packet_length > cpcb) {
+                    break;
+                }
+
+                if (!NSP_SUCCESS(_tcp_deliver(ncb, cpbuff, total_packet_length, frame.cb_))) {
+                    return -1;
+                }
+                cpbuff += total_packet_length;
+                cpcb -= total_packet_length;
+            }
+
+            if (0 == cpcb) {
+                return 0;
+            }
+        }
+    }
+
     /* the length of data is not enough to constitute the protocol header.
     *  All data is used to construct the protocol header and return the remaining length of 0. */
     if (ncb->u.tcp.rx_parse_offset + cpcb < ncb->u.tcp.template.cb_) {
@@ -80,18 +314,22 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
         ncb->u.tcp.rx_parse_offset = ncb->u.tcp.template.cb_;
     }
 
-    /* The low-level protocol interacts with the protocol template, and the unpacking operation cannot continue if the processing fails.  */
-    if (!(*ncb->u.tcp.template.parser_)) {
-        mxx_call_ecr("parser tempalte method illegal.");
-        return -1;
-    }
+    if (frame.width > 0) {
+        user_data_size = _tcp_frame_decode(&frame, ncb->u.tcp.rx_parse_buffer);
+    } else {
+        /* The low-level protocol interacts with the protocol template, and the unpacking operation cannot continue if the processing fails.  */
+        if (!(*ncb->u.tcp.template.parser_)) {
+            mxx_call_ecr("parser tempalte method illegal.");
+            return -1;
+        }
 
-	/* Get the length of user segment data by interpreting routines  */
-    status = (*ncb->u.tcp.template.parser_)(ncb->u.tcp.rx_parse_buffer, ncb->u.tcp.rx_parse_offset, &user_data_size);
-    if (!NSP_SUCCESS(status)) {
-        mxx_call_ecr("failed to parse template header.");
-		return -1;
-	}
+        /* Get the length of user segment data by interpreting routines  */
+        status = (*ncb->u.tcp.template.parser_)(ncb->u.tcp.rx_parse_buffer, ncb->u.tcp.rx_parse_offset, &user_data_size);
+        if (!NSP_SUCCESS(status)) {
+            mxx_call_ecr("failed to parse template header.");
+            return -1;
+        }
+    }
 
 	/* If the user data length exceeds the maximum tolerance length,
      * it will be reported as an error directly, possibly a malicious attack.  */
@@ -105,16 +343,17 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
 
     /* If it is a large-block, then we should establish a large-block process.  */
     if (total_packet_length > TCP_BUFFER_SIZE) {
-        if (NULL == (ncb->u.tcp.lbdata = (unsigned char *)ztrymalloc(total_packet_length))) {
+        if (NULL == (ncb->u.tcp.lbdata = (unsigned char *)bufpool_alloc(total_packet_length))) {
             return -1;
         }
 
         /* total large-block length, include the low-level protocol head length */
         ncb->u.tcp.lbsize = total_packet_length;
 
-        /* copy all data to buffer */
-        memcpy(ncb->u.tcp.lbdata, data, cpcb);
-        ncb->u.tcp.lboffset = cpcb;
+        /* copy all data to buffer, the protocol head may arrive in previous receive, so it come from the parse cache */
+        memcpy(ncb->u.tcp.lbdata, ncb->u.tcp.rx_parse_buffer, ncb->u.tcp.rx_parse_offset);
+        memcpy(ncb->u.tcp.lbdata + ncb->u.tcp.rx_parse_offset, cpbuff, overplus);
+        ncb->u.tcp.lboffset = ncb->u.tcp.rx_parse_offset + overplus;
 
         /* clear the describe information of buffer */
         ncb->u.tcp.rx_parse_offset = 0;
@@ -132,15 +371,10 @@ int tcp_parse_pkt(ncb_t *ncb, const unsigned char *data, int cpcb)
             (The total number of bytes consumed to build this package) */
         retcb = (overplus - (total_packet_length - ncb->u.tcp.rx_parse_offset));
 
-        if (ncb->attr & LINKATTR_TCP_FULLY_RECEIVE) {
-            ncb_post_recvdata(ncb, user_data_size + ncb->u.tcp.template.cb_, ncb->u.tcp.rx_parse_buffer);
-        } else {
-            ncb_post_recvdata(ncb, user_data_size, ncb->u.tcp.rx_parse_buffer + ncb->u.tcp.template.cb_);
-        }
-
+        status = _tcp_deliver(ncb, ncb->u.tcp.rx_parse_buffer, total_packet_length, ncb->u.tcp.template.cb_);
 
         ncb->u.tcp.rx_parse_offset = 0;
-        return retcb;
+        return NSP_SUCCESS(status) ? retcb : -1;
     }
 
     /*If the number of bytes remaining is not enough to construct a complete package,
@@ -3,15 +3,21 @@
 #include "mxx.h"
 #include "fifo.h"
 #include "io.h"
+#include "shm.h"
+#include "dispatch.h"
+#include "capture.h"
+#include "wpool.h"
 
-static nsp_status_t _tcp_syn_try(ncb_t *ncb_server, int *clientfd)
+#include <sys/sendfile.h>
+
+static nsp_status_t _tcp_syn_try(ncb_t *ncb_server, int *clientfd, struct sockaddr_in *raddr)
 {
-    struct sockaddr_in raddr;
     socklen_t addrlen;
     int fd;
 
-    addrlen = sizeof ( raddr);
-    fd = accept4(ncb_server->sockfd, (struct sockaddr *) &raddr, &addrlen, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    /* the address of domain socket peer are truncated, it's useless anyway */
+    addrlen = sizeof(*raddr);
+    fd = accept4(ncb_server->sockfd, (struct sockaddr *)raddr, &addrlen, SOCK_CLOEXEC | SOCK_NONBLOCK);
     if (fd < 0) {
         switch (errno) {
         /* The system call was interrupted by a signal that was caught before a valid connection arrived, or this connection has been aborted.
@@ -54,34 +60,23 @@ static nsp_status_t _tcp_syn_try(ncb_t *ncb_server, int *clientfd)
     return NSP_STATUS_SUCCESSFUL;
 }
 
-static nsp_status_t _tcp_syn_dpc(ncb_t *ncb_server, ncb_t *ncb)
+static nsp_status_t _tcp_syn_dpc(ncb_t *ncb_server, ncb_t *ncb, const struct sockaddr_in *raddr)
 {
     nsp_status_t status;
     int attr;
 
-    /* set options */
+    /* keep-alive, linger, nodelay and buffer size are set on listener by @tcp_listen, the accepted socket inherit them from kernel.
+        the remote address come from accept4(2), the local address is the listener's one,
+        when listener bound on INADDR_ANY, the actual local address is queried by @tcp_getaddr on demand */
     if (AF_UNIX == ncb_server->local_addr.sin_family ) {
         ncb->local_addr.sin_family = AF_UNIX;
         ncb->local_addr.sin_port = 0;
         strncpy(ncb->domain_addr.sun_path, ncb_server->domain_addr.sun_path, sizeof(ncb_server->domain_addr.sun_path) - 1);
     } else {
-        /* save local and remote address structure */
-        tcp_relate_address(ncb);
-        /* the low-level [TCP Keep-ALive] are usable. */
-        tcp_set_keepalive(ncb, 9);
-        /* acquire save TCP Info and adjust linger in the accept phase.
-            l_onoff on and l_linger not zero, these settings means:
-            TCP drop any data cached in the kernel buffer of this socket file descriptor when close(2) called.
-            post a TCP-RST to peer, do not use FIN-FINACK, using this flag to avoid TIME_WAIT stauts */
-        ncb_set_linger(ncb);
+        memcpy(&ncb->remot_addr, raddr, sizeof(ncb->remot_addr));
+        memcpy(&ncb->local_addr, &ncb_server->local_addr, sizeof(ncb->local_addr));
     }
 
-    /* disable delay optimization */
-    tcp_set_nodelay(ncb, 1);
-
-    /* adjust TCP window size to mimimum require. */
-    ncb_set_buffsize(ncb);
-
     /* this link use to receive data from remote peer,
             so the packet and rx memory acquire to allocate now */
     status = tcp_allocate_rx_buffer(ncb);
@@ -89,8 +84,16 @@ static nsp_status_t _tcp_syn_dpc(ncb_t *ncb_server, ncb_t *ncb)
         return status;
     }
 
+    /* accepted SHM link receive it's rings later in @tcp_shm_rx, writes before that are queued */
+    if (ncb_shm(ncb_server)) {
+        status = shm_create(ncb);
+        if ( !NSP_SUCCESS(status) ) {
+            return status;
+        }
+    }
+
     /* specify data handler proc for client ncb object */
-    __atomic_store_n(&ncb->ncb_read, &tcp_rx, __ATOMIC_RELEASE);
+    __atomic_store_n(&ncb->ncb_read, ncb_shm(ncb) ? &tcp_shm_rx : &tcp_rx, __ATOMIC_RELEASE);
     __atomic_store_n(&ncb->ncb_write, &tcp_tx, __ATOMIC_RELEASE);
 
     /* copy the context from listen fd to accepted one in needed */
@@ -98,21 +101,36 @@ static nsp_status_t _tcp_syn_dpc(ncb_t *ncb_server, ncb_t *ncb)
     if (attr & LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT) {
         tcp_setattr_r(ncb, attr);
         memcpy(&ncb->u.tcp.template, &ncb_server->u.tcp.template, sizeof(tst_t));
+        memcpy(&ncb->u.tcp.frame, &ncb_server->u.tcp.frame, sizeof(ncb->u.tcp.frame));
+        memcpy(ncb->u.tcp.delimiter, ncb_server->u.tcp.delimiter, sizeof(ncb->u.tcp.delimiter));
+        ncb->u.tcp.delimiter_cb = ncb_server->u.tcp.delimiter_cb;
+        ncb->u.tcp.nfilters = __atomic_load_n(&ncb_server->u.tcp.nfilters, __ATOMIC_ACQUIRE);
+        memcpy(ncb->u.tcp.filters, ncb_server->u.tcp.filters, sizeof(ncb->u.tcp.filters));
     }
 
-    /* attach to epoll as early as it can to ensure the EPOLLRDHUP and EPOLLERR event not be lost,
-    BUT do NOT allow the EPOLLIN event, because receive message should NOT early than accepted message */
-    status = io_attach(ncb, 0);
-    if ( !NSP_SUCCESS(status) ) {
-        return status;
+    /* record to the capture file of listener */
+    if (ncb_capturing(ncb_server)) {
+        capture_inherit(ncb, ncb_server);
+    }
+
+    /* write to ring never block, full ring queue the packet like EAGAIN of nonblocking socket */
+    if (ncb_shm(ncb)) {
+        ncb->attr |= LINKATTR_NONBLOCK;
     }
 
+    /* accepted link inherit the receive budget of listener */
+    ncb_set_rx_budget(ncb, ncb_rx_budget_bytes(ncb_server), ncb_rx_budget_frames(ncb_server));
+
     /* tell calling thread, link has been accepted.
         user can rewrite some context in callback even if LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT is set */
     ncb_post_accepted(ncb_server, ncb->hld);
 
-    /* allow the EPOLLIN event to visit this file-descriptor */
-    io_modify(ncb, EPOLLIN);
+    /* attach to epoll with EPOLLIN in one call after the accepted message, so receive message never early than it,
+        the pending EPOLLIN/EPOLLRDHUP are reported by EPOLL_CTL_ADD, nothing lost.
+        Tx requests queued by callback are waiting for the EPOLLOUT apply here, the fifo lock keep @fifo_queue out until attached */
+    lwp_mutex_lock(&ncb->fifo.lock);
+    status = io_attach(ncb, EPOLLIN | (ncb->fifo.tx_overflow ? EPOLLOUT : 0));
+    lwp_mutex_unlock(&ncb->fifo.lock);
     return status;
 }
 
@@ -120,25 +138,16 @@ static nsp_status_t _tcp_syn(ncb_t *ncb_server)
 {
     ncb_t *ncb;
     objhld_t hld;
-    struct tcp_info ktcp;
     int clientfd;
+    struct sockaddr_in raddr;
     struct objcreator creator;
     nsp_status_t status;
 
     clientfd = -1;
 
-    /* get the socket status of tcp_info to check the socket tcp statues,
-        it must be listen states when accept syscall */
-    status = tcp_save_info(ncb_server, &ktcp);
-    if (NSP_SUCCESS(status)) {
-        if (ktcp.tcpi_state != TCP_LISTEN) {
-            mxx_call_ecr("Link:%lld, kernel states error:%s.", ncb_server->hld, tcp_state2name(ktcp.tcpi_state));
-            return NSP_STATUS_SUCCESSFUL;
-        }
-    }
-
-    /* try syscall connect(2) once, if accept socket fatal, the ncb object willbe destroy */
-    status = _tcp_syn_try(ncb_server, &clientfd);
+    /* the listen state is not checked by TCP_INFO for each accept, accept4(2) fails with EINVAL when the socket is not listening.
+        try syscall accept(2) once, if accept socket fatal, the ncb object willbe destroy */
+    status = _tcp_syn_try(ncb_server, &clientfd, &raddr);
     if ( NSP_SUCCESS(status)) {
         creator.known = INVALID_OBJHLD;
         creator.size = sizeof(ncb_t);
@@ -161,7 +170,7 @@ static nsp_status_t _tcp_syn(ncb_t *ncb_server)
         mxx_call_ecr("Accepted link:%lld, socket:%d ", hld, clientfd);
 
         /* initial the client ncb object, link willbe destroy on fatal. */
-        status = _tcp_syn_dpc(ncb_server, ncb);
+        status = _tcp_syn_dpc(ncb_server, ncb, &raddr);
         if ( !NSP_SUCCESS(status) ) {
             objclos(hld);
         }
@@ -182,7 +191,7 @@ nsp_status_t tcp_syn(ncb_t *ncb_server)
     return status;
 }
 
-static nsp_status_t _tcp_rx(ncb_t *ncb)
+static nsp_status_t _tcp_rx(ncb_t *ncb, int *rxcb)
 {
     int recvcb;
     int overplus;
@@ -191,6 +200,7 @@ static nsp_status_t _tcp_rx(ncb_t *ncb)
 
     recvcb = ncb_recvdata(ncb, NULL, 0, NULL, 0);
     if (recvcb > 0) {
+        *rxcb = recvcb;
         cpcb = recvcb;
         overplus = recvcb;
         offset = 0;
@@ -199,11 +209,15 @@ static nsp_status_t _tcp_rx(ncb_t *ncb)
             if (overplus < 0) {
                 /* fatal to parse low level protocol,
                     close the object immediately */
+                dispatch_detach(ncb);
                 return NSP_STATUS_FATAL;
             }
             offset += (cpcb - overplus);
             cpcb = overplus;
         } while (overplus > 0);
+
+        /* packets parsed in place may have been lent to dispatch workers with the Rx buffer */
+        dispatch_detach(ncb);
     }
 
     /* a stream socket peer has performed an orderly shutdown */
@@ -223,25 +237,164 @@ static nsp_status_t _tcp_rx(ncb_t *ncb)
     return NSP_STATUS_SUCCESSFUL;
 }
 
+/* read receive buffer until it's empty or the per-wakeup budget of this link exhausted.
+ * return EAGAIN when the kernel buffer has been drained, success means data may still pending,
+ * in this case, the link will be put on the ready list of Rx thread and serve again before next epoll_wait(2) */
 nsp_status_t tcp_rx(ncb_t *ncb)
 {
     nsp_status_t status;
-    int available;
+    int recvcb;
+    int bytes;
+    int frames;
+
+    bytes = 0;
+    frames = 0;
+    do {
+        /* application ask to pause receive during callback, EPOLLIN has been dropped */
+        if (ncb_rx_paused(ncb)) {
+            status = posix__makeerror(EAGAIN);
+            break;
+        }
+
+        recvcb = 0;
+        status = _tcp_rx(ncb, &recvcb);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+
+        /* a short read on stream socket means the kernel buffer has been drained at that moment,
+            any data arrived later trigger a new edge, so there is no need to call recv(2) again only for EAGAIN.
+            this is not true for domain socket which created with SOCK_SEQPACKET, one record per read */
+        if (AF_UNIX != ncb->local_addr.sin_family && recvcb < ncb->rx_buffer_size) {
+            status = posix__makeerror(EAGAIN);
+            break;
+        }
+
+        bytes += recvcb;
+        frames++;
+    } while (!ncb_rx_budget_exhausted(ncb, bytes, frames));
+
+    return status;
+}
+
+/* Rx proc of SHM link, bytes are parsed in place of the ring.
+ * each piece are no more than TCP_BUFFER_SIZE just like one recv(2), the large-block path of @tcp_parse_pkt depend on it */
+nsp_status_t tcp_shm_rx(ncb_t *ncb)
+{
+    nsp_status_t status;
+    const unsigned char *data;
+    int n;
+    int overplus;
+    int offset;
+    int cpcb;
+    int bytes;
+    int frames;
+
+    /* the rings are delivered by the first message on socket of accepted link */
+    if (!ncb_shm_ready(ncb)) {
+        status = shm_accept(ncb);
+        if (!NSP_SUCCESS(status)) {
+            return NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN) ? status : NSP_STATUS_FATAL;
+        }
+
+        status = shm_attach(ncb);
+        if (!NSP_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    shm_drain(ncb);
 
-    /* read receive buffer until it's empty */
+    bytes = 0;
+    frames = 0;
+    status = NSP_STATUS_SUCCESSFUL;
     do {
-        if (0 == ioctl(ncb->sockfd, FIONREAD, &available)) {
-            if (0 == available) {
+        if (ncb_rx_paused(ncb)) {
+            status = posix__makeerror(EAGAIN);
+            break;
+        }
+
+        n = shm_peek(ncb, &data, TCP_BUFFER_SIZE);
+        if (n < 0) {
+            return NSP_STATUS_FATAL;
+        }
+
+        /* go to sleep only if the ring still empty after announce it */
+        if (0 == n) {
+            if (shm_sleep(ncb)) {
                 status = posix__makeerror(EAGAIN);
                 break;
             }
+            continue;
         }
 
-        status = _tcp_rx(ncb);
-    }while( NSP_SUCCESS(status) );
+        offset = 0;
+        cpcb = n;
+        do {
+            overplus = tcp_parse_pkt(ncb, data + offset, cpcb);
+            if (overplus < 0) {
+                return NSP_STATUS_FATAL;
+            }
+            offset += (cpcb - overplus);
+            cpcb = overplus;
+        } while (overplus > 0);
+        shm_commit(ncb, n);
+
+        bytes += n;
+        frames++;
+    } while (!ncb_rx_budget_exhausted(ncb, bytes, frames));
+
+    /* doorbell also rang when the peer release space of Tx ring, the queued packets can continue */
+    if (__atomic_load_n(&ncb->fifo.size, __ATOMIC_ACQUIRE) > 0) {
+        wp_queued(ncb);
+    }
+
     return status;
 }
 
+/* the file part of node queued by @tcp_sendfile, bytes are copy from page cache to socket inside the kernel */
+static nsp_status_t _tcp_txn_file(ncb_t *ncb, struct tx_file *file)
+{
+    int64_t remain;
+    off_t offset;
+    ssize_t wcb;
+    int want;
+
+    while (file->sent < file->length) {
+        remain = file->length - file->sent;
+        want = (remain > TCP_SENDFILE_CHUNK) ? TCP_SENDFILE_CHUNK : (int)remain;
+        want = fifo_rate_quota(ncb, want, nsp_true);
+        if (want <= 0) {
+            return posix__makeerror(EINPROGRESS);
+        }
+
+        offset = (off_t)(file->offset + file->sent);
+        wcb = sendfile(ncb->sockfd, file->fd, &offset, want);
+        if (wcb < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN != errno) {
+                file->status = posix__makeerror(errno);
+                mxx_call_ecr("Fatal error occurred syscall sendfile(2), error:%d, link:%lld", errno, ncb->hld);
+            }
+            return posix__makeerror(errno);
+        }
+
+        /* the file are truncated after request, the peer can never receive a complete packet */
+        if (0 == wcb) {
+            file->status = posix__makeerror(ENODATA);
+            mxx_call_ecr("Unexpected end of file, %lld bytes remain, link:%lld", file->length - file->sent, ncb->hld);
+            return NSP_STATUS_FATAL;
+        }
+
+        fifo_rate_consume(ncb, (int)wcb);
+        file->sent += wcb;
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
 nsp_status_t tcp_txn(ncb_t *ncb, void *p)
 {
     int wcb;
@@ -250,7 +403,17 @@ nsp_status_t tcp_txn(ncb_t *ncb, void *p)
     node = (struct tx_node *)p;
 
     while (node->offset < node->wcb) {
-        wcb = ncb_senddata(ncb, node->data + node->offset, node->wcb - node->offset, NULL, 0);
+        /* throttled by Tx rate limit, the remain part of @node will be written when tokens refilled */
+        wcb = fifo_rate_quota(ncb, node->wcb - node->offset, nsp_true);
+        if (wcb <= 0) {
+            return posix__makeerror(EINPROGRESS);
+        }
+
+        if (ncb_shm(ncb)) {
+            wcb = shm_write(ncb, node->data + node->offset, wcb);
+        } else {
+            wcb = ncb_senddata(ncb, node->data + node->offset, wcb, NULL, 0);
+        }
 
         /* fatal-error/connection-terminated  */
         if (0 == wcb) {
@@ -262,9 +425,14 @@ nsp_status_t tcp_txn(ncb_t *ncb, void *p)
             return posix__makeerror(errno);
         }
 
+        fifo_rate_consume(ncb, wcb);
         node->offset += wcb;
     }
 
+    if (node->file) {
+        return _tcp_txn_file(ncb, node->file);
+    }
+
     return NSP_STATUS_SUCCESSFUL;
 }
 
@@ -284,12 +452,18 @@ nsp_status_t tcp_tx(ncb_t *ncb)
         }
     }
 
+    /* a producer is writing the socket directly, it bring the wpool thread back when it's done */
+    if (!fifo_tx_acquire(ncb)) {
+        return posix__makeerror(EAGAIN);
+    }
+
     /* try to write front package into system kernel send-buffer */
     status = fifo_top(ncb, &node);
     if (NSP_SUCCESS(status)) {
-        return tcp_txn(ncb, node);
+        status = tcp_txn(ncb, node);
     }
 
+    fifo_tx_release(ncb);
     return status;
 }
 
@@ -353,17 +527,37 @@ nsp_status_t tcp_tx_syn(ncb_t *ncb)
                 tcp_relate_address(ncb);
             }
 
+            /* hand over the rings to peer */
+            if (ncb_shm(ncb)) {
+                status = shm_connect(ncb);
+                if (!NSP_SUCCESS(status) ) {
+                    objclos(ncb->hld);
+                    return status;
+                }
+                ncb->attr |= LINKATTR_NONBLOCK;
+            }
+
             /* follow tcp rx/tx event */
-            __atomic_store_n(&ncb->ncb_read, &tcp_rx, __ATOMIC_RELEASE);
+            __atomic_store_n(&ncb->ncb_read, ncb_shm(ncb) ? &tcp_shm_rx : &tcp_rx, __ATOMIC_RELEASE);
             __atomic_store_n(&ncb->ncb_write, &tcp_tx, __ATOMIC_RELEASE);
 
-            /* focus EPOLLIN only */
+            /* focus EPOLLIN only, this handler run on worker thread, modify under the lock keep consistent with migration of epoll thread */
+            lwp_mutex_lock(&ncb->fifo.lock);
             status = io_modify(ncb, EPOLLIN);
+            lwp_mutex_unlock(&ncb->fifo.lock);
             if (!NSP_SUCCESS(status) ) {
                 objclos(ncb->hld);
                 return status;
             }
 
+            if (ncb_shm(ncb)) {
+                status = shm_attach(ncb);
+                if (!NSP_SUCCESS(status) ) {
+                    objclos(ncb->hld);
+                    return status;
+                }
+            }
+
             if (ncb->local_addr.sin_family != AF_UNIX) {
                 mxx_call_ecr("connection established associated binding on %s:%d, link:%lld .",
                     inet_ntoa(ncb->local_addr.sin_addr), ntohs(ncb->local_addr.sin_port), ncb->hld);
@@ -4,10 +4,14 @@
 #include "fifo.h"
 #include "io.h"
 #include "wpool.h"
+#include "slab.h"
+#include "bufpool.h"
 #include "pipe.h"
 
 #include "zmalloc.h"
 
+#include <linux/filter.h>
+
 static nsp_status_t _udprefr( objhld_t hld, ncb_t **ncb )
 {
     if (unlikely( hld < 0 || !ncb)) {
@@ -59,10 +63,20 @@ void udp_uninit()
     _udp_invoke(wp_uninit);
 }
 
+nsp_status_t udp_resize(int nprocs)
+{
+    return io_resize(IPPROTO_UDP, nprocs);
+}
+
+int udp_getnprocs()
+{
+    return io_nprocs(IPPROTO_UDP);
+}
+
 static nsp_status_t udp_allocate_rx_buffer(ncb_t *ncb)
 {
     if (likely(!ncb->rx_buffer)) {
-        ncb->rx_buffer = (unsigned char *)zmalloc(MAX_UDP_UNIT);
+        ncb->rx_buffer = (unsigned char *)bufpool_alloc(MAX_UDP_UNIT);
         if (unlikely(!ncb->rx_buffer)) {
             return posix__makeerror(ENOMEM);
         }
@@ -167,6 +181,17 @@ static nsp_status_t _udp_create(ncb_t *ncb, const char* ipstr, uint16_t port, in
         /* allow port reuse(the same port number binding on different IP address) */
         ncb_set_reuseaddr(ncb);
 
+        /* every socket of the group bind on the same address:port, the kernel spread datagrams over them */
+        if (flag & UDP_FLAG_REUSEPORT) {
+            expect = 1;
+            if (-1 == setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const void *)&expect, sizeof(expect))) {
+                mxx_call_ecr("fatal error occurred syscall setsockopt(2) with SO_REUSEPORT, error:%d", errno);
+                status = posix__makeerror(errno);
+                break;
+            }
+            ncb->attr |= UDP_FLAG_REUSEPORT;
+        }
+
         addrlocal.sin_addr.s_addr = ipstr ? inet_addr(ipstr) : INADDR_ANY;
         addrlocal.sin_family = AF_INET;
         addrlocal.sin_port = htons(port);
@@ -219,11 +244,10 @@ static nsp_status_t _udp_create(ncb_t *ncb, const char* ipstr, uint16_t port, in
     return status;
 }
 
-HUDPLINK udp_create(udp_io_fp callback, const char* ipstr, uint16_t port, int flag)
+/* allocate a UDP object and return it with one reference */
+static objhld_t _udp_allocate(udp_io_fp callback, ncb_t **ncb)
 {
-    ncb_t *ncb;
     struct objcreator creator;
-    nsp_status_t status;
     objhld_t hld;
 
     creator.known = INVALID_OBJHLD;
@@ -238,12 +262,87 @@ HUDPLINK udp_create(udp_io_fp callback, const char* ipstr, uint16_t port, int fl
         return INVALID_HUDPLINK;
     }
 
-    ncb = (ncb_t *) objrefr(hld);
-    assert(ncb);
+    *ncb = (ncb_t *) objrefr(hld);
+    assert(*ncb);
+
+    (*ncb)->hld = hld;
+    (*ncb)->protocol = IPPROTO_UDP;
+    (*ncb)->nis_callback = callback;
+    return hld;
+}
+
+/* open one more SO_REUSEPORT socket for each of the other epoll threads, the first one(@ncb itself) served by thread 0.
+ * these sockets are hidden links belong to @ncb, failure of them only reduce the parallelism */
+static void _udp_create_shadows(ncb_t *ncb, const char *ipstr, int flag)
+{
+    int nprocs;
+    int i;
+    objhld_t hld;
+    ncb_t *shadow;
+    nsp_status_t status;
+
+    nprocs = io_nprocs(IPPROTO_UDP);
+    if (nprocs <= 1) {
+        return;
+    }
+
+    ncb->u.udp.shadows = (objhld_t *)ztrycalloc((nprocs - 1) * sizeof(objhld_t));
+    if (unlikely(!ncb->u.udp.shadows)) {
+        mxx_call_ecr("insufficient resource for SO_REUSEPORT group of link:%lld", ncb->hld);
+        return;
+    }
 
-    ncb->hld = hld;
-    ncb->protocol = IPPROTO_UDP;
-    ncb->nis_callback = callback;
+    for (i = 1; i < nprocs; i++) {
+        hld = _udp_allocate(ncb->nis_callback, &shadow);
+        if (unlikely(hld < 0)) {
+            break;
+        }
+
+        shadow->u.udp.master = ncb->hld;
+        shadow->rx_affinity = i;
+        ncb_set_rx_budget(shadow, ncb_rx_budget_bytes(ncb), ncb_rx_budget_frames(ncb));
+        status = _udp_create(shadow, ipstr, ntohs(ncb->local_addr.sin_port), flag);
+        objdefr(hld);
+        if (!NSP_SUCCESS(status)) {
+            objclos(hld);
+            break;
+        }
+        ncb->u.udp.shadows[ncb->u.udp.nshadows++] = hld;
+    }
+
+    mxx_call_ecr("link:%lld SO_REUSEPORT group with %d sockets", ncb->hld, ncb->u.udp.nshadows + 1);
+}
+
+/* apply @fn to every hidden socket of the SO_REUSEPORT group which @ncb is master of */
+static void _udp_foreach_shadow(ncb_t *ncb, void (*fn)(ncb_t *, int), int arg)
+{
+    int i;
+    ncb_t *shadow;
+
+    for (i = 0; i < ncb->u.udp.nshadows; i++) {
+        shadow = (ncb_t *)objrefr(ncb->u.udp.shadows[i]);
+        if (shadow) {
+            fn(shadow, arg);
+            objdefr(ncb->u.udp.shadows[i]);
+        }
+    }
+}
+
+static void _udp_shutdown_shadow(ncb_t *shadow, int how)
+{
+    io_shutdown(shadow, how);
+}
+
+HUDPLINK udp_create(udp_io_fp callback, const char* ipstr, uint16_t port, int flag)
+{
+    ncb_t *ncb;
+    nsp_status_t status;
+    objhld_t hld;
+
+    hld = _udp_allocate(callback, &ncb);
+    if (unlikely(hld < 0)) {
+        return INVALID_HUDPLINK;
+    }
 
     do {
         if (ipstr) {
@@ -253,7 +352,19 @@ HUDPLINK udp_create(udp_io_fp callback, const char* ipstr, uint16_t port, int fl
             }
         }
 
+        /* synchronous link read by calling thread, a group of sockets make no sense */
+        if (!callback) {
+            flag &= ~UDP_FLAG_REUSEPORT;
+        }
+
+        if (flag & UDP_FLAG_REUSEPORT) {
+            ncb->rx_affinity = 0;
+        }
+
         status = _udp_create(ncb, ipstr, port, flag);
+        if (NSP_SUCCESS(status) && (flag & UDP_FLAG_REUSEPORT)) {
+            _udp_create_shadows(ncb, ipstr, flag);
+        }
     } while(0);
 
     objdefr(hld);
@@ -275,6 +386,7 @@ void udp_destroy(HUDPLINK link)
 
     mxx_call_ecr("link:%lld order to destroy", ncb->hld);
     io_shutdown(ncb, SHUT_RDWR);
+    _udp_foreach_shadow(ncb, &_udp_shutdown_shadow, SHUT_RDWR);
     objdefr(link);
 }
 
@@ -297,14 +409,14 @@ nsp_status_t udp_awaken(HUDPLINK link, const void *pipedata, unsigned int cb)
     return status;
 }
 
-nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const char* ipstr, uint16_t port, const nis_serializer_fp serializer)
+static nsp_status_t _udp_write(HUDPLINK link, const void *origin, unsigned int cb, int segment, const char* ipstr, uint16_t port,
+    const nis_serializer_fp serializer)
 {
     ncb_t *ncb;
-    unsigned char *buffer;
     struct tx_node *node;
     nsp_status_t status;
 
-    if (unlikely( !ipstr || (cb <= 0) || (link < 0) || (cb > MAX_UDP_UNIT) || !origin)) {
+    if (unlikely( !ipstr || (cb <= 0) || (link < 0) || !origin)) {
         return posix__makeerror(EINVAL);
     }
 
@@ -312,7 +424,6 @@ nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const
         return posix__makeerror(EINVAL);
     }
 
-    buffer = NULL;
     node = NULL;
 
     status = _udprefr(link, &ncb);
@@ -329,30 +440,26 @@ nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const
             break;
         }
 
-        buffer = (unsigned char *)ztrymalloc(cb);
-        if (unlikely(!buffer)) {
+        /* node and packet in one allocation */
+        node = (struct tx_node *)slab_alloc(sizeof (struct tx_node) + cb);
+        if (unlikely(!node)) {
             status = posix__makeerror(ENOMEM);
             break;
         }
+        memset(node, 0, sizeof(struct tx_node));
+        node->data = fifo_inline_data(node);
+        node->wcb = cb;
+        node->offset = 0;
+        node->segment = segment;
 
         /* serialize data into packet or direct use data pointer by @origin */
         if (serializer) {
-            if ((*serializer)(buffer, origin, cb) < 0 ) {
+            if ((*serializer)(node->data, origin, cb) < 0 ) {
                 break;
             }
         } else {
-            memcpy(buffer, origin, cb);
-        }
-
-        node = (struct tx_node *)ztrymalloc(sizeof (struct tx_node));
-        if (unlikely(!node)) {
-            status = posix__makeerror(ENOMEM);
-            break;
+            memcpy(node->data, origin, cb);
         }
-        memset(node, 0, sizeof(struct tx_node));
-        node->data = buffer;
-        node->wcb = cb;
-        node->offset = 0;
 
         if (AF_UNIX == ncb->local_addr.sin_family ) {
             memset(&node->domain_target, 0, sizeof(node->domain_target));
@@ -375,9 +482,9 @@ nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const
              */
             status = udp_txn(ncb, node);
 
-            /* break if success or failed without EAGAIN
+            /* break if success or failed without EAGAIN/EINPROGRESS(throttled by Tx rate limit)
              */
-            if (!NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN)) {
+            if (!NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN) && !NSP_FAILED_AND_ERROR_EQUAL(status, EINPROGRESS)) {
                 break;
             }
         }
@@ -401,12 +508,8 @@ nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const
         return status;
     } while (0);
 
-    if (likely(buffer)) {
-        zfree(buffer);
-    }
-
     if (likely(node)) {
-        zfree(node);
+        slab_free(node);
     }
 
     objdefr(link);
@@ -421,6 +524,30 @@ nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const
     return status;
 }
 
+nsp_status_t udp_write(HUDPLINK link, const void *origin, unsigned int cb, const char* ipstr, uint16_t port, const nis_serializer_fp serializer)
+{
+    if (unlikely(cb > MAX_UDP_UNIT)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    return _udp_write(link, origin, cb, 0, ipstr, port, serializer);
+}
+
+nsp_status_t udp_write_gso(HUDPLINK link, const void *origin, unsigned int cb, int segment, const char* ipstr, uint16_t port,
+    const nis_serializer_fp serializer)
+{
+    if (unlikely(segment <= 0 || segment > MAX_UDP_UNIT || cb > MAX_UDP_GSO_SIZE)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    if (unlikely((cb + segment - 1) / segment > MAX_UDP_GSO_SEGMENTS)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* only one datagram, GSO is unnecessary */
+    return _udp_write(link, origin, cb, (cb > (unsigned int)segment) ? segment : 0, ipstr, port, serializer);
+}
+
 nsp_status_t udp_read(HTCPLINK link, void *data, int size, struct nis_inet_addr *raddr, uint16_t *rport)
 {
     ncb_t *ncb;
@@ -566,6 +693,72 @@ nsp_status_t udp_get_boardcast(ncb_t *ncb, int *enabled)
     return posix__makeerror(errno);
 }
 
+static void _udp_set_shadow_gro(ncb_t *shadow, int enable)
+{
+    udp_set_gro(shadow, enable);
+}
+
+nsp_status_t udp_set_gro(ncb_t *ncb, int enable)
+{
+    enable = !!enable;
+
+    if (AF_INET != ncb->local_addr.sin_family) {
+        return posix__makeerror(EPROTONOSUPPORT);
+    }
+
+    if (0 != setsockopt(ncb->sockfd, SOL_UDP, UDP_GRO, (const void *)&enable, sizeof(enable))) {
+        return posix__makeerror(errno);
+    }
+
+    /* the receive buffer grow by Rx thread itself on next read */
+    __atomic_store_n(&ncb->u.udp.gro, enable, __ATOMIC_RELEASE);
+    _udp_foreach_shadow(ncb, &_udp_set_shadow_gro, enable);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+int udp_get_gro(ncb_t *ncb)
+{
+    return __atomic_load_n(&ncb->u.udp.gro, __ATOMIC_ACQUIRE);
+}
+
+/* the steering program attached to any socket take effect on the whole SO_REUSEPORT group,
+ * return value of the program is the index of socket in group, which is the order they bound, so master is 0 and shadows follow it */
+nsp_status_t udp_set_steer(ncb_t *ncb, int mode)
+{
+    struct sock_filter code[3];
+    struct sock_fprog prog;
+    int ignore;
+
+    if (!(ncb->attr & LINKATTR_UDP_REUSEPORT)) {
+        return posix__makeerror(EINVAL);
+    }
+
+    if (UDP_STEER_HASH == mode) {
+        ignore = 0;
+        if (0 != setsockopt(ncb->sockfd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF, (const void *)&ignore, sizeof(ignore)) && ENOENT != errno) {
+            return posix__makeerror(errno);
+        }
+        return NSP_STATUS_SUCCESSFUL;
+    }
+
+    if (UDP_STEER_CPU != mode) {
+        return posix__makeerror(EINVAL);
+    }
+
+    /* A = cpu; A = A % sockets; return A */
+    code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    code[1] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, ncb->u.udp.nshadows + 1);
+    code[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (0 != setsockopt(ncb->sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, (const void *)&prog, sizeof(prog))) {
+        mxx_call_ecr("fatal error occurred syscall setsockopt(2) with SO_ATTACH_REUSEPORT_CBPF, error:%d, link:%lld", errno, ncb->hld);
+        return posix__makeerror(errno);
+    }
+
+    return NSP_STATUS_SUCCESSFUL;
+}
+
 /*
 * The destination address of multicast message uses Class D IP address. Class D address cannot appear in the source IP address field of IP message.
 * In the process of unicast data transmission, a data packet transmission path is routed from the source address to the destination address,
@@ -706,4 +899,7 @@ void udp_setattr_r(ncb_t *ncb, int attr)
     if ((oldattr & LINKATTR_UDP_BAORDCAST) && (0 == (ncb->attr & LINKATTR_UDP_BAORDCAST))) {
         udp_set_boardcast(ncb, 0);
     }
+
+    /* sockets of SO_REUSEPORT group behave as one link */
+    _udp_foreach_shadow(ncb, &udp_setattr_r, attr);
 }
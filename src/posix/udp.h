@@ -3,6 +3,28 @@
 
 #include "ncb.h"
 
+#include <netinet/udp.h>
+
+/* UDP segmentation/receive offload since linux 4.18/5.0, keep compile on the older headers */
+#if !defined SOL_UDP
+#define SOL_UDP                     (17)
+#endif
+#if !defined UDP_SEGMENT
+#define UDP_SEGMENT                 (103)
+#endif
+#if !defined UDP_GRO
+#define UDP_GRO                     (104)
+#endif
+#if !defined SO_REUSEPORT
+#define SO_REUSEPORT                (15)
+#endif
+#if !defined SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF    (51)
+#endif
+#if !defined SO_DETACH_REUSEPORT_BPF
+#define SO_DETACH_REUSEPORT_BPF     (68)
+#endif
+
 #if !defined UDP_BUFFER_SIZE
 #define UDP_BUFFER_SIZE          	(0xFFFF)
 #endif
@@ -20,6 +42,13 @@ nsp_status_t udp_set_boardcast(ncb_t *ncb, int enable);
 extern
 nsp_status_t udp_get_boardcast(ncb_t *ncb, int *enabled);
 
+extern
+nsp_status_t udp_set_gro(ncb_t *ncb, int enable);
+extern
+int udp_get_gro(ncb_t *ncb);
+extern
+nsp_status_t udp_set_steer(ncb_t *ncb, int mode);
+
 extern
 void udp_setattr_r(ncb_t *ncb, int attr);
 
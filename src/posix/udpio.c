@@ -2,23 +2,131 @@
 
 #include "mxx.h"
 #include "fifo.h"
+#include "bufpool.h"
 
-static nsp_status_t _udp_rx(ncb_t *ncb)
+#include "zmalloc.h"
+
+/* receive with UDP_GRO enabled, the kernel may coalesce several datagrams from the same sender into one buffer,
+ * and report the size of each of them in control message */
+static int _udp_recvgro(ncb_t *ncb, struct sockaddr *addr, socklen_t addrlen, int *segment)
+{
+    int cb;
+    struct msghdr msg;
+    struct iovec iov[1];
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int)) + NCB_RX_TIMESTAMP_CONTROL];
+    unsigned char *buffer;
+
+    /* coalesced datagrams can reach 64KB, Rx thread is the only one touch the receive buffer, grow it here */
+    if (unlikely(ncb->rx_buffer_size < UDP_BUFFER_SIZE)) {
+        buffer = (unsigned char *)bufpool_alloc(UDP_BUFFER_SIZE);
+        if (buffer) {
+            bufpool_free(ncb->rx_buffer);
+            ncb->rx_buffer = buffer;
+            ncb->rx_buffer_size = UDP_BUFFER_SIZE;
+        }
+    }
+
+    iov[0].iov_base = ncb->rx_buffer;
+    iov[0].iov_len = ncb->rx_buffer_size;
+
+    msg.msg_name = addr;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    msg.msg_flags = 0;
+
+    /* only the Rx thread read here and loop until EAGAIN, never block it even the socket is not in nonblocking mode */
+    SYSCALL_WHILE_EINTR(cb, recvmsg(ncb->sockfd, &msg, MSG_DONTWAIT));
+    if (cb < 0) {
+        return posix__makeerror(errno);
+    }
+
+    *segment = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (SOL_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type) {
+            memcpy(segment, CMSG_DATA(cmsg), sizeof(int));
+            break;
+        }
+    }
+
+    if (ncb->attr & LINKATTR_RX_TIMESTAMP) {
+        ncb_read_rx_timestamp(ncb, &msg);
+    }
+
+    return cb;
+}
+
+static int _udp_sendgso(ncb_t *ncb, const void *data, size_t datalen, const struct sockaddr *addr, socklen_t addrlen, int segment)
+{
+    int cb;
+    struct msghdr msg;
+    struct iovec iov[1];
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    uint16_t gso_size;
+
+    iov[0].iov_base = (void *)data;
+    iov[0].iov_len = datalen;
+
+    memset(control, 0, sizeof(control));
+    msg.msg_name = (void *)addr;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    msg.msg_flags = 0;
+
+    gso_size = (uint16_t)segment;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+    SYSCALL_WHILE_EINTR(cb, sendmsg(ncb->sockfd, &msg, MSG_NOSIGNAL | ((ncb->attr & LINKATTR_NONBLOCK) ? MSG_DONTWAIT : 0)));
+
+    return cb < 0 ? posix__makeerror(errno) : cb;
+}
+
+static nsp_status_t _udp_rx(ncb_t *ncb, int *rxcb)
 {
     int recvcb;
+    int segment;
     struct sockaddr_in remote;
     udp_data_t c_data;
     nis_event_t c_event;
 
-    recvcb = ncb_recvdata(ncb, NULL, 0, (struct sockaddr *)&remote, sizeof(remote));
+    segment = 0;
+    if (udp_get_gro(ncb)) {
+        recvcb = _udp_recvgro(ncb, (struct sockaddr *)&remote, sizeof(remote), &segment);
+    } else {
+        recvcb = ncb_recvdata(ncb, NULL, 0, (struct sockaddr *)&remote, sizeof(remote));
+    }
     if (recvcb > 0) {
-        c_event.Ln.Udp.Link = ncb->hld;
+        *rxcb = recvcb;
+        /* hidden socket of SO_REUSEPORT group report datagrams on behalf of it's master */
+        c_event.Ln.Udp.Link = ncb_udp_shadow(ncb) ? ncb->u.udp.master : ncb->hld;
         c_event.Event = EVT_RECEIVEDATA;
         c_data.e.Packet.Data = ncb->rx_buffer;
         c_data.e.Packet.Size = recvcb;
-        inet_ntop(AF_INET, &remote.sin_addr, c_data.e.Packet.RemoteAddress, sizeof (c_data.e.Packet.RemoteAddress));
+        c_data.e.Packet.RemoteIpv4 = ntohl(remote.sin_addr.s_addr);
         c_data.e.Packet.RemotePort = ntohs(remote.sin_port);
+        /* formatting the sender are as expensive as the syscall itself, skip it when the receiver only need the binary one */
+        if (ncb->attr & LINKATTR_UDP_BINARY_ADDRESS) {
+            c_data.e.Packet.RemoteAddress[0] = 0;
+        } else {
+            inet_ntop(AF_INET, &remote.sin_addr, c_data.e.Packet.RemoteAddress, sizeof (c_data.e.Packet.RemoteAddress));
+        }
         c_data.e.Packet.Domain = &c_data.e.Packet.RemoteAddress[0];
+        c_data.e.Packet.Segment = (segment > 0 && segment < recvcb) ? segment : recvcb;
+        c_data.e.Packet.Timestamp = (ncb->attr & LINKATTR_RX_TIMESTAMP) ? ncb->rx_timestamp : 0;
+        if (c_data.e.Packet.Timestamp > 0) {
+            ncb_count_rx_latency(c_data.e.Packet.Timestamp);
+        }
         if (ncb->nis_callback) {
             ncb->nis_callback(&c_event, &c_data);
         }
@@ -42,7 +150,7 @@ static nsp_status_t _udp_rx(ncb_t *ncb)
     return NSP_STATUS_SUCCESSFUL;
 }
 
-static nsp_status_t _udp_rx_domain(ncb_t *ncb)
+static nsp_status_t _udp_rx_domain(ncb_t *ncb, int *rxcb)
 {
     int recvcb;
     struct sockaddr_un remote;
@@ -52,13 +160,20 @@ static nsp_status_t _udp_rx_domain(ncb_t *ncb)
     remote.sun_path[0] = 0;
     recvcb = ncb_recvdata(ncb, NULL, 0, (struct sockaddr *)&remote, sizeof(remote));
     if (recvcb > 0) {
+        *rxcb = recvcb;
         c_event.Ln.Udp.Link = ncb->hld;
         c_event.Event = EVT_RECEIVEDATA;
         c_data.e.Packet.Data = ncb->rx_buffer;
         c_data.e.Packet.Size = recvcb;
         c_data.e.Packet.RemoteAddress[0] = 0;
         c_data.e.Packet.RemotePort = 0;
+        c_data.e.Packet.RemoteIpv4 = 0;
         c_data.e.Packet.Domain = ((0 == remote.sun_path[0]) ? NULL : &remote.sun_path[0]);
+        c_data.e.Packet.Segment = recvcb;
+        c_data.e.Packet.Timestamp = (ncb->attr & LINKATTR_RX_TIMESTAMP) ? ncb->rx_timestamp : 0;
+        if (c_data.e.Packet.Timestamp > 0) {
+            ncb_count_rx_latency(c_data.e.Packet.Timestamp);
+        }
         if (ncb->nis_callback) {
             ncb->nis_callback(&c_event, &c_data);
         }
@@ -83,42 +198,91 @@ static nsp_status_t _udp_rx_domain(ncb_t *ncb)
     return NSP_STATUS_SUCCESSFUL;
 }
 
+/* read datagrams until the socket is empty or the per-wakeup budget of this link exhausted,
+ * success means datagrams may still pending and the link shall be served again by the ready list of Rx thread */
 nsp_status_t udp_rx(ncb_t *ncb)
 {
     nsp_status_t status;
-    nsp_status_t (*rxfn)(ncb_t *);
-    int available;
+    nsp_status_t (*rxfn)(ncb_t *, int *);
+    int recvcb;
+    int bytes;
+    int frames;
 
     rxfn = (AF_UNIX == ncb->local_addr.sin_family) ? &_udp_rx_domain : &_udp_rx;
+    bytes = 0;
+    frames = 0;
     do {
-        if (0 == ioctl(ncb->sockfd, FIONREAD, &available)) {
-            if (0 == available) {
-                status = posix__makeerror(EAGAIN);
-                break;
-            }
+        if (ncb_rx_paused(ncb)) {
+            status = posix__makeerror(EAGAIN);
+            break;
         }
-        status = rxfn(ncb);
-    } while(NSP_SUCCESS(status));
+
+        recvcb = 0;
+        status = rxfn(ncb, &recvcb);
+        if (!NSP_SUCCESS(status)) {
+            break;
+        }
+        bytes += recvcb;
+        frames++;
+    } while (!ncb_rx_budget_exhausted(ncb, bytes, frames));
+
     return status;
 }
 
 nsp_status_t udp_txn(ncb_t *ncb, void *p)
 {
     int wcb;
+    int remain;
+    int gso;
     struct tx_node *node;
+    const struct sockaddr *target;
+    socklen_t targetlen;
 
 	node = (struct tx_node *)p;
 	if (!node) {
 		return -EINVAL;
 	}
 
+    /* datagram can not be split, send it as long as any token remain */
+    if (fifo_rate_quota(ncb, node->wcb - node->offset, nsp_false) <= 0) {
+        return posix__makeerror(EINPROGRESS);
+    }
+
+    if (AF_INET == ncb->local_addr.sin_family ) {
+        target = (const struct sockaddr *)&node->udp_target;
+        targetlen = sizeof(node->udp_target);
+    } else if (AF_UNIX == ncb->local_addr.sin_family) {
+        target = (const struct sockaddr *)&node->domain_target;
+        targetlen = sizeof(node->domain_target);
+    } else {
+        return posix__makeerror(EPROTO);
+    }
+
+    gso = (AF_INET == ncb->local_addr.sin_family && !ncb->u.udp.gso_unsupported);
     while (node->offset < node->wcb) {
-        if (AF_INET == ncb->local_addr.sin_family ) {
-            wcb = ncb_senddata(ncb, node->data + node->offset, node->wcb - node->offset, (struct sockaddr *)&node->udp_target, sizeof(node->udp_target));
-        } else if (AF_UNIX == ncb->local_addr.sin_family) {
-            wcb = ncb_senddata(ncb, node->data + node->offset, node->wcb - node->offset, (struct sockaddr *)&node->domain_target, sizeof(node->domain_target));
+        remain = node->wcb - node->offset;
+
+        if (node->segment <= 0 || remain <= node->segment) {
+            wcb = ncb_senddata(ncb, node->data + node->offset, remain, target, targetlen);
+        } else if (gso) {
+            /* all segments are submit by one syscall, the kernel(or NIC) split them into datagrams */
+            wcb = _udp_sendgso(ncb, node->data + node->offset, remain, target, targetlen, node->segment);
+            if (NSP_FAILED_AND_ERROR_EQUAL(wcb, ENOPROTOOPT) || NSP_FAILED_AND_ERROR_EQUAL(wcb, EOPNOTSUPP)) {
+                mxx_call_ecr("UDP_SEGMENT unsupported by kernel, error:%d, link:%lld, fallback to send segments one by one", errno, ncb->hld);
+                ncb->u.udp.gso_unsupported = 1;
+                gso = 0;
+                continue;
+            }
+            /* segment exceed the MTU, too many segments and so on are faults of this request only,
+                send the rest of this node one segment each syscall but keep GSO for the link */
+            if (NSP_FAILED_AND_ERROR_EQUAL(wcb, EIO) || NSP_FAILED_AND_ERROR_EQUAL(wcb, EINVAL)) {
+                mxx_call_ecr("UDP_SEGMENT refused by kernel, error:%d, link:%lld, send this request one segment each syscall", errno, ncb->hld);
+                gso = 0;
+                continue;
+            }
         } else {
-            return posix__makeerror(EPROTO);
+            /* domain socket or GSO unsupported, send one segment each syscall */
+            wcb = ncb_senddata(ncb, node->data + node->offset, node->segment, target, targetlen);
         }
 
         /* fatal-error/connection-terminated  */
@@ -140,6 +304,7 @@ nsp_status_t udp_txn(ncb_t *ncb, void *p)
             return posix__makeerror(errno);
         }
 
+        fifo_rate_consume(ncb, wcb);
         node->offset += wcb;
     }
 
@@ -154,10 +319,8 @@ nsp_status_t udp_tx(ncb_t *ncb)
     /* try to write front package into system kernel send-buffer */
     status = fifo_top(ncb, &node);
     if (NSP_SUCCESS(status)) {
-        status = udp_txn(ncb, node);
-        if (NSP_SUCCESS(status)) {
-            return fifo_pop(ncb, NULL);
-        }
+        /* the node are pop by wpool after success written, same as TCP */
+        return udp_txn(ncb, node);
     }
 
     return status;
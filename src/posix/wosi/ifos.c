@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <shadow.h>
 #include <pwd.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <syscall.h>
@@ -381,6 +382,137 @@ int ifos_getnprocs()
     return sysconf(_SC_NPROCESSORS_CONF);
 }
 
+/* CPUs granted by bandwidth limit of the cgroup in directory @dir, round up, zero when unlimited or unknown.
+ *  v2 hold "$MAX $PERIOD" in cpu.max, v1 hold them in cpu.cfs_quota_us and cpu.cfs_period_us */
+static int _ifos_cgroup_quota(const char *dir, int v2)
+{
+    char path[PATH_MAX];
+    char max[32];
+    FILE *fp;
+    long long quota, period;
+
+    quota = -1;
+    period = 0;
+    if (v2) {
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        fp = fopen(path, "r");
+        if (!fp) {
+            return 0;
+        }
+        if (2 == fscanf(fp, "%31s %lld", max, &period) && 0 != strcmp(max, "max")) {
+            quota = atoll(max);
+        }
+        fclose(fp);
+    } else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        fp = fopen(path, "r");
+        if (!fp) {
+            return 0;
+        }
+        if (1 != fscanf(fp, "%lld", &quota)) {
+            quota = -1;
+        }
+        fclose(fp);
+
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        fp = fopen(path, "r");
+        if (!fp) {
+            return 0;
+        }
+        if (1 != fscanf(fp, "%lld", &period)) {
+            period = 0;
+        }
+        fclose(fp);
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (int)((quota + period - 1) / period);
+}
+
+/* every ancestor of the cgroup limit the bandwidth, the tightest one works */
+static void _ifos_cgroup_walk(const char *mount, const char *cgpath, int v2, int *nprocs)
+{
+    char dir[PATH_MAX];
+    char *slash;
+    size_t mountlen;
+    int quota;
+
+    mountlen = strlen(mount);
+    snprintf(dir, sizeof(dir), "%s%s", mount, (0 == strcmp(cgpath, "/")) ? "" : cgpath);
+    while (1) {
+        quota = _ifos_cgroup_quota(dir, v2);
+        if (quota > 0 && quota < *nprocs) {
+            *nprocs = quota;
+        }
+        slash = strrchr(dir, '/');
+        if (!slash || (size_t)(slash - dir) < mountlen) {
+            break;
+        }
+        *slash = 0;
+    }
+}
+
+static int _ifos_cgroup_has_cpu(const char *controllers)
+{
+    char list[256];
+    char *token, *saveptr;
+
+    strncpy(list, controllers, sizeof(list) - 1);
+    list[sizeof(list) - 1] = 0;
+    for (token = strtok_r(list, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+        if (0 == strcmp(token, "cpu")) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int ifos_getnprocs_quota()
+{
+    cpu_set_t cpus;
+    FILE *fp;
+    char line[PATH_MAX];
+    char mount[PATH_MAX];
+    char *controllers, *cgpath;
+    int nprocs;
+
+    /* CPUs this process allowed to run on */
+    CPU_ZERO(&cpus);
+    nprocs = (0 == sched_getaffinity(0, sizeof(cpus), &cpus)) ? CPU_COUNT(&cpus) : ifos_getnprocs();
+
+    /* each line of /proc/self/cgroup is "hierarchy-ID:controller-list:cgroup-path", the controller-list of v2 is empty */
+    fp = fopen("/proc/self/cgroup", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = 0;
+            controllers = strchr(line, ':');
+            if (!controllers) {
+                continue;
+            }
+            cgpath = strchr(++controllers, ':');
+            if (!cgpath) {
+                continue;
+            }
+            *cgpath++ = 0;
+
+            if (0 == controllers[0]) {
+                _ifos_cgroup_walk("/sys/fs/cgroup", cgpath, 1, &nprocs);
+            } else if (_ifos_cgroup_has_cpu(controllers)) {
+                snprintf(mount, sizeof(mount), "/sys/fs/cgroup/%s", controllers);
+                if (0 != access(mount, F_OK)) {
+                    crt_strcpy(mount, sizeof(mount), "/sys/fs/cgroup/cpu");
+                }
+                _ifos_cgroup_walk(mount, cgpath, 0, &nprocs);
+            }
+        }
+        fclose(fp);
+    }
+
+    return (nprocs > 0) ? nprocs : 1;
+}
+
 nsp_status_t ifos_setaffinity_process(int mask)
 {
     int i;
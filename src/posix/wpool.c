@@ -11,6 +11,7 @@
 #include "zmalloc.h"
 #include "spinlock.h"
 #include "refs.h"
+#include "slab.h"
 
 struct wpool;
 struct wptask {
@@ -27,6 +28,7 @@ struct wpool {
     struct list_head tasks; /* struct wptask::link */
     int task_list_size;
     int actived;
+    struct list_head delayed; /* struct wptask::link, tasks throttled by Tx rate limit, only visit by wpool thread */
 };
 
 struct wp_manager
@@ -107,6 +109,16 @@ static struct wptask *_wp_get_task(struct wpool *poolptr)
     return task;
 }
 
+static void _wp_resume_delayed(struct wpool *poolptr)
+{
+    struct wptask *task;
+
+    while (NULL != (task = list_first_entry_or_null(&poolptr->delayed, struct wptask, link))) {
+        list_del(&task->link);
+        _wp_add_task(task);
+    }
+}
+
 static nsp_status_t _wp_exec(struct wptask *task)
 {
     nsp_status_t status;
@@ -139,6 +151,11 @@ static nsp_status_t _wp_exec(struct wptask *task)
             /* when EAGAIN occurred or no item in fifo now, wait for next EPOLLOUT event, just ok */
             if (NSP_FAILED_AND_ERROR_EQUAL(status, EAGAIN) || NSP_FAILED_AND_ERROR_EQUAL(status, ENOENT)) {
                 ;
+            } else if (NSP_FAILED_AND_ERROR_EQUAL(status, EINPROGRESS)) {
+                /* throttled by Tx rate limit, no EPOLLOUT will be trigger for this case,
+                    retry this task on next tick of the wpool thread */
+                list_add_tail(&task->link, &task->poolptr->delayed);
+                status = NSP_STATUS_SUCCESSFUL;
             } else {
                 objclos(ncb->hld); /* fatal error cause by syscall, close this link */
             }
@@ -172,12 +189,15 @@ static void *_wp_run(void *p)
         }
         lwp_event_block(&poolptr->signal);
 
+        /* the tasks throttled in previous tick have chance to run now */
+        _wp_resume_delayed(poolptr);
+
         /* complete all write task when once signal arrived,
             no matter which thread wake up this wait object */
         while ((NULL != (task = _wp_get_task(poolptr)) ) && poolptr->actived) {
             status = _wp_exec(task);
             if (!NSP_SUCCESS(status)) {
-                zfree(task);
+                slab_free(task);
             }
         }
     }
@@ -190,6 +210,7 @@ static void *_wp_run(void *p)
 static nsp_status_t _wp_init(struct wpool *poolptr)
 {
     INIT_LIST_HEAD(&poolptr->tasks);
+    INIT_LIST_HEAD(&poolptr->delayed);
     lwp_event_init(&poolptr->signal, LWPEC_NOTIFY);
     initial_spinlock(&poolptr->sp);
     poolptr->task_list_size = 0;
@@ -215,8 +236,9 @@ static void _wp_uninit(struct wpool *poolptr)
         lwp_join(&poolptr->thread, NULL);
 
         /* clear the tasks which too late to deal with */
+        _wp_resume_delayed(poolptr);
         while (NULL != (task = _wp_get_task(poolptr))) {
-            zfree(task);
+            slab_free(task);
         }
 
         INIT_LIST_HEAD(&poolptr->tasks);
@@ -303,7 +325,7 @@ nsp_status_t wp_queued(void *ncbptr)
     }
 
     do {
-        if (NULL == (task = (struct wptask *)ztrymalloc(sizeof(struct wptask)))) {
+        if (NULL == (task = (struct wptask *)slab_alloc(sizeof(struct wptask)))) {
             status = posix__makeerror(ENOMEM);
             break;
         }
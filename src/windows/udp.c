@@ -66,6 +66,9 @@ static void udp_dispatch_io_recv( packet_t *packet )
 		c_data.e.Packet.Size = packet->size_for_translation_;
 		c_data.e.Packet.Data = ( const char * ) packet->irp_;
 		c_data.e.Packet.RemotePort = ntohs( packet->remote_addr.sin_port );
+		c_data.e.Packet.RemoteIpv4 = ntohl( packet->remote_addr.sin_addr.s_addr );
+		c_data.e.Packet.Segment = packet->size_for_translation_;
+
 		if ( !inet_ntop( AF_INET, &packet->remote_addr.sin_addr, c_data.e.Packet.RemoteAddress, _countof( c_data.e.Packet.RemoteAddress ) ) ) {
 			RtlZeroMemory( c_data.e.Packet.RemoteAddress, _countof( c_data.e.Packet.RemoteAddress ) );
 		}
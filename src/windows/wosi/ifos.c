@@ -353,6 +353,11 @@ PORTABLEIMPL(int) ifos_getnprocs()
     return (int)sysinfo.dwNumberOfProcessors;
 }
 
+PORTABLEIMPL(int) ifos_getnprocs_quota()
+{
+    return ifos_getnprocs();
+}
+
 PORTABLEIMPL(int) ifos_setaffinity_process(int mask)
 {
     if (0 == mask) {
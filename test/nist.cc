@@ -3,9 +3,17 @@
 #include "compiler.h"
 #include "nis.h"
 #include "ifos.h"
+#include "clock.h"
+#include "threading.h"
 
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <vector>
 
 static void STDCALL TestTcpCallback(const struct nis_event *event, const void *data) {
     if (event->Event == EVT_RECEIVEDATA) {
@@ -147,3 +155,2021 @@ TEST(DoTestUdpDomainFlow, TestUdpDomainFlow) {
     udp_destroy(cli);
     udp_uninit();
 }
+
+static HTCPLINK paused_link = INVALID_HTCPLINK;
+static int paused_received = 0;
+
+static void STDCALL TestTcpPauseCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        // pause receive before any data arrived
+        EXPECT_GE(nis_cntl(tcp_data->e.Accept.AcceptLink, NI_PAUSERX), 0);
+        __atomic_store_n(&paused_link, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+
+    if (event->Event == EVT_RECEIVEDATA) {
+        __atomic_add_fetch(&paused_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpPauseResume) {
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestTcpPauseCallback, "127.0.0.1", 10223);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    HTCPLINK cli = tcp_create(NULL, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    nsp_status_t status = tcp_listen(srv, 100);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    status = tcp_connect(cli, "127.0.0.1", 10223);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    for (int i = 0; i < 100 && __atomic_load_n(&paused_link, __ATOMIC_SEQ_CST) == INVALID_HTCPLINK; i++) {
+        usleep(10000);
+    }
+    ASSERT_NE(__atomic_load_n(&paused_link, __ATOMIC_SEQ_CST), INVALID_HTCPLINK);
+    status = tcp_write(cli, "\1hello", 6, NULL);
+    EXPECT_GE(status, 0);
+    // nothing can be received while the accepted link is paused
+    EXPECT_EQ(nis_cntl(paused_link, NI_REPORTRXDEPTH, 0), 1);
+    for (int i = 0; i < 30 && 0 == __atomic_load_n(&paused_received, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&paused_received, __ATOMIC_SEQ_CST), 0);
+    // resume it, data pending in kernel shall be delivered
+    EXPECT_GE(nis_cntl(paused_link, NI_RESUMERX), 0);
+    for (int i = 0; i < 100 && 0 == __atomic_load_n(&paused_received, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    EXPECT_GT(__atomic_load_n(&paused_received, __ATOMIC_SEQ_CST), 0);
+    // automatic mode pause the link when the reported depth reach high watermark
+    EXPECT_GE(nis_cntl(paused_link, NI_SETRXWATERMARK, 8, 2), 0);
+    EXPECT_EQ(nis_cntl(paused_link, NI_REPORTRXDEPTH, 8), 1);
+    EXPECT_EQ(nis_cntl(paused_link, NI_REPORTRXDEPTH, 4), 1);
+    EXPECT_EQ(nis_cntl(paused_link, NI_REPORTRXDEPTH, 2), 0);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+}
+
+static const int kBudgetPackets = 100;
+static const int kBudgetPacketSize = 0x1000;
+static HTCPLINK budget_links[2] = { INVALID_HTCPLINK, INVALID_HTCPLINK };
+static int budget_accepted = 0;
+static int budget_hold = 1;
+static int budget_sequence = 0;
+static int budget_received[2] = { 0, 0 };
+static int budget_order[8];
+
+static void STDCALL TestTcpBudgetCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        int index = __atomic_load_n(&budget_accepted, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&budget_links[index], tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&budget_accepted, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (event->Event == EVT_RECEIVEDATA) {
+        int index = (event->Ln.Tcp.Link == budget_links[0]) ? 0 : 1;
+        int sequence = __atomic_fetch_add(&budget_sequence, 1, __ATOMIC_SEQ_CST);
+        // hold the Rx thread in the first delivery until both links have a backlog in kernel
+        for (int i = 0; i < 500 && 0 == sequence && __atomic_load_n(&budget_hold, __ATOMIC_SEQ_CST); i++) {
+            usleep(10000);
+        }
+        if (sequence < 8) {
+            budget_order[sequence] = index;
+        }
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        __atomic_add_fetch(&budget_received[index], tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpRxBudget) {
+    // one Rx thread serve both links
+    tcp_init2(1);
+    HTCPLINK srv = tcp_create(TestTcpBudgetCallback, "127.0.0.1", 10245);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_EQ(nis_cntl(srv, NI_SETRXBUDGET, -1, 1), -EINVAL);
+    // accepted links inherit the budget of listener, one recv(2) each wakeup
+    EXPECT_GE(nis_cntl(srv, NI_SETRXBUDGET, kBudgetPacketSize, 1), 0);
+    int bytes, frames;
+    EXPECT_GE(nis_cntl(srv, NI_GETRXBUDGET, &bytes, &frames), 0);
+    EXPECT_EQ(bytes, kBudgetPacketSize);
+    EXPECT_EQ(frames, 1);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK clis[2];
+    for (int i = 0; i < 2; i++) {
+        clis[i] = tcp_create(TestTcpBudgetCallback, NULL, 0);
+        EXPECT_NE(clis[i], INVALID_HTCPLINK);
+        EXPECT_TRUE(NSP_SUCCESS(tcp_connect(clis[i], "127.0.0.1", 10245)));
+        EXPECT_GE(nis_cntl(clis[i], NI_SETATTR, nis_cntl(clis[i], NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    }
+    for (int i = 0; i < 100 && __atomic_load_n(&budget_accepted, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    ASSERT_EQ(__atomic_load_n(&budget_accepted, __ATOMIC_SEQ_CST), 2);
+    EXPECT_EQ(nis_cntl(budget_links[0], NI_GETRXTID), nis_cntl(budget_links[1], NI_GETRXTID));
+    static char packet[kBudgetPacketSize];
+    for (int i = 0; i < kBudgetPackets; i++) {
+        EXPECT_GE(tcp_write(clis[0], packet, sizeof(packet), NULL), 0);
+        EXPECT_GE(tcp_write(clis[1], packet, sizeof(packet), NULL), 0);
+    }
+    usleep(100000);
+    __atomic_store_n(&budget_hold, 0, __ATOMIC_SEQ_CST);
+    // links without @tst are plain stream, count the bytes
+    int total = kBudgetPackets * kBudgetPacketSize;
+    for (int i = 0; i < 500 && (__atomic_load_n(&budget_received[0], __ATOMIC_SEQ_CST) < total ||
+        __atomic_load_n(&budget_received[1], __ATOMIC_SEQ_CST) < total); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&budget_received[0], __ATOMIC_SEQ_CST), total);
+    EXPECT_EQ(__atomic_load_n(&budget_received[1], __ATOMIC_SEQ_CST), total);
+    // one recv(2) each wakeup, the links with backlog are served in turn rather than drained one by one
+    for (int i = 1; i < 6; i++) {
+        EXPECT_NE(budget_order[i], budget_order[i - 1]);
+    }
+    for (int i = 0; i < 2; i++) {
+        tcp_destroy(clis[i]);
+    }
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static int rate_received = 0;
+
+static void STDCALL TestTcpRateCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        __atomic_add_fetch(&rate_received, tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpDomainFlow, TestTcpTxRate) {
+    ifos_path_buffer_t file;
+    ifos_getpedir(&file);
+    char domain[300];
+    sprintf(domain, "ipc:%s/%s", file.u.cst, "nist_rate.sock");
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestTcpRateCallback, domain, 0);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    HTCPLINK cli = tcp_create(TestTcpRateCallback, "ipc:", 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    nsp_status_t status = tcp_listen(srv, 100);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    status = tcp_connect(cli, domain, 0);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    // domain socket has no kernel pacing, token bucket limit it to 4MB/s
+    EXPECT_GE(nis_cntl(cli, NI_SETTXRATE, 4 << 20, 0x11000), 0);
+    int rate, burst;
+    EXPECT_GE(nis_cntl(cli, NI_GETTXRATE, &rate, &burst), 0);
+    EXPECT_EQ(nis_cntl(cli, NI_GETTXRATE, &rate, NULL), -EINVAL);
+    EXPECT_EQ(rate, 4 << 20);
+    EXPECT_EQ(burst, 0x11000);
+    static char packet[0x4000];
+    uint64_t begin = clock_monotonic();
+    int total = 0;
+    while (total < (1 << 20)) {
+        status = tcp_write(cli, packet, sizeof(packet), NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            usleep(1000);
+            continue;
+        }
+        EXPECT_GE(status, 0);
+        total += sizeof(packet);
+    }
+    for (int i = 0; i < 500 && __atomic_load_n(&rate_received, __ATOMIC_SEQ_CST) < total; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&rate_received, __ATOMIC_SEQ_CST), total);
+    // about 1MB - 68KB at 4MB/s
+    EXPECT_GE((clock_monotonic() - begin) / 10000, 150);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+}
+
+static int cork_received = 0;
+
+static void STDCALL TestTcpCorkCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        __atomic_add_fetch(&cork_received, tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpCorkFlush) {
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestTcpCorkCallback, "127.0.0.1", 10224);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    HTCPLINK cli = tcp_create(TestTcpCorkCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    nsp_status_t status = tcp_listen(srv, 100);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    status = tcp_connect(cli, "127.0.0.1", 10224);
+    EXPECT_TRUE(NSP_SUCCESS(status));
+    // small packets with NIS_MORE are held by framework
+    for (int i = 0; i < 10; i++) {
+        status = tcp_write2(cli, "hello", 5, NULL, NIS_MORE);
+        EXPECT_GE(status, 0);
+    }
+    usleep(100000);
+    EXPECT_EQ(__atomic_load_n(&cork_received, __ATOMIC_SEQ_CST), 0);
+    // explicit flush send them all
+    EXPECT_GE(tcp_flush(cli), 0);
+    for (int i = 0; i < 100 && __atomic_load_n(&cork_received, __ATOMIC_SEQ_CST) < 50; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&cork_received, __ATOMIC_SEQ_CST), 50);
+    // write without NIS_MORE flush the previous corked packets together
+    EXPECT_GE(tcp_write2(cli, "hello", 5, NULL, NIS_MORE), 0);
+    EXPECT_GE(tcp_write(cli, "world", 5, NULL), 0);
+    for (int i = 0; i < 100 && __atomic_load_n(&cork_received, __ATOMIC_SEQ_CST) < 60; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&cork_received, __ATOMIC_SEQ_CST), 60);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+}
+
+static HTCPLINK cork_busy_link = INVALID_HTCPLINK;
+static int cork_busy_received = 0;
+
+static void STDCALL TestTcpCorkBusyCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        // hold the receive, so the Tx lane of client fill up
+        EXPECT_GE(nis_cntl(tcp_data->e.Accept.AcceptLink, NI_PAUSERX), 0);
+        __atomic_store_n(&cork_busy_link, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_RECEIVEDATA) {
+        __atomic_add_fetch(&cork_busy_received, tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpCorkBusy) {
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestTcpCorkBusyCallback, "127.0.0.1", 10244);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create(TestTcpCorkBusyCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10244)));
+    EXPECT_GE(nis_cntl(cli, NI_SETATTR, nis_cntl(cli, NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    for (int i = 0; i < 100 && __atomic_load_n(&cork_busy_link, __ATOMIC_SEQ_CST) == INVALID_HTCPLINK; i++) {
+        usleep(10000);
+    }
+    ASSERT_NE(__atomic_load_n(&cork_busy_link, __ATOMIC_SEQ_CST), INVALID_HTCPLINK);
+    static char packet[0x10000];
+    int total = 0;
+    nsp_status_t status;
+    while (NSP_SUCCESS(status = tcp_write(cli, packet, sizeof(packet), NULL))) {
+        total += sizeof(packet);
+    }
+    EXPECT_TRUE(NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY));
+    // the packet with NIS_MORE is corked, the flush of the next one fail and it is left to the caller
+    EXPECT_GE(tcp_write2(cli, "hello", 5, NULL, NIS_MORE), 0);
+    status = tcp_write(cli, "world", 5, NULL);
+    EXPECT_TRUE(NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY));
+    EXPECT_GE(nis_cntl(cork_busy_link, NI_RESUMERX), 0);
+    for (int i = 0; i < 5000 && NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY); i++) {
+        usleep(1000);
+        status = tcp_write(cli, "world", 5, NULL);
+    }
+    EXPECT_GE(status, 0);
+    total += 10;
+    for (int i = 0; i < 500 && __atomic_load_n(&cork_busy_received, __ATOMIC_SEQ_CST) < total; i++) {
+        usleep(10000);
+    }
+    // nothing are sent twice
+    usleep(100000);
+    EXPECT_EQ(__atomic_load_n(&cork_busy_received, __ATOMIC_SEQ_CST), total);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+}
+
+static nsp_status_t STDCALL TestShmParser(void *data, int cb, int *user_data_size) {
+    *user_data_size = *(const int *)data;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t STDCALL TestShmBuilder(void *data, int cb) {
+    *(int *)data = cb;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static const int kShmLargeSize = 6 << 20;
+static int shm_srv_received = 0;
+static int shm_srv_disorder = 0;
+static int shm_srv_large = 0;
+static int shm_cli_received = 0;
+
+static void STDCALL TestShmServerCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        if (tcp_data->e.Packet.Size == kShmLargeSize) {
+            // larger than both the ring and the receive buffer
+            int bad = 0;
+            for (int i = 0; i < kShmLargeSize; i += 4096) {
+                bad += (tcp_data->e.Packet.Data[i] != (unsigned char)(i >> 12));
+            }
+            __atomic_store_n(&shm_srv_large, bad ? -1 : 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+        int seq = *(const int *)tcp_data->e.Packet.Data;
+        if (seq != __atomic_load_n(&shm_srv_received, __ATOMIC_SEQ_CST)) {
+            __atomic_add_fetch(&shm_srv_disorder, 1, __ATOMIC_SEQ_CST);
+        }
+        __atomic_add_fetch(&shm_srv_received, 1, __ATOMIC_SEQ_CST);
+        EXPECT_GE(tcp_write(event->Ln.Tcp.Link, tcp_data->e.Packet.Data, tcp_data->e.Packet.Size, NULL), 0);
+    }
+}
+
+static void STDCALL TestShmClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        __atomic_add_fetch(&shm_cli_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpDomainFlow, TestTcpShmFlow) {
+    ifos_path_buffer_t file;
+    ifos_getpedir(&file);
+    char domain[300];
+    sprintf(domain, "shm:%s/%s", file.u.cst, "nist_shm.sock");
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create2(TestShmServerCallback, domain, 0, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    // the rings can not be read without callback
+    HTCPLINK sync = tcp_create(NULL, "shm:", 0);
+    EXPECT_NE(sync, INVALID_HTCPLINK);
+    EXPECT_FALSE(NSP_SUCCESS(tcp_connect(sync, domain, 0)));
+    tcp_destroy(sync);
+    HTCPLINK cli = tcp_create2(TestShmClientCallback, "shm:", 0, &tst);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, domain, 0)));
+    // packets keep their boundary and order, server echo every one of them
+    for (int i = 0; i < 1000; i++) {
+        nsp_status_t status = tcp_write(cli, &i, sizeof(i), NULL);
+        if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            usleep(1000);
+            i--;
+            continue;
+        }
+        EXPECT_GE(status, 0);
+    }
+    for (int i = 0; i < 300 && __atomic_load_n(&shm_cli_received, __ATOMIC_SEQ_CST) < 1000; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&shm_srv_received, __ATOMIC_SEQ_CST), 1000);
+    EXPECT_EQ(__atomic_load_n(&shm_srv_disorder, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(__atomic_load_n(&shm_cli_received, __ATOMIC_SEQ_CST), 1000);
+    // a packet larger than the ring are written in pieces as the reader release space
+    unsigned char *large = (unsigned char *)malloc(kShmLargeSize);
+    for (int i = 0; i < kShmLargeSize; i++) {
+        large[i] = (unsigned char)(i >> 12);
+    }
+    EXPECT_GE(tcp_write(cli, large, kShmLargeSize, NULL), 0);
+    free(large);
+    for (int i = 0; i < 300 && 0 == __atomic_load_n(&shm_srv_large, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&shm_srv_large, __ATOMIC_SEQ_CST), 1);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+}
+
+static const int kSendfileSize = 12 << 20;
+static int sendfile_received = 0;
+static int sendfile_bad = 0;
+static int sendfile_completed = 0;
+static int64_t sendfile_sent = 0;
+
+static void STDCALL TestSendfileServerCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        // header follow by the file from offset 100 to the end
+        int bad = (tcp_data->e.Packet.Size != 4 + kSendfileSize - 100);
+        bad += (0 != memcmp(tcp_data->e.Packet.Data, "FILE", 4));
+        for (int i = 100; !bad && i < kSendfileSize; i += 4093) {
+            bad += (tcp_data->e.Packet.Data[4 + i - 100] != (unsigned char)(i % 251));
+        }
+        __atomic_add_fetch(&sendfile_bad, bad, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&sendfile_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void STDCALL TestSendfileClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_SENDFILE) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        EXPECT_EQ(tcp_data->e.SendFile.Status, 0);
+        EXPECT_EQ(tcp_data->e.SendFile.Offset, 100);
+        __atomic_store_n(&sendfile_sent, tcp_data->e.SendFile.Sent, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&sendfile_completed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpSendfile) {
+    ifos_path_buffer_t dir;
+    ifos_getpedir(&dir);
+    char path[300];
+    sprintf(path, "%s/%s", dir.u.cst, "nist_sendfile.dat");
+    unsigned char *content = (unsigned char *)malloc(kSendfileSize);
+    for (int i = 0; i < kSendfileSize; i++) {
+        content[i] = (unsigned char)(i % 251);
+    }
+    FILE *fp = fopen(path, "wb");
+    ASSERT_TRUE(fp != NULL);
+    EXPECT_EQ(fwrite(content, 1, kSendfileSize, fp), (size_t)kSendfileSize);
+    fclose(fp);
+    free(content);
+
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create2(TestSendfileServerCallback, "127.0.0.1", 10225, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create2(TestSendfileClientCallback, NULL, 0, &tst);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10225)));
+    int fd = open(path, O_RDONLY);
+    ASSERT_GE(fd, 0);
+    EXPECT_FALSE(NSP_SUCCESS(tcp_sendfile(cli, fd, -1, 0, NULL, 0)));
+    EXPECT_FALSE(NSP_SUCCESS(tcp_sendfile(cli, fd, 0, 0, NULL, 4)));
+    // zero length means to the end of file, @fd can close immediately
+    EXPECT_GE(tcp_sendfile(cli, fd, 100, 0, "FILE", 4), 0);
+    close(fd);
+    for (int i = 0; i < 500 && __atomic_load_n(&sendfile_received, __ATOMIC_SEQ_CST) < 1; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&sendfile_received, __ATOMIC_SEQ_CST), 1);
+    EXPECT_EQ(__atomic_load_n(&sendfile_bad, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(__atomic_load_n(&sendfile_completed, __ATOMIC_SEQ_CST), 1);
+    EXPECT_EQ(__atomic_load_n(&sendfile_sent, __ATOMIC_SEQ_CST), kSendfileSize - 100);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    tcp_uninit();
+    unlink(path);
+}
+
+static const int kBroadcastLinks = 8;
+static const int kBroadcastLargeSize = 2 << 20;
+static HTCPLINK broadcast_accepted[kBroadcastLinks];
+static int broadcast_naccepted = 0;
+static int broadcast_received = 0;
+static int broadcast_bad = 0;
+
+static void STDCALL TestBroadcastServerCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        int i = __atomic_fetch_add(&broadcast_naccepted, 1, __ATOMIC_SEQ_CST);
+        if (i < kBroadcastLinks) {
+            broadcast_accepted[i] = tcp_data->e.Accept.AcceptLink;
+        }
+    }
+}
+
+static void STDCALL TestBroadcastClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        int bad = 0;
+        if (tcp_data->e.Packet.Size == kBroadcastLargeSize) {
+            for (int i = 0; i < kBroadcastLargeSize; i += 4093) {
+                bad += (tcp_data->e.Packet.Data[i] != (unsigned char)(i % 253));
+            }
+        } else {
+            bad += (tcp_data->e.Packet.Size != 12 || 0 != memcmp(tcp_data->e.Packet.Data, "notification", 12));
+        }
+        __atomic_add_fetch(&broadcast_bad, bad, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&broadcast_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpBroadcast) {
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create2(TestBroadcastServerCallback, "127.0.0.1", 10226, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK clients[kBroadcastLinks];
+    for (int i = 0; i < kBroadcastLinks; i++) {
+        clients[i] = tcp_create2(TestBroadcastClientCallback, NULL, 0, &tst);
+        EXPECT_NE(clients[i], INVALID_HTCPLINK);
+        EXPECT_TRUE(NSP_SUCCESS(tcp_connect(clients[i], "127.0.0.1", 10226)));
+    }
+    for (int i = 0; i < 100 && __atomic_load_n(&broadcast_naccepted, __ATOMIC_SEQ_CST) < kBroadcastLinks; i++) {
+        usleep(10000);
+    }
+    ASSERT_EQ(__atomic_load_n(&broadcast_naccepted, __ATOMIC_SEQ_CST), kBroadcastLinks);
+
+    EXPECT_TRUE(NULL == nis_buffer_create("notification", 0, NULL, &tst));
+    nis_buffer_t *small = nis_buffer_create("notification", 12, NULL, &tst);
+    ASSERT_TRUE(small != NULL);
+    EXPECT_GE(tcp_write_buffer(broadcast_accepted[0], small), 0);
+    // invalid link in the list never interrupt the others
+    HTCPLINK links[kBroadcastLinks + 1];
+    memcpy(links, broadcast_accepted, sizeof(broadcast_accepted));
+    links[kBroadcastLinks] = INVALID_HTCPLINK;
+    EXPECT_EQ(tcp_broadcast(links + 1, kBroadcastLinks, small), kBroadcastLinks - 1);
+    nis_buffer_release(small);
+
+    // the large buffer is still referenced by the queued requests after release
+    unsigned char *content = (unsigned char *)malloc(kBroadcastLargeSize);
+    for (int i = 0; i < kBroadcastLargeSize; i++) {
+        content[i] = (unsigned char)(i % 253);
+    }
+    nis_buffer_t *large = nis_buffer_create(content, kBroadcastLargeSize, NULL, &tst);
+    free(content);
+    ASSERT_TRUE(large != NULL);
+    EXPECT_EQ(tcp_broadcast(links, kBroadcastLinks, large), kBroadcastLinks);
+    nis_buffer_release(large);
+
+    for (int i = 0; i < 500 && __atomic_load_n(&broadcast_received, __ATOMIC_SEQ_CST) < 2 * kBroadcastLinks; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&broadcast_received, __ATOMIC_SEQ_CST), 2 * kBroadcastLinks);
+    EXPECT_EQ(__atomic_load_n(&broadcast_bad, __ATOMIC_SEQ_CST), 0);
+    for (int i = 0; i < kBroadcastLinks; i++) {
+        tcp_destroy(clients[i]);
+    }
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static const int kLaneBulkCount = 40;
+static const int kLaneBulkSize = 1 << 20;
+static HTCPLINK lane_link = INVALID_HTCPLINK;
+static int lane_received = 0;
+static int lane_urgent_index = -1;
+static int lane_disorder = 0;
+static int lane_closed = 0;
+
+static void STDCALL TestLaneServerCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        // hold the receive, so the bulk data pile up in the Tx fifo of client
+        lane_link = tcp_data->e.Accept.AcceptLink;
+        EXPECT_GE(nis_cntl(lane_link, NI_PAUSERX), 0);
+    }
+
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        int index = __atomic_fetch_add(&lane_received, 1, __ATOMIC_SEQ_CST);
+        if (tcp_data->e.Packet.Size == 6) {
+            EXPECT_EQ(0, memcmp(tcp_data->e.Packet.Data, "cancel", 6));
+            lane_urgent_index = index;
+            return;
+        }
+        // bulk packets keep their order and never interleave with the urgent one
+        int seq = *(const int *)tcp_data->e.Packet.Data;
+        int expect = (lane_urgent_index >= 0) ? index - 1 : index;
+        if (tcp_data->e.Packet.Size != kLaneBulkSize || seq != expect ||
+            tcp_data->e.Packet.Data[kLaneBulkSize - 1] != (unsigned char)seq) {
+            __atomic_add_fetch(&lane_disorder, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&lane_closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void STDCALL TestLaneClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&lane_closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestTcpUrgentLane) {
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create2(TestLaneServerCallback, "127.0.0.1", 10227, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    // only link with callback can be nonblocking
+    HTCPLINK cli = tcp_create2(TestLaneClientCallback, NULL, 0, &tst);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10227)));
+    EXPECT_GE(nis_cntl(cli, NI_SETATTR, nis_cntl(cli, NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    unsigned char *bulk = (unsigned char *)malloc(kLaneBulkSize);
+    for (int i = 0; i < kLaneBulkCount; i++) {
+        *(int *)bulk = i;
+        bulk[kLaneBulkSize - 1] = (unsigned char)i;
+        EXPECT_GE(tcp_write(cli, bulk, kLaneBulkSize, NULL), 0);
+    }
+    free(bulk);
+    // the urgent packet overtake the bulk data still pending in Tx fifo
+    EXPECT_GE(tcp_write2(cli, "cancel", 6, NULL, NIS_URGENT), 0);
+    for (int i = 0; i < 100 && INVALID_HTCPLINK == lane_link; i++) {
+        usleep(10000);
+    }
+    EXPECT_GE(nis_cntl(lane_link, NI_RESUMERX), 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&lane_received, __ATOMIC_SEQ_CST) < kLaneBulkCount + 1; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&lane_received, __ATOMIC_SEQ_CST), kLaneBulkCount + 1);
+    EXPECT_EQ(__atomic_load_n(&lane_disorder, __ATOMIC_SEQ_CST), 0);
+    EXPECT_GE(lane_urgent_index, 0);
+    EXPECT_LT(lane_urgent_index, kLaneBulkCount / 2);
+    tcp_destroy(srv);
+    tcp_destroy(cli);
+    // Rx buffers of the client and the accepted link go back to pool before their close events,
+    // the statistics case count on it
+    for (int i = 0; i < 500 && __atomic_load_n(&lane_closed, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    tcp_uninit();
+}
+
+static int gso_received = 0;
+static int gso_datagrams = 0;
+static int gso_bad_segment = 0;
+
+static void STDCALL TestUdpGsoCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const udp_data_t *udp = (const udp_data_t *)data;
+        // every datagram carry 1000 bytes except the last one
+        if (udp->e.Packet.Segment != 1000 && udp->e.Packet.Segment != udp->e.Packet.Size) {
+            __atomic_add_fetch(&gso_bad_segment, 1, __ATOMIC_SEQ_CST);
+        }
+        __atomic_add_fetch(&gso_datagrams, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&gso_received, udp->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestUdpFlow, TestUdpGsoGro) {
+    udp_init2(0);
+    HUDPLINK srv = udp_create(TestUdpGsoCallback, "127.0.0.1", 10225, UDP_FLAG_NONE);
+    EXPECT_NE(srv, INVALID_HUDPLINK);
+    HUDPLINK cli = udp_create(NULL, NULL, 0, UDP_FLAG_NONE);
+    EXPECT_NE(cli, INVALID_HUDPLINK);
+    static unsigned char train[10500];
+    memset(train, 'g', sizeof(train));
+    // oversize segment or too many segments are refused
+    EXPECT_FALSE(NSP_SUCCESS(udp_write_gso(cli, train, sizeof(train), MAX_UDP_UNIT + 1, "127.0.0.1", 10225, NULL)));
+    EXPECT_FALSE(NSP_SUCCESS(udp_write_gso(cli, train, sizeof(train), 100, "127.0.0.1", 10225, NULL)));
+    // without GRO, receiver see 11 ordinary datagrams
+    EXPECT_GE(udp_write_gso(cli, train, sizeof(train), 1000, "127.0.0.1", 10225, NULL), 0);
+    for (int i = 0; i < 100 && __atomic_load_n(&gso_received, __ATOMIC_SEQ_CST) < (int)sizeof(train); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&gso_received, __ATOMIC_SEQ_CST), (int)sizeof(train));
+    EXPECT_EQ(__atomic_load_n(&gso_datagrams, __ATOMIC_SEQ_CST), 11);
+    // with GRO, the datagrams may be coalesced but the bytes and segment size keep
+    __atomic_store_n(&gso_received, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&gso_datagrams, 0, __ATOMIC_SEQ_CST);
+    if (NSP_SUCCESS(nis_cntl(srv, NI_SETUDPGRO, 1))) {
+        EXPECT_EQ(nis_cntl(srv, NI_GETUDPGRO), 1);
+        EXPECT_GE(udp_write_gso(cli, train, sizeof(train), 1000, "127.0.0.1", 10225, NULL), 0);
+        for (int i = 0; i < 100 && __atomic_load_n(&gso_received, __ATOMIC_SEQ_CST) < (int)sizeof(train); i++) {
+            usleep(10000);
+        }
+        EXPECT_EQ(__atomic_load_n(&gso_received, __ATOMIC_SEQ_CST), (int)sizeof(train));
+        EXPECT_LE(__atomic_load_n(&gso_datagrams, __ATOMIC_SEQ_CST), 11);
+    }
+    EXPECT_EQ(__atomic_load_n(&gso_bad_segment, __ATOMIC_SEQ_CST), 0);
+    udp_destroy(srv);
+    udp_destroy(cli);
+    udp_uninit();
+}
+
+static uint32_t binary_ipv4 = 0;
+static int binary_port = 0;
+static int binary_strlen = -1;
+
+static void STDCALL TestUdpBinaryCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        const udp_data_t *udp = (const udp_data_t *)data;
+        EXPECT_TRUE(udp_not_domain_received(&udp->e.Packet));
+        binary_strlen = (int)strlen(udp->e.Packet.RemoteAddress);
+        binary_port = udp->e.Packet.RemotePort;
+        __atomic_store_n(&binary_ipv4, udp->e.Packet.RemoteIpv4, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestUdpFlow, TestUdpBinaryAddress) {
+    udp_init2(0);
+    HUDPLINK srv = udp_create(TestUdpBinaryCallback, "127.0.0.1", 10226, UDP_FLAG_NONE);
+    EXPECT_NE(srv, INVALID_HUDPLINK);
+    // sender are delivered in binary only
+    int attr = nis_cntl(srv, NI_GETATTR);
+    EXPECT_GE(attr, 0);
+    nis_cntl(srv, NI_SETATTR, attr | LINKATTR_UDP_BINARY_ADDRESS);
+    HUDPLINK cli = udp_create(NULL, "127.0.0.1", 0, UDP_FLAG_NONE);
+    EXPECT_NE(cli, INVALID_HUDPLINK);
+    uint32_t cli_ipv4;
+    uint16_t cli_port;
+    EXPECT_TRUE(NSP_SUCCESS(udp_getaddr(cli, &cli_ipv4, &cli_port)));
+    EXPECT_GE(udp_write(cli, "binary", 6, "127.0.0.1", 10226, NULL), 0);
+    for (int i = 0; i < 100 && 0 == __atomic_load_n(&binary_ipv4, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&binary_ipv4, __ATOMIC_SEQ_CST), 0x7F000001u);
+    EXPECT_EQ(binary_port, cli_port);
+    EXPECT_EQ(binary_strlen, 0);
+    udp_destroy(srv);
+    udp_destroy(cli);
+    udp_uninit();
+}
+
+static HUDPLINK reuseport_link = INVALID_HUDPLINK;
+static int reuseport_received = 0;
+static int reuseport_foreign = 0;
+static pid_t reuseport_tids[8];
+static int reuseport_ntids = 0;
+
+static void STDCALL TestUdpReuseportCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        if (event->Ln.Udp.Link != reuseport_link) {
+            __atomic_add_fetch(&reuseport_foreign, 1, __ATOMIC_SEQ_CST);
+        }
+        pid_t tid = ifos_gettid();
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        pthread_mutex_lock(&lock);
+        int i;
+        for (i = 0; i < reuseport_ntids && reuseport_tids[i] != tid; i++);
+        if (i == reuseport_ntids && reuseport_ntids < 8) {
+            reuseport_tids[reuseport_ntids++] = tid;
+        }
+        pthread_mutex_unlock(&lock);
+        __atomic_add_fetch(&reuseport_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestUdpFlow, TestUdpReuseport) {
+    // nonzero when the UDP framework is already running with the thread count of a earlier case
+    nsp_status_t fresh = udp_init2(4);
+    reuseport_link = udp_create(TestUdpReuseportCallback, "127.0.0.1", 10227, UDP_FLAG_REUSEPORT);
+    EXPECT_NE(reuseport_link, INVALID_HUDPLINK);
+    EXPECT_TRUE(nis_cntl(reuseport_link, NI_GETATTR) & LINKATTR_UDP_REUSEPORT);
+    // flows from 16 senders are spread over the sockets served by different threads
+    HUDPLINK clis[16];
+    for (int i = 0; i < 16; i++) {
+        clis[i] = udp_create(NULL, NULL, 0, UDP_FLAG_NONE);
+        EXPECT_NE(clis[i], INVALID_HUDPLINK);
+        for (int j = 0; j < 10; j++) {
+            EXPECT_GE(udp_write(clis[i], "reuse", 5, "127.0.0.1", 10227, NULL), 0);
+        }
+    }
+    for (int i = 0; i < 100 && __atomic_load_n(&reuseport_received, __ATOMIC_SEQ_CST) < 160; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&reuseport_received, __ATOMIC_SEQ_CST), 160);
+    EXPECT_EQ(__atomic_load_n(&reuseport_foreign, __ATOMIC_SEQ_CST), 0);
+    if (0 == fresh) {
+        EXPECT_GT(reuseport_ntids, 1);
+    }
+    // steering by CPU keep every datagram delivered
+    if (NSP_SUCCESS(nis_cntl(reuseport_link, NI_SETUDPSTEER, UDP_STEER_CPU))) {
+        for (int i = 0; i < 16; i++) {
+            EXPECT_GE(udp_write(clis[i], "steer", 5, "127.0.0.1", 10227, NULL), 0);
+        }
+        for (int i = 0; i < 100 && __atomic_load_n(&reuseport_received, __ATOMIC_SEQ_CST) < 176; i++) {
+            usleep(10000);
+        }
+        EXPECT_EQ(__atomic_load_n(&reuseport_received, __ATOMIC_SEQ_CST), 176);
+        EXPECT_TRUE(NSP_SUCCESS(nis_cntl(reuseport_link, NI_SETUDPSTEER, UDP_STEER_HASH)));
+    }
+    for (int i = 0; i < 16; i++) {
+        udp_destroy(clis[i]);
+    }
+    udp_destroy(reuseport_link);
+    udp_uninit();
+}
+
+static const int kPoolLargeSize = 3 << 20;
+static HTCPLINK pool_accepted = INVALID_HTCPLINK;
+static int pool_received = 0;
+static int pool_released = 0;
+
+static void STDCALL TestPoolServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        __atomic_store_n(&pool_accepted, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_RECEIVEDATA) {
+        EXPECT_EQ(tcp_data->e.Packet.Size, kPoolLargeSize);
+        if (tcp_data->e.Packet.Size == kPoolLargeSize) {
+            EXPECT_EQ(tcp_data->e.Packet.Data[kPoolLargeSize - 1], 0x5A);
+        }
+        __atomic_add_fetch(&pool_received, 1, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&pool_released, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestBufferPoolStatistics) {
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    nis_statistics_t before, during, after;
+    EXPECT_FALSE(NSP_SUCCESS(nis_getstat(NULL)));
+    tcp_init2(0);
+    EXPECT_TRUE(NSP_SUCCESS(nis_getstat(&before)));
+    HTCPLINK srv = tcp_create2(TestPoolServerCallback, "127.0.0.1", 10228, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create2(TestPoolServerCallback, NULL, 0, &tst);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10228)));
+    for (int i = 0; i < 100 && __atomic_load_n(&pool_accepted, __ATOMIC_SEQ_CST) == INVALID_HTCPLINK; i++) {
+        usleep(10000);
+    }
+    ASSERT_NE(__atomic_load_n(&pool_accepted, __ATOMIC_SEQ_CST), INVALID_HTCPLINK);
+
+    // the large-block of receiver larger than the biggest class of pool, it's served by heap
+    unsigned char *content = (unsigned char *)malloc(kPoolLargeSize);
+    memset(content, 0x5A, kPoolLargeSize);
+    EXPECT_GE(tcp_write(cli, content, kPoolLargeSize, NULL), 0);
+    free(content);
+    for (int i = 0; i < 500 && __atomic_load_n(&pool_received, __ATOMIC_SEQ_CST) < 1; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&pool_received, __ATOMIC_SEQ_CST), 1);
+
+    // Rx buffers of both side come from regions of pool
+    EXPECT_TRUE(NSP_SUCCESS(nis_getstat(&during)));
+    EXPECT_GE(during.Pool.Inuse, before.Pool.Inuse + 4 * 0x11000);
+    EXPECT_GE(during.Pool.Mapped, during.Pool.Inuse + during.Pool.Cached);
+    EXPECT_GT(during.Pool.Regions, 0);
+    EXPECT_LE(during.Pool.HugeTlb + during.Pool.Advised, during.Pool.Mapped);
+
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    for (int i = 0; i < 500 && __atomic_load_n(&pool_released, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    tcp_uninit();
+
+    // buffers go back to free list of pool, regions are kept
+    EXPECT_TRUE(NSP_SUCCESS(nis_getstat(&after)));
+    EXPECT_LE(after.Pool.Inuse, during.Pool.Inuse - 4 * 0x11000);
+    EXPECT_GE(after.Pool.Cached, during.Pool.Cached + 4 * 0x11000);
+    EXPECT_EQ(after.Pool.Mapped, during.Pool.Mapped);
+}
+
+static HTCPLINK accept_link = INVALID_HTCPLINK;
+static int accept_greeting = 0;
+
+static void STDCALL TestAcceptServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        // the accepted link are ready to write before it attached to epoll
+        EXPECT_GE(tcp_write(tcp_data->e.Accept.AcceptLink, "welcome", 7, NULL), 0);
+        __atomic_store_n(&accept_link, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void STDCALL TestAcceptClientCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_RECEIVEDATA) {
+        if (tcp_data->e.Packet.Size == 7 && 0 == memcmp(tcp_data->e.Packet.Data, "welcome", 7)) {
+            __atomic_add_fetch(&accept_greeting, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+TEST(DoTestTcpFlow, TestAcceptInheritance) {
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestAcceptServerCallback, "0.0.0.0", 10229);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create(TestAcceptClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10229)));
+    EXPECT_GE(nis_cntl(cli, NI_SETATTR, nis_cntl(cli, NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    for (int i = 0; i < 100 && __atomic_load_n(&accept_greeting, __ATOMIC_SEQ_CST) < 1; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&accept_greeting, __ATOMIC_SEQ_CST), 1);
+    HTCPLINK link = __atomic_load_n(&accept_link, __ATOMIC_SEQ_CST);
+    ASSERT_NE(link, INVALID_HTCPLINK);
+
+    // options set on listener are inherited by the accepted socket
+    int val = 0, len = sizeof(val);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_getopt(link, SOL_SOCKET, SO_KEEPALIVE, (char *)&val, &len)));
+    EXPECT_NE(val, 0);
+    val = 0;
+    len = sizeof(val);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_getopt(link, IPPROTO_TCP, TCP_NODELAY, (char *)&val, &len)));
+    EXPECT_NE(val, 0);
+
+    // the addresses come from accept4(2), the local one resolved on demand for the wildcard listener
+    uint32_t ip = 0, cliip = 0;
+    uint16_t port = 0, cliport = 0;
+    EXPECT_TRUE(NSP_SUCCESS(tcp_getaddr(link, LINK_ADDR_LOCAL, &ip, &port)));
+    EXPECT_EQ(ip, 0x7F000001U);
+    EXPECT_EQ(port, 10229);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_getaddr(cli, LINK_ADDR_LOCAL, &cliip, &cliport)));
+    EXPECT_TRUE(NSP_SUCCESS(tcp_getaddr(link, LINK_ADDR_REMOTE, &ip, &port)));
+    EXPECT_EQ(ip, cliip);
+    EXPECT_EQ(port, cliport);
+
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static int resize_echo_bytes = 0;
+static int resize_awaken = 0;
+
+static void STDCALL TestResizeServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_RECEIVEDATA) {
+        EXPECT_GE(tcp_write(event->Ln.Tcp.Link, tcp_data->e.Packet.Data, tcp_data->e.Packet.Size, NULL), 0);
+    }
+}
+
+static void STDCALL TestResizeClientCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_RECEIVEDATA) {
+        __atomic_add_fetch(&resize_echo_bytes, tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_PIPEDATA) {
+        __atomic_add_fetch(&resize_awaken, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static int TestResizeDistinctThreads(const HTCPLINK *links, int count) {
+    int tids[16], distinct = 0;
+    for (int i = 0; i < count; i++) {
+        int tid = nis_cntl(links[i], NI_GETRXTID);
+        int j = 0;
+        while (j < distinct && tids[j] != tid) {
+            j++;
+        }
+        if (j == distinct) {
+            tids[distinct++] = tid;
+        }
+    }
+    return distinct;
+}
+
+// the pipes of epoll threads migrate with links, pipe message still arrive
+static void TestResizeEcho(const HTCPLINK *links, int count) {
+    __atomic_store_n(&resize_echo_bytes, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&resize_awaken, 0, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < count; i++) {
+        EXPECT_GE(tcp_write(links[i], "ping", 4, NULL), 0);
+        EXPECT_TRUE(NSP_SUCCESS(tcp_awaken(links[i], "wake", 4)));
+    }
+    for (int i = 0; i < 200 && (__atomic_load_n(&resize_echo_bytes, __ATOMIC_SEQ_CST) < count * 4 ||
+            __atomic_load_n(&resize_awaken, __ATOMIC_SEQ_CST) < count); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&resize_echo_bytes, __ATOMIC_SEQ_CST), count * 4);
+    EXPECT_EQ(__atomic_load_n(&resize_awaken, __ATOMIC_SEQ_CST), count);
+}
+
+TEST(DoTestTcpFlow, TestEpollResize) {
+    const int kLinks = 8;
+    HTCPLINK clients[kLinks];
+    tcp_init2(0);
+    int origin = tcp_getnprocs();
+    EXPECT_GT(origin, 0);
+    EXPECT_EQ(tcp_resize(-1), -EINVAL);
+    EXPECT_EQ(tcp_resize(257), -EINVAL);
+
+    HTCPLINK srv = tcp_create(TestResizeServerCallback, "127.0.0.1", 10230);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    for (int i = 0; i < kLinks; i++) {
+        clients[i] = tcp_create(TestResizeClientCallback, NULL, 0);
+        EXPECT_NE(clients[i], INVALID_HTCPLINK);
+        EXPECT_TRUE(NSP_SUCCESS(tcp_connect(clients[i], "127.0.0.1", 10230)));
+        EXPECT_GE(nis_cntl(clients[i], NI_SETATTR, nis_cntl(clients[i], NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    }
+
+    // grow, the existing links are spread over the new threads by their own Rx thread,
+    // handles of clients interleave with the accepted links, so they take a half of threads at least
+    EXPECT_TRUE(NSP_SUCCESS(tcp_resize(4)));
+    EXPECT_EQ(tcp_getnprocs(), 4);
+    int distinct = 0;
+    for (int i = 0; i < 100 && (distinct = TestResizeDistinctThreads(clients, kLinks)) < 2; i++) {
+        usleep(10000);
+    }
+    EXPECT_GE(distinct, 2);
+    TestResizeEcho(clients, kLinks);
+
+    // shrink, links on the retired threads are migrated before return
+    EXPECT_TRUE(NSP_SUCCESS(tcp_resize(1)));
+    EXPECT_EQ(tcp_getnprocs(), 1);
+    EXPECT_EQ(TestResizeDistinctThreads(clients, kLinks), 1);
+    TestResizeEcho(clients, kLinks);
+
+    // grow again, the blocks of retired threads are reused
+    EXPECT_TRUE(NSP_SUCCESS(tcp_resize(2)));
+    EXPECT_EQ(tcp_getnprocs(), 2);
+    TestResizeEcho(clients, kLinks);
+
+    for (int i = 0; i < kLinks; i++) {
+        tcp_destroy(clients[i]);
+    }
+    tcp_destroy(srv);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_resize(origin)));
+    tcp_uninit();
+}
+
+static const int kContendedWriters = 8;
+static const int kContendedCount = 1000;
+static const int kContendedSize = 3000;
+static HTCPLINK contended_link = INVALID_HTCPLINK;
+static HTCPLINK contended_client = INVALID_HTCPLINK;
+static int contended_received = 0;
+static int contended_disorder = 0;
+static int contended_next[kContendedWriters];
+
+static void STDCALL TestContendedServerCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        // hold the receive, so the writers meet each other in Tx fifo of client
+        contended_link = tcp_data->e.Accept.AcceptLink;
+        EXPECT_GE(nis_cntl(contended_link, NI_PAUSERX), 0);
+    }
+
+    if (event->Event == EVT_RECEIVEDATA) {
+        const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+        // packets of each writer keep their order and never interleave with the others
+        int writer = ((const int *)tcp_data->e.Packet.Data)[0];
+        int seq = ((const int *)tcp_data->e.Packet.Data)[1];
+        if (tcp_data->e.Packet.Size != kContendedSize || writer < 0 || writer >= kContendedWriters ||
+            seq != contended_next[writer] || tcp_data->e.Packet.Data[kContendedSize - 1] != (unsigned char)(writer + seq)) {
+            __atomic_add_fetch(&contended_disorder, 1, __ATOMIC_SEQ_CST);
+        } else {
+            contended_next[writer]++;
+        }
+        __atomic_add_fetch(&contended_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void STDCALL TestContendedClientCallback(const struct nis_event *event, const void *data) {
+}
+
+static void *TestContendedWriterProc(void *p) {
+    unsigned char packet[kContendedSize];
+    int writer = (int)(intptr_t)p;
+    memset(packet, 0, sizeof(packet));
+    ((int *)packet)[0] = writer;
+    for (int seq = 0; seq < kContendedCount; ) {
+        ((int *)packet)[1] = seq;
+        packet[kContendedSize - 1] = (unsigned char)(writer + seq);
+        nsp_status_t status = tcp_write(contended_client, packet, sizeof(packet), NULL);
+        if (NSP_SUCCESS(status)) {
+            seq++;
+        } else if (NSP_FAILED_AND_ERROR_EQUAL(status, EBUSY)) {
+            usleep(1000);
+        } else {
+            ADD_FAILURE() << "tcp_write failed " << status;
+            break;
+        }
+    }
+    return NULL;
+}
+
+TEST(DoTestTcpFlow, TestContendedWriters) {
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    lwp_t writers[kContendedWriters];
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create2(TestContendedServerCallback, "127.0.0.1", 10231, &tst);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    contended_client = tcp_create2(TestContendedClientCallback, NULL, 0, &tst);
+    EXPECT_NE(contended_client, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(contended_client, "127.0.0.1", 10231)));
+    EXPECT_GE(nis_cntl(contended_client, NI_SETATTR, nis_cntl(contended_client, NI_GETATTR) | LINKATTR_NONBLOCK), 0);
+    for (int i = 0; i < 100 && INVALID_HTCPLINK == contended_link; i++) {
+        usleep(10000);
+    }
+    for (int i = 0; i < kContendedWriters; i++) {
+        EXPECT_GE(lwp_create(&writers[i], 0, &TestContendedWriterProc, (void *)(intptr_t)i), 0);
+    }
+    // the kernel buffers are full while the receiver paused, the normal lane fill up to it's limit
+    int count = 0;
+    int64_t bytes = 0;
+    for (int i = 0; i < 200 && count < 100; i++) {
+        usleep(10000);
+        EXPECT_GE(nis_cntl(contended_client, NI_GETTXQUEUE, &count, &bytes), 0);
+    }
+    EXPECT_EQ(count, 100);
+    EXPECT_EQ(bytes, (int64_t)count * (kContendedSize + sizeof(int)));
+    EXPECT_GE(nis_cntl(contended_link, NI_RESUMERX), 0);
+    for (int i = 0; i < kContendedWriters; i++) {
+        lwp_join(&writers[i], NULL);
+    }
+    for (int i = 0; i < 1000 && __atomic_load_n(&contended_received, __ATOMIC_SEQ_CST) < kContendedWriters * kContendedCount; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&contended_received, __ATOMIC_SEQ_CST), kContendedWriters * kContendedCount);
+    EXPECT_EQ(__atomic_load_n(&contended_disorder, __ATOMIC_SEQ_CST), 0);
+    EXPECT_GE(nis_cntl(contended_client, NI_GETTXQUEUE, &count, &bytes), 0);
+    EXPECT_EQ(count, 0);
+    EXPECT_EQ(bytes, 0);
+    tcp_destroy(contended_client);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static const int kFrameLargeSize = 200000;
+static int frame_received = 0;
+static int frame_malformed = 0;
+static int64_t frame_bytes = 0;
+static HTCPLINK frame_accepted = INVALID_HTCPLINK;
+
+// every frame of this case filled with the low byte of (size - 1)
+static void STDCALL TestFrameServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        __atomic_store_n(&frame_accepted, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_RECEIVEDATA) {
+        for (int i = 0; i < tcp_data->e.Packet.Size; i++) {
+            if (tcp_data->e.Packet.Data[i] != (unsigned char)(tcp_data->e.Packet.Size - 1)) {
+                __atomic_add_fetch(&frame_malformed, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+        }
+        __atomic_add_fetch(&frame_bytes, tcp_data->e.Packet.Size, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&frame_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestBuiltinFrame) {
+    nis_frame_template_t frame = { 6, 2, 4, NIS_FRAME_BIG_ENDIAN | NIS_FRAME_INCLUSIVE };
+    nis_frame_template_t bad, current;
+    tcp_init2(0);
+    HTCPLINK srv = tcp_create(TestFrameServerCallback, "127.0.0.1", 10232);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+
+    // the length field must lay inside the head
+    bad = frame; bad.width = 3;
+    EXPECT_EQ(nis_cntl(srv, NI_SETFRAME, &bad), -EINVAL);
+    bad = frame; bad.offset = 4;
+    EXPECT_EQ(nis_cntl(srv, NI_SETFRAME, &bad), -EINVAL);
+    bad = frame; bad.cb_ = 33;
+    EXPECT_EQ(nis_cntl(srv, NI_SETFRAME, &bad), -EINVAL);
+    bad = frame; bad.flags = 4;
+    EXPECT_EQ(nis_cntl(srv, NI_SETFRAME, &bad), -EINVAL);
+    EXPECT_EQ(nis_cntl(srv, NI_GETFRAME, &current), -ENOENT);
+
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    HTCPLINK cli = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    memset(&current, 0, sizeof(current));
+    EXPECT_GE(nis_cntl(cli, NI_GETFRAME, &current), 0);
+    EXPECT_EQ(0, memcmp(&current, &frame, sizeof(frame)));
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10232)));
+
+    // small frames are parsed in place several at a time, the large one go through large-block
+    unsigned char *content = (unsigned char *)malloc(kFrameLargeSize);
+    int64_t expect_bytes = 0;
+    for (int size = 1; size <= 200; size++) {
+        memset(content, size - 1, size);
+        EXPECT_GE(tcp_write(cli, content, size, NULL), 0);
+        expect_bytes += size;
+    }
+    memset(content, (kFrameLargeSize - 1) & 0xFF, kFrameLargeSize);
+    EXPECT_GE(tcp_write(cli, content, kFrameLargeSize, NULL), 0);
+    expect_bytes += kFrameLargeSize;
+    free(content);
+
+    // the head built by hand and written byte by byte, the protocol head split across receives
+    HTCPLINK raw = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(raw, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(raw, "127.0.0.1", 10232)));
+    const unsigned char wire[] = { 0xEE, 0xEE, 0, 0, 0, 9, 2, 2, 2, 0, 0, 0, 0, 0, 11, 4, 4, 4, 4, 4 };
+    for (size_t i = 0; i < sizeof(wire); i++) {
+        EXPECT_GE(tcp_write(raw, &wire[i], 1, NULL), 0);
+        usleep(1000);
+    }
+    expect_bytes += 3 + 5;
+
+    for (int i = 0; i < 500 && __atomic_load_n(&frame_received, __ATOMIC_SEQ_CST) < 203; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&frame_received, __ATOMIC_SEQ_CST), 203);
+    EXPECT_EQ(__atomic_load_n(&frame_bytes, __ATOMIC_SEQ_CST), expect_bytes);
+    EXPECT_EQ(__atomic_load_n(&frame_malformed, __ATOMIC_SEQ_CST), 0);
+
+    // 16 bits length field can not describe the packet, stream template switch the framing off
+    nis_frame_template_t narrow = { 4, 0, 2, 0 };
+    EXPECT_GE(nis_cntl(raw, NI_SETFRAME, &narrow), 0);
+    unsigned char *huge = (unsigned char *)calloc(1, 0x10000);
+    EXPECT_EQ(tcp_write(raw, huge, 0x10000, NULL), -EINVAL);
+    free(huge);
+    tst_t tst = { TestShmParser, TestShmBuilder, sizeof(int) };
+    EXPECT_GE(nis_cntl(raw, NI_SETTST, &tst), 0);
+    EXPECT_EQ(nis_cntl(raw, NI_GETFRAME, &current), -ENOENT);
+
+    // the framing can not change while a frame is half received, setting the same one again is harmless until the head arrived
+    HTCPLINK half = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(half, INVALID_HTCPLINK);
+    __atomic_store_n(&frame_accepted, INVALID_HTCPLINK, __ATOMIC_SEQ_CST);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(half, "127.0.0.1", 10232)));
+    EXPECT_GE(tcp_write(half, wire, 3, NULL), 0);
+    for (int i = 0; i < 500 && INVALID_HTCPLINK == __atomic_load_n(&frame_accepted, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    HTCPLINK accepted = __atomic_load_n(&frame_accepted, __ATOMIC_SEQ_CST);
+    ASSERT_NE(accepted, INVALID_HTCPLINK);
+    for (int i = 0; i < 500 && nis_cntl(accepted, NI_SETFRAME, &frame) >= 0; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(nis_cntl(accepted, NI_SETFRAME, &narrow), -EBUSY);
+    EXPECT_GE(tcp_write(half, wire + 3, 6, NULL), 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&frame_received, __ATOMIC_SEQ_CST) < 204; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&frame_received, __ATOMIC_SEQ_CST), 204);
+    EXPECT_GE(nis_cntl(accepted, NI_SETFRAME, &narrow), 0);
+
+    tcp_destroy(half);
+    tcp_destroy(raw);
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static std::vector<std::string> delim_lines;
+static int delim_received = 0;
+static HTCPLINK delim_accepted = INVALID_HTCPLINK;
+
+static void STDCALL TestDelimServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_TCP_ACCEPTED) {
+        __atomic_store_n(&delim_accepted, tcp_data->e.Accept.AcceptLink, __ATOMIC_SEQ_CST);
+    }
+    if (event->Event == EVT_RECEIVEDATA) {
+        delim_lines.push_back(std::string((const char *)tcp_data->e.Packet.Data, tcp_data->e.Packet.Size));
+        __atomic_add_fetch(&delim_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// lines made of the bytes of delimiter and letters, the stream written in random pieces so delimiters straddle the receives
+static void TestDelimRound(const std::string &delim, uint16_t port, int attr) {
+    std::vector<std::string> lines;
+    std::string stream, alphabet = delim + "abcxyz";
+    unsigned int seed = port;
+    for (int i = 0; i < 2000; i++) {
+        std::string line;
+        int size = (0 == i % 500) ? 0 : rand_r(&seed) % 300;
+        if (1000 == i) {
+            size = 200000;
+        }
+        // the delimiters of this case never overlap themselves, so a line never contain a whole delimiter also not end with one
+        for (int j = 0; j < size; j++) {
+            line += alphabet[rand_r(&seed) % alphabet.size()];
+            if (line.size() >= delim.size() && 0 == line.compare(line.size() - delim.size(), delim.size(), delim)) {
+                line[line.size() - 1] = 'a';
+            }
+        }
+        lines.push_back((attr & LINKATTR_TCP_FULLY_RECEIVE) ? line + delim : line);
+        stream += line + delim;
+    }
+
+    delim_lines.clear();
+    __atomic_store_n(&delim_received, 0, __ATOMIC_SEQ_CST);
+    HTCPLINK srv = tcp_create(TestDelimServerCallback, "127.0.0.1", port);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETDELIM, delim.data(), (int)delim.size()), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT | attr), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", port)));
+
+    for (size_t offset = 0; offset < stream.size(); ) {
+        size_t piece = 1 + rand_r(&seed) % 3000;
+        if (piece > stream.size() - offset) {
+            piece = stream.size() - offset;
+        }
+        EXPECT_GE(tcp_write(cli, stream.data() + offset, (int)piece, NULL), 0);
+        offset += piece;
+        // give the receiver a chance to see the pieces separately
+        if (0 == offset % 7) {
+            usleep(100);
+        }
+    }
+
+    for (int i = 0; i < 500 && __atomic_load_n(&delim_received, __ATOMIC_SEQ_CST) < (int)lines.size(); i++) {
+        usleep(10000);
+    }
+    ASSERT_EQ(__atomic_load_n(&delim_received, __ATOMIC_SEQ_CST), (int)lines.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        EXPECT_EQ(delim_lines[i], lines[i]) << "line " << i;
+        if (delim_lines[i] != lines[i]) {
+            break;
+        }
+    }
+
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+}
+
+TEST(DoTestTcpFlow, TestDelimiterFrame) {
+    char delim[NIS_MAXIMUM_DELIMITER];
+    tcp_init2(0);
+    HTCPLINK link = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(link, INVALID_HTCPLINK);
+    EXPECT_EQ(nis_cntl(link, NI_SETDELIM, "123456789", 9), -EINVAL);
+    EXPECT_EQ(nis_cntl(link, NI_GETDELIM, delim), 0);
+    EXPECT_GE(nis_cntl(link, NI_SETDELIM, "\r\n", 2), 0);
+    EXPECT_EQ(nis_cntl(link, NI_GETDELIM, delim), 2);
+    EXPECT_EQ(0, memcmp(delim, "\r\n", 2));
+    nis_frame_template_t frame = { 4, 0, 4, 0 };
+    EXPECT_GE(nis_cntl(link, NI_SETFRAME, &frame), 0);
+    EXPECT_EQ(nis_cntl(link, NI_GETDELIM, delim), 0);
+    tcp_destroy(link);
+
+    TestDelimRound(std::string("\r\n"), 10233, 0);
+    TestDelimRound(std::string("\0", 1), 10234, 0);
+    TestDelimRound(std::string("<EOM>"), 10235, LINKATTR_TCP_FULLY_RECEIVE);
+
+    // the delimiter can not change while a line is half received, setting the same one again is harmless until it arrived
+    delim_lines.clear();
+    __atomic_store_n(&delim_received, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&delim_accepted, INVALID_HTCPLINK, __ATOMIC_SEQ_CST);
+    HTCPLINK srv = tcp_create(TestDelimServerCallback, "127.0.0.1", 10246);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETDELIM, "\r\n", 2), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    HTCPLINK cli = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10246)));
+    EXPECT_GE(tcp_write(cli, "abc", 3, NULL), 0);
+    for (int i = 0; i < 500 && INVALID_HTCPLINK == __atomic_load_n(&delim_accepted, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    HTCPLINK accepted = __atomic_load_n(&delim_accepted, __ATOMIC_SEQ_CST);
+    ASSERT_NE(accepted, INVALID_HTCPLINK);
+    for (int i = 0; i < 500 && nis_cntl(accepted, NI_SETDELIM, "\r\n", 2) >= 0; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(nis_cntl(accepted, NI_SETDELIM, "\n", 1), -EBUSY);
+    EXPECT_EQ(nis_cntl(accepted, NI_SETFRAME, &frame), -EBUSY);
+    EXPECT_GE(tcp_write(cli, "\r\n", 2, NULL), 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&delim_received, __ATOMIC_SEQ_CST) < 1; i++) {
+        usleep(10000);
+    }
+    ASSERT_EQ(__atomic_load_n(&delim_received, __ATOMIC_SEQ_CST), 1);
+    EXPECT_EQ(delim_lines[0], "abc");
+    EXPECT_GE(nis_cntl(accepted, NI_SETDELIM, "\n", 1), 0);
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static std::vector<std::string> filter_packets;
+static int filter_received = 0;
+static int filter_closed = 0;
+
+static void STDCALL TestFilterServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_RECEIVEDATA) {
+        filter_packets.push_back(std::string((const char *)tcp_data->e.Packet.Data, tcp_data->e.Packet.Size));
+        __atomic_add_fetch(&filter_received, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void STDCALL TestFilterClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&filter_closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// user stage, Rx transform in place of the parse buffer, Tx output to the reserved buffer
+static nsp_status_t STDCALL TestFilterXorRx(void *context, nis_filter_frame_t *frame) {
+    for (int i = 0; i < frame->size; i++) {
+        frame->data[i] ^= *(const unsigned char *)context;
+    }
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t STDCALL TestFilterXorTx(void *context, nis_filter_frame_t *frame) {
+    unsigned char *output = nis_filter_reserve(frame, frame->size);
+    if (!output) {
+        return -ENOMEM;
+    }
+    for (int i = 0; i < frame->size; i++) {
+        output[i] = frame->data[i] ^ *(const unsigned char *)context;
+    }
+    frame->data = output;
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static nsp_status_t STDCALL TestFilterSerializer(unsigned char *packet, const void *origin, int cb) {
+    memcpy(packet, origin, cb);
+    return NSP_STATUS_SUCCESSFUL;
+}
+
+static void TestFilterWait(int count) {
+    for (int i = 0; i < 500 && __atomic_load_n(&filter_received, __ATOMIC_SEQ_CST) < count; i++) {
+        usleep(10000);
+    }
+}
+
+TEST(DoTestTcpFlow, TestFilterPipeline) {
+    nis_frame_template_t frame = { 4, 0, 4, 0 };
+    static unsigned char key = 0x5A;
+    nis_filter_stage_t xorer = { TestFilterXorRx, TestFilterXorTx, &key };
+    tcp_init2(0);
+
+    HTCPLINK srv = tcp_create(TestFilterServerCallback, "127.0.0.1", 10236);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    for (int i = 0; i < NIS_MAXIMUM_FILTERS; i++) {
+        EXPECT_GE(nis_cntl(srv, NI_ADDFILTER, &xorer), 0);
+    }
+    EXPECT_EQ(nis_cntl(srv, NI_ADDFILTER, &xorer), -ENOSPC);
+    EXPECT_GE(nis_cntl(srv, NI_CLRFILTER), 0);
+    EXPECT_GE(nis_cntl(srv, NI_ADDFILTER, nis_filter_crc32c()), 0);
+    EXPECT_GE(nis_cntl(srv, NI_ADDFILTER, nis_filter_lz()), 0);
+    EXPECT_GE(nis_cntl(srv, NI_ADDFILTER, &xorer), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    HTCPLINK cli = tcp_create(TestFilterClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(cli, NI_ADDFILTER, nis_filter_crc32c()), 0);
+    EXPECT_GE(nis_cntl(cli, NI_ADDFILTER, nis_filter_lz()), 0);
+    EXPECT_GE(nis_cntl(cli, NI_ADDFILTER, &xorer), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10236)));
+
+    // text compress well, random bytes are sent stored, the large ones go through large-block before the pipeline
+    std::vector<std::string> packets;
+    unsigned int seed = 10236;
+    for (int size = 1; size <= 300; size++) {
+        std::string packet;
+        for (int i = 0; i < size; i++) {
+            packet += "the quick brown fox "[(i + size) % 20];
+        }
+        packets.push_back(packet);
+    }
+    for (int size : { 5000, 200000 }) {
+        std::string packet;
+        for (int i = 0; i < size; i++) {
+            packet += (char)rand_r(&seed);
+        }
+        packets.push_back(packet);
+    }
+    packets.push_back(std::string(300000, 'z'));
+    for (size_t i = 0; i < packets.size(); i++) {
+        EXPECT_GE(tcp_write(cli, packets[i].data(), (int)packets[i].size(), (i & 1) ? TestFilterSerializer : NULL), 0);
+    }
+
+    TestFilterWait((int)packets.size());
+    ASSERT_EQ(__atomic_load_n(&filter_received, __ATOMIC_SEQ_CST), (int)packets.size());
+    for (size_t i = 0; i < packets.size(); i++) {
+        EXPECT_TRUE(filter_packets[i] == packets[i]) << "packet " << i;
+    }
+
+    // shared buffer can not pass the pipeline
+    nis_buffer_t *buffer = nis_buffer_create("x", 1, NULL, NULL);
+    EXPECT_EQ(tcp_write_buffer(cli, buffer), -EOPNOTSUPP);
+    nis_buffer_release(buffer);
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+
+    // the trailer on wire is CRC32C of the check string in little-endian
+    filter_packets.clear();
+    __atomic_store_n(&filter_received, 0, __ATOMIC_SEQ_CST);
+    srv = tcp_create(TestFilterServerCallback, "127.0.0.1", 10237);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+    cli = tcp_create(TestFilterClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(cli, NI_ADDFILTER, nis_filter_crc32c()), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10237)));
+    EXPECT_GE(tcp_write(cli, "123456789", 9, NULL), 0);
+    TestFilterWait(1);
+    ASSERT_EQ(__atomic_load_n(&filter_received, __ATOMIC_SEQ_CST), 1);
+    EXPECT_TRUE(filter_packets[0] == std::string("123456789\x83\x92\x06\xE3", 13));
+
+    // the packed stream of a repeated byte is tiny
+    EXPECT_GE(nis_cntl(cli, NI_ADDFILTER, nis_filter_lz()), 0);
+    std::string repeated(300000, 'z');
+    EXPECT_GE(tcp_write(cli, repeated.data(), (int)repeated.size(), NULL), 0);
+    TestFilterWait(2);
+    ASSERT_EQ(__atomic_load_n(&filter_received, __ATOMIC_SEQ_CST), 2);
+    EXPECT_LT(filter_packets[1].size(), 2000U);
+    EXPECT_EQ(filter_packets[1][0], 1);
+    tcp_destroy(cli);
+
+    // a corrupt packet close the link, the close events of the previous clients may arrive late
+    EXPECT_GE(nis_cntl(srv, NI_ADDFILTER, nis_filter_crc32c()), 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&filter_closed, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    __atomic_store_n(&filter_closed, 0, __ATOMIC_SEQ_CST);
+    cli = tcp_create(TestFilterClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10237)));
+    EXPECT_GE(tcp_write(cli, "123456789\x83\x92\x06\xE4", 13, NULL), 0);
+    for (int i = 0; i < 500 && 0 == __atomic_load_n(&filter_closed, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&filter_closed, __ATOMIC_SEQ_CST), 1);
+    EXPECT_EQ(__atomic_load_n(&filter_received, __ATOMIC_SEQ_CST), 2);
+
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+#define DISPATCH_CLIENTS    (4)
+#define DISPATCH_PACKETS    (200)
+
+static HTCPLINK dispatch_links[DISPATCH_CLIENTS];
+static int dispatch_next[DISPATCH_CLIENTS];
+static int dispatch_closed_at[DISPATCH_CLIENTS];
+static int dispatch_disorder = 0;
+static int dispatch_on_rx_thread = 0;
+static int dispatch_received = 0;
+static int dispatch_closed = 0;
+static int dispatch_blocked = 0;
+static int dispatch_released = 0;
+
+// payload: index of client, sequence in client, filler
+static void STDCALL TestDispatchServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    int index, seq;
+
+    if (event->Event == EVT_RECEIVEDATA) {
+        if (ifos_gettid() == nis_cntl(event->Ln.Tcp.Link, NI_GETRXTID)) {
+            __atomic_add_fetch(&dispatch_on_rx_thread, 1, __ATOMIC_SEQ_CST);
+        }
+        memcpy(&index, tcp_data->e.Packet.Data, sizeof(index));
+        memcpy(&seq, tcp_data->e.Packet.Data + sizeof(index), sizeof(seq));
+        __atomic_store_n(&dispatch_links[index], event->Ln.Tcp.Link, __ATOMIC_SEQ_CST);
+        if (seq != dispatch_next[index] || tcp_data->e.Packet.Size != 8 + (seq % 50) * 10 + ((seq == 100) ? 200000 : 0) ||
+            (tcp_data->e.Packet.Size > 8 && tcp_data->e.Packet.Data[tcp_data->e.Packet.Size - 1] != (unsigned char)seq)) {
+            __atomic_add_fetch(&dispatch_disorder, 1, __ATOMIC_SEQ_CST);
+        }
+        dispatch_next[index] = seq + 1;
+
+        // a slow handler of link 0 wait for the packet of link 1 which arrive on the same epoll thread
+        if (0 == index && 0 == seq) {
+            __atomic_store_n(&dispatch_blocked, 1, __ATOMIC_SEQ_CST);
+            for (int i = 0; i < 500 && !__atomic_load_n(&dispatch_released, __ATOMIC_SEQ_CST); i++) {
+                usleep(10000);
+            }
+        }
+        if (1 == index && 0 == seq) {
+            __atomic_store_n(&dispatch_released, 1, __ATOMIC_SEQ_CST);
+        }
+        __atomic_add_fetch(&dispatch_received, 1, __ATOMIC_SEQ_CST);
+    } else if (event->Event == EVT_PRE_CLOSE) {
+        for (int i = 0; i < DISPATCH_CLIENTS; i++) {
+            if (__atomic_load_n(&dispatch_links[i], __ATOMIC_SEQ_CST) == event->Ln.Tcp.Link) {
+                dispatch_closed_at[i] = dispatch_next[i];
+                __atomic_add_fetch(&dispatch_closed, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+    }
+}
+
+static void TestDispatchWrite(HTCPLINK link, int index, int seq) {
+    std::string packet(8 + (seq % 50) * 10 + ((seq == 100) ? 200000 : 0), (char)seq);
+    memcpy(&packet[0], &index, sizeof(index));
+    memcpy(&packet[sizeof(index)], &seq, sizeof(seq));
+    EXPECT_GE(tcp_write(link, packet.data(), (int)packet.size(), NULL), 0);
+}
+
+TEST(DoTestTcpFlow, TestDispatchWorkers) {
+    nis_frame_template_t frame = { 4, 0, 4, 0 };
+    HTCPLINK clients[DISPATCH_CLIENTS];
+    nis_statistics_t stat;
+
+    // one epoll thread, the links can only run concurrently on workers
+    tcp_init2(1);
+    EXPECT_EQ(nis_dispatch_init(-1), -EINVAL);
+    EXPECT_EQ(nis_dispatch_init(4), 0);
+    EXPECT_EQ(nis_dispatch_init(4), -EALREADY);
+
+    HTCPLINK srv = tcp_create(TestDispatchServerCallback, "127.0.0.1", 10238);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT | LINKATTR_TCP_DISPATCH), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    for (int i = 0; i < DISPATCH_CLIENTS; i++) {
+        dispatch_links[i] = INVALID_HTCPLINK;
+        clients[i] = tcp_create(TestLaneClientCallback, NULL, 0);
+        EXPECT_NE(clients[i], INVALID_HTCPLINK);
+        EXPECT_GE(nis_cntl(clients[i], NI_SETFRAME, &frame), 0);
+        EXPECT_TRUE(NSP_SUCCESS(tcp_connect(clients[i], "127.0.0.1", 10238)));
+    }
+
+    TestDispatchWrite(clients[0], 0, 0);
+    for (int i = 0; i < 500 && !__atomic_load_n(&dispatch_blocked, __ATOMIC_SEQ_CST); i++) {
+        usleep(10000);
+    }
+    TestDispatchWrite(clients[1], 1, 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&dispatch_received, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&dispatch_received, __ATOMIC_SEQ_CST), 2);
+    EXPECT_EQ(__atomic_load_n(&dispatch_released, __ATOMIC_SEQ_CST), 1);
+
+    // interleaved streams, each link deliver in order
+    for (int seq = 0; seq < DISPATCH_PACKETS; seq++) {
+        for (int i = (0 == seq) ? 2 : 0; i < DISPATCH_CLIENTS; i++) {
+            TestDispatchWrite(clients[i], i, seq);
+        }
+    }
+    int total = DISPATCH_CLIENTS * DISPATCH_PACKETS;
+    for (int i = 0; i < 1000 && __atomic_load_n(&dispatch_received, __ATOMIC_SEQ_CST) < total; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&dispatch_received, __ATOMIC_SEQ_CST), total);
+    EXPECT_EQ(__atomic_load_n(&dispatch_disorder, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(__atomic_load_n(&dispatch_on_rx_thread, __ATOMIC_SEQ_CST), 0);
+
+    EXPECT_EQ(nis_getstat(&stat), 0);
+    EXPECT_EQ(stat.Dispatch.Workers, 4);
+    EXPECT_GE(stat.Dispatch.Dispatched, (uint64_t)total);
+    EXPECT_GT(stat.Dispatch.Lent, 0U);
+    EXPECT_GT(stat.Dispatch.Latency, 0U);
+    EXPECT_GE(stat.Dispatch.MaximumLatency * stat.Dispatch.Dispatched, stat.Dispatch.Latency);
+
+    // the accepted links close after all their packets delivered
+    for (int i = 0; i < DISPATCH_CLIENTS; i++) {
+        tcp_destroy(clients[i]);
+    }
+    for (int i = 0; i < 500 && __atomic_load_n(&dispatch_closed, __ATOMIC_SEQ_CST) < DISPATCH_CLIENTS; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&dispatch_closed, __ATOMIC_SEQ_CST), DISPATCH_CLIENTS);
+    for (int i = 0; i < DISPATCH_CLIENTS; i++) {
+        EXPECT_EQ(dispatch_closed_at[i], DISPATCH_PACKETS);
+    }
+
+    nis_dispatch_uninit();
+    EXPECT_EQ(nis_getstat(&stat), 0);
+    EXPECT_EQ(stat.Dispatch.Workers, 0);
+    EXPECT_GE(stat.Dispatch.Dispatched, (uint64_t)total);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+static int capture_received = 0;
+static int capture_closed = 0;
+
+// every frame echoed, so the capture has both directions
+static void STDCALL TestCaptureServerCallback(const struct nis_event *event, const void *data) {
+    const tcp_data_t *tcp_data = (const tcp_data_t *)data;
+    if (event->Event == EVT_RECEIVEDATA) {
+        tcp_write(event->Ln.Tcp.Link, tcp_data->e.Packet.Data, tcp_data->e.Packet.Size, NULL);
+        __atomic_add_fetch(&capture_received, 1, __ATOMIC_SEQ_CST);
+    } else if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&capture_closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+TEST(DoTestTcpFlow, TestCapture) {
+    static const int kCaptureFrames = 300;
+    static const char *path = "/tmp/nist_capture.bin";
+    nis_frame_template_t frame = { 4, 0, 4, 0 };
+    tcp_init2(1);
+    HTCPLINK srv = tcp_create(TestCaptureServerCallback, "127.0.0.1", 10239);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT), 0);
+    EXPECT_EQ(nis_cntl(srv, NI_SETCAPTURE, "/nonexistent/nist_capture.bin"), -ENOENT);
+    EXPECT_GE(nis_cntl(srv, NI_SETCAPTURE, path), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    HTCPLINK cli = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10239)));
+
+    // frames larger than the buffer of capture are written directly
+    std::vector<unsigned char> content(100000);
+    for (int i = 1; i <= kCaptureFrames; i++) {
+        int size = (i == kCaptureFrames) ? (int)content.size() : i;
+        memset(&content[0], i & 0xFF, size);
+        EXPECT_GE(tcp_write(cli, &content[0], size, NULL), 0);
+    }
+    for (int i = 0; i < 500 && __atomic_load_n(&capture_received, __ATOMIC_SEQ_CST) < kCaptureFrames; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&capture_received, __ATOMIC_SEQ_CST), kCaptureFrames);
+
+    // the file is completed after the listener and the accepted link released it
+    tcp_destroy(cli);
+    for (int i = 0; i < 500 && __atomic_load_n(&capture_closed, __ATOMIC_SEQ_CST) < 1; i++) {
+        usleep(10000);
+    }
+    tcp_destroy(srv);
+    tcp_uninit();
+
+    FILE *fp = fopen(path, "rb");
+    ASSERT_TRUE(fp != NULL);
+    nis_capture_head_t head;
+    ASSERT_EQ(fread(&head, sizeof(head), 1, fp), 1U);
+    EXPECT_EQ(0, memcmp(head.magic, NIS_CAPTURE_MAGIC, sizeof(head.magic)));
+    EXPECT_GT(le64toh(head.realtime), 0U);
+    EXPECT_EQ((int)le32toh(head.framing), NIS_CAPTURE_FRAMING_FRAME);
+    EXPECT_EQ((int)le32toh(head.frame.cb_), frame.cb_);
+    EXPECT_EQ((int)le32toh(head.frame.width), frame.width);
+
+    nis_capture_record_t record;
+    int inbound = 0, outbound = 0, malformed = 0;
+    uint64_t timestamp = 0;
+    uint32_t stream = 0;
+    while (1 == fread(&record, sizeof(record), 1, fp)) {
+        int size = (int)le32toh(record.size);
+        ASSERT_LE(size, (int)content.size());
+        ASSERT_EQ(fread(&content[0], 1, size, fp), (size_t)size);
+        EXPECT_GE(le64toh(record.timestamp), timestamp);
+        timestamp = le64toh(record.timestamp);
+        if (0 == stream) {
+            stream = le32toh(record.stream);
+        }
+        EXPECT_EQ(le32toh(record.stream), stream);
+        EXPECT_EQ(le32toh(record.flags) & NIS_CAPTURE_HEAD, 0U);
+
+        // the frames in each direction are in the order they were written, both are user data
+        int *count = (le32toh(record.flags) & NIS_CAPTURE_OUTBOUND) ? &outbound : &inbound;
+        (*count)++;
+        if (size != ((*count == kCaptureFrames) ? (int)content.size() : *count) || content[size - 1] != (*count & 0xFF)) {
+            malformed++;
+        }
+    }
+    EXPECT_EQ(inbound, kCaptureFrames);
+    EXPECT_EQ(outbound, kCaptureFrames);
+    EXPECT_EQ(malformed, 0);
+    fclose(fp);
+    unlink(path);
+}
+
+static int stamp_received = 0;
+static int stamp_missing = 0;
+static int stamp_skewed = 0;
+
+// the kernel stamp is taken before the callback on the same wall clock, a few seconds at most in between
+static void TestStampCheck(uint64_t timestamp) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (0 == timestamp) {
+        __atomic_add_fetch(&stamp_missing, 1, __ATOMIC_SEQ_CST);
+    } else if (timestamp > now || now - timestamp > 5000000000ULL) {
+        __atomic_add_fetch(&stamp_skewed, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&stamp_received, 1, __ATOMIC_SEQ_CST);
+}
+
+static void STDCALL TestStampTcpCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        TestStampCheck(((const tcp_data_t *)data)->e.Packet.Timestamp);
+    }
+}
+
+static void STDCALL TestStampUdpCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_RECEIVEDATA) {
+        TestStampCheck(((const udp_data_t *)data)->e.Packet.Timestamp);
+    }
+}
+
+static void TestStampReset() {
+    __atomic_store_n(&stamp_received, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&stamp_missing, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&stamp_skewed, 0, __ATOMIC_SEQ_CST);
+}
+
+static void TestStampWait(int count) {
+    for (int i = 0; i < 500 && __atomic_load_n(&stamp_received, __ATOMIC_SEQ_CST) < count; i++) {
+        usleep(10000);
+    }
+}
+
+// the kernel turn on the stamping of all sockets by a deferred work, the packets arrived before that are not stamped
+static void TestStampWriteTcp(objhld_t link) {
+    tcp_write(link, "warmup", 6, NULL);
+}
+
+static void TestStampWriteUdp(objhld_t link) {
+    udp_write(link, "warmup", 6, "127.0.0.1", 10241, NULL);
+}
+
+static void TestStampWarmup(void (*write)(objhld_t), objhld_t link) {
+    for (int i = 0; i < 100; i++) {
+        TestStampReset();
+        write(link);
+        TestStampWait(1);
+        if (0 == __atomic_load_n(&stamp_missing, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        usleep(10000);
+    }
+    TestStampReset();
+}
+
+static uint64_t TestStampBucketed(const nis_statistics_t &before, const nis_statistics_t &after) {
+    uint64_t bucketed = 0;
+    for (int i = 0; i < NIS_RX_LATENCY_BUCKETS; i++) {
+        bucketed += after.Rx.Histogram[i] - before.Rx.Histogram[i];
+    }
+    return bucketed;
+}
+
+TEST(DoTestTcpFlow, TestRxTimestamp) {
+    nis_frame_template_t frame = { 4, 0, 4, 0 };
+    nis_statistics_t before, after;
+
+    tcp_init2(1);
+    HTCPLINK srv = tcp_create(TestStampTcpCallback, "127.0.0.1", 10240);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(srv, NI_SETFRAME, &frame), 0);
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_TCP_UPDATE_ACCEPT_CONTEXT | LINKATTR_RX_TIMESTAMP), 0);
+    EXPECT_TRUE(nis_cntl(srv, NI_GETATTR) & LINKATTR_RX_TIMESTAMP);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    HTCPLINK cli = tcp_create(TestLaneClientCallback, NULL, 0);
+    EXPECT_NE(cli, INVALID_HTCPLINK);
+    EXPECT_GE(nis_cntl(cli, NI_SETFRAME, &frame), 0);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_connect(cli, "127.0.0.1", 10240)));
+    TestStampWarmup(&TestStampWriteTcp, cli);
+
+    // the accepted link inherit the attribute, every packet carry the stamp of the receive it completed in
+    EXPECT_EQ(nis_getstat(&before), 0);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_GE(tcp_write(cli, "timestamp", 9, NULL), 0);
+    }
+    TestStampWait(100);
+    EXPECT_EQ(__atomic_load_n(&stamp_received, __ATOMIC_SEQ_CST), 100);
+    EXPECT_EQ(__atomic_load_n(&stamp_missing, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(__atomic_load_n(&stamp_skewed, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(nis_getstat(&after), 0);
+    EXPECT_EQ(after.Rx.Stamped - before.Rx.Stamped, 100U);
+    EXPECT_EQ(TestStampBucketed(before, after), 100U);
+    EXPECT_GE(after.Rx.MaximumLatency * after.Rx.Stamped, after.Rx.Latency);
+
+    tcp_destroy(cli);
+    tcp_destroy(srv);
+    tcp_uninit();
+}
+
+TEST(DoTestUdpFlow, TestUdpRxTimestamp) {
+    nis_statistics_t before, after;
+
+    udp_init2(0);
+    HUDPLINK srv = udp_create(TestStampUdpCallback, "127.0.0.1", 10241, UDP_FLAG_NONE);
+    EXPECT_NE(srv, INVALID_HUDPLINK);
+    HUDPLINK cli = udp_create(NULL, NULL, 0, UDP_FLAG_NONE);
+    EXPECT_NE(cli, INVALID_HUDPLINK);
+
+    // the link without attribute deliver zero
+    TestStampReset();
+    EXPECT_GE(udp_write(cli, "plain", 5, "127.0.0.1", 10241, NULL), 0);
+    TestStampWait(1);
+    EXPECT_EQ(__atomic_load_n(&stamp_missing, __ATOMIC_SEQ_CST), 1);
+
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) | LINKATTR_RX_TIMESTAMP), 0);
+    TestStampWarmup(&TestStampWriteUdp, cli);
+
+    EXPECT_EQ(nis_getstat(&before), 0);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_GE(udp_write(cli, "stamped", 7, "127.0.0.1", 10241, NULL), 0);
+    }
+    TestStampWait(10);
+    EXPECT_EQ(__atomic_load_n(&stamp_received, __ATOMIC_SEQ_CST), 10);
+    EXPECT_EQ(__atomic_load_n(&stamp_missing, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(__atomic_load_n(&stamp_skewed, __ATOMIC_SEQ_CST), 0);
+    EXPECT_EQ(nis_getstat(&after), 0);
+    EXPECT_EQ(after.Rx.Stamped - before.Rx.Stamped, 10U);
+    EXPECT_EQ(TestStampBucketed(before, after), 10U);
+
+    // cleared attribute stop the stamping
+    EXPECT_GE(nis_cntl(srv, NI_SETATTR, nis_cntl(srv, NI_GETATTR) & ~LINKATTR_RX_TIMESTAMP), 0);
+    TestStampReset();
+    EXPECT_GE(udp_write(cli, "plain", 5, "127.0.0.1", 10241, NULL), 0);
+    TestStampWait(1);
+    EXPECT_EQ(__atomic_load_n(&stamp_missing, __ATOMIC_SEQ_CST), 1);
+
+    udp_destroy(cli);
+    udp_destroy(srv);
+    udp_uninit();
+}
+
+static int pool_connected = 0;
+static int pool_closed = 0;
+
+static void STDCALL TestPoolClientCallback(const struct nis_event *event, const void *data) {
+    if (event->Event == EVT_TCP_CONNECTED) {
+        __atomic_add_fetch(&pool_connected, 1, __ATOMIC_SEQ_CST);
+    } else if (event->Event == EVT_CLOSED) {
+        __atomic_add_fetch(&pool_closed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static tcp_pool_stat_t TestPoolStat(tcp_pool_t *pool, uint16_t port) {
+    tcp_pool_stat_t stat;
+    memset(&stat, 0, sizeof(stat));
+    EXPECT_EQ(tcp_pool_getstat(pool, "127.0.0.1", port, &stat), 0);
+    return stat;
+}
+
+static void TestPoolWaitReady(tcp_pool_t *pool, uint16_t port, int ready) {
+    for (int i = 0; i < 500 && TestPoolStat(pool, port).Ready != ready; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(TestPoolStat(pool, port).Ready, ready);
+}
+
+TEST(DoTestTcpFlow, TestClientPool) {
+    tcp_pool_stat_t stat;
+    HTCPLINK links[4];
+
+    tcp_init2(1);
+    HTCPLINK srv = tcp_create(TestLaneClientCallback, "127.0.0.1", 10242);
+    EXPECT_NE(srv, INVALID_HTCPLINK);
+    EXPECT_TRUE(NSP_SUCCESS(tcp_listen(srv, 100)));
+
+    EXPECT_TRUE(tcp_pool_create(NULL, NULL, 1, 2) == NULL);
+    EXPECT_TRUE(tcp_pool_create(TestPoolClientCallback, NULL, 3, 2) == NULL);
+    tcp_pool_t *pool = tcp_pool_create(TestPoolClientCallback, NULL, 2, 3);
+    ASSERT_TRUE(pool != NULL);
+    EXPECT_EQ(tcp_pool_getstat(pool, "127.0.0.1", 10242, &stat), -ENOENT);
+    EXPECT_EQ(tcp_pool_prewarm(pool, "not an address", 10242), -EINVAL);
+
+    // the minimum links connect together, the callback of pool see them as usual
+    EXPECT_EQ(tcp_pool_prewarm(pool, "127.0.0.1", 10242), 0);
+    TestPoolWaitReady(pool, 10242, 2);
+    EXPECT_EQ(__atomic_load_n(&pool_connected, __ATOMIC_SEQ_CST), 2);
+
+    // least outstanding first, the third request find all links busy and grow one in background
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &links[0]), 0);
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &links[1]), 0);
+    EXPECT_NE(links[0], links[1]);
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &links[2]), 0);
+    EXPECT_TRUE(links[2] == links[0] || links[2] == links[1]);
+    EXPECT_EQ(TestPoolStat(pool, 10242).Links, 3);
+    TestPoolWaitReady(pool, 10242, 3);
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &links[3]), 0);
+    EXPECT_NE(links[3], links[0]);
+    EXPECT_NE(links[3], links[1]);
+    EXPECT_GE(tcp_write(links[3], "pooled", 6, NULL), 0);
+    stat = TestPoolStat(pool, 10242);
+    EXPECT_EQ(stat.Links, 3);
+    EXPECT_EQ(stat.Outstanding, 4);
+
+    // never more than maximum
+    HTCPLINK extra;
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &extra), 0);
+    EXPECT_EQ(TestPoolStat(pool, 10242).Links, 3);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(tcp_pool_release(pool, links[i]), 0);
+    }
+    EXPECT_EQ(tcp_pool_release(pool, extra), 0);
+    EXPECT_EQ(TestPoolStat(pool, 10242).Outstanding, 0);
+    EXPECT_EQ(tcp_pool_release(pool, srv), -EINVAL);
+
+    // the closed links leave pool before EVT_CLOSED, the next request restore the minimum
+    tcp_destroy(links[0]);
+    tcp_destroy(links[1]);
+    for (int i = 0; i < 500 && __atomic_load_n(&pool_closed, __ATOMIC_SEQ_CST) < 2; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(tcp_pool_release(pool, links[0]), -ENOENT);
+    EXPECT_EQ(TestPoolStat(pool, 10242).Links, 1);
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10242, &links[0]), 0);
+    EXPECT_EQ(tcp_pool_release(pool, links[0]), 0);
+    TestPoolWaitReady(pool, 10242, 2);
+
+    // the endpoint nobody listen on, request never block but fail fast during the retry backoff
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10243, &links[0]), -EAGAIN);
+    for (int i = 0; i < 500 && TestPoolStat(pool, 10243).Failures < 2; i++) {
+        usleep(10000);
+    }
+    stat = TestPoolStat(pool, 10243);
+    EXPECT_EQ(stat.Failures, 2);
+    EXPECT_EQ(stat.Links, 0);
+    EXPECT_EQ(tcp_pool_acquire(pool, "127.0.0.1", 10243, &links[0]), -EHOSTDOWN);
+    EXPECT_EQ(TestPoolStat(pool, 10243).Links, 0);
+
+    int connected = __atomic_load_n(&pool_connected, __ATOMIC_SEQ_CST);
+    tcp_pool_destroy(pool);
+    for (int i = 0; i < 500 && __atomic_load_n(&pool_closed, __ATOMIC_SEQ_CST) < connected + 2; i++) {
+        usleep(10000);
+    }
+    EXPECT_EQ(__atomic_load_n(&pool_closed, __ATOMIC_SEQ_CST), connected + 2);
+    tcp_destroy(srv);
+    tcp_uninit();
+}